@@ -1,12 +1,17 @@
 #ifndef Codec_H
 #define Codec_H
 
+#include <string>
+#include <vector>
+
 static std::string codecName[] = {
     "",
     "jpeg",
     "blosc",
     "lz4",
-    "bslz4"
+    "bslz4",
+    "zstd",
+    "bszstd"
 };
 
 typedef enum {
@@ -14,7 +19,9 @@ typedef enum {
   NDCODEC_JPEG,
   NDCODEC_BLOSC,
   NDCODEC_LZ4,
-  NDCODEC_BSLZ4
+  NDCODEC_BSLZ4,
+  NDCODEC_ZSTD,
+  NDCODEC_BSZSTD
 } NDCodecCompressor_t;
 
 typedef struct Codec_t {
@@ -22,6 +29,8 @@ typedef struct Codec_t {
   int         level;      /**< Compression level. */
   int         shuffle;    /**< Shuffle type. */
   int         compressor; /**< Compressor type. For codecs that support more than one compressor. */
+  size_t      blockSize;  /**< Uncompressed bytes per independently compressed block; 0 if the data is a single block. */
+  std::vector<size_t> blockOffsets; /**< Byte offset in pData at which each block starts; empty if the data is a single block. */
 
   Codec_t() {
     clear();
@@ -32,6 +41,8 @@ typedef struct Codec_t {
     level = -1;
     shuffle = -1;
     compressor = -1;
+    blockSize = 0;
+    blockOffsets.clear();
   }
 
   bool empty() {
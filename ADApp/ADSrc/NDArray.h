@@ -29,6 +29,7 @@ typedef void *(*MallocFunc_t)(size_t size);
 typedef void (*FreeFunc_t)(void *ptr);
 extern MallocFunc_t defaultFrameMalloc;
 extern FreeFunc_t defaultFrameFree;
+extern volatile int alignNDArrayData;
 
 /** Enumeration of color modes for NDArray attribute "colorMode" */
 typedef enum
@@ -191,6 +192,7 @@ public:
                                                 FreeFunc_t newFree);
     virtual void* frameMalloc(size_t size);
     virtual void frameFree(void *ptr);
+    virtual size_t frameSize(size_t size);
 
 protected:
     /** The following methods should be implemented by a pool class
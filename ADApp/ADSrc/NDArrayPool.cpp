@@ -46,6 +46,16 @@ FreeFunc_t defaultFrameFree = free;
 volatile int eraseNDAttributes=0;
 extern "C" {epicsExportAddress(int, eraseNDAttributes);}
 
+/** alignNDArrayData is a global variable that sets the alignment in bytes of the frame buffers
+  * allocated by NDArrayPool with the default memory functions.  The default value is 0, meaning
+  * the alignment of malloc().  It must be a power of 2; buffer sizes are rounded up to a multiple
+  * of it.  Setting it to the file system block size (e.g. 4096) allows file writers using O_DIRECT
+  * to write NDArrays without copying them.  It is only used on Linux, and should be set before
+  * iocInit.
+  */
+volatile int alignNDArrayData=0;
+extern "C" {epicsExportAddress(int, alignNDArrayData);}
+
 /** NDArrayPool constructor
   * \param[in] pDriver Pointer to the asynNDArrayDriver that created this object.
   * \param[in] maxMemory Maxiumum number of bytes of memory the the pool is allowed to use, summed over
@@ -80,9 +90,36 @@ void NDArrayPool::setDefaultFrameMemoryFunctions(
  */
 void* NDArrayPool::frameMalloc(size_t size)
 {
+#ifdef __linux__
+    // Memory from posix_memalign() is released with free(), so the default functions still pair up
+    size_t align = (size_t)alignNDArrayData;
+    if ((align > 0) && ((align & (align - 1)) == 0) && (align % sizeof(void *) == 0) &&
+        (defaultFrameMalloc == malloc) && (defaultFrameFree == free)) {
+        void *ptr = NULL;
+        if (posix_memalign(&ptr, align, NDArrayPool::frameSize(size)) != 0) return NULL;
+        return ptr;
+    }
+#endif
     return defaultFrameMalloc(size);
 }
 
+/** Returns the number of bytes frameMalloc() allocates for a buffer of the required size.
+ * This is the size rounded up to alignNDArrayData when frameMalloc() aligns the buffer.
+ * This method should be overriden in subclasses that override frameMalloc()
+  * \param[in] size Required buffer size
+ */
+size_t NDArrayPool::frameSize(size_t size)
+{
+#ifdef __linux__
+    size_t align = (size_t)alignNDArrayData;
+    if ((align > 0) && ((align & (align - 1)) == 0) && (align % sizeof(void *) == 0) &&
+        (defaultFrameMalloc == malloc) && (defaultFrameFree == free)) {
+        return ((size + align - 1) / align) * align;
+    }
+#endif
+    return size;
+}
+
 /** Used to free a frame buffer
  * This method can be overriden in subclasses to use custom memory deallocation
   * \param[in] ptr Pointer to memory that will be deallocated
@@ -119,6 +156,8 @@ void NDArrayPool::onReserveArray(NDArray *pArray)
 
 /** Hook for pool classes that manage objects derived from NDArray class.
   * This hook is called after array has been released.
+  * When the reference count has reached 0 a pool that passed a buffer it does not own to alloc()
+  * can give the buffer back here by setting pArray->pData to NULL, leaving pArray->dataSize unchanged.
   * \param[in] pArray Pointer to the released NDArray object
   */
 void NDArrayPool::onReleaseArray(NDArray *pArray)
@@ -175,10 +214,11 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
     pArray = this->createArray();
   } else {
     pArray = pListElement->pArray_;
-    if (pData || (pListElement->dataSize_ > (dataSize * THRESHOLD_SIZE_RATIO))) {
-      // We found an array but it is too large.  Set the size to 0 so it will be allocated below.
+    if (pData || !pArray->pData || (pListElement->dataSize_ > (dataSize * THRESHOLD_SIZE_RATIO))) {
+      // We found an array but it is too large, or onReleaseArray() gave its data back to the owner
+      // of a buffer that was passed to alloc().  Set the size to 0 so it will be allocated below.
       memorySize_ -= pArray->dataSize;
-      frameFree(pArray->pData);
+      if (pArray->pData) frameFree(pArray->pData);
       pArray->pData = NULL;
     }
     freeList_.erase(pListElement);
@@ -211,13 +251,15 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
     pArray->dataSize = dataSize;
     memorySize_ += dataSize;
   } else if (pArray->pData == NULL) {
-    if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+    // Count the bytes that are really allocated, so that maxMemory_ is enforced
+    size_t allocSize = frameSize(dataSize);
+    if ((maxMemory_ > 0) && ((memorySize_ + allocSize) > maxMemory_)) {
       // We don't have enough memory to allocate the array
       // See if we can get memory by deleting arrays
       // Delete the largest arrays first, i.e. work from the end of freeList_
       NDArray *freeArray;
       std::multiset<freeListElement>::iterator it;
-      while (!freeList_.empty() && ((memorySize_ + dataSize) > maxMemory_)) {
+      while (!freeList_.empty() && ((memorySize_ + allocSize) > maxMemory_)) {
         it = freeList_.end();
         it--;
         freeArray = it->pArray_;
@@ -227,16 +269,16 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
         delete freeArray;
       }
     }
-    if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+    if ((maxMemory_ > 0) && ((memorySize_ + allocSize) > maxMemory_)) {
       asynPrint(pDriver_->pasynUserSelf, ASYN_TRACE_ERROR,
              "%s: error: reached limit of %ld memory (%d buffers)\n",
              functionName, (long)maxMemory_, numBuffers_);
     } else {
       pArray->pData = frameMalloc(dataSize);
       if (pArray->pData) {
-        pArray->dataSize = dataSize;
+        pArray->dataSize = allocSize;
         pArray->compressedSize = dataSize;
-        memorySize_ += dataSize;
+        memorySize_ += allocSize;
       }
     }
   }
@@ -290,7 +332,7 @@ NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, bool copyData, bool copy
   if (copyDataType) {
     pOut->dataType = pIn->dataType;
   }
-  pOut->codec.name = pIn->codec.name;
+  pOut->codec = pIn->codec;
   pOut->compressedSize = pIn->compressedSize;
   if (copyData) {
     pIn->getInfo(&arrayInfo);
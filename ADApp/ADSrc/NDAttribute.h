@@ -117,6 +117,7 @@ public:
     virtual int report(FILE *fp, int details);
     friend class NDArray;
     friend class NDAttributeList;
+    friend class NDAttributeCodec;
 
 
 private:
@@ -0,0 +1,393 @@
+/** NDAttributeCodec.cpp
+ *
+ * Compact binary encoding of an NDAttributeList, for transports and file formats.
+ *
+ * A schema block is the header followed by an entry for each attribute:
+ *   epicsUInt8 dataType, epicsUInt8 sourceType, epicsUInt16 unused,
+ *   epicsUInt32 nameBytes, descriptionBytes, sourceBytes, followed by the 3 strings without 0 terminators.
+ * A values block is the header followed by the value of each attribute in the order of the schema:
+ *   numbers in the size of their data type, strings as epicsUInt32 bytes followed by the string
+ *   and its 0 terminator, and nothing for attributes of undefined type.
+ * Nothing is aligned.
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "NDAttributeCodec.h"
+
+/* Bytes of the fixed part of a schema entry */
+#define SCHEMA_ENTRY_BYTES 16
+
+/* 32 bit FNV-1a hash, the id of a schema */
+static epicsUInt32 hashBytes(const char *pData, size_t size)
+{
+  epicsUInt32 hash = 2166136261u;
+
+  for (size_t i=0; i<size; i++) {
+    hash ^= (epicsUInt8)pData[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Bytes of a value in a values block for the data types with a fixed size, 0 for strings */
+static size_t valueBytes(NDAttrDataType_t dataType)
+{
+  switch (dataType) {
+    case NDAttrInt8:
+    case NDAttrUInt8:
+      return 1;
+    case NDAttrInt16:
+    case NDAttrUInt16:
+      return 2;
+    case NDAttrInt32:
+    case NDAttrUInt32:
+    case NDAttrFloat32:
+      return 4;
+    case NDAttrInt64:
+    case NDAttrUInt64:
+    case NDAttrFloat64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+static void putUInt32(std::vector<char>& buffer, size_t offset, epicsUInt32 value)
+{
+  memcpy(&buffer[offset], &value, sizeof(value));
+}
+
+static epicsUInt32 getUInt32(const char *pIn)
+{
+  epicsUInt32 value;
+
+  memcpy(&value, pIn, sizeof(value));
+  return value;
+}
+
+/* Append a block header to the buffer, with blockBytes filled in later */
+static size_t putHeader(std::vector<char>& buffer, NDAttrBlockKind_t kind, epicsUInt32 schemaId, size_t count)
+{
+  NDAttrBlockHeader_t header;
+  size_t offset = buffer.size();
+
+  header.magic = NDATTRIBUTE_CODEC_MAGIC;
+  header.version = NDATTRIBUTE_CODEC_VERSION;
+  header.kind = (epicsUInt16)kind;
+  header.schemaId = schemaId;
+  header.count = (epicsUInt32)count;
+  header.blockBytes = 0;
+  buffer.resize(offset + sizeof(header));
+  memcpy(&buffer[offset], &header, sizeof(header));
+  return offset;
+}
+
+/** NDAttributeCodec constructor */
+NDAttributeCodec::NDAttributeCodec()
+{
+  this->reset();
+}
+
+/** Forget the schema, so that the next encode() writes it again or the next decode() requires it. */
+void NDAttributeCodec::reset()
+{
+  this->entries_.clear();
+  this->schema_.clear();
+  this->schemaId_ = 0;
+  this->fixedValueBytes_ = 0;
+  this->haveSchema_ = false;
+  this->schemaChanged_ = false;
+  this->schemaSent_ = false;
+}
+
+/** Returns the id of the current schema, which is in the header of every block. */
+epicsUInt32 NDAttributeCodec::schemaId()
+{
+  return this->schemaId_;
+}
+
+/** Returns the schema block of the attributes last encoded or decoded. */
+const std::vector<char>& NDAttributeCodec::schema()
+{
+  return this->schema_;
+}
+
+/** Returns true if the last call to encode() or decode() changed the schema. */
+bool NDAttributeCodec::schemaChanged()
+{
+  return this->schemaChanged_;
+}
+
+/* Returns true if the names, descriptions, sources or data types of the attributes in the list differ
+ * from the schema.  Called with the list locked. */
+bool NDAttributeCodec::layoutChanged(NDAttributeList *pList)
+{
+  NDAttributeListNode *pListNode;
+  size_t i = 0;
+
+  if (!this->haveSchema_ || ((size_t)ellCount(&pList->list_) != this->entries_.size())) return true;
+  pListNode = (NDAttributeListNode *)ellFirst(&pList->list_);
+  while (pListNode) {
+    NDAttribute *pAttribute = pListNode->pNDAttribute;
+    Entry_t& entry = this->entries_[i++];
+    if ((pAttribute->dataType_ != entry.dataType) ||
+        (pAttribute->sourceType_ != entry.sourceType) ||
+        (pAttribute->name_ != entry.name) ||
+        (pAttribute->description_ != entry.description) ||
+        (pAttribute->source_ != entry.source)) return true;
+    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+  }
+  return false;
+}
+
+/* Build the schema and its block from the attributes in the list.  Called with the list locked. */
+void NDAttributeCodec::buildSchema(NDAttributeList *pList)
+{
+  NDAttributeListNode *pListNode;
+  size_t offset;
+
+  this->entries_.resize(ellCount(&pList->list_));
+  this->fixedValueBytes_ = 0;
+  this->schema_.clear();
+  putHeader(this->schema_, NDAttrBlockSchema, 0, this->entries_.size());
+  pListNode = (NDAttributeListNode *)ellFirst(&pList->list_);
+  for (size_t i=0; pListNode; i++) {
+    NDAttribute *pAttribute = pListNode->pNDAttribute;
+    Entry_t& entry = this->entries_[i];
+    entry.name = pAttribute->name_;
+    entry.description = pAttribute->description_;
+    entry.source = pAttribute->source_;
+    entry.dataType = pAttribute->dataType_;
+    entry.sourceType = pAttribute->sourceType_;
+    entry.valueBytes = valueBytes(entry.dataType);
+    this->fixedValueBytes_ += (entry.dataType == NDAttrString) ? sizeof(epicsUInt32) : entry.valueBytes;
+
+    offset = this->schema_.size();
+    this->schema_.resize(offset + SCHEMA_ENTRY_BYTES + entry.name.size() + entry.description.size() +
+                         entry.source.size());
+    char *pOut = &this->schema_[offset];
+    pOut[0] = (char)entry.dataType;
+    pOut[1] = (char)entry.sourceType;
+    pOut[2] = pOut[3] = 0;
+    putUInt32(this->schema_, offset + 4, (epicsUInt32)entry.name.size());
+    putUInt32(this->schema_, offset + 8, (epicsUInt32)entry.description.size());
+    putUInt32(this->schema_, offset + 12, (epicsUInt32)entry.source.size());
+    pOut += SCHEMA_ENTRY_BYTES;
+    memcpy(pOut, entry.name.data(), entry.name.size());
+    pOut += entry.name.size();
+    memcpy(pOut, entry.description.data(), entry.description.size());
+    pOut += entry.description.size();
+    memcpy(pOut, entry.source.data(), entry.source.size());
+    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+  }
+  this->schemaId_ = hashBytes(&this->schema_[sizeof(NDAttrBlockHeader_t)],
+                              this->schema_.size() - sizeof(NDAttrBlockHeader_t));
+  putUInt32(this->schema_, offsetof(NDAttrBlockHeader_t, schemaId), this->schemaId_);
+  putUInt32(this->schema_, offsetof(NDAttrBlockHeader_t, blockBytes), (epicsUInt32)this->schema_.size());
+  this->haveSchema_ = true;
+}
+
+/** Encode the attributes of a list.
+  * The buffer is replaced by a values block, preceded by the schema block if withSchema is true,
+  * if this is the first call, or if the attributes have changed since the last call.
+  * The schema is only rebuilt when the attributes have changed, otherwise its cached block is copied.
+  * \param[in] pList The list of attributes to encode.
+  * \param[out] buffer The encoded blocks.  Its memory is reused, so the same vector should be passed for
+  *            each frame.
+  * \param[in] withSchema Always write the schema block, for a receiver that may not have it.
+  * \return ND_SUCCESS, or ND_ERROR if the value of an attribute could not be read.
+  */
+int NDAttributeCodec::encode(NDAttributeList *pList, std::vector<char>& buffer, bool withSchema)
+{
+  NDAttributeListNode *pListNode;
+  NDAttrDataType_t dataType;
+  NDAttrValue value;
+  size_t dataSize;
+  size_t offset;
+  int status = ND_SUCCESS;
+
+  epicsMutexLock(pList->lock_);
+  this->schemaChanged_ = this->layoutChanged(pList);
+  if (this->schemaChanged_) {
+    this->buildSchema(pList);
+    this->schemaSent_ = false;
+  }
+  buffer.clear();
+  if (withSchema || !this->schemaSent_) {
+    buffer.insert(buffer.end(), this->schema_.begin(), this->schema_.end());
+    this->schemaSent_ = true;
+  }
+
+  size_t start = putHeader(buffer, NDAttrBlockValues, this->schemaId_, this->entries_.size());
+  /* Size the buffer for everything but the strings, which are added as they are found */
+  offset = buffer.size();
+  buffer.resize(offset + this->fixedValueBytes_);
+  pListNode = (NDAttributeListNode *)ellFirst(&pList->list_);
+  for (size_t i=0; pListNode; i++) {
+    NDAttribute *pAttribute = pListNode->pNDAttribute;
+    const Entry_t& entry = this->entries_[i];
+    if (entry.valueBytes > 0) {
+      /* Read into the union because the buffer is not aligned */
+      if (pAttribute->getValue(entry.dataType, &value, entry.valueBytes)) status = ND_ERROR;
+      memcpy(&buffer[offset], &value, entry.valueBytes);
+      offset += entry.valueBytes;
+    } else if (entry.dataType == NDAttrString) {
+      pAttribute->getValueInfo(&dataType, &dataSize);
+      buffer.resize(buffer.size() + dataSize);
+      putUInt32(buffer, offset, (epicsUInt32)dataSize);
+      offset += sizeof(epicsUInt32);
+      if (pAttribute->getValue(NDAttrString, &buffer[offset], dataSize)) status = ND_ERROR;
+      offset += dataSize;
+    }
+    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+  }
+  epicsMutexUnlock(pList->lock_);
+  putUInt32(buffer, start + offsetof(NDAttrBlockHeader_t, blockBytes), (epicsUInt32)(buffer.size() - start));
+  return status;
+}
+
+/* Parse a schema block whose header has been checked */
+int NDAttributeCodec::parseSchema(const char *pBlock, size_t size)
+{
+  NDAttrBlockHeader_t header;
+  std::vector<Entry_t> entries;
+  size_t fixedValueBytes = 0;
+  const char *pIn = pBlock + sizeof(header);
+  const char *pEnd = pBlock + size;
+
+  memcpy(&header, pBlock, sizeof(header));
+  if (hashBytes(pIn, size - sizeof(header)) != header.schemaId) return ND_ERROR;
+  entries.resize(header.count);
+  for (size_t i=0; i<entries.size(); i++) {
+    Entry_t& entry = entries[i];
+    if (pEnd - pIn < SCHEMA_ENTRY_BYTES) return ND_ERROR;
+    entry.dataType = (NDAttrDataType_t)(epicsUInt8)pIn[0];
+    entry.sourceType = (NDAttrSource_t)(epicsUInt8)pIn[1];
+    if ((entry.dataType > NDAttrUndefined) || (entry.sourceType > NDAttrSourceUndefined)) return ND_ERROR;
+    entry.valueBytes = valueBytes(entry.dataType);
+    fixedValueBytes += (entry.dataType == NDAttrString) ? sizeof(epicsUInt32) : entry.valueBytes;
+    size_t nameBytes = getUInt32(pIn + 4);
+    size_t descriptionBytes = getUInt32(pIn + 8);
+    size_t sourceBytes = getUInt32(pIn + 12);
+    pIn += SCHEMA_ENTRY_BYTES;
+    if ((size_t)(pEnd - pIn) < nameBytes + descriptionBytes + sourceBytes) return ND_ERROR;
+    entry.name.assign(pIn, nameBytes);
+    pIn += nameBytes;
+    entry.description.assign(pIn, descriptionBytes);
+    pIn += descriptionBytes;
+    entry.source.assign(pIn, sourceBytes);
+    pIn += sourceBytes;
+  }
+  if (pIn != pEnd) return ND_ERROR;
+  this->entries_.swap(entries);
+  this->schema_.assign(pBlock, pBlock + size);
+  this->schemaId_ = header.schemaId;
+  this->fixedValueBytes_ = fixedValueBytes;
+  this->haveSchema_ = true;
+  this->schemaChanged_ = true;
+  return ND_SUCCESS;
+}
+
+/* Returns true if the list has the attributes of the schema in the same order, so that only their values
+ * need to be set.  Called with the list locked. */
+bool NDAttributeCodec::listMatches(NDAttributeList *pList)
+{
+  return (ellCount(&pList->list_) > 0) && !this->layoutChanged(pList);
+}
+
+/* Decode a values block whose header has been checked into the list */
+int NDAttributeCodec::decodeValues(const char *pBlock, size_t size, NDAttributeList *pList)
+{
+  NDAttrValue value;
+  const char *pIn = pBlock + sizeof(NDAttrBlockHeader_t);
+  const char *pEnd = pBlock + size;
+  NDAttributeListNode *pListNode = NULL;
+  bool valid = true;
+  int status = ND_SUCCESS;
+
+  epicsMutexLock(pList->lock_);
+  bool inPlace = this->listMatches(pList);
+  if (inPlace) {
+    pListNode = (NDAttributeListNode *)ellFirst(&pList->list_);
+  } else {
+    pList->clear();
+  }
+  for (size_t i=0; valid && (i<this->entries_.size()); i++) {
+    const Entry_t& entry = this->entries_[i];
+    const void *pValue = NULL;
+    if (entry.valueBytes > 0) {
+      if ((size_t)(pEnd - pIn) < entry.valueBytes) {
+        valid = false;
+        break;
+      }
+      memcpy(&value, pIn, entry.valueBytes);
+      pValue = &value;
+      pIn += entry.valueBytes;
+    } else if (entry.dataType == NDAttrString) {
+      size_t dataSize = (pEnd - pIn < (ptrdiff_t)sizeof(epicsUInt32)) ? 0 : getUInt32(pIn);
+      pIn += sizeof(epicsUInt32);
+      if ((dataSize == 0) || ((size_t)(pEnd - pIn) < dataSize) || pIn[dataSize - 1]) {
+        valid = false;
+        break;
+      }
+      pValue = pIn;
+      pIn += dataSize;
+    }
+    if (inPlace) {
+      if (pValue) pListNode->pNDAttribute->setValue(pValue);
+      pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+    } else {
+      NDAttribute *pAttribute = new NDAttribute(entry.name.c_str(), entry.description.c_str(), entry.sourceType,
+                                                entry.source.c_str(), entry.dataType, (void *)pValue);
+      /* The names in a schema are unique, so the search done by NDAttributeList::add is not needed */
+      ellAdd(&pList->list_, &pAttribute->listNode_.node);
+    }
+  }
+  if (!valid || (pIn != pEnd)) {
+    pList->clear();
+    status = ND_ERROR;
+  }
+  epicsMutexUnlock(pList->lock_);
+  return status;
+}
+
+/** Decode blocks written by encode().
+  * A schema block replaces the current schema, unless it has the id of the current schema, in which
+  * case it is not parsed again.  A values block sets the attributes of the list to those of the schema
+  * with the values in the block.  If the list already has those attributes only their values are set,
+  * otherwise the list is cleared and the attributes are created.
+  * \param[in] pBuffer The encoded blocks.
+  * \param[in] size Bytes in the buffer.
+  * \param[out] pList The list of attributes, which is only changed if the buffer has a values block.
+  * \return ND_SUCCESS, or ND_ERROR if a block is invalid, is from a different version or byte order,
+  *         or is a values block for a schema that the decoder does not have.
+  */
+int NDAttributeCodec::decode(const char *pBuffer, size_t size, NDAttributeList *pList)
+{
+  NDAttrBlockHeader_t header;
+
+  this->schemaChanged_ = false;
+  while (size > 0) {
+    if (size < sizeof(header)) return ND_ERROR;
+    memcpy(&header, pBuffer, sizeof(header));
+    if ((header.magic != NDATTRIBUTE_CODEC_MAGIC) || (header.version != NDATTRIBUTE_CODEC_VERSION) ||
+        (header.blockBytes < sizeof(header)) || (header.blockBytes > size)) return ND_ERROR;
+    if (header.kind == NDAttrBlockSchema) {
+      if (!this->haveSchema_ || (header.schemaId != this->schemaId_) || (header.count != this->entries_.size())) {
+        if (this->parseSchema(pBuffer, header.blockBytes)) return ND_ERROR;
+      }
+    } else if (header.kind == NDAttrBlockValues) {
+      if (!this->haveSchema_ || (header.schemaId != this->schemaId_) || (header.count != this->entries_.size()))
+        return ND_ERROR;
+      if (this->decodeValues(pBuffer, header.blockBytes, pList)) return ND_ERROR;
+    } else {
+      return ND_ERROR;
+    }
+    pBuffer += header.blockBytes;
+    size -= header.blockBytes;
+  }
+  return ND_SUCCESS;
+}
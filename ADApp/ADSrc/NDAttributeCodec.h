@@ -0,0 +1,87 @@
+/** NDAttributeCodec.h
+ *
+ * Compact binary encoding of an NDAttributeList, for transports and file formats.
+ *
+ */
+
+#ifndef NDAttributeCodec_H
+#define NDAttributeCodec_H
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+
+#include "NDAttributeList.h"
+
+/** First word of each block, "NDAT" */
+#define NDATTRIBUTE_CODEC_MAGIC 0x4E444154
+/** Version of the encoding, written in each block */
+#define NDATTRIBUTE_CODEC_VERSION 1
+
+/** Kinds of block in an encoded attribute stream */
+typedef enum {
+  NDAttrBlockSchema = 1,   /**< Name, description, source and data type of each attribute */
+  NDAttrBlockValues = 2    /**< Value of each attribute, in the order of the schema */
+} NDAttrBlockKind_t;
+
+/** Header of each block.  The fields are in the byte order of the host that wrote the block. */
+typedef struct {
+  epicsUInt32 magic;       /**< NDATTRIBUTE_CODEC_MAGIC, which also identifies the byte order */
+  epicsUInt16 version;     /**< NDATTRIBUTE_CODEC_VERSION */
+  epicsUInt16 kind;        /**< NDAttrBlockKind_t */
+  epicsUInt32 schemaId;    /**< Hash of the schema, the same in the schema block and the values blocks */
+  epicsUInt32 count;       /**< Number of attributes */
+  epicsUInt32 blockBytes;  /**< Bytes of the block including this header */
+} NDAttrBlockHeader_t;
+
+/** Binary encoding of an NDAttributeList.
+  * The list is described by a schema block, with the name, description, source and data type
+  * of each attribute, and by a values block with just the value of each attribute in the order
+  * of the schema.  Numeric values take their natural size and strings their length plus 4 bytes.
+  * The schema is sent once and only needs to be sent again when the attributes change,
+  * so a stream of frames with the same attributes costs little more than their values.
+  * Each block starts with a header that has a version and the id of its schema, so that a decoder
+  * rejects values that were encoded with a schema it does not have.
+  *
+  * An object is either an encoder or a decoder.  Both keep the current schema, so an encoder
+  * only rebuilds the schema block, and a decoder only parses it, when the attributes change.
+  * The object is not thread safe.
+  */
+class ADCORE_API NDAttributeCodec {
+public:
+  NDAttributeCodec();
+  int encode(NDAttributeList *pList, std::vector<char>& buffer, bool withSchema);
+  const std::vector<char>& schema();
+  bool schemaChanged();
+  int decode(const char *pBuffer, size_t size, NDAttributeList *pList);
+  epicsUInt32 schemaId();
+  void reset();
+
+private:
+  /* An attribute of the schema */
+  typedef struct {
+    std::string name;
+    std::string description;
+    std::string source;
+    NDAttrDataType_t dataType;
+    NDAttrSource_t sourceType;
+    size_t valueBytes;       /* Bytes of the value in a values block, 0 for strings */
+  } Entry_t;
+
+  bool layoutChanged(NDAttributeList *pList);
+  void buildSchema(NDAttributeList *pList);
+  int parseSchema(const char *pBlock, size_t size);
+  int decodeValues(const char *pBlock, size_t size, NDAttributeList *pList);
+  bool listMatches(NDAttributeList *pList);
+
+  std::vector<Entry_t> entries_;
+  std::vector<char> schema_;     /* Encoded schema block */
+  epicsUInt32 schemaId_;
+  size_t fixedValueBytes_;       /* Bytes of a values block after the header, except for the strings */
+  bool haveSchema_;
+  bool schemaChanged_;
+  bool schemaSent_;              /* The schema block has been written since it last changed */
+};
+
+#endif
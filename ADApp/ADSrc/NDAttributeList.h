@@ -33,6 +33,7 @@ public:
     int          copy(NDAttributeList *pOut);
     int          updateValues();
     int          report(FILE *fp, int details);
+    friend class NDAttributeCodec;
 
 private:
     ELLLIST      list_;   /**< The EPICS ELLLIST  */
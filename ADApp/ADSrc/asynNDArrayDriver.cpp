@@ -935,6 +935,23 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     createParam(NDFileLazyOpenString,         asynParamInt32,           &NDFileLazyOpen);
     createParam(NDFileCreateDirString,        asynParamInt32,           &NDFileCreateDir);
     createParam(NDFileTempSuffixString,       asynParamOctet,           &NDFileTempSuffix);
+    createParam(NDFileWriteBehindString,      asynParamInt32,           &NDFileWriteBehind);
+    createParam(NDFileWriteBehindQueueSizeString, asynParamInt32,       &NDFileWriteBehindQueueSize);
+    createParam(NDFileWriteBehindMaxMemString, asynParamFloat64,        &NDFileWriteBehindMaxMem);
+    createParam(NDFileWriteBehindQueuedString, asynParamInt32,          &NDFileWriteBehindQueued);
+    createParam(NDFileWriteBehindHighWaterString, asynParamInt32,       &NDFileWriteBehindHighWater);
+    createParam(NDFileMaxWriteTimeString,     asynParamFloat64,         &NDFileMaxWriteTime);
+    createParam(NDFileRolloverFramesString,   asynParamInt32,           &NDFileRolloverFrames);
+    createParam(NDFileRolloverSizeString,     asynParamFloat64,         &NDFileRolloverSize);
+    createParam(NDFileRolloverCountString,    asynParamInt32,           &NDFileRolloverCount);
+    createParam(NDFileCaptureArenaSizeString, asynParamFloat64,         &NDFileCaptureArenaSize);
+    createParam(NDFileCaptureArenaFileString, asynParamOctet,           &NDFileCaptureArenaFile);
+    createParam(NDFileCaptureArenaUsedString, asynParamFloat64,         &NDFileCaptureArenaUsed);
+    createParam(NDFileReplayString,           asynParamInt32,           &NDFileReplay);
+    createParam(NDFileReplayRateString,       asynParamFloat64,         &NDFileReplayRate);
+    createParam(NDFileReplayReadAheadString,  asynParamInt32,           &NDFileReplayReadAhead);
+    createParam(NDFileReplayNumArraysString,  asynParamInt32,           &NDFileReplayNumArrays);
+    createParam(NDFileReplayCountString,      asynParamInt32,           &NDFileReplayCount);
     createParam(NDAttributesFileString,       asynParamOctet,           &NDAttributesFile);
     createParam(NDAttributesStatusString,     asynParamInt32,           &NDAttributesStatus);
     createParam(NDAttributesMacrosString,     asynParamOctet,           &NDAttributesMacros);
@@ -993,6 +1010,23 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     setIntegerParam(NDFileFreeCapture, 0);
     setIntegerParam(NDFileCreateDir, 0);
     setStringParam (NDFileTempSuffix, "");
+    setIntegerParam(NDFileWriteBehind, 0);
+    setIntegerParam(NDFileWriteBehindQueueSize, 16);
+    setDoubleParam (NDFileWriteBehindMaxMem, 0.0);
+    setIntegerParam(NDFileWriteBehindQueued, 0);
+    setIntegerParam(NDFileWriteBehindHighWater, 0);
+    setDoubleParam (NDFileMaxWriteTime, 0.0);
+    setIntegerParam(NDFileRolloverFrames, 0);
+    setDoubleParam (NDFileRolloverSize, 0.0);
+    setIntegerParam(NDFileRolloverCount, 0);
+    setDoubleParam (NDFileCaptureArenaSize, 0.0);
+    setStringParam (NDFileCaptureArenaFile, "");
+    setDoubleParam (NDFileCaptureArenaUsed, 0.0);
+    setIntegerParam(NDFileReplay, 0);
+    setDoubleParam (NDFileReplayRate, 0.0);
+    setIntegerParam(NDFileReplayReadAhead, 8);
+    setIntegerParam(NDFileReplayNumArrays, 0);
+    setIntegerParam(NDFileReplayCount, 0);
     setStringParam (NDAttributesFile, "");
     setIntegerParam(NDAttributesStatus, NDAttributesFileNotFound);
     setStringParam (NDAttributesMacros, "");
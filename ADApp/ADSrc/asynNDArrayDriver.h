@@ -105,6 +105,23 @@ typedef enum {
 #define NDFileLazyOpenString    "FILE_LAZY_OPEN"    /**< (asynInt32,    r/w) Don't open file until first frame arrives in Stream mode */
 #define NDFileCreateDirString   "CREATE_DIR"        /**< (asynInt32,    r/w) Create the target directory up to this depth */
 #define NDFileTempSuffixString  "FILE_TEMP_SUFFIX"  /**< (asynOctet,    r/w) Temporary filename suffix while writing data to file. The file will be renamed (suffix removed) upon closing the file. */
+#define NDFileWriteBehindString "WRITE_BEHIND"      /**< (asynInt32,    r/w) Write arrays in Stream mode from a separate I/O thread */
+#define NDFileWriteBehindQueueSizeString "WRITE_BEHIND_QUEUE_SIZE" /**< (asynInt32, r/w) Maximum number of arrays waiting for the I/O thread */
+#define NDFileWriteBehindMaxMemString "WRITE_BEHIND_MAX_MEM" /**< (asynFloat64, r/w) Maximum memory in MB of arrays waiting for the I/O thread */
+#define NDFileWriteBehindQueuedString "WRITE_BEHIND_QUEUED" /**< (asynInt32, r/o) Number of arrays waiting for the I/O thread */
+#define NDFileWriteBehindHighWaterString "WRITE_BEHIND_HIGH_WATER" /**< (asynInt32, r/o) Maximum number of arrays waiting since capture started */
+#define NDFileMaxWriteTimeString "MAX_WRITE_TIME"   /**< (asynFloat64,  r/o) Longest time in ms to write an array since capture started */
+#define NDFileRolloverFramesString "ROLLOVER_FRAMES" /**< (asynInt32, r/w) Start a new file in Stream mode after this many arrays, 0=never */
+#define NDFileRolloverSizeString "ROLLOVER_SIZE"   /**< (asynFloat64,  r/w) Start a new file in Stream mode after this many MB, 0=never */
+#define NDFileRolloverCountString "ROLLOVER_COUNT" /**< (asynInt32,    r/o) Number of new files started by rollover since streaming started */
+#define NDFileCaptureArenaSizeString "CAPTURE_ARENA_SIZE" /**< (asynFloat64, r/w) Size in MB of the memory mapped Capture mode buffer, 0=keep the arrays */
+#define NDFileCaptureArenaFileString "CAPTURE_ARENA_FILE" /**< (asynOctet,   r/w) Scratch file for the Capture mode buffer, empty=anonymous memory */
+#define NDFileCaptureArenaUsedString "CAPTURE_ARENA_USED" /**< (asynFloat64, r/o) MB of the Capture mode buffer used by captured arrays */
+#define NDFileReplayString        "REPLAY"            /**< (asynInt32,    r/w) Start (1) or stop (0) replaying the arrays of a file */
+#define NDFileReplayRateString    "REPLAY_RATE"       /**< (asynFloat64,  r/w) Arrays per second sent by a replay, 0=as fast as possible */
+#define NDFileReplayReadAheadString "REPLAY_READ_AHEAD" /**< (asynInt32,  r/w) Arrays read ahead of the one being sent by a replay */
+#define NDFileReplayNumArraysString "REPLAY_NUM_ARRAYS" /**< (asynInt32,  r/o) Number of arrays in the file being replayed */
+#define NDFileReplayCountString   "REPLAY_COUNT"      /**< (asynInt32,    r/o) Number of arrays sent since the replay started */
 
 #define NDAttributesFileString    "ND_ATTRIBUTES_FILE"   /**< (asynOctet,    r/w) Attributes file name */
 #define NDAttributesStatusString  "ND_ATTRIBUTES_STATUS" /**< (asynInt32,    r/o) Attributes status */
@@ -218,6 +235,23 @@ protected:
     int NDFileLazyOpen;
     int NDFileCreateDir;
     int NDFileTempSuffix;
+    int NDFileWriteBehind;
+    int NDFileWriteBehindQueueSize;
+    int NDFileWriteBehindMaxMem;
+    int NDFileWriteBehindQueued;
+    int NDFileWriteBehindHighWater;
+    int NDFileMaxWriteTime;
+    int NDFileRolloverFrames;
+    int NDFileRolloverSize;
+    int NDFileRolloverCount;
+    int NDFileCaptureArenaSize;
+    int NDFileCaptureArenaFile;
+    int NDFileCaptureArenaUsed;
+    int NDFileReplay;
+    int NDFileReplayRate;
+    int NDFileReplayReadAhead;
+    int NDFileReplayNumArrays;
+    int NDFileReplayCount;
     int NDAttributesFile;
     int NDAttributesStatus;
     int NDAttributesMacros;
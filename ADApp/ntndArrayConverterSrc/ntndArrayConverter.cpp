@@ -44,6 +44,52 @@ struct freeNDArray {
     void operator()(dataType *data) { array->release(); }
 };
 
+/* NDArray that holds a reference to the NTNDArray value it uses as its data */
+class NTNDPoolArray : public NDArray
+{
+public:
+    shared_vector<const void> value;
+};
+
+NTNDArrayPool::NTNDArrayPool (asynNDArrayDriver *pDriver, size_t maxMemory)
+    : NDArrayPool(pDriver, maxMemory) {}
+
+/** Allocates an NDArray whose data is the data of an NTNDArray value, without copying it.
+  * \param[in] ndims The number of dimensions in the NDArray.
+  * \param[in] dims Array of dimensions, whose size must be at least ndims.
+  * \param[in] dataType Data type of the NDArray data.
+  * \param[in] data The value of the NTNDArray.
+  */
+NDArray* NTNDArrayPool::wrap (int ndims, size_t *dims, NDDataType_t dataType,
+        const shared_vector<const void>& data)
+{
+    if(data.empty())
+        return NULL;
+
+    NDArray *pArray = alloc(ndims, dims, dataType, data.size(), const_cast<void *>(data.data()));
+    if(pArray) {
+        static_cast<NTNDPoolArray *>(pArray)->value = data;
+        pArray->compressedSize = data.size();
+    }
+    return pArray;
+}
+
+NDArray* NTNDArrayPool::createArray ()
+{
+    return new NTNDPoolArray;
+}
+
+void NTNDArrayPool::onReleaseArray (NDArray *pArray)
+{
+    NTNDPoolArray *pPoolArray = static_cast<NTNDPoolArray *>(pArray);
+
+    // Give the data back to pvAccess, the pool must not free or reuse it
+    if(pArray->getReferenceCount() == 0 && !pPoolArray->value.empty()) {
+        pPoolArray->value.clear();
+        pArray->pData = NULL;
+    }
+}
+
 NTNDArrayConverter::NTNDArrayConverter (NTNDArrayPtr array) : m_array(array) {}
 
 ScalarType NTNDArrayConverter::getValueType (void)
@@ -218,6 +264,39 @@ void NTNDArrayConverter::toArray (NDArray *dest)
     dest->uniqueId = uniqueId->get();
 }
 
+/** Creates an NDArray from the NTNDArray.  The NDArray uses the value of the NTNDArray as its data
+  * rather than a copy of it.
+  * \param[in] pPool The pool to allocate the NDArray from.
+  * \return The NDArray, with a reference count of 1.
+  */
+NDArray *NTNDArrayConverter::toArray (NTNDArrayPool *pPool)
+{
+    NTNDArrayInfo_t info = getInfo();
+    NDArray *dest = pPool->wrap(info.ndims, info.dims, info.dataType, getValueData());
+
+    if(!dest)
+        throw std::runtime_error("failed to allocate NDArray");
+
+    try
+    {
+        dest->codec.name = info.codec;
+        dest->pAttributeList->clear();
+        toDimensions(dest);
+        toTimeStamp(dest);
+        toDataTimeStamp(dest);
+        toAttributes(dest);
+    }
+    catch(...)
+    {
+        dest->release();
+        throw;
+    }
+
+    PVIntPtr uniqueId(m_array->getPVStructure()->getSubField<PVInt>("uniqueId"));
+    dest->uniqueId = uniqueId->get();
+    return dest;
+}
+
 void NTNDArrayConverter::fromArray (NDArray *src)
 {
     fromValue(src);
@@ -273,6 +352,34 @@ void NTNDArrayConverter::toValue (NDArray *dest)
 
 }
 
+template <typename arrayType>
+shared_vector<const void> NTNDArrayConverter::getValueData (void)
+{
+    typename arrayType::const_svector srcVec(m_array->getValue()->get<arrayType>()->view());
+    return static_shared_vector_cast<const void>(srcVec);
+}
+
+shared_vector<const void> NTNDArrayConverter::getValueData (void)
+{
+    switch(getValueType())
+    {
+    case pvByte:    return getValueData<PVByteArray>  ();
+    case pvUByte:   return getValueData<PVUByteArray> ();
+    case pvShort:   return getValueData<PVShortArray> ();
+    case pvUShort:  return getValueData<PVUShortArray>();
+    case pvInt:     return getValueData<PVIntArray>   ();
+    case pvUInt:    return getValueData<PVUIntArray>  ();
+    case pvLong:    return getValueData<PVLongArray>  ();
+    case pvULong:   return getValueData<PVULongArray> ();
+    case pvFloat:   return getValueData<PVFloatArray> ();
+    case pvDouble:  return getValueData<PVDoubleArray>();
+    case pvBoolean:
+    case pvString:
+    default:
+        throw std::runtime_error("invalid value data type");
+    }
+}
+
 void NTNDArrayConverter::toDimensions (NDArray *dest)
 {
     PVStructureArrayPtr src(m_array->getDimension());
@@ -541,12 +648,109 @@ void NTNDArrayConverter::fromUndefinedAttribute (PVStructurePtr dest)
     dest->getSubField<PVUnion>("value")->set(nullPtr);
 }
 
+template <typename pvAttrType, typename valueType>
+bool NTNDArrayConverter::attributeChanged (PVStructurePtr dest, NDAttribute *src)
+{
+    valueType value;
+    src->getValue(src->getDataType(), (void*)&value);
+
+    typename pvAttrType::shared_pointer valueFld(dest->getSubFieldT<PVUnion>("value")->get<pvAttrType>());
+    return !valueFld || valueFld->get() != value;
+}
+
+bool NTNDArrayConverter::stringAttributeChanged (PVStructurePtr dest, NDAttribute *src)
+{
+    NDAttrDataType_t attrDataType;
+    size_t attrDataSize;
+
+    src->getValueInfo(&attrDataType, &attrDataSize);
+    std::vector<char> value(attrDataSize);
+    src->getValue(attrDataType, &value[0], attrDataSize);
+
+    PVStringPtr valueFld(dest->getSubFieldT<PVUnion>("value")->get<PVString>());
+    return !valueFld || valueFld->get() != &value[0];
+}
+
+/* Compares the name, description, source and data type of each attribute with what was last written
+ * to the attribute field, and remembers the new layout if it differs. */
+bool NTNDArrayConverter::attributeLayoutChanged (NDAttributeList *srcList)
+{
+    NDAttribute *attr = NULL;
+    NDAttrSource_t sourceType;
+    bool changed = ((size_t)srcList->count() != m_attrLayout.size());
+    size_t i = 0;
+
+    while(!changed && (attr = srcList->next(attr)))
+    {
+        const AttributeLayout_t& layout = m_attrLayout[i++];
+        attr->getSourceInfo(&sourceType);
+        changed = layout.dataType != attr->getDataType() || layout.sourceType != sourceType ||
+                  layout.name != attr->getName() || layout.description != attr->getDescription() ||
+                  layout.source != attr->getSource();
+    }
+
+    if(!changed)
+        return false;
+
+    m_attrLayout.resize(srcList->count());
+    i = 0;
+    while((attr = srcList->next(attr)))
+    {
+        AttributeLayout_t& layout = m_attrLayout[i++];
+        layout.name        = attr->getName();
+        layout.description = attr->getDescription();
+        layout.source      = attr->getSource();
+        attr->getSourceInfo(&layout.sourceType);
+        layout.dataType    = attr->getDataType();
+    }
+    return true;
+}
+
 void NTNDArrayConverter::fromAttributes (NDArray *src)
 {
     PVStructureArrayPtr dest(m_array->getAttribute());
     NDAttributeList *srcList = src->pAttributeList;
     NDAttribute *attr = NULL;
     StructureConstPtr structure(dest->getStructureArray()->getStructure());
+    bool layoutChanged = attributeLayoutChanged(srcList);
+
+    /*
+     * When the attributes are the same as the last frame apart from their values, and no value has
+     * changed either, the attribute field is left alone so that monitors do not send it again.
+     */
+    if(!layoutChanged)
+    {
+        PVStructureArray::const_svector current(dest->view());
+        bool changed = false;
+        size_t i = 0;
+
+        while(!changed && (attr = srcList->next(attr)))
+        {
+            PVStructurePtr pvAttr(current[i++]);
+
+            switch(attr->getDataType())
+            {
+            case NDAttrInt8:      changed = attributeChanged <PVByte,   int8_t>  (pvAttr, attr); break;
+            case NDAttrUInt8:     changed = attributeChanged <PVUByte,  uint8_t> (pvAttr, attr); break;
+            case NDAttrInt16:     changed = attributeChanged <PVShort,  int16_t> (pvAttr, attr); break;
+            case NDAttrUInt16:    changed = attributeChanged <PVUShort, uint16_t>(pvAttr, attr); break;
+            case NDAttrInt32:     changed = attributeChanged <PVInt,    int32_t> (pvAttr, attr); break;
+            case NDAttrUInt32:    changed = attributeChanged <PVUInt,   uint32_t>(pvAttr, attr); break;
+            case NDAttrInt64:     changed = attributeChanged <PVLong,   int64_t> (pvAttr, attr); break;
+            case NDAttrUInt64:    changed = attributeChanged <PVULong,  uint64_t>(pvAttr, attr); break;
+            case NDAttrFloat32:   changed = attributeChanged <PVFloat,  float>   (pvAttr, attr); break;
+            case NDAttrFloat64:   changed = attributeChanged <PVDouble, double>  (pvAttr, attr); break;
+            case NDAttrString:    changed = stringAttributeChanged(pvAttr, attr); break;
+            case NDAttrUndefined: changed = pvAttr->getSubField<PVUnion>("value")->get().get() != NULL; break;
+            default:              throw std::runtime_error("invalid attribute data type");
+            }
+        }
+
+        if(!changed)
+            return;
+        attr = NULL;
+    }
+
     PVStructureArray::svector destVec(dest->reuse());
 
     destVec.resize(srcList->count());
@@ -554,18 +758,23 @@ void NTNDArrayConverter::fromAttributes (NDArray *src)
     size_t i = 0;
     while((attr = srcList->next(attr)))
     {
-        if(!destVec[i].get() || !destVec[i].unique())
+        bool newStructure = !destVec[i].get() || !destVec[i].unique();
+        if(newStructure)
             destVec[i] = PVDC->createPVStructure(structure);
 
         PVStructurePtr pvAttr(destVec[i]);
 
-        pvAttr->getSubField<PVString>("name")->put(attr->getName());
-        pvAttr->getSubField<PVString>("descriptor")->put(attr->getDescription());
-        pvAttr->getSubField<PVString>("source")->put(attr->getSource());
+        // Structures kept from the last frame already hold the right name, descriptor and source
+        if(newStructure || layoutChanged)
+        {
+            pvAttr->getSubField<PVString>("name")->put(attr->getName());
+            pvAttr->getSubField<PVString>("descriptor")->put(attr->getDescription());
+            pvAttr->getSubField<PVString>("source")->put(attr->getSource());
 
-        NDAttrSource_t sourceType;
-        attr->getSourceInfo(&sourceType);
-        pvAttr->getSubField<PVInt>("sourceType")->put(sourceType);
+            NDAttrSource_t sourceType;
+            attr->getSourceInfo(&sourceType);
+            pvAttr->getSubField<PVInt>("sourceType")->put(sourceType);
+        }
 
         switch(attr->getDataType())
         {
@@ -581,7 +790,9 @@ void NTNDArrayConverter::fromAttributes (NDArray *src)
         case NDAttrFloat64:   fromAttribute <PVDouble, double>  (pvAttr, attr); break;
         case NDAttrString:    fromStringAttribute(pvAttr, attr); break;
         case NDAttrUndefined: fromUndefinedAttribute(pvAttr); break;
-        default:              throw std::runtime_error("invalid attribute data type");
+        default:
+            m_attrLayout.clear();
+            throw std::runtime_error("invalid attribute data type");
         }
 
         ++i;
@@ -1,4 +1,6 @@
 #include <math.h>
+#include <string>
+#include <vector>
 
 #include <ntndArrayConverterAPI.h>
 #include <NDArray.h>
@@ -21,6 +23,22 @@ typedef struct NTNDArrayInfo
     }x, y, color;
 }NTNDArrayInfo_t;
 
+/** An NDArrayPool whose NDArrays can use the value of an NTNDArray as their data without copying it.
+  * The NDArray holds a reference to the shared_vector of the value, which is dropped when the
+  * NDArray is released for the last time.  The data is shared with pvAccess, so it must not be
+  * modified. */
+class NTNDARRAYCONVERTER_API NTNDArrayPool : public NDArrayPool
+{
+public:
+    NTNDArrayPool(class asynNDArrayDriver *pDriver, size_t maxMemory);
+    NDArray* wrap(int ndims, size_t *dims, NDDataType_t dataType,
+                  const epics::pvData::shared_vector<const void>& data);
+
+protected:
+    virtual NDArray* createArray();
+    virtual void onReleaseArray(NDArray *pArray);
+};
+
 class NTNDARRAYCONVERTER_API NTNDArrayConverter
 {
 public:
@@ -28,10 +46,22 @@ public:
 
     NTNDArrayInfo_t getInfo (void);
     void toArray (NDArray *dest);
+    NDArray *toArray (NTNDArrayPool *pPool);
     void fromArray (NDArray *src);
 
 private:
+    /* What fromAttributes last wrote to each element of the attribute field, other than the value */
+    typedef struct
+    {
+        std::string name;
+        std::string description;
+        std::string source;
+        NDAttrSource_t sourceType;
+        NDAttrDataType_t dataType;
+    }AttributeLayout_t;
+
     epics::nt::NTNDArrayPtr m_array;
+    std::vector<AttributeLayout_t> m_attrLayout;
 
     epics::pvData::ScalarType getValueType (void);
     NDColorMode_t getColorMode (void);
@@ -39,6 +69,9 @@ private:
     template <typename arrayType>
     void toValue (NDArray *dest);
     void toValue (NDArray *dest);
+    template <typename arrayType>
+    epics::pvData::shared_vector<const void> getValueData (void);
+    epics::pvData::shared_vector<const void> getValueData (void);
 
     void toDimensions (NDArray *dest);
     void toTimeStamp (NDArray *dest);
@@ -62,6 +95,10 @@ private:
     void fromAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
     void fromStringAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
     void fromUndefinedAttribute (epics::pvData::PVStructurePtr dest);
+    template <typename pvAttrType, typename valueType>
+    bool attributeChanged (epics::pvData::PVStructurePtr dest, NDAttribute *src);
+    bool stringAttributeChanged (epics::pvData::PVStructurePtr dest, NDAttribute *src);
+    bool attributeLayoutChanged (NDAttributeList *srcList);
     void fromAttributes (NDArray *src);
 };
 
@@ -0,0 +1,78 @@
+/*
+ * NDArrayDescriptor.cpp
+ *
+ * Description of an NDArray without its data, shared by the memory regions that hold arrays.
+ */
+
+#include <string.h>
+
+#include "NDArrayDescriptor.h"
+
+/** Return the bytes needed to describe an array, including the codec block offsets and the attributes.
+ * \param[in] pArray - The array.
+ * \param[in] attributeBytes - Bytes of the encoded attributes.
+ */
+size_t NDArrayDescriptorBytes(NDArray *pArray, size_t attributeBytes)
+{
+  return sizeof(NDArrayDescriptor_t) + pArray->codec.blockOffsets.size() * sizeof(size_t) + attributeBytes;
+}
+
+/** Describe an array.  The caller must have checked that NDArrayDescriptorBytes() fit at pDescriptor.
+ * \param[in] pArray - The array.
+ * \param[in] attributes - The attributes of the array, encoded by NDAttributeCodec.
+ * \param[out] pDescriptor - Where to write the description.
+ */
+void NDArrayDescriptorWrite(NDArray *pArray, const std::vector<char>& attributes, NDArrayDescriptor_t *pDescriptor)
+{
+  NDArrayInfo_t arrayInfo;
+
+  pArray->getInfo(&arrayInfo);
+  pDescriptor->dataBytes = pArray->codec.empty() ? arrayInfo.totalBytes : pArray->compressedSize;
+  pDescriptor->compressedSize = pArray->compressedSize;
+  pDescriptor->uniqueId = pArray->uniqueId;
+  pDescriptor->timeStamp = pArray->timeStamp;
+  pDescriptor->epicsTS = pArray->epicsTS;
+  pDescriptor->ndims = pArray->ndims;
+  memcpy(pDescriptor->dims, pArray->dims, sizeof(pDescriptor->dims));
+  pDescriptor->dataType = pArray->dataType;
+  strncpy(pDescriptor->codecName, pArray->codec.name.c_str(), sizeof(pDescriptor->codecName) - 1);
+  pDescriptor->codecName[sizeof(pDescriptor->codecName) - 1] = 0;
+  pDescriptor->codecLevel = pArray->codec.level;
+  pDescriptor->codecShuffle = pArray->codec.shuffle;
+  pDescriptor->codecCompressor = pArray->codec.compressor;
+  pDescriptor->codecBlockSize = pArray->codec.blockSize;
+  pDescriptor->numBlockOffsets = pArray->codec.blockOffsets.size();
+  pDescriptor->attributeBytes = attributes.size();
+
+  char *pOut = (char *)(pDescriptor + 1);
+  if (pDescriptor->numBlockOffsets > 0) {
+    memcpy(pOut, &pArray->codec.blockOffsets[0], pDescriptor->numBlockOffsets * sizeof(size_t));
+    pOut += pDescriptor->numBlockOffsets * sizeof(size_t);
+  }
+  if (pDescriptor->attributeBytes > 0) memcpy(pOut, &attributes[0], pDescriptor->attributeBytes);
+}
+
+/** Set the dimensions, time stamps and codec of an array from its description.
+ * The caller allocates the array with the dimensions and data type of the description, copies the data
+ * and decodes the attributes.
+ * \param[in] pDescriptor - The description.
+ * \param[out] pArray - The array.
+ * \return The start of the encoded attributes.
+ */
+const char *NDArrayDescriptorRead(const NDArrayDescriptor_t *pDescriptor, NDArray *pArray)
+{
+  memcpy(pArray->dims, pDescriptor->dims, sizeof(pArray->dims));
+  pArray->uniqueId = pDescriptor->uniqueId;
+  pArray->timeStamp = pDescriptor->timeStamp;
+  pArray->epicsTS = pDescriptor->epicsTS;
+  pArray->codec.name = pDescriptor->codecName;
+  pArray->codec.level = pDescriptor->codecLevel;
+  pArray->codec.shuffle = pDescriptor->codecShuffle;
+  pArray->codec.compressor = pDescriptor->codecCompressor;
+  pArray->codec.blockSize = pDescriptor->codecBlockSize;
+  pArray->compressedSize = pDescriptor->compressedSize;
+
+  const char *pIn = (const char *)(pDescriptor + 1);
+  pArray->codec.blockOffsets.assign((const size_t *)pIn, (const size_t *)pIn + pDescriptor->numBlockOffsets);
+  return pIn + pDescriptor->numBlockOffsets * sizeof(size_t);
+}
@@ -0,0 +1,40 @@
+#ifndef NDArrayDescriptor_H
+#define NDArrayDescriptor_H
+
+#include <vector>
+
+#include <NDPluginAPI.h>
+#include "NDArray.h"
+
+/** Bytes of the codec name in an NDArrayDescriptor_t */
+#define NDARRAY_DESCRIPTOR_CODEC_NAME 32
+
+/** Description of an NDArray without its data, for arrays that are kept in a memory region rather than
+  * in an NDArray object, as in NDArrayShmem and NDFileCaptureArena.
+  * The structure is followed in the region by numBlockOffsets codec block offsets and then attributeBytes
+  * of attributes encoded by NDAttributeCodec.
+  */
+typedef struct {
+  size_t dataBytes;                /**< Bytes of data, the compressed size if the array is compressed */
+  size_t compressedSize;
+  int uniqueId;
+  double timeStamp;
+  epicsTimeStamp epicsTS;
+  int ndims;
+  NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+  NDDataType_t dataType;
+  char codecName[NDARRAY_DESCRIPTOR_CODEC_NAME];
+  int codecLevel;
+  int codecShuffle;
+  int codecCompressor;
+  size_t codecBlockSize;
+  size_t numBlockOffsets;
+  size_t attributeBytes;
+} NDArrayDescriptor_t;
+
+NDPLUGIN_API size_t NDArrayDescriptorBytes(NDArray *pArray, size_t attributeBytes);
+NDPLUGIN_API void NDArrayDescriptorWrite(NDArray *pArray, const std::vector<char>& attributes,
+                                         NDArrayDescriptor_t *pDescriptor);
+NDPLUGIN_API const char *NDArrayDescriptorRead(const NDArrayDescriptor_t *pDescriptor, NDArray *pArray);
+
+#endif
@@ -9,13 +9,15 @@
 
 #include "NDArrayRing.h"
 
-NDArrayRing::NDArrayRing(int noOfBuffers)
+NDArrayRing::NDArrayRing(int noOfBuffers, bool growable)
 {
   noOfBuffers_ = noOfBuffers;
+  growable_ = growable;
   buffers_ = NULL;
   writeIndex_ = -1;
   readIndex_ = -1;
-  wrapped_ = 0;
+  startIndex_ = 0;
+  count_ = 0;
 
   buffers_ = new NDArray *[noOfBuffers_];
   for (int index = 0; index < noOfBuffers_; index++){
@@ -31,26 +33,26 @@ NDArrayRing::~NDArrayRing()
 
 int NDArrayRing::size()
 {
-  if (wrapped_ == 1){
-    return noOfBuffers_;
-  }
-  return writeIndex_ + 1;
+  return count_;
 }
 
 NDArray *NDArrayRing::addToEnd(NDArray *pArray)
 {
   NDArray *retVal = NULL;
 
+  if (growable_ && (count_ == noOfBuffers_)) {
+      grow();
+  }
   if (noOfBuffers_ > 0) {
       writeIndex_ = (writeIndex_ + 1) % noOfBuffers_;
-      if (wrapped_ == 1){
+      if (count_ == noOfBuffers_){
+          // The ring is full, so the oldest buffer is overwritten
           retVal = buffers_[writeIndex_];
+          startIndex_ = (startIndex_ + 1) % noOfBuffers_;
+      } else {
+          count_++;
       }
       buffers_[writeIndex_] = pArray;
-      if (writeIndex_+1 == noOfBuffers_){
-          // We have now wrapped
-          wrapped_ = 1;
-      }
   } else {
       // Buffer is not being used, so return the passed array to be released immediately.
       retVal = pArray;
@@ -58,14 +60,29 @@ NDArray *NDArrayRing::addToEnd(NDArray *pArray)
   return retVal;
 }
 
+void NDArrayRing::grow()
+{
+  int newSize = (noOfBuffers_ > 0) ? 2 * noOfBuffers_ : 16;
+  NDArray **newBuffers = new NDArray *[newSize];
+
+  // Copy the buffers oldest first, so the oldest is at index 0 of the new ring
+  for (int index = 0; index < newSize; index++){
+    newBuffers[index] = (index < count_) ? buffers_[(startIndex_ + index) % noOfBuffers_] : NULL;
+  }
+  if (readIndex_ >= 0){
+    readIndex_ = (readIndex_ - startIndex_ + noOfBuffers_) % noOfBuffers_;
+  }
+  writeIndex_ = count_ - 1;
+  startIndex_ = 0;
+  delete[] buffers_;
+  buffers_ = newBuffers;
+  noOfBuffers_ = newSize;
+}
+
 // Return the oldest frame in the buffer
 NDArray *NDArrayRing::readFromStart()
 {
-  if (wrapped_) {
-    readIndex_ = ((writeIndex_+1) % noOfBuffers_);
-  } else {
-    readIndex_ = 0;
-  }
+  readIndex_ = startIndex_;
 
   //printf("readFromStart - Readindex %d\n", readIndex_);
   return buffers_[readIndex_];
@@ -87,11 +104,31 @@ bool NDArrayRing::hasNext()
   return true;
 }
 
+// Remove the oldest frame from the buffer, the caller takes over the reference
+NDArray *NDArrayRing::removeFromStart()
+{
+  NDArray *retVal = NULL;
+
+  if (count_ > 0){
+    retVal = buffers_[startIndex_];
+    buffers_[startIndex_] = NULL;
+    startIndex_ = (startIndex_ + 1) % noOfBuffers_;
+    count_--;
+    if (count_ == 0){
+      writeIndex_ = -1;
+      readIndex_  = -1;
+      startIndex_ = 0;
+    }
+  }
+  return retVal;
+}
+
 void NDArrayRing::clear()
 {
   writeIndex_ = -1;
   readIndex_  = -1;
-  wrapped_ = 0;
+  startIndex_ = 0;
+  count_ = 0;
   if (buffers_){
     for (int index = 0; index < noOfBuffers_; index++){
       if (buffers_[index]){
@@ -8,7 +8,9 @@ class NDArrayRing
   public:
 
     // Creates a ring with pointers to buffers.
-    NDArrayRing(int noOfBuffers);
+    // A growable ring doubles its size when it is full instead of overwriting the oldest buffer,
+    // for a caller that limits the ring some other way.
+    NDArrayRing(int noOfBuffers, bool growable = false);
 
     // Destructor.
     ~NDArrayRing();
@@ -28,6 +30,9 @@ class NDArrayRing
     // Does the ring have any other data
     bool hasNext();
 
+    // Remove the oldest buffer reference from the ring, returns NULL if the ring is empty
+    NDArray *removeFromStart();
+
     // Removes all the elements from the ring.
     void clear();
 
@@ -44,8 +49,17 @@ class NDArrayRing
     // Index to write a new NDArray pointer into the ring
     int  writeIndex_;
 
-    // Has the ring wrapped yet
-    int  wrapped_;
+    // Index of the oldest NDArray pointer in the ring
+    int  startIndex_;
+
+    // Number of NDArray pointers in the ring
+    int  count_;
+
+    // Whether the ring grows when it is full
+    bool growable_;
+
+    // Doubles the size of the ring, keeping the buffers in order
+    void grow();
 };
 
 #endif
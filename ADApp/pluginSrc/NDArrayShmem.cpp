@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsAtomic.h>
+
+#include "NDArrayShmem.h"
+#include "NDArrayDescriptor.h"
+
+#define SHMEM_MAGIC 0x4E44534D       /* "NDSM" */
+#define SHMEM_VERSION 1
+/* The counters, the descriptors and the data of each slot start on a new cache line */
+#define SHMEM_ALIGNMENT 64
+#define SHMEM_ALIGN(n, a) (((n) + (a) - 1) / (a) * (a))
+/* The receiver is disconnected if it has not updated the heartbeat for this many seconds */
+#define HEARTBEAT_TIMEOUT 2
+
+/* A counter on its own cache line, so that the sender and the receiver do not share the line they write */
+typedef struct {
+  size_t value;
+  char pad[SHMEM_ALIGNMENT - sizeof(size_t)];
+} NDArrayShmemCounter;
+
+/* Start of the segment.  It is followed by the ring of slot indices, the state of each slot and the slots. */
+struct NDArrayShmemHeader {
+  NDArrayShmemCounter head;        /* Written by the sender: number of slots published */
+  NDArrayShmemCounter tail;        /* Written by the receiver: number of slots taken from the ring */
+  epicsUInt32 magic;               /* Written last by the sender when the segment is ready */
+  epicsUInt32 version;
+  size_t headerBytes;              /* sizeof(NDArrayShmemHeader), so that 32 and 64 bit processes do not mix */
+  size_t segmentBytes;
+  int numSlots;
+  int closed;                      /* Set by the sender when it removes the segment */
+  size_t slotBytes;                /* Bytes of array data in each slot */
+  size_t descriptorBytes;          /* Bytes before the data of each slot for the description of the array */
+  size_t slotStride;
+  size_t firstSlotOffset;
+  size_t heartbeat;                /* Written by the receiver: seconds past the EPICS epoch, 0 when detached */
+};
+
+/* State of a slot.  A slot is free when neither process uses it. */
+struct NDArrayShmemSlot {
+  int sender;                      /* 1 while an array in the sending process uses the slot, only changed by the sender */
+  int receiver;                    /* 1 from publication until the receiver gives the slot back */
+  size_t sequence;                 /* Value of head when the slot was published */
+};
+
+
+/* POSIX shared memory object names start with a / */
+static std::string objectName(const std::string& name)
+{
+#ifdef _WIN32
+  return name;
+#else
+  return (name.empty() || name[0] != '/') ? "/" + name : name;
+#endif
+}
+
+NDArrayShmem::NDArrayShmem()
+  : pBase_(NULL), size_(0), owner_(false), pHeader_(NULL), pSlots_(NULL), pRing_(NULL)
+{
+#ifdef _WIN32
+  this->mappingHandle_ = NULL;
+#endif
+}
+
+NDArrayShmem::~NDArrayShmem()
+{
+  this->destroy();
+}
+
+/* Set the pointers to the parts of a mapped segment */
+void NDArrayShmem::map(void *pBase, size_t size)
+{
+  this->pBase_ = (char *)pBase;
+  this->size_ = size;
+  this->pHeader_ = (NDArrayShmemHeader *)pBase;
+  this->pRing_ = (int *)(this->pBase_ + SHMEM_ALIGN(sizeof(NDArrayShmemHeader), SHMEM_ALIGNMENT));
+  this->pSlots_ = (NDArrayShmemSlot *)SHMEM_ALIGN((size_t)(this->pRing_ + this->pHeader_->numSlots),
+                                                  sizeof(size_t));
+}
+
+/** Create the segment as the sending process.
+ * A segment with the same name left by an earlier sender is marked as closed and removed first,
+ * so that a receiver still attached to it attaches to the new one.
+ * \param[in] name - Name of the segment, shared by the sender and the receiver.
+ * \param[in] numSlots - Number of slots, the most arrays that can be in use at once by the two processes.
+ * \param[in] slotBytes - Bytes of array data in each slot.
+ * \param[out] errorMessage - Reason for a failure.
+ * \param[in] maxChars - Size of errorMessage.
+ */
+asynStatus NDArrayShmem::create(const char *name, int numSlots, size_t slotBytes, char *errorMessage, size_t maxChars)
+{
+  this->destroy();
+  if (!name || !name[0] || (numSlots < 1) || (slotBytes == 0)) {
+    epicsSnprintf(errorMessage, maxChars, "Shared memory segment needs a name, slots and a slot size");
+    return asynError;
+  }
+  this->name_ = objectName(name);
+
+  size_t ringOffset = SHMEM_ALIGN(sizeof(NDArrayShmemHeader), SHMEM_ALIGNMENT);
+  size_t slotsOffset = SHMEM_ALIGN(ringOffset + numSlots * sizeof(int), sizeof(size_t));
+  size_t firstSlotOffset = SHMEM_ALIGN(slotsOffset + numSlots * sizeof(NDArrayShmemSlot), SHMEM_ALIGNMENT);
+  size_t slotStride = NDARRAY_SHMEM_DESCRIPTOR_BYTES + SHMEM_ALIGN(slotBytes, SHMEM_ALIGNMENT);
+  size_t size = firstSlotOffset + numSlots * slotStride;
+  void *pBase;
+
+#ifdef _WIN32
+  this->mappingHandle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                            (DWORD)((unsigned long long)size >> 32),
+                                            (DWORD)(size & 0xFFFFFFFF), this->name_.c_str());
+  if (this->mappingHandle_ && (GetLastError() == ERROR_ALREADY_EXISTS)) {
+    // Another sender still has the segment, it cannot be replaced on Windows
+    epicsSnprintf(errorMessage, maxChars, "Shared memory segment %s is in use", this->name_.c_str());
+    this->destroy();
+    return asynError;
+  }
+  pBase = this->mappingHandle_ ? MapViewOfFile(this->mappingHandle_, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+  if (pBase == NULL) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot create shared memory segment %s of %lu bytes, error=%lu",
+                  this->name_.c_str(), (unsigned long)size, (unsigned long)GetLastError());
+    this->destroy();
+    return asynError;
+  }
+#else
+  int fd = shm_open(this->name_.c_str(), O_RDWR, 0);
+  if (fd >= 0) {
+    struct stat info;
+    if ((fstat(fd, &info) == 0) && ((size_t)info.st_size >= sizeof(NDArrayShmemHeader))) {
+      void *pOld = mmap(NULL, sizeof(NDArrayShmemHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (pOld != MAP_FAILED) {
+        epicsAtomicSetIntT(&((NDArrayShmemHeader *)pOld)->closed, 1);
+        munmap(pOld, sizeof(NDArrayShmemHeader));
+      }
+    }
+    close(fd);
+    shm_unlink(this->name_.c_str());
+  }
+  // The receiving IOC may run as another user of the same group
+  fd = shm_open(this->name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+  if (fd < 0) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot create shared memory segment %s, error=%s",
+                  this->name_.c_str(), strerror(errno));
+    return asynError;
+  }
+  if (ftruncate(fd, (off_t)size) != 0) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot size shared memory segment %s to %lu bytes, error=%s",
+                  this->name_.c_str(), (unsigned long)size, strerror(errno));
+    close(fd);
+    shm_unlink(this->name_.c_str());
+    return asynError;
+  }
+  pBase = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pBase == MAP_FAILED) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot map shared memory segment %s of %lu bytes, error=%s",
+                  this->name_.c_str(), (unsigned long)size, strerror(errno));
+    shm_unlink(this->name_.c_str());
+    return asynError;
+  }
+#endif
+  this->owner_ = true;
+
+  // A new segment is filled with zeros, so the ring is empty and every slot is free
+  NDArrayShmemHeader *pHeader = (NDArrayShmemHeader *)pBase;
+  pHeader->version = SHMEM_VERSION;
+  pHeader->headerBytes = sizeof(NDArrayShmemHeader);
+  pHeader->segmentBytes = size;
+  pHeader->numSlots = numSlots;
+  pHeader->slotBytes = slotBytes;
+  pHeader->descriptorBytes = NDARRAY_SHMEM_DESCRIPTOR_BYTES;
+  pHeader->slotStride = slotStride;
+  pHeader->firstSlotOffset = firstSlotOffset;
+  this->map(pBase, size);
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetIntT((int *)&pHeader->magic, SHMEM_MAGIC);
+  return asynSuccess;
+}
+
+/** Attach to the segment created by the sending process, as the receiving process.
+ * The slots still held by an earlier receiver are given back, and the arrays it did not take are skipped.
+ * \param[in] name - Name of the segment.
+ * \param[out] errorMessage - Reason for a failure.
+ * \param[in] maxChars - Size of errorMessage.
+ */
+asynStatus NDArrayShmem::attach(const char *name, char *errorMessage, size_t maxChars)
+{
+  void *pBase;
+  size_t size;
+
+  this->destroy();
+  if (!name || !name[0]) {
+    epicsSnprintf(errorMessage, maxChars, "Shared memory segment needs a name");
+    return asynError;
+  }
+  this->name_ = objectName(name);
+
+#ifdef _WIN32
+  this->mappingHandle_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, this->name_.c_str());
+  pBase = this->mappingHandle_ ? MapViewOfFile(this->mappingHandle_, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+  if (pBase == NULL) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot open shared memory segment %s, error=%lu",
+                  this->name_.c_str(), (unsigned long)GetLastError());
+    this->destroy();
+    return asynError;
+  }
+  MEMORY_BASIC_INFORMATION info;
+  VirtualQuery(pBase, &info, sizeof(info));
+  size = info.RegionSize;
+#else
+  struct stat info;
+  int fd = shm_open(this->name_.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot open shared memory segment %s, error=%s",
+                  this->name_.c_str(), strerror(errno));
+    return asynError;
+  }
+  if (fstat(fd, &info) != 0) info.st_size = 0;
+  size = (size_t)info.st_size;
+  pBase = (size >= sizeof(NDArrayShmemHeader)) ?
+    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (pBase == MAP_FAILED) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot map shared memory segment %s", this->name_.c_str());
+    return asynError;
+  }
+#endif
+
+  NDArrayShmemHeader *pHeader = (NDArrayShmemHeader *)pBase;
+  const char *problem = NULL;
+  if ((epicsUInt32)epicsAtomicGetIntT((int *)&pHeader->magic) != SHMEM_MAGIC)
+    problem = "is not ready";
+  else if ((pHeader->version != SHMEM_VERSION) || (pHeader->headerBytes != sizeof(NDArrayShmemHeader)))
+    problem = "has a different version";
+  else if (pHeader->segmentBytes > size)
+    problem = "is smaller than its header says";
+  else if (epicsAtomicGetIntT(&pHeader->closed))
+    problem = "has been closed";
+  if (problem) {
+    epicsSnprintf(errorMessage, maxChars, "Shared memory segment %s %s", this->name_.c_str(), problem);
+#ifdef _WIN32
+    UnmapViewOfFile(pBase);
+#else
+    munmap(pBase, size);
+#endif
+    this->destroy();
+    return asynError;
+  }
+  epicsAtomicReadMemoryBarrier();
+  this->owner_ = false;
+  this->map(pBase, size);
+
+  // A slot published before head was read belongs to an earlier receiver, or is an array that is skipped.
+  // The sender writes the sequence before setting the receiver flag, so a slot it publishes now is kept.
+  size_t head = epicsAtomicGetSizeT(&pHeader->head.value);
+  epicsAtomicReadMemoryBarrier();
+  for (int i=0; i<pHeader->numSlots; i++) {
+    NDArrayShmemSlot *pSlot = &this->pSlots_[i];
+    if (epicsAtomicGetIntT(&pSlot->receiver)) {
+      epicsAtomicReadMemoryBarrier();
+      if ((ptrdiff_t)(head - pSlot->sequence) > 0)
+        epicsAtomicSetIntT(&pSlot->receiver, 0);
+    }
+  }
+  epicsAtomicSetSizeT(&pHeader->tail.value, head);
+  this->heartbeat();
+  return asynSuccess;
+}
+
+/** Unmap the segment.  The sending process marks it as closed and removes it;
+ * the receiving process tells the sender that it is no longer connected.
+ * A receiver must not call this while arrays using the data of its slots are in use. */
+void NDArrayShmem::destroy()
+{
+  if (this->pBase_) {
+    if (this->owner_)
+      epicsAtomicSetIntT(&this->pHeader_->closed, 1);
+    else
+      epicsAtomicSetSizeT(&this->pHeader_->heartbeat, 0);
+#ifdef _WIN32
+    UnmapViewOfFile(this->pBase_);
+#else
+    munmap(this->pBase_, this->size_);
+    if (this->owner_) shm_unlink(this->name_.c_str());
+#endif
+  }
+#ifdef _WIN32
+  if (this->mappingHandle_) CloseHandle(this->mappingHandle_);
+  this->mappingHandle_ = NULL;
+#endif
+  this->pBase_ = NULL;
+  this->size_ = 0;
+  this->owner_ = false;
+  this->pHeader_ = NULL;
+  this->pSlots_ = NULL;
+  this->pRing_ = NULL;
+}
+
+/** Return true if the segment is mapped. */
+bool NDArrayShmem::isMapped()
+{
+  return this->pBase_ != NULL;
+}
+
+/** Return true if the sender has removed the segment, so the receiver should attach again. */
+bool NDArrayShmem::isClosed()
+{
+  return this->pBase_ && epicsAtomicGetIntT(&this->pHeader_->closed);
+}
+
+/** Return the name of the shared memory object. */
+const char *NDArrayShmem::name()
+{
+  return this->name_.c_str();
+}
+
+/** Return the number of slots, 0 if the segment is not mapped. */
+int NDArrayShmem::numSlots()
+{
+  return this->pBase_ ? this->pHeader_->numSlots : 0;
+}
+
+/** Return the bytes of array data in each slot, 0 if the segment is not mapped. */
+size_t NDArrayShmem::slotBytes()
+{
+  return this->pBase_ ? this->pHeader_->slotBytes : 0;
+}
+
+/** Return the number of slots that neither process is using. */
+int NDArrayShmem::numFreeSlots()
+{
+  int numFree = 0;
+
+  for (int i=0; i<this->numSlots(); i++) {
+    if (!epicsAtomicGetIntT(&this->pSlots_[i].sender) && !epicsAtomicGetIntT(&this->pSlots_[i].receiver))
+      numFree++;
+  }
+  return numFree;
+}
+
+char *NDArrayShmem::slotData(int slot)
+{
+  return this->pBase_ + this->pHeader_->firstSlotOffset + slot * this->pHeader_->slotStride +
+         this->pHeader_->descriptorBytes;
+}
+
+/** Return the slot whose data starts at pData, or -1 if pData is not the data of a slot. */
+int NDArrayShmem::slotIndex(const void *pData)
+{
+  if (!this->pBase_ || ((const char *)pData < this->slotData(0))) return -1;
+  size_t offset = (const char *)pData - this->slotData(0);
+  if (offset % this->pHeader_->slotStride) return -1;
+  size_t slot = offset / this->pHeader_->slotStride;
+  return (slot < (size_t)this->pHeader_->numSlots) ? (int)slot : -1;
+}
+
+/** Take a free slot for the data of an array in the sending process.
+ * \param[in] size - Bytes of data needed.
+ * \return The data of the slot, or NULL if size is larger than a slot or no slot is free.
+ */
+void *NDArrayShmem::claimSlot(size_t size)
+{
+  if (!this->pBase_ || (size > this->pHeader_->slotBytes)) return NULL;
+  for (int i=0; i<this->pHeader_->numSlots; i++) {
+    NDArrayShmemSlot *pSlot = &this->pSlots_[i];
+    if (!epicsAtomicGetIntT(&pSlot->receiver) && (epicsAtomicCmpAndSwapIntT(&pSlot->sender, 0, 1) == 0)) {
+      epicsAtomicReadMemoryBarrier();
+      return this->slotData(i);
+    }
+  }
+  return NULL;
+}
+
+/** Give back a slot taken with claimSlot() when the sending process has finished with the array.
+ * The slot stays in use until the receiver has also given it back if it was published. */
+void NDArrayShmem::releaseSlot(void *pData)
+{
+  int slot = this->slotIndex(pData);
+
+  if (slot < 0) return;
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetIntT(&this->pSlots_[slot].sender, 0);
+}
+
+/** Return true if a receiver is attached and has updated its heartbeat recently. */
+bool NDArrayShmem::receiverConnected()
+{
+  epicsTimeStamp now;
+
+  if (!this->pBase_) return false;
+  size_t heartbeat = epicsAtomicGetSizeT(&this->pHeader_->heartbeat);
+  if (heartbeat == 0) return false;
+  epicsTimeGetCurrent(&now);
+  return ((size_t)now.secPastEpoch >= heartbeat) ? (now.secPastEpoch - heartbeat <= HEARTBEAT_TIMEOUT) :
+                                                   (heartbeat - now.secPastEpoch <= HEARTBEAT_TIMEOUT);
+}
+
+/** Describe an array whose data is in a slot, and put the slot on the ring for the receiver.
+ * Only the data of the array is in the slot, so only its description is written here.
+ * \param[in] pArray - The array, whose data must have come from claimSlot().
+ * \return asynError if the data is not in a free slot or the attributes do not fit in the descriptor.
+ */
+asynStatus NDArrayShmem::publish(NDArray *pArray)
+{
+  int slot = this->slotIndex(pArray->pData);
+  if (slot < 0) return asynError;
+  NDArrayShmemSlot *pSlot = &this->pSlots_[slot];
+  if (epicsAtomicGetIntT(&pSlot->receiver)) return asynError;
+
+  /* Each slot has the schema of the attributes, because a receiver may attach at any time.
+   * The codec only builds the schema again when the attributes change, and the receiver
+   * only parses it when it changes.  The array is described by an NDArrayDescriptor_t
+   * before the data of the slot. */
+  if (this->attributeCodec_.encode(pArray->pAttributeList, this->attributeBuffer_, true)) return asynError;
+  if (NDArrayDescriptorBytes(pArray, this->attributeBuffer_.size()) > this->pHeader_->descriptorBytes) return asynError;
+
+  NDArrayDescriptor_t *pDescriptor = (NDArrayDescriptor_t *)(this->slotData(slot) - this->pHeader_->descriptorBytes);
+  NDArrayDescriptorWrite(pArray, this->attributeBuffer_, pDescriptor);
+
+  /* The ring holds every slot at most once, so it cannot be full */
+  size_t head = this->pHeader_->head.value;
+  pSlot->sequence = head;
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetIntT(&pSlot->receiver, 1);
+  this->pRing_[head % this->pHeader_->numSlots] = slot;
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&this->pHeader_->head.value, head + 1);
+  return asynSuccess;
+}
+
+/** Tell the sender that the receiver is still attached.  The receiver calls this at least once a second. */
+void NDArrayShmem::heartbeat()
+{
+  epicsTimeStamp now;
+
+  if (!this->pBase_) return;
+  epicsTimeGetCurrent(&now);
+  epicsAtomicSetSizeT(&this->pHeader_->heartbeat, now.secPastEpoch ? now.secPastEpoch : 1);
+}
+
+/** Take the next published array from the ring.
+ * If pPool is an NDArrayShmemPool for this segment the array uses the data in the slot, which is given
+ * back when the array is released.  Otherwise the data is copied into an array from pPool and the slot
+ * is given back at once.
+ * \param[in] pPool - Pool to allocate the array from.
+ * \param[out] ppArray - The array, NULL unless asynSuccess is returned.
+ * \return asynTimeout if no array has been published, asynError if the pool could not allocate the array
+ *         or the attributes could not be decoded.
+ */
+asynStatus NDArrayShmem::receive(NDArrayPool *pPool, NDArray **ppArray)
+{
+  size_t dims[ND_ARRAY_MAX_DIMS];
+  NDArray *pArray;
+
+  *ppArray = NULL;
+  if (!this->pBase_) return asynDisconnected;
+  size_t tail = this->pHeader_->tail.value;
+  if (epicsAtomicGetSizeT(&this->pHeader_->head.value) == tail) return asynTimeout;
+  epicsAtomicReadMemoryBarrier();
+  int slot = this->pRing_[tail % this->pHeader_->numSlots];
+  epicsAtomicSetSizeT(&this->pHeader_->tail.value, tail + 1);
+  if ((slot < 0) || (slot >= this->pHeader_->numSlots)) return asynError;
+
+  char *pData = this->slotData(slot);
+  NDArrayDescriptor_t *pDescriptor = (NDArrayDescriptor_t *)(pData - this->pHeader_->descriptorBytes);
+  for (int i=0; i<pDescriptor->ndims; i++) dims[i] = pDescriptor->dims[i].size;
+  NDArrayShmemPool *pShmemPool = dynamic_cast<NDArrayShmemPool *>(pPool);
+  if (pShmemPool && (pShmemPool->getShmem() == this)) {
+    pArray = pPool->alloc(pDescriptor->ndims, dims, pDescriptor->dataType, this->pHeader_->slotBytes, pData);
+  } else {
+    bool compressed = (codecName[NDCODEC_NONE] != pDescriptor->codecName);
+    pArray = pPool->alloc(pDescriptor->ndims, dims, pDescriptor->dataType,
+                          compressed ? pDescriptor->dataBytes : 0, NULL);
+    if (pArray) memcpy(pArray->pData, pData, pDescriptor->dataBytes);
+  }
+  if (pArray == NULL) {
+    this->releaseReceived(pData);
+    return asynError;
+  }
+
+  const char *pIn = NDArrayDescriptorRead(pDescriptor, pArray);
+
+  /* An array reused from the pool usually still has the attributes of an earlier array with the same schema,
+   * in which case the codec only sets their values */
+  int attributeStatus = this->attributeCodec_.decode(pIn, pDescriptor->attributeBytes, pArray->pAttributeList);
+
+  if (!pShmemPool || (pShmemPool->getShmem() != this)) this->releaseReceived(pData);
+  if (attributeStatus) {
+    pArray->release();
+    return asynError;
+  }
+  *ppArray = pArray;
+  return asynSuccess;
+}
+
+/** Give a received slot back to the sender when the receiving process has finished with the array. */
+void NDArrayShmem::releaseReceived(void *pData)
+{
+  int slot = this->slotIndex(pData);
+
+  if (slot < 0) return;
+  // The reads of the data must be complete before the sender can reuse the slot
+  epicsAtomicReadMemoryBarrier();
+  epicsAtomicSetIntT(&this->pSlots_[slot].receiver, 0);
+}
+
+/** Constructor for NDArrayShmemPool.
+ * \param[in] pDriver - The driver that owns the pool.
+ * \param[in] pShmem - The segment, which must stay mapped while the arrays of the pool are in use.
+ * \param[in] receiver - The pool is in the receiving process; otherwise it allocates data from free slots.
+ */
+NDArrayShmemPool::NDArrayShmemPool(asynNDArrayDriver *pDriver, NDArrayShmem *pShmem, bool receiver)
+  : NDArrayPool(pDriver, 0), pShmem_(pShmem), receiver_(receiver)
+{
+}
+
+/** Return the segment of this pool. */
+NDArrayShmem *NDArrayShmemPool::getShmem()
+{
+  return this->pShmem_;
+}
+
+/** Allocate the data of an array from a free slot of the segment in the sending process. */
+void *NDArrayShmemPool::frameMalloc(size_t size)
+{
+  if (this->receiver_) return NDArrayPool::frameMalloc(size);
+  return this->pShmem_->claimSlot(size);
+}
+
+/** A slot of the segment holds exactly the size that was claimed. */
+size_t NDArrayShmemPool::frameSize(size_t size)
+{
+  if (this->receiver_) return NDArrayPool::frameSize(size);
+  return size;
+}
+
+/** Give a slot back to the segment, or free memory that is not in the segment. */
+void NDArrayShmemPool::frameFree(void *ptr)
+{
+  if (this->pShmem_->slotIndex(ptr) < 0)
+    NDArrayPool::frameFree(ptr);
+  else if (this->receiver_)
+    this->pShmem_->releaseReceived(ptr);
+  else
+    this->pShmem_->releaseSlot(ptr);
+}
+
+/** Give the slot of an array back to the segment as soon as the last reference is released,
+ * rather than keeping it for the next array from the pool while the other process may still use it. */
+void NDArrayShmemPool::onReleaseArray(NDArray *pArray)
+{
+  if ((pArray->getReferenceCount() == 0) && pArray->pData && (this->pShmem_->slotIndex(pArray->pData) >= 0)) {
+    this->frameFree(pArray->pData);
+    pArray->pData = NULL;
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef NDArrayShmem_H
+#define NDArrayShmem_H
+
+#include <string>
+
+#include <asynDriver.h>
+#include <NDPluginAPI.h>
+#include "NDArray.h"
+#include "NDAttributeCodec.h"
+
+/** Bytes reserved in each slot for the description of an array: its dimensions, time stamps, codec and attributes */
+#define NDARRAY_SHMEM_DESCRIPTOR_BYTES (128*1024)
+
+/** A named shared memory segment that passes NDArrays from one process on a host to another.
+  * The segment is divided into a fixed number of slots, each holding the data of one array and its description.
+  * The sending process creates the segment, fills a slot and publishes it by putting the slot index on a
+  * single producer, single consumer ring in the segment. The receiving process attaches to the segment,
+  * takes slot indices from the ring and gives each slot back when it has finished with the array.
+  * Neither side takes a lock: each field of the segment is only changed by one of the two processes.
+  */
+class NDPLUGIN_API NDArrayShmem
+{
+  public:
+    NDArrayShmem();
+    ~NDArrayShmem();
+
+    asynStatus create(const char *name, int numSlots, size_t slotBytes, char *errorMessage, size_t maxChars);
+    asynStatus attach(const char *name, char *errorMessage, size_t maxChars);
+    void destroy();
+    bool isMapped();
+    bool isClosed();
+    const char *name();
+    int numSlots();
+    size_t slotBytes();
+    int numFreeSlots();
+
+    /* Used by the sending process */
+    void *claimSlot(size_t size);
+    void releaseSlot(void *pData);
+    int slotIndex(const void *pData);
+    bool receiverConnected();
+    asynStatus publish(NDArray *pArray);
+
+    /* Used by the receiving process */
+    void heartbeat();
+    asynStatus receive(NDArrayPool *pPool, NDArray **ppArray);
+    void releaseReceived(void *pData);
+
+  private:
+    void map(void *pBase, size_t size);
+    char *slotData(int slot);
+
+    char *pBase_;                    // Start of the mapped segment, NULL if there is none
+    size_t size_;                    // Size of the mapped segment in bytes
+    std::string name_;
+    bool owner_;                     // This process created the segment
+    struct NDArrayShmemHeader *pHeader_;
+    struct NDArrayShmemSlot *pSlots_;
+    int *pRing_;
+    NDAttributeCodec attributeCodec_;  // Encodes the attributes when sending, decodes them when receiving
+    std::vector<char> attributeBuffer_;
+#ifdef _WIN32
+    void *mappingHandle_;
+#endif
+};
+
+/** NDArrayPool whose arrays use the slots of an NDArrayShmem segment for their data.
+  * In the sending process the pool allocates the data of each array from a free slot, so that a driver
+  * using the pool produces arrays that NDPluginShmem publishes without copying them.
+  * In the receiving process the pool holds the arrays that use the data of the slots received.
+  * In both cases the slot is given back to the segment when the reference count of the array reaches 0.
+  */
+class NDPLUGIN_API NDArrayShmemPool : public NDArrayPool
+{
+  public:
+    NDArrayShmemPool(class asynNDArrayDriver *pDriver, NDArrayShmem *pShmem, bool receiver);
+    NDArrayShmem *getShmem();
+    virtual void *frameMalloc(size_t size);
+    virtual void frameFree(void *ptr);
+    virtual size_t frameSize(size_t size);
+
+  protected:
+    virtual void onReleaseArray(NDArray *pArray);
+
+  private:
+    NDArrayShmem *pShmem_;
+    bool receiver_;
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * NDCodecBlockPool.cpp
+ *
+ * Worker threads that compress and decompress the blocks of a frame in parallel
+ */
+
+#include <epicsThread.h>
+#include <epicsStdio.h>
+
+#include "NDCodecBlockPool.h"
+
+// Maximum number of block jobs that can be waiting for a worker thread
+#define MAX_BLOCK_JOBS 256
+
+NDCodecBlockPool *NDCodecBlockPool::pInstance_ = NULL;
+
+NDCodecBlockPool::NDCodecBlockPool()
+    : jobQueue_(MAX_BLOCK_JOBS, sizeof(codecBlockJob*)), numWorkers_(0)
+{
+    lock_ = epicsMutexMustCreate();
+}
+
+void NDCodecBlockPool::createInstance(void *)
+{
+    pInstance_ = new NDCodecBlockPool();
+}
+
+/** Returns the pool, creating it the first time. */
+NDCodecBlockPool *NDCodecBlockPool::getInstance()
+{
+    static epicsThreadOnceId onceId = EPICS_THREAD_ONCE_INIT;
+
+    epicsThreadOnce(&onceId, createInstance, NULL);
+    return pInstance_;
+}
+
+void NDCodecBlockPool::workerTask(void *drvPvt)
+{
+    NDCodecBlockPool *pPool = (NDCodecBlockPool *)drvPvt;
+    pPool->worker();
+}
+
+void NDCodecBlockPool::addWorkers(int numWorkers)
+{
+    char taskName[32];
+
+    epicsMutexLock(lock_);
+    while (numWorkers_ < numWorkers) {
+        epicsSnprintf(taskName, sizeof(taskName)-1, "NDCodecBlock_%d", numWorkers_);
+        epicsThreadId threadId = epicsThreadCreate(taskName, epicsThreadPriorityMedium,
+                                                   epicsThreadGetStackSize(epicsThreadStackMedium),
+                                                   (EPICSTHREADFUNC)workerTask, this);
+        if (!threadId) break;
+        numWorkers_++;
+    }
+    epicsMutexUnlock(lock_);
+}
+
+void NDCodecBlockPool::processBlocks(codecBlockJob *pJob)
+{
+    size_t block;
+
+    epicsMutexLock(pJob->lock);
+    while (pJob->nextBlock < pJob->nBlocks) {
+        block = pJob->nextBlock++;
+        epicsMutexUnlock(pJob->lock);
+        pJob->blockFunc(pJob, block);
+        epicsMutexLock(pJob->lock);
+        if (++pJob->blocksDone == pJob->nBlocks) epicsEventSignal(pJob->done);
+    }
+    epicsMutexUnlock(pJob->lock);
+}
+
+/* Drops the reference of a thread to a job, the last thread deletes it */
+void NDCodecBlockPool::releaseJob(codecBlockJob *pJob)
+{
+    int refCount;
+
+    epicsMutexLock(pJob->lock);
+    refCount = --pJob->refCount;
+    epicsMutexUnlock(pJob->lock);
+    if (refCount > 0) return;
+    epicsEventDestroy(pJob->done);
+    epicsMutexDestroy(pJob->lock);
+    delete pJob;
+}
+
+void NDCodecBlockPool::worker()
+{
+    codecBlockJob *pJob;
+
+    while (1) {
+        jobQueue_.receive(&pJob, sizeof(pJob));
+        // A worker that gets the job after the last block was taken has nothing to do
+        processBlocks(pJob);
+        releaseJob(pJob);
+    }
+}
+
+/** Processes all of the blocks of a job using up to numThreads threads, including the calling thread.
+  * Returns as soon as the last block has been processed, without waiting for workers that are still
+  * busy with other jobs and have not taken the job from the queue yet.  The workers use their own copy
+  * of the job, so pJob can go out of scope when this returns.
+  * Returns false if any of the blocks failed.
+  */
+bool NDCodecBlockPool::run(codecBlockJob *pJob, int numThreads)
+{
+    int nHelpers = numThreads - 1;
+    bool failed;
+
+    if (pJob->nBlocks == 0) return true;
+    if ((size_t)nHelpers > pJob->nBlocks - 1) nHelpers = (int)pJob->nBlocks - 1;
+    if (nHelpers < 0) nHelpers = 0;
+    if (nHelpers > 0) addWorkers(nHelpers);
+    epicsMutexLock(lock_);
+    if (nHelpers > numWorkers_) nHelpers = numWorkers_;
+    epicsMutexUnlock(lock_);
+
+    codecBlockJob *pShared = new codecBlockJob(*pJob);
+    pShared->nextBlock = 0;
+    pShared->blocksDone = 0;
+    pShared->refCount = nHelpers + 1;
+    pShared->failed = false;
+    pShared->lock = epicsMutexMustCreate();
+    pShared->done = epicsEventMustCreate(epicsEventEmpty);
+
+    for (int i=0; i<nHelpers; i++) {
+        jobQueue_.send(&pShared, sizeof(pShared));
+    }
+    processBlocks(pShared);
+    epicsEventMustWait(pShared->done);
+    epicsMutexLock(pShared->lock);
+    failed = pShared->failed;
+    epicsMutexUnlock(pShared->lock);
+    releaseJob(pShared);
+
+    pJob->failed = failed;
+    return !failed;
+}
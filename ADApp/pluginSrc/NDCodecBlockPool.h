@@ -0,0 +1,64 @@
+#ifndef NDCodecBlockPool_H
+#define NDCodecBlockPool_H
+
+#include <stddef.h>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+
+#include <NDPluginAPI.h>
+
+/** A frame that is compressed or decompressed as independent blocks.
+  * The blocks are processed by the thread that submitted the job and by up to
+  * numThreads-1 worker threads of NDCodecBlockPool, each taking the next
+  * unprocessed block until there are none left.
+  * The caller fills in the fields down to nBlocks; the others are set by NDCodecBlockPool::run().
+  */
+typedef struct codecBlockJob {
+    void (*blockFunc)(struct codecBlockJob *pJob, size_t block);
+    const char *pIn;        /**< Input data */
+    char *pOut;             /**< Output data */
+    size_t totalBytes;      /**< Uncompressed size of the frame */
+    size_t blockSize;       /**< Uncompressed bytes per block */
+    size_t slotSize;        /**< Space reserved in pOut for each compressed block */
+    size_t elemSize;        /**< Bytes per element */
+    size_t bshufBlock;      /**< Bitshuffle block size in elements */
+    int compressor;         /**< NDCODEC_BSLZ4 or NDCODEC_BSZSTD for the bitshuffle block functions */
+    int clevel;             /**< Compression level for compressors that have one */
+    const size_t *pOffsets; /**< Offset of each compressed block in pIn when decompressing */
+    const size_t *pSizes;   /**< Size of each compressed block in pIn when decompressing */
+    size_t *pCompSizes;     /**< Compressed size of each block in pOut when compressing */
+    size_t nBlocks;
+    size_t nextBlock;       /**< Next block to be taken by a thread */
+    size_t blocksDone;      /**< Number of blocks that have been processed */
+    int refCount;           /**< Number of threads that still hold the job */
+    bool failed;
+    epicsMutexId lock;
+    epicsEventId done;      /**< Signalled when the last block has been processed */
+} codecBlockJob;
+
+/** Pool of worker threads shared by all NDPluginCodec instances.
+  * Threads are created on demand, up to the largest number requested so far.
+  */
+class NDPLUGIN_API NDCodecBlockPool {
+public:
+    static NDCodecBlockPool *getInstance();
+    bool run(codecBlockJob *pJob, int numThreads);
+
+private:
+    NDCodecBlockPool();
+    static void createInstance(void *);
+    static void workerTask(void *drvPvt);
+    static void processBlocks(codecBlockJob *pJob);
+    static void releaseJob(codecBlockJob *pJob);
+    void worker();
+    void addWorkers(int numWorkers);
+
+    static NDCodecBlockPool *pInstance_;
+    epicsMessageQueue jobQueue_;
+    epicsMutexId lock_;
+    int numWorkers_;
+};
+
+#endif
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+
+#ifndef HAVE_FILE_MAPPING
+/* The arena cannot be created on this OS */
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <epicsStdio.h>
+
+#include "NDFileCaptureArena.h"
+#include "NDArrayDescriptor.h"
+
+/* Each array starts on a new cache line, so that its data is as well aligned as in an NDArrayPool buffer */
+#define ARENA_ALIGNMENT 64
+#define ARENA_ALIGN(n, a) (((n) + (a) - 1) / (a) * (a))
+/* Value of schemaOffset_ and decodedSchemaOffset_ when no record has a schema */
+#define NO_SCHEMA ((size_t)-1)
+
+/* Header of an array in the arena.  The description of the array is followed by the codec block offsets,
+ * the attributes encoded by NDAttributeCodec and, from dataOffset, the array data.
+ * The schema of the attributes is only in the first record that has it. */
+typedef struct {
+    size_t recordBytes;              /* Bytes used by the array in the arena */
+    size_t dataOffset;               /* Offset of the data from the start of the header */
+    size_t schemaOffset;             /* Offset in the arena of the record with the schema of the attributes */
+    NDArrayDescriptor_t array;       /* Must be last, the block offsets follow it */
+} NDFileCaptureArenaRecord;
+
+NDFileCaptureArena::NDFileCaptureArena()
+  : pBase_(NULL), capacity_(0), used_(0), schemaOffset_(NO_SCHEMA), decodedSchemaOffset_(NO_SCHEMA)
+{
+#ifdef _WIN32
+  this->fileHandle_ = INVALID_HANDLE_VALUE;
+  this->mappingHandle_ = NULL;
+#else
+  this->fd_ = -1;
+#endif
+}
+
+NDFileCaptureArena::~NDFileCaptureArena()
+{
+  this->destroy();
+}
+
+/** Map the region that the arrays are captured into.
+ * \param[in] capacity - Size of the region in bytes.
+ * \param[in] fileName - Scratch file to map, or an empty string for anonymous memory.
+ *            The file is created sparse and is removed when the region is unmapped.
+ * \param[out] errorMessage - Reason for a failure.
+ * \param[in] maxChars - Size of errorMessage.
+ */
+asynStatus NDFileCaptureArena::create(size_t capacity, const char *fileName, char *errorMessage, size_t maxChars)
+{
+  this->destroy();
+  if (capacity == 0) {
+    epicsSnprintf(errorMessage, maxChars, "Capture arena size must be greater than 0");
+    return asynError;
+  }
+  this->fileName_ = fileName ? fileName : "";
+#ifndef HAVE_FILE_MAPPING
+  epicsSnprintf(errorMessage, maxChars, "Capture arena is not supported on this OS");
+  return asynError;
+#elif defined(_WIN32)
+  if (this->fileName_.empty()) {
+    // Pages are only given physical memory when they are first written
+    this->pBase_ = (char *)VirtualAlloc(NULL, capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  } else {
+    DWORD bytesReturned;
+    this->fileHandle_ = CreateFileA(this->fileName_.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                    FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (this->fileHandle_ == INVALID_HANDLE_VALUE) {
+      epicsSnprintf(errorMessage, maxChars, "Cannot create capture arena file %s", this->fileName_.c_str());
+      return asynError;
+    }
+    DeviceIoControl(this->fileHandle_, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytesReturned, NULL);
+    this->mappingHandle_ = CreateFileMappingA(this->fileHandle_, NULL, PAGE_READWRITE,
+                                              (DWORD)((unsigned long long)capacity >> 32),
+                                              (DWORD)(capacity & 0xFFFFFFFF), NULL);
+    if (this->mappingHandle_)
+      this->pBase_ = (char *)MapViewOfFile(this->mappingHandle_, FILE_MAP_ALL_ACCESS, 0, 0, capacity);
+  }
+  if (this->pBase_ == NULL) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot map capture arena of %lu bytes, error=%lu",
+                  (unsigned long)capacity, (unsigned long)GetLastError());
+    this->destroy();
+    return asynError;
+  }
+#else
+  void *pBase;
+  if (this->fileName_.empty()) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    // Pages are only given physical memory when they are first written
+    flags |= MAP_NORESERVE;
+#endif
+    pBase = mmap(NULL, capacity, PROT_READ | PROT_WRITE, flags, -1, 0);
+  } else {
+    int fd = open(this->fileName_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+      epicsSnprintf(errorMessage, maxChars, "Cannot create capture arena file %s, error=%s",
+                    this->fileName_.c_str(), strerror(errno));
+      return asynError;
+    }
+    // Extending the file with ftruncate leaves it sparse, blocks are allocated as arrays are captured
+    if (ftruncate(fd, (off_t)capacity) != 0) {
+      epicsSnprintf(errorMessage, maxChars, "Cannot size capture arena file %s, error=%s",
+                    this->fileName_.c_str(), strerror(errno));
+      close(fd);
+      unlink(this->fileName_.c_str());
+      return asynError;
+    }
+    pBase = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the file until it is unmapped, nothing is left behind if the IOC exits.
+    // The file stays open so that clear() can free its blocks.
+    unlink(this->fileName_.c_str());
+    if (pBase == MAP_FAILED) close(fd);
+    else this->fd_ = fd;
+  }
+  if (pBase == MAP_FAILED) {
+    epicsSnprintf(errorMessage, maxChars, "Cannot map capture arena of %lu bytes, error=%s",
+                  (unsigned long)capacity, strerror(errno));
+    return asynError;
+  }
+  this->pBase_ = (char *)pBase;
+#endif
+  this->capacity_ = capacity;
+  this->used_ = 0;
+  this->offsets_.clear();
+  this->forgetSchema();
+  return asynSuccess;
+}
+
+/** Unmap the region, discarding any captured arrays. */
+void NDFileCaptureArena::destroy()
+{
+#ifdef _WIN32
+  if (this->pBase_) {
+    if (this->fileName_.empty())
+      VirtualFree(this->pBase_, 0, MEM_RELEASE);
+    else
+      UnmapViewOfFile(this->pBase_);
+  }
+  if (this->mappingHandle_) CloseHandle(this->mappingHandle_);
+  if (this->fileHandle_ != INVALID_HANDLE_VALUE) CloseHandle(this->fileHandle_);
+  this->mappingHandle_ = NULL;
+  this->fileHandle_ = INVALID_HANDLE_VALUE;
+#elif defined(HAVE_FILE_MAPPING)
+  if (this->pBase_) munmap(this->pBase_, this->capacity_);
+  if (this->fd_ >= 0) close(this->fd_);
+  this->fd_ = -1;
+#endif
+  this->pBase_ = NULL;
+  this->capacity_ = 0;
+  this->used_ = 0;
+  this->offsets_.clear();
+  this->forgetSchema();
+}
+
+/** Return true if the region is mapped with this size and file, so it can be used for the next capture. */
+bool NDFileCaptureArena::matches(size_t capacity, const char *fileName)
+{
+  return this->pBase_ && (this->capacity_ == capacity) && (this->fileName_ == (fileName ? fileName : ""));
+}
+
+/** Copy an array into the region.  The caller can release the array as soon as this returns.
+ * \param[in] pArray - The array to capture.
+ * \return asynError if the array does not fit in the space that is left.
+ */
+asynStatus NDFileCaptureArena::add(NDArray *pArray)
+{
+  size_t headerBytes, recordBytes, dataBytes;
+  NDArrayInfo_t arrayInfo;
+
+  if (this->pBase_ == NULL) return asynError;
+
+  pArray->getInfo(&arrayInfo);
+  dataBytes = pArray->codec.empty() ? arrayInfo.totalBytes : pArray->compressedSize;
+
+  /* The schema is written with the first array and whenever the attributes change */
+  if (this->attributeEncoder_.encode(pArray->pAttributeList, this->attributeBuffer_, false)) {
+    this->attributeEncoder_.reset();
+    return asynError;
+  }
+  bool withSchema = this->attributeEncoder_.schemaChanged();
+
+  /* Work out the space the array needs before copying anything */
+  headerBytes = offsetof(NDFileCaptureArenaRecord, array) + NDArrayDescriptorBytes(pArray, this->attributeBuffer_.size());
+  headerBytes = ARENA_ALIGN(headerBytes, ARENA_ALIGNMENT);
+  recordBytes = headerBytes + ARENA_ALIGN(dataBytes, ARENA_ALIGNMENT);
+  if (this->used_ + recordBytes > this->capacity_) {
+    /* The schema of an array that does not fit must be written with the next array */
+    if (withSchema) this->attributeEncoder_.reset();
+    return asynError;
+  }
+
+  char *pRecordStart = this->pBase_ + this->used_;
+  NDFileCaptureArenaRecord *pRecord = (NDFileCaptureArenaRecord *)pRecordStart;
+  if (withSchema) this->schemaOffset_ = this->used_;
+  pRecord->recordBytes = recordBytes;
+  pRecord->dataOffset = headerBytes;
+  pRecord->schemaOffset = this->schemaOffset_;
+  NDArrayDescriptorWrite(pArray, this->attributeBuffer_, &pRecord->array);
+
+  memcpy(pRecordStart + headerBytes, pArray->pData, dataBytes);
+  this->offsets_.push_back(this->used_);
+  this->used_ += recordBytes;
+  return asynSuccess;
+}
+
+/** Rebuild a captured array.  The caller must release the array when it has been written.
+ * \param[in] index - The array to rebuild, in the order they were captured.
+ * \param[in] pPool - Pool to allocate the array from.
+ * \return The array, or NULL if the index is not valid or the pool could not allocate the array.
+ */
+NDArray *NDFileCaptureArena::get(size_t index, NDArrayPool *pPool)
+{
+  size_t dims[ND_ARRAY_MAX_DIMS];
+
+  if (index >= this->offsets_.size()) return NULL;
+  char *pRecordStart = this->pBase_ + this->offsets_[index];
+  NDFileCaptureArenaRecord *pRecord = (NDFileCaptureArenaRecord *)pRecordStart;
+
+  for (int i=0; i<pRecord->array.ndims; i++) dims[i] = pRecord->array.dims[i].size;
+  bool compressed = (codecName[NDCODEC_NONE] != pRecord->array.codecName);
+  NDArray *pArray = pPool->alloc(pRecord->array.ndims, dims, pRecord->array.dataType,
+                                 compressed ? pRecord->array.dataBytes : 0, NULL);
+  if (pArray == NULL) return NULL;
+
+  const char *pIn = NDArrayDescriptorRead(&pRecord->array, pArray);
+
+  /* An array reused from the pool usually still has the attributes of an earlier array with the same schema,
+   * in which case the codec only sets their values */
+  int attributeStatus;
+  if (pRecord->schemaOffset == this->decodedSchemaOffset_) {
+    attributeStatus = this->attributeDecoder_.decode(pIn, pRecord->array.attributeBytes, pArray->pAttributeList);
+  } else {
+    /* The attributes of the record with the schema start with the schema block, decode them for the schema */
+    NDFileCaptureArenaRecord *pSchemaRecord = (NDFileCaptureArenaRecord *)(this->pBase_ + pRecord->schemaOffset);
+    const char *pSchema = (const char *)(&pSchemaRecord->array + 1) +
+                          pSchemaRecord->array.numBlockOffsets * sizeof(size_t);
+    attributeStatus = this->attributeDecoder_.decode(pSchema, pSchemaRecord->array.attributeBytes,
+                                                     pArray->pAttributeList);
+    this->decodedSchemaOffset_ = (attributeStatus == ND_SUCCESS) ? pRecord->schemaOffset : NO_SCHEMA;
+    if ((attributeStatus == ND_SUCCESS) && (pSchemaRecord != pRecord))
+      attributeStatus = this->attributeDecoder_.decode(pIn, pRecord->array.attributeBytes, pArray->pAttributeList);
+  }
+  if (attributeStatus != ND_SUCCESS) {
+    pArray->release();
+    return NULL;
+  }
+
+  memcpy(pArray->pData, pRecordStart + pRecord->dataOffset, pRecord->array.dataBytes);
+  return pArray;
+}
+
+/** Discard the captured arrays and give the memory or disk blocks they used back to the operating system.
+ * The region stays mapped for the next capture.
+ * \return asynError if the blocks of the scratch file could not be freed, the region can still be used.
+ */
+asynStatus NDFileCaptureArena::clear()
+{
+  asynStatus status = asynSuccess;
+
+  if (this->pBase_ && (this->used_ > 0)) {
+#ifdef _WIN32
+    // The blocks of a mapped file cannot be freed on Windows, they are reused by the next capture
+    if (this->fileName_.empty())
+      VirtualAlloc(this->pBase_, this->used_, MEM_RESET, PAGE_READWRITE);
+#elif defined(HAVE_FILE_MAPPING)
+    if (this->fd_ < 0) {
+      madvise(this->pBase_, this->used_, MADV_DONTNEED);
+    } else {
+      // MADV_DONTNEED only drops the pages of a shared file mapping from memory, the file keeps its blocks.
+#ifdef FALLOC_FL_PUNCH_HOLE
+      if (fallocate(this->fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, (off_t)this->used_) != 0)
+        status = asynError;
+#else
+      // Truncating the file frees them, and extending it again leaves it sparse as when it was created
+      if (ftruncate(this->fd_, 0) != 0) {
+        status = asynError;
+      } else if (ftruncate(this->fd_, (off_t)this->capacity_) != 0) {
+        // The mapping is now beyond the end of the file, so it must not be used again
+        this->destroy();
+        return asynError;
+      }
+#endif
+    }
+#endif
+  }
+  this->used_ = 0;
+  this->offsets_.clear();
+  this->forgetSchema();
+  return status;
+}
+
+/* Forget the schema of the attributes, so that it is written with the next array captured */
+void NDFileCaptureArena::forgetSchema()
+{
+  this->attributeEncoder_.reset();
+  this->attributeDecoder_.reset();
+  this->schemaOffset_ = NO_SCHEMA;
+  this->decodedSchemaOffset_ = NO_SCHEMA;
+}
+
+/** Return the number of arrays in the region. */
+size_t NDFileCaptureArena::count()
+{
+  return this->offsets_.size();
+}
+
+/** Return the size of the region in bytes. */
+size_t NDFileCaptureArena::capacity()
+{
+  return this->capacity_;
+}
+
+/** Return the number of bytes used by the arrays in the region. */
+size_t NDFileCaptureArena::used()
+{
+  return this->used_;
+}
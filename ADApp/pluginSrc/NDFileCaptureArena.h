@@ -0,0 +1,56 @@
+#ifndef NDFileCaptureArena_H
+#define NDFileCaptureArena_H
+
+#include <string>
+#include <vector>
+
+#include <asynDriver.h>
+#include <NDPluginAPI.h>
+#include "NDArray.h"
+#include "NDAttributeCodec.h"
+
+/** Buffer for the arrays collected by NDPluginFile in Capture mode.
+  * The data, dimensions, time stamps, codec and attributes of each array are copied into one memory
+  * mapped region of fixed size, so the array can be released to its pool as soon as it has been captured.
+  * The attributes are encoded by NDAttributeCodec, with their schema only when it changes.
+  * The region is anonymous memory, or a sparse scratch file when a file name is given, so that a capture
+  * can be larger than the memory of the IOC. The arrays are rebuilt from the region when the file is written.
+  */
+class NDPLUGIN_API NDFileCaptureArena
+{
+  public:
+    NDFileCaptureArena();
+    ~NDFileCaptureArena();
+
+    asynStatus create(size_t capacity, const char *fileName, char *errorMessage, size_t maxChars);
+    void destroy();
+    bool matches(size_t capacity, const char *fileName);
+    asynStatus add(NDArray *pArray);
+    NDArray *get(size_t index, NDArrayPool *pPool);
+    asynStatus clear();
+    size_t count();
+    size_t capacity();
+    size_t used();
+
+  private:
+    void forgetSchema();
+
+    char *pBase_;                    // Start of the mapped region, NULL if there is none
+    size_t capacity_;                // Size of the mapped region in bytes
+    size_t used_;                    // Bytes used by the captured arrays
+    std::string fileName_;           // Scratch file, empty for anonymous memory
+    std::vector<size_t> offsets_;    // Offset of each captured array in the region
+    NDAttributeCodec attributeEncoder_;
+    NDAttributeCodec attributeDecoder_;
+    std::vector<char> attributeBuffer_;
+    size_t schemaOffset_;            // Offset of the array with the schema of the attributes being captured
+    size_t decodedSchemaOffset_;     // Offset of the array with the schema attributeDecoder_ has
+#ifdef _WIN32
+    void *fileHandle_;
+    void *mappingHandle_;
+#else
+    int fd_;                         // Scratch file, -1 for anonymous memory
+#endif
+};
+
+#endif
@@ -40,7 +40,9 @@ enum HDF5Compression_t {HDF5CompressNone=0,
                         HDF5CompressBlosc,
                         HDF5CompressBshuf,
                         HDF5CompressLZ4,
-                        HDF5CompressJPEG};
+                        HDF5CompressJPEG,
+                        HDF5CompressZstd,
+                        HDF5CompressBshufZstd};
 /* Filter ID officially assigned to blosc */
 #define FILTER_BLOSC 32001
 /* Filter ID officially assigned to bitshuffle */
@@ -49,10 +51,14 @@ enum HDF5Compression_t {HDF5CompressNone=0,
 #define FILTER_LZ4 32004
 /* Filter ID officially assigned to jpeg */
 #define FILTER_JPEG 32019
+/* Filter ID officially assigned to zstd */
+#define FILTER_ZSTD 32015
 
 #define DIMSREPORTSIZE 512
 #define DIMNAMESIZE 40
 #define ALIGNMENT_BOUNDARY 1048576
+#define DIRECT_IO_BLOCK_SIZE 4096       /* File system block size assumed for O_DIRECT when BoundaryAlign is 0 */
+#define DIRECT_IO_COPY_BUFFER 16777216  /* Size of the direct VFD buffer for blocks that are not aligned */
 #define INFINITE_FRAMES_CAPTURE 10000 /* Used to calculate istorek (the size of the chunk index binar search tree) when capturing infinite number of frames */
 
 #ifdef HDF5_BTREE_IK_MAX_ENTRIES
@@ -64,6 +70,14 @@ enum HDF5Compression_t {HDF5CompressNone=0,
 static const char *driverName = "NDFileHDF5";
 static const char *uniqueIDName = "NDArrayUniqueId";
 
+/* Files written by the NDFileHDF5 instances of a striped group, keyed by the name of the group's VDS master file */
+typedef struct {
+  NDFileHDF5VDS *pVDS;
+  int numFinished;
+} NDFileHDF5StripeGroup_t;
+static std::map<std::string, NDFileHDF5StripeGroup_t> stripeGroups;
+static epicsMutex stripeGroupsLock;
+
 // Not required if SWMR is not supported
 #if H5_VERSION_GE(1,9,178)
 // This is a callback function for object flushing when in SWMR mode
@@ -162,7 +176,8 @@ static void flushTaskC(void *drvPvt)
 /** Opens a HDF5 file.
  * In write mode if NDFileModeMultiple is set then the first dataspace dimension is set to H5S_UNLIMITED to allow
  * multiple arrays to be written to the same file.
- * NOTE: Does not currently support NDFileModeRead or NDFileModeAppend.
+ * In read mode the default detector dataset of the XML layout is opened, see NDFileHDF5::openFileForRead.
+ * NOTE: Does not currently support NDFileModeAppend.
  * \param[in] fileName  Absolute path name of the file to open.
  * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite, NDFileModeAppend.
  *           May also have the bit NDFileModeMultiple set if the file is to be opened to write or read multiple
@@ -183,17 +198,10 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   this->lock();
   // Reset flush counter
   setIntegerParam(NDFileHDF5_SWMRCbCounter, 0);
-  getIntegerParam(NDFileNumCapture, &numCapture);
+  numCapture = this->getNumCaptureForFile();
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
 
-  // We don't support reading yet
-  if (openMode & NDFileModeRead) {
-    setIntegerParam(NDFileCapture, 0);
-    setIntegerParam(NDWriteFile, 0);
-    status = asynError;
-  }
-
   // We don't support opening an existing file for appending yet
   if (openMode & NDFileModeAppend) {
     setIntegerParam(NDFileCapture, 0);
@@ -220,6 +228,17 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   // Check to see if a file is already open and close it
   this->checkForOpenFile();
 
+  if (openMode & NDFileModeRead){
+    return this->openFileForRead(fileName);
+  }
+
+  // Forget the files of the previous stream unless this file continues it after a rollover
+  this->stripeFrames.clear();
+  if (!this->isRollingOver()){
+    this->rolloverVDS->clear();
+    this->configureStripe(openMode);
+  }
+
   if (openMode & NDFileModeMultiple){
     this->multiFrameFile = true;
   } else {
@@ -293,6 +312,9 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   // Configure compression if required
   this->configureDatasetCompression();
 
+  // The write statistics are counted from the start of each file
+  this->publishWriteStats();
+
   if (storeAttributes == 1){
     this->createAttributeDataset(pArray);
     this->writeAttributeDataset(hdf5::OnFileOpen, 0, NULL);
@@ -1331,6 +1353,8 @@ hid_t NDFileHDF5::createDatasetDetector(hid_t group, hdf5::Dataset *dset)
   hid_t dset_access_plist = H5Pcreate(H5P_DATASET_ACCESS);
   hsize_t nbytes = this->calcChunkCacheBytes();
   hsize_t nslots = this->calcChunkCacheSlots();
+  hsize_t chunkBytes = this->bytesPerElement;
+  for (int i = 0; i < this->rank; i++) chunkBytes *= this->chunkdims[i];
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Setting cache size=%d slots=%d\n",
             driverName, functionName,
             (int)nbytes, (int)nslots);
@@ -1351,7 +1375,13 @@ hid_t NDFileHDF5::createDatasetDetector(hid_t group, hdf5::Dataset *dset)
   H5Pclose(dset_access_plist);
 
   // Store the dataset into the detector dataset map
-  this->detDataMap[dset->get_full_name()] = new NDFileHDF5Dataset(this->pasynUserSelf, dset->get_name(), dataset);
+  NDFileHDF5Dataset *pDataset = new NDFileHDF5Dataset(this->pasynUserSelf, dset->get_name(), dataset);
+  pDataset->configureChunkCache(this->rank, this->multiFrameFile ? this->nvirtual : 0,
+                                this->chunkdims, this->maxdims, chunkBytes > 0 ? nbytes / chunkBytes : 0);
+  this->detDataMap[dset->get_full_name()] = pDataset;
+  this->lock();
+  setDoubleParam(NDFileHDF5_chunkCacheSize, (double)nbytes / (1024.0 * 1024.0));
+  this->unlock();
 
   return dataset;
 }
@@ -1390,7 +1420,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
 
   this->lock();
   getIntegerParam(NDFileHDF5_dimAttDatasets, &dimAttDataset);
-  getIntegerParam(NDFileNumCaptured, &numCaptured);
+  numCaptured = this->getNumCapturedForWrite();
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
   getIntegerParam(NDFileHDF5_flushNthFrame, &flush);
@@ -1517,6 +1547,9 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
 
   if (status == asynSuccess){
     status = this->detDataMap[destination]->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
+    if (status == asynSuccess && this->stripeCount > 0 && destination == this->defDsetName){
+      this->stripeFrames.push_back((hsize_t)pArray->uniqueId);
+    }
   }
   if (status != asynSuccess){
     // If dataset creation fails then close file and abort as all following writes will fail as well
@@ -1597,6 +1630,8 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     if ((numCaptured+1) % flush == 0) {
       // We are in SWMR mode so flush the dataset on every <flush> frames
       status = this->detDataMap[destination]->flushDataset();
+      // Attribute values buffered since the last chunk boundary are flushed with the frames
+      if (storeAttributes == 1) this->flushAttributeBuffers(1);
     }
   }
 
@@ -1620,6 +1655,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
               driverName, functionName, dt, period);
 
     this->nextRecord++;
+    this->publishWriteStats();
   }
 
   // Release the flushing lock here to allow a manual flush
@@ -1628,12 +1664,53 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   return status;
 }
 
-/** Read NDArray data from a HDF5 file; NOTE: not implemented yet.
+/** Opens a HDF5 file written by this plugin to read its frames back with NDFileHDF5::readFile.
+ * The frames are read from the default detector dataset of the XML layout, or from /entry/data/data
+ * if the layout has no default dataset.
+ * \param[in] fileName  Absolute path name of the file to open.
+ */
+asynStatus NDFileHDF5::openFileForRead(const char *fileName)
+{
+  static const char *functionName = "openFileForRead";
+
+  if (this->loadLayoutXML()){
+    return asynError;
+  }
+  std::string dsetName = "/entry/data/data";
+  hdf5::Dataset *dset;
+  hdf5::Root *root = this->layout.get_hdftree();
+  if (root != NULL && !root->find_detector_default_dset(&dset)){
+    dsetName = dset->get_full_name();
+  }
+  this->layout.unload_xml();
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s reading dataset %s of %s\n",
+            driverName, functionName, dsetName.c_str(), fileName);
+  this->readFrame = 0;
+  return this->reader->open(fileName, dsetName);
+}
+
+/** Returns the number of frames in the file opened with NDFileHDF5::openFileForRead.
+ */
+int NDFileHDF5::getNumArraysInFile()
+{
+  return (int)this->reader->getNumFrames();
+}
+
+/** Read the next frame of the file opened in read mode into an NDArray.
   * \param[in] pArray Pointer to the address of an NDArray to read the data into.  */
 asynStatus NDFileHDF5::readFile(NDArray **pArray)
 {
-  //static const char *functionName = "readFile";
-  return asynError;
+  static const char *functionName = "readFile";
+
+  if (!this->reader->isOpen()){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s no file is open for reading\n",
+              driverName, functionName);
+    return asynError;
+  }
+  return this->reader->read(this->readFrame++, this->pNDArrayPool, pArray);
 }
 
 /** Closes the HDF5 file opened with NDFileHDF5::openFile
@@ -1641,11 +1718,19 @@ asynStatus NDFileHDF5::readFile(NDArray **pArray)
 asynStatus NDFileHDF5::closeFile()
 {
   int storeAttributes, storePerformance;
+  int rolloverVDS, extraDims, fileWriteMode;
+  char tempSuffix[MAX_FILENAME_LEN];
+  std::string partFileName;
   epicsTimeStamp now;
   double runtime = 0.0, writespeed = 0.0;
   epicsInt32 numCaptured;
   static const char *functionName = "closeFile";
 
+  if (this->reader->isOpen()){
+    this->reader->close();
+    return asynSuccess;
+  }
+
   if (this->file == 0){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
               "%s::%s file was not open! Ignoring close command.\n",
@@ -1656,7 +1741,28 @@ asynStatus NDFileHDF5::closeFile()
   this->lock();
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
+  getIntegerParam(NDFileHDF5_rolloverVDS, &rolloverVDS);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
+  getIntegerParam(NDFileWriteMode, &fileWriteMode);
+  getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
   this->unlock();
+
+  // Streams that roll over to several files, or the files of a striped group,
+  // can be tied together by a VDS master file
+  if ((rolloverVDS == 1 && extraDims == 0 && fileWriteMode == NDFileModeStream) || this->stripeCount > 0){
+    ssize_t len = H5Fget_name(this->file, NULL, 0);
+    if (len > 0){
+      std::vector<char> name(len+1);
+      H5Fget_name(this->file, &name[0], len+1);
+      partFileName = &name[0];
+      size_t suffixLen = strlen(tempSuffix);
+      if (suffixLen > 0 && partFileName.size() > suffixLen &&
+          partFileName.compare(partFileName.size()-suffixLen, suffixLen, tempSuffix) == 0){
+        partFileName.erase(partFileName.size()-suffixLen);
+      }
+    }
+  }
+
   if (storeAttributes == 1) {
      this->writeAttributeDataset(hdf5::OnFileClose, 0, NULL);
      this->storeOnCloseAttributes();
@@ -1686,9 +1792,28 @@ asynStatus NDFileHDF5::closeFile()
             "%s::%s closing groups\n",
             driverName, functionName);
 
-  // Iterate over the stored detector data sets and close them
+  // Iterate over the stored detector data sets, write any chunks still staged or being compressed and close them
   std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
+    it_dset->second->writePendingChunks();
+    it_dset->second->closeChunkCache();
+    if (!partFileName.empty() && it_dset->first == this->defDsetName && this->stripeCount > 0){
+      stripeGroupsLock.lock();
+      NDFileHDF5StripeGroup_t& group = stripeGroups[this->stripeVDSFileName];
+      if (group.pVDS == NULL) group.pVDS = new NDFileHDF5VDS(this->pasynUserSelf);
+      group.pVDS->addSource(partFileName, this->defDsetName, it_dset->second->getHandle(), this->stripeFrames);
+      stripeGroupsLock.unlock();
+    } else if (!partFileName.empty() && it_dset->first == this->defDsetName){
+      if (this->rolloverVDS->getNumSources() == 0){
+        // The master file is named after the first file of the stream
+        size_t dot = partFileName.find_last_of('.');
+        size_t slash = partFileName.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = partFileName.size();
+        this->rolloverVDSFileName = partFileName.substr(0, dot) + "_vds" + partFileName.substr(dot);
+      }
+      this->rolloverVDS->addSource(partFileName, this->defDsetName, it_dset->second->getHandle(),
+                                   this->rolloverVDS->getNumFrames(), 1);
+    }
     H5Dclose(it_dset->second->getHandle());
   }
   std::map<std::string, hid_t>::iterator it_hid;
@@ -1726,6 +1851,31 @@ asynStatus NDFileHDF5::closeFile()
   // Close the HDF file
   H5Fclose(this->file);
   this->file = 0;
+  this->publishWriteStats();
+
+  // The last writer of a striped group to finish writes the VDS master file of the group
+  if (!this->isRollingOver() && this->stripeCount > 0){
+    stripeGroupsLock.lock();
+    NDFileHDF5StripeGroup_t& group = stripeGroups[this->stripeVDSFileName];
+    group.numFinished++;
+    if (group.numFinished >= this->stripeCount){
+      if (group.pVDS) {
+        group.pVDS->write(this->stripeVDSFileName, this->defDsetName);
+        delete group.pVDS;
+      }
+      stripeGroups.erase(this->stripeVDSFileName);
+    }
+    stripeGroupsLock.unlock();
+    this->stripeCount = 0;
+  }
+
+  // Write the VDS master file once the last file of a stream that rolled over is closed
+  if (!this->isRollingOver()){
+    if (this->rolloverVDS->getNumSources() > 1){
+      this->rolloverVDS->write(this->rolloverVDSFileName, this->defDsetName);
+    }
+    this->rolloverVDS->clear();
+  }
 
   // At this point we can clear the SWMR active flag, whether we were running
   // in SWMR mode or not
@@ -1745,7 +1895,7 @@ asynStatus NDFileHDF5::closeFile()
   epicsTimeGetCurrent(&now);
   runtime = epicsTimeDiffInSeconds(&now, &this->opents);
   this->lock();
-  getIntegerParam(NDFileNumCaptured, &numCaptured);
+  numCaptured = this->getNumCapturedForWrite();
   writespeed = (numCaptured * this->frameSize)/runtime;
   setDoubleParam(NDFileHDF5_totalIoSpeed, writespeed);
   setDoubleParam(NDFileHDF5_totalRuntime, runtime);
@@ -1945,6 +2095,12 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       case HDF5CompressJPEG:
         filterId = FILTER_JPEG;
         break;
+      case HDF5CompressZstd:
+        filterId = FILTER_ZSTD;
+        break;
+      case HDF5CompressBshufZstd:
+        filterId = FILTER_BSHUF;
+        break;
       default:
         filterId = H5Z_FILTER_NONE;
         status = asynError;
@@ -2016,6 +2172,48 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = asynError;
       setIntegerParam(function, oldvalue);
     }
+  } else if (function == NDFileHDF5_zstdCompressLevel) {
+    if (this->file != 0 || value < 1 || value > 22)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_compressThreads) {
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_metaBlockSize) {
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_directIO) {
+    if (this->file != 0 || value < 0 || value > 1)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_rolloverVDS) {
+    if (this->file != 0 || value < 0 || value > 1)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_stripeCount) {
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_chunkCacheMax) {
+    if (this->file != 0 || value < 0)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
   } else if (function == NDFileHDF5_SWMRMode){
 
     // Reject SWMR mode if the HDF version doesn't support it
@@ -2277,6 +2475,11 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   }
   this->createParam(str_NDFileHDF5_chunkBoundaryAlign, asynParamInt32,&NDFileHDF5_chunkBoundaryAlign);
   this->createParam(str_NDFileHDF5_chunkBoundaryThreshold, asynParamInt32,&NDFileHDF5_chunkBoundaryThreshold);
+  this->createParam(str_NDFileHDF5_metaBlockSize,   asynParamInt32,   &NDFileHDF5_metaBlockSize);
+  this->createParam(str_NDFileHDF5_directIO,        asynParamInt32,   &NDFileHDF5_directIO);
+  this->createParam(str_NDFileHDF5_rolloverVDS,     asynParamInt32,   &NDFileHDF5_rolloverVDS);
+  this->createParam(str_NDFileHDF5_stripeCount,     asynParamInt32,   &NDFileHDF5_stripeCount);
+  this->createParam(str_NDFileHDF5_stripeVDSFile,   asynParamOctet,   &NDFileHDF5_stripeVDSFile);
   this->createParam(str_NDFileHDF5_NDAttributeChunk,asynParamInt32,   &NDFileHDF5_NDAttributeChunk);
   this->createParam(str_NDFileHDF5_nExtraDims,      asynParamInt32,   &NDFileHDF5_nExtraDims);
   this->createParam(str_NDFileHDF5_extraDimOffsetX, asynParamInt32,   &NDFileHDF5_extraDimOffsetX);
@@ -2290,12 +2493,20 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_storePerformance,asynParamInt32,   &NDFileHDF5_storePerformance);
   this->createParam(str_NDFileHDF5_totalRuntime,    asynParamFloat64, &NDFileHDF5_totalRuntime);
   this->createParam(str_NDFileHDF5_totalIoSpeed,    asynParamFloat64, &NDFileHDF5_totalIoSpeed);
+  this->createParam(str_NDFileHDF5_chunkCacheMax,   asynParamInt32,   &NDFileHDF5_chunkCacheMax);
+  this->createParam(str_NDFileHDF5_chunkCacheSize,  asynParamFloat64, &NDFileHDF5_chunkCacheSize);
+  this->createParam(str_NDFileHDF5_bytesWritten,    asynParamFloat64, &NDFileHDF5_bytesWritten);
+  this->createParam(str_NDFileHDF5_chunksFlushed,   asynParamInt32,   &NDFileHDF5_chunksFlushed);
+  this->createParam(str_NDFileHDF5_chunkEvictions,  asynParamInt32,   &NDFileHDF5_chunkEvictions);
+  this->createParam(str_NDFileHDF5_avgWriteTime,    asynParamFloat64, &NDFileHDF5_avgWriteTime);
   this->createParam(str_NDFileHDF5_flushNthFrame,   asynParamInt32,   &NDFileHDF5_flushNthFrame);
   this->createParam(str_NDFileHDF5_compressionType, asynParamInt32,   &NDFileHDF5_compressionType);
   this->createParam(str_NDFileHDF5_nbitsPrecision,  asynParamInt32,   &NDFileHDF5_nbitsPrecision);
   this->createParam(str_NDFileHDF5_nbitsOffset,     asynParamInt32,   &NDFileHDF5_nbitsOffset);
   this->createParam(str_NDFileHDF5_szipNumPixels,   asynParamInt32,   &NDFileHDF5_szipNumPixels);
   this->createParam(str_NDFileHDF5_zCompressLevel,  asynParamInt32,   &NDFileHDF5_zCompressLevel);
+  this->createParam(str_NDFileHDF5_zstdCompressLevel, asynParamInt32,  &NDFileHDF5_zstdCompressLevel);
+  this->createParam(str_NDFileHDF5_compressThreads, asynParamInt32,   &NDFileHDF5_compressThreads);
   this->createParam(str_NDFileHDF5_bloscShuffleType,   asynParamInt32,   &NDFileHDF5_bloscShuffleType);
   this->createParam(str_NDFileHDF5_bloscCompressor,    asynParamInt32,   &NDFileHDF5_bloscCompressor);
   this->createParam(str_NDFileHDF5_bloscCompressLevel, asynParamInt32,   &NDFileHDF5_bloscCompressLevel);
@@ -2324,6 +2535,11 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_NDAttributeChunk,0);
   setIntegerParam(NDFileHDF5_chunkBoundaryAlign, 0);
   setIntegerParam(NDFileHDF5_chunkBoundaryThreshold, 65536);
+  setIntegerParam(NDFileHDF5_metaBlockSize,   0);
+  setIntegerParam(NDFileHDF5_directIO,        0);
+  setIntegerParam(NDFileHDF5_rolloverVDS,     0);
+  setIntegerParam(NDFileHDF5_stripeCount,     0);
+  setStringParam (NDFileHDF5_stripeVDSFile,   "");
   setIntegerParam(NDFileHDF5_nExtraDims,      0);
   setIntegerParam(NDFileHDF5_extraDimOffsetX, 0);
   setIntegerParam(NDFileHDF5_extraDimOffsetY, 0);
@@ -2335,12 +2551,20 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_storePerformance,1);
   setDoubleParam (NDFileHDF5_totalRuntime,    0.0);
   setDoubleParam (NDFileHDF5_totalIoSpeed,    0.0);
+  setIntegerParam(NDFileHDF5_chunkCacheMax,   0);
+  setDoubleParam (NDFileHDF5_chunkCacheSize,  0.0);
+  setDoubleParam (NDFileHDF5_bytesWritten,    0.0);
+  setIntegerParam(NDFileHDF5_chunksFlushed,   0);
+  setIntegerParam(NDFileHDF5_chunkEvictions,  0);
+  setDoubleParam (NDFileHDF5_avgWriteTime,    0.0);
   setIntegerParam(NDFileHDF5_flushNthFrame,   0);
   setIntegerParam(NDFileHDF5_compressionType, HDF5CompressNone);
   setIntegerParam(NDFileHDF5_nbitsPrecision,  8);
   setIntegerParam(NDFileHDF5_nbitsOffset,     0);
   setIntegerParam(NDFileHDF5_szipNumPixels,   16);
   setIntegerParam(NDFileHDF5_zCompressLevel,  6);
+  setIntegerParam(NDFileHDF5_zstdCompressLevel, 3);
+  setIntegerParam(NDFileHDF5_compressThreads, 0);
   setIntegerParam(NDFileHDF5_bloscShuffleType, 1);
   setIntegerParam(NDFileHDF5_bloscCompressor, 0);
   setIntegerParam(NDFileHDF5_bloscCompressLevel, 5);
@@ -2411,6 +2635,12 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->hostname = (char*)calloc(MAXHOSTNAMELEN, sizeof(char));
   gethostname(this->hostname, MAXHOSTNAMELEN);
 
+  this->chunkCompressor = NULL;
+  this->rolloverVDS = new NDFileHDF5VDS(this->pasynUserSelf);
+  this->reader = new NDFileHDF5Reader(this->pasynUserSelf);
+  this->readFrame = 0;
+  this->stripeCount = 0;
+
   this->flushEventId = epicsEventCreate(epicsEventEmpty);
   if (!this->flushEventId){
       printf("%s:%s epicsEventCreate failure for flush event\n", driverName, functionName);
@@ -2474,7 +2704,7 @@ unsigned int NDFileHDF5::calcIstorek()
   for (int extraDimIndex = 0; extraDimIndex < MAXEXTRADIMS; extraDimIndex++){
     getIntegerParam(NDFileHDF5_extraDimSize[extraDimIndex], &extradimsizes[extraDimIndex]);
   }
-  getIntegerParam(NDFileNumCapture, &fileNumCapture);
+  fileNumCapture = this->getNumCaptureForFile();
   this->unlock();
   extradim = MAXEXTRADIMS - numExtraDims-1;
   if (numExtraDims == 0) {
@@ -2498,17 +2728,55 @@ unsigned int NDFileHDF5::calcIstorek()
   return retval;
 }
 
+/** Work out the number of chunks that are partly written at any one time, which is
+ * the number of chunks the chunk cache has to hold to write each chunk only once.
+ * Frames are written in order along the extra dimensions, the last one fastest.  A chunk
+ * that spans several frames in an extra dimension is only complete once that dimension
+ * has moved on by the chunk size, by which time every chunk of the faster dimensions
+ * has been started.
+ */
+hsize_t NDFileHDF5::calcChunkCacheChunks()
+{
+  hsize_t num_chunks = 1;
+  hsize_t maxdim = 0;
+  int extradims = this->multiFrameFile ? this->nvirtual : 0;
+  int slowest = extradims;
+
+  // Chunks of a single frame
+  for (int i = extradims; i < this->rank; i++){
+    num_chunks *= (this->maxdims[i] + this->chunkdims[i] - 1) / this->chunkdims[i];
+  }
+  // Chunks of the faster extra dimensions started before a chunk is complete
+  for (int i = 0; i < extradims; i++){
+    if (this->chunkdims[i] > 1){
+      slowest = i;
+      break;
+    }
+  }
+  for (int i = slowest+1; i < extradims; i++){
+    maxdim = this->maxdims[i];
+    if (maxdim == H5S_UNLIMITED) maxdim = this->chunkdims[i];
+    num_chunks *= (maxdim + this->chunkdims[i] - 1) / this->chunkdims[i];
+  }
+  return num_chunks;
+}
+
+/** Size the chunk cache to hold every chunk that is partly written at one time, limited
+ * to HDF5_chunkCacheMax MB if that is set.
+ */
 hsize_t NDFileHDF5::calcChunkCacheBytes()
 {
-  hsize_t nbytes = 0;
-  epicsInt32 n_frames_chunk=0;
+  hsize_t nbytes = this->bytesPerElement;
+  epicsInt32 cacheMax = 0;
   this->lock();
-  getIntegerParam(NDFileHDF5_nFramesChunks, &n_frames_chunk);
+  getIntegerParam(NDFileHDF5_chunkCacheMax, &cacheMax);
   this->unlock();
-  nbytes = this->maxdims[this->rank - 1]  * this->bytesPerElement * n_frames_chunk;
-  if ((this->multiFrameFile && this->rank >= 3) ||
-      (!this->multiFrameFile && this->rank >= 2)) {
-    nbytes *= this->maxdims[this->rank - 2];
+  for (int i = 0; i < this->rank; i++){
+    nbytes *= this->chunkdims[i];
+  }
+  nbytes *= this->calcChunkCacheChunks();
+  if (cacheMax > 0 && nbytes > (hsize_t)cacheMax * 1024 * 1024){
+    nbytes = (hsize_t)cacheMax * 1024 * 1024;
   }
   return nbytes;
 }
@@ -2532,43 +2800,74 @@ hsize_t NDFileHDF5::calcChunkCacheBytes()
 hsize_t NDFileHDF5::calcChunkCacheSlots()
 {
   unsigned int long nslots = 1;
-  unsigned int long num_chunks = 1;
-  double div_result = 0.0;
-  epicsInt32 n_frames_chunk=0, n_extra_dims=0, n_frames_capture=0;
+  hsize_t chunkBytes = this->bytesPerElement;
+  hsize_t num_chunks = 1;
 
-  this->lock();
-  getIntegerParam(NDFileHDF5_nFramesChunks, &n_frames_chunk);
-  getIntegerParam(NDFileHDF5_nExtraDims, &n_extra_dims);
-  getIntegerParam(NDFileNumCapture, &n_frames_capture);
-  this->unlock();
+  for (int i = 0; i < this->rank; i++){
+    chunkBytes *= this->chunkdims[i];
+  }
+  if (chunkBytes > 0) num_chunks = this->calcChunkCacheBytes() / chunkBytes;
+  if (num_chunks < 1) num_chunks = 1;
 
-  div_result = (double)this->maxdims[this->rank - 1] / (double)this->chunkdims[this->rank -1];
-  num_chunks *= (unsigned int long)ceil(div_result);
-  // this check prevents double counting number of frames when the data is 1D in a multiframe file
-  // and it also prevents an invalid memory access when the data is 1D in a non multiframe file
-  if ((this->multiFrameFile && this->rank >= 3) ||
-      (!this->multiFrameFile && this->rank >= 2)) {
-    div_result = (double)this->maxdims[this->rank - 2] / (double)this->chunkdims[this->rank - 2];
-    num_chunks *= (unsigned int long)ceil(div_result);
-  }
-  div_result = (double)n_frames_capture / (double)n_frames_chunk;
-  num_chunks *= (unsigned int long)ceil(div_result);
-
-  // number of slots have to be a prime number which is between 10 and 50 times
-  // larger than the numer of chunks that can fit in the file/dataset.
-  nslots = num_chunks * 50;
+  // number of slots have to be a prime number which is about 100 times
+  // larger than the number of chunks that can fit in the cache.
+  nslots = (unsigned int long)num_chunks * 100;
   while(!IsPrime(nslots))
     nslots++;
   return nslots;
 }
 
+/** Publish the write statistics of the datasets of the current file.
+ */
+void NDFileHDF5::publishWriteStats()
+{
+  NDFileHDF5WriteStats stats;
+  memset(&stats, 0, sizeof(stats));
+  std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
+  for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
+    it_dset->second->getWriteStats(&stats);
+  }
+  this->lock();
+  setDoubleParam(NDFileHDF5_bytesWritten, stats.bytesWritten / (1024.0 * 1024.0));
+  setIntegerParam(NDFileHDF5_chunksFlushed, stats.chunksFlushed);
+  setIntegerParam(NDFileHDF5_chunkEvictions, stats.chunkEvictions);
+  setDoubleParam(NDFileHDF5_avgWriteTime, stats.writeCalls > 0 ? 1000.0 * stats.writeTime / stats.writeCalls : 0.0);
+  this->unlock();
+}
+
+/** Latch the striped group settings when a stream or capture is started.
+ * Striping needs a multi-frame file without extra dimensions.
+ * \param[in] openMode - Mode that the file is being opened with.
+ */
+void NDFileHDF5::configureStripe(NDFileOpenMode_t openMode)
+{
+  int extraDims = 0;
+  char vdsFileName[MAX_FILENAME_LEN];
+  static const char *functionName = "configureStripe";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_stripeCount, &this->stripeCount);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
+  getStringParam(NDFileHDF5_stripeVDSFile, sizeof(vdsFileName), vdsFileName);
+  this->unlock();
+  this->stripeVDSFileName = vdsFileName;
+  if (this->stripeCount < 1 || this->stripeVDSFileName.empty()){
+    this->stripeCount = 0;
+  } else if (!(openMode & NDFileModeMultiple) || extraDims > 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s striping needs a multi-frame file without extra dimensions, %s will not be written\n",
+              driverName, functionName, vdsFileName);
+    this->stripeCount = 0;
+  }
+}
+
 /** Setup the required allocation for the performance dataset
  */
 asynStatus NDFileHDF5::configurePerformanceDataset()
 {
   int numCaptureFrames;
   this->lock();
-  getIntegerParam(NDFileNumCapture, &numCaptureFrames);
+  numCaptureFrames = this->getNumCaptureForFile();
   this->unlock();
   if (numCaptureFrames == 0) {
     // Special case: acquiring an infinite number of frames
@@ -2678,7 +2977,7 @@ asynStatus NDFileHDF5::writePerformanceDataset()
   epicsInt32 numCaptured;
 
   this->lock();
-  getIntegerParam(NDFileNumCaptured, &numCaptured);
+  numCaptured = this->getNumCapturedForWrite();
   this->unlock();
   dims[1] = 5;
   if (numCaptured < this->numPerformancePoints) dims[0] = numCaptured;
@@ -2887,7 +3186,7 @@ asynStatus NDFileHDF5::calculateAttributeChunking(int *chunking, int *mdim_chunk
       }
     } else {
       // We aren't in single mode so read the number of frames
-      getIntegerParam(NDFileNumCapture, chunking);
+      *chunking = this->getNumCaptureForFile();
       if (*chunking <= 0) {
         // Special case: writing infinite number of frames, so we guess a good(ish) chunk number
         *chunking = 16*1024;
@@ -2934,7 +3233,7 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positi
   if (checkForSWMRMode()){
     int numCaptured = 0;
     this->lock();
-    getIntegerParam(NDFileNumCaptured, &numCaptured);
+    numCaptured = this->getNumCapturedForWrite();
     this->unlock();
     int chunking = 0;
     int mdchunking[MAXEXTRADIMS];
@@ -2993,6 +3292,28 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positi
   return status;
 }
 
+/** Write the attribute values that are buffered by the attribute datasets to the file.
+ *  The unique ID attribute is written last, as it is in writeAttributeDataset.
+ *  \param[in] flush If 1 the attribute datasets are also flushed for SWMR readers.
+ */
+asynStatus NDFileHDF5::flushAttributeBuffers(int flush)
+{
+  asynStatus status = asynSuccess;
+  NDFileHDF5AttributeDataset *uniqueIDNode = NULL;
+
+  for (std::list<NDFileHDF5AttributeDataset*>::iterator it_node = attrList.begin(); it_node != attrList.end(); ++it_node){
+    if (strcmp(uniqueIDName, (*it_node)->getName().c_str())){
+      if (flush == 1) (*it_node)->flushDataset(); else (*it_node)->writeBuffer();
+    } else {
+      uniqueIDNode = *it_node;
+    }
+  }
+  if (uniqueIDNode != NULL){
+    status = (flush == 1) ? uniqueIDNode->flushDataset() : uniqueIDNode->writeBuffer();
+  }
+  return status;
+}
+
 /** Close all attribute datasets and clear out memory
  */
 asynStatus NDFileHDF5::closeAttributeDataset()
@@ -3001,6 +3322,9 @@ asynStatus NDFileHDF5::closeAttributeDataset()
   NDFileHDF5AttributeDataset *dsetPtr;
   static const char *functionName = "closeAttributeDataset";
 
+  // Write out any buffered attribute values
+  this->flushAttributeBuffers(0);
+
   while (attrList.size() > 0){
     dsetPtr = attrList.front();
     attrList.pop_front();
@@ -3184,7 +3508,7 @@ asynStatus NDFileHDF5::configureDims(NDArray *pArray)
       getIntegerParam(extradimdefs[MAXEXTRADIMS - extradims + i].sizeChunkId, &chunkSize);
       if (extradims == 1 && i == 0){
         // Special case, no extra dims so numCapture is equal to specified number of frames
-        getIntegerParam(NDFileNumCapture, &numCapture);
+        numCapture = this->getNumCaptureForFile();
       } else {
         getIntegerParam(extradimdefs[MAXEXTRADIMS - extradims + i].sizeParamId, &numCapture);
       }
@@ -3304,6 +3628,7 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
   int nbitPrecision = 0;
   int nbitOffset = 0;
   int zLevel = 0;
+  int zstdLevel = 0;
   int bloscShuffle = 0;
   int bloscCompressor = 0;
   int bloscLevel = 0;
@@ -3327,6 +3652,12 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
       setIntegerParam(NDFileHDF5_compressionType, HDF5CompressLZ4);
     } else if (pArray->codec.name == codecName[NDCODEC_JPEG]) {
       setIntegerParam(NDFileHDF5_compressionType, HDF5CompressJPEG);
+    } else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+      setIntegerParam(NDFileHDF5_compressionType, HDF5CompressZstd);
+      setIntegerParam(NDFileHDF5_zstdCompressLevel, pArray->codec.level);
+    } else if (pArray->codec.name == codecName[NDCODEC_BSZSTD]) {
+      setIntegerParam(NDFileHDF5_compressionType, HDF5CompressBshufZstd);
+      setIntegerParam(NDFileHDF5_zstdCompressLevel, pArray->codec.level);
     }
   }
   getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
@@ -3334,6 +3665,7 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
   getIntegerParam(NDFileHDF5_nbitsPrecision, &nbitPrecision);
   getIntegerParam(NDFileHDF5_szipNumPixels, &szipNumPixels);
   getIntegerParam(NDFileHDF5_zCompressLevel, &zLevel);
+  getIntegerParam(NDFileHDF5_zstdCompressLevel, &zstdLevel);
   getIntegerParam(NDFileHDF5_bloscShuffleType, &bloscShuffle);
   getIntegerParam(NDFileHDF5_bloscCompressor, &bloscCompressor);
   getIntegerParam(NDFileHDF5_bloscCompressLevel, &bloscLevel);
@@ -3451,6 +3783,38 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
         this->codec.name = codecName[NDCODEC_JPEG];
       }
       break;
+    case HDF5CompressZstd: {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s Setting zstd compression filter level=%d\n",
+                  driverName, functionName, zstdLevel);
+        unsigned int cds[1];
+        cds[0] = zstdLevel;
+        int h5status = H5Pset_filter(this->cparms, FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, cds);
+        if (h5status) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Failed to set h5 zstd filter\n");
+          break;
+        }
+        this->codec.name = codecName[NDCODEC_ZSTD];
+        this->codec.level = zstdLevel;
+      }
+      break;
+    case HDF5CompressBshufZstd: {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s Setting bitshuffle/zstd compression filter level=%d\n",
+                  driverName, functionName, zstdLevel);
+        unsigned int cds[3];
+        cds[0] = 0; /* bitshuffle selects the block size automatically */
+        cds[1] = 3; /* zstd compression */
+        cds[2] = zstdLevel;
+        int h5status = H5Pset_filter(this->cparms, FILTER_BSHUF, H5Z_FLAG_MANDATORY, 3, cds);
+        if (h5status) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Failed to set h5 bitshuffle filter\n");
+          break;
+        }
+        this->codec.name = codecName[NDCODEC_BSZSTD];
+        this->codec.level = zstdLevel;
+      }
+      break;
   }
   return status;
 }
@@ -3465,10 +3829,34 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
  */
 asynStatus NDFileHDF5::configureDatasetCompression()
 {
+  int compressThreads;
+  static const char *functionName = "configureDatasetCompression";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_compressThreads, &compressThreads);
+  this->unlock();
+
+  // (Re)create the compression threads if their number has changed
+  if (this->chunkCompressor && this->chunkCompressor->getNumThreads() != compressThreads){
+    delete this->chunkCompressor;
+    this->chunkCompressor = NULL;
+  }
+  if (compressThreads > 0 && this->chunkCompressor == NULL){
+    this->chunkCompressor = new NDFileHDF5ChunkCompressor(this->portName, compressThreads, this->pNDArrayPool);
+    if (this->chunkCompressor->getNumThreads() == 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Unable to create compression threads, compressing in the writing thread\n",
+                driverName, functionName);
+      delete this->chunkCompressor;
+      this->chunkCompressor = NULL;
+    }
+  }
+
   // Iterate over the stored detector data sets and store the compression settings
   std::map<std::string, NDFileHDF5Dataset*>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
     it_dset->second->configureCompression(this->codec);
+    it_dset->second->configureChunkCompression(this->pNDArrayPool, this->chunkCompressor);
   }
   return asynSuccess;
 }
@@ -3746,11 +4134,15 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   int tempAlign = 0;
   int tempThreshold = 0;
   int SWMRMode = 0;
+  int metaBlockSize = 0;
+  int directIO = 0;
   static const char *functionName = "createNewFile";
 
   this->lock();
   getIntegerParam(NDFileHDF5_chunkBoundaryAlign, &tempAlign);
   getIntegerParam(NDFileHDF5_chunkBoundaryThreshold, (int*)&tempThreshold);
+  getIntegerParam(NDFileHDF5_metaBlockSize, &metaBlockSize);
+  getIntegerParam(NDFileHDF5_directIO, &directIO);
   // Check if we are in SWMR mode
   getIntegerParam(NDFileHDF5_SWMRMode, &SWMRMode);
   this->unlock();
@@ -3767,6 +4159,45 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   if (tempThreshold > 0){
     threshold = tempThreshold;
   }
+
+  /* Direct I/O: open the file with the direct VFD (O_DIRECT) so that chunks are written from
+   * the NDArray buffers to disk without going through the page cache. Writes that are not
+   * aligned to the block size in memory, in the file and in size are bounced through a copy
+   * buffer by the VFD, so chunks are aligned to the block size if no alignment is set. */
+  if (directIO == 1){
+    char directIOMessage[256] = "";
+    if (SWMRMode == 1){
+      epicsSnprintf(directIOMessage, sizeof(directIOMessage), "Direct I/O is not used in SWMR mode");
+    } else {
+      #ifdef H5_HAVE_DIRECT
+      size_t blockSize = (align > 0) ? (size_t)align : DIRECT_IO_BLOCK_SIZE;
+      // The copy buffer must be a multiple of the block size
+      size_t copyBufferSize = ((DIRECT_IO_COPY_BUFFER + blockSize - 1) / blockSize) * blockSize;
+      hdfstatus = H5Pset_fapl_direct(access_plist, blockSize, blockSize, copyBufferSize);
+      if (hdfstatus < 0){
+        epicsSnprintf(directIOMessage, sizeof(directIOMessage),
+            "Direct I/O is not used, cannot set the direct VFD with block size=%lu",
+            (unsigned long)blockSize);
+      } else if (align == 0){
+        align = blockSize;
+      }
+      #else
+      epicsSnprintf(directIOMessage, sizeof(directIOMessage),
+          "Direct I/O is not used, the HDF5 library was built without the direct VFD");
+      #endif
+    }
+    if (directIOMessage[0]){
+      // The file is still written, without direct I/O, so this is reported as a warning
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+          "%s::%s Warning: %s\n",
+          driverName, functionName, directIOMessage);
+      this->lock();
+      setIntegerParam(NDFileHDF5_directIO, 0);
+      setStringParam(NDFileWriteMessage, directIOMessage);
+      this->unlock();
+    }
+  }
+
   if (align > 0){
     hdfstatus = H5Pset_alignment( access_plist, threshold, align );
     if (hdfstatus < 0){
@@ -3781,6 +4212,17 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
     }
   }
 
+  /* Metadata is allocated in blocks of this size, which keeps it together and away from
+   * the aligned chunks. If it is 0 the library default is used. */
+  if (metaBlockSize > 0){
+    hdfstatus = H5Pset_meta_block_size(access_plist, (hsize_t)metaBlockSize);
+    if (hdfstatus < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s::%s Warning: failed to set metadata block size=%d bytes\n",
+          driverName, functionName, metaBlockSize);
+    }
+  }
+
   /* File creation property list: set the i-storek according to HDF group recommendations */
   H5Pset_fclose_degree(access_plist, H5F_CLOSE_STRONG);
 
@@ -3845,42 +4287,11 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   return asynSuccess;
 }
 
-/** Create the output file layout as specified by the XML layout.
+/** Load the XML layout from NDFileHDF5_layoutFilename, or the default layout if it is empty.
  */
-asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
+asynStatus NDFileHDF5::loadLayoutXML()
 {
-  hid_t hdfdatatype;
-  static const char *functionName = "createFileLayout";
-
-  /*
-   * Create the data space with appropriate dimensions
-   */
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-    "%s::%s Creating dataspace with given dimensions\n",
-    driverName, functionName);
-  this->dataspace = H5Screate_simple(this->rank, this->framesize, this->maxdims);
-
-  /*
-   * Modify dataset creation properties, i.e. enable chunking.
-   */
-  this->cparms = H5Pcreate(H5P_DATASET_CREATE);
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-    "%s::%s Configuring chunking\n",
-    driverName, functionName);
-  H5Pset_chunk(this->cparms, this->rank, this->chunkdims);
-
-  /* Get the datatype */
-  hdfdatatype = this->typeNd2Hdf(pArray->dataType);
-  this->datatype = H5Tcopy(hdfdatatype);
-
-  /* configure compression if required */
-  this->configureCompression(pArray);
-
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-    "%s::%s Setting fillvalue\n",
-    driverName, functionName);
-  H5Pset_fill_value(this->cparms, this->datatype, this->ptrFillValue );
-
+  static const char *functionName = "loadLayoutXML";
 
   //We use MAX_LAYOUT_LEN instead of MAX_FILENAME_LEN because we want to be able to load
   // in an xml string or a file containing the xml
@@ -3927,6 +4338,49 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
     }
   }
   delete [] layoutFile;
+  return asynSuccess;
+}
+
+/** Create the output file layout as specified by the XML layout.
+ */
+asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
+{
+  hid_t hdfdatatype;
+  static const char *functionName = "createFileLayout";
+
+  /*
+   * Create the data space with appropriate dimensions
+   */
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s::%s Creating dataspace with given dimensions\n",
+    driverName, functionName);
+  this->dataspace = H5Screate_simple(this->rank, this->framesize, this->maxdims);
+
+  /*
+   * Modify dataset creation properties, i.e. enable chunking.
+   */
+  this->cparms = H5Pcreate(H5P_DATASET_CREATE);
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s::%s Configuring chunking\n",
+    driverName, functionName);
+  H5Pset_chunk(this->cparms, this->rank, this->chunkdims);
+
+  /* Get the datatype */
+  hdfdatatype = this->typeNd2Hdf(pArray->dataType);
+  this->datatype = H5Tcopy(hdfdatatype);
+
+  /* configure compression if required */
+  this->configureCompression(pArray);
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+    "%s::%s Setting fillvalue\n",
+    driverName, functionName);
+  H5Pset_fill_value(this->cparms, this->datatype, this->ptrFillValue );
+
+
+  if (this->loadLayoutXML()){
+    return asynError;
+  }
 
   // Append the default NDArray attributes to the detector datasets
   if (this->writeDefaultDatasetAttributes(pArray)) {
@@ -17,6 +17,8 @@
 #include "NDFileHDF5LayoutXML.h"
 #include "NDFileHDF5AttributeDataset.h"
 #include "NDFileHDF5VersionCheck.h"
+#include "NDFileHDF5VDS.h"
+#include "NDFileHDF5Reader.h"
 #include "Codec.h"
 
 #define MAXEXTRADIMS 10
@@ -26,6 +28,11 @@
 #define str_NDFileHDF5_nFramesChunks     "HDF5_nFramesChunks"
 #define str_NDFileHDF5_chunkBoundaryAlign "HDF5_chunkBoundaryAlign"
 #define str_NDFileHDF5_chunkBoundaryThreshold "HDF5_chunkBoundaryThreshold"
+#define str_NDFileHDF5_metaBlockSize     "HDF5_metaBlockSize"
+#define str_NDFileHDF5_directIO          "HDF5_directIO"
+#define str_NDFileHDF5_rolloverVDS       "HDF5_rolloverVDS"
+#define str_NDFileHDF5_stripeCount       "HDF5_stripeCount"
+#define str_NDFileHDF5_stripeVDSFile     "HDF5_stripeVDSFile"
 #define str_NDFileHDF5_NDAttributeChunk  "HDF5_NDAttributeChunk"
 #define str_NDFileHDF5_nExtraDims        "HDF5_nExtraDims"
 #define str_NDFileHDF5_extraDimOffsetX   "HDF5_extraDimOffsetX"
@@ -34,12 +41,20 @@
 #define str_NDFileHDF5_storePerformance  "HDF5_storePerformance"
 #define str_NDFileHDF5_totalRuntime      "HDF5_totalRuntime"
 #define str_NDFileHDF5_totalIoSpeed      "HDF5_totalIoSpeed"
+#define str_NDFileHDF5_chunkCacheMax     "HDF5_chunkCacheMax"
+#define str_NDFileHDF5_chunkCacheSize    "HDF5_chunkCacheSize"
+#define str_NDFileHDF5_bytesWritten      "HDF5_bytesWritten"
+#define str_NDFileHDF5_chunksFlushed     "HDF5_chunksFlushed"
+#define str_NDFileHDF5_chunkEvictions    "HDF5_chunkEvictions"
+#define str_NDFileHDF5_avgWriteTime      "HDF5_avgWriteTime"
 #define str_NDFileHDF5_flushNthFrame     "HDF5_flushNthFrame"
 #define str_NDFileHDF5_compressionType   "HDF5_compressionType"
 #define str_NDFileHDF5_nbitsPrecision    "HDF5_nbitsPrecision"
 #define str_NDFileHDF5_nbitsOffset       "HDF5_nbitsOffset"
 #define str_NDFileHDF5_szipNumPixels     "HDF5_szipNumPixels"
 #define str_NDFileHDF5_zCompressLevel    "HDF5_zCompressLevel"
+#define str_NDFileHDF5_zstdCompressLevel "HDF5_zstdCompressLevel"
+#define str_NDFileHDF5_compressThreads   "HDF5_compressThreads"
 #define str_NDFileHDF5_bloscShuffleType  "HDF5_bloscShuffleType"
 #define str_NDFileHDF5_bloscCompressor   "HDF5_bloscCompressor"
 #define str_NDFileHDF5_bloscCompressLevel "HDF5_bloscCompressLevel"
@@ -83,6 +98,7 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual int getNumArraysInFile();
     virtual void report(FILE *fp, int details);
     virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
@@ -137,6 +153,11 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_chunkSize[MAX_CHUNK_DIMS];
     int NDFileHDF5_chunkBoundaryAlign;
     int NDFileHDF5_chunkBoundaryThreshold;
+    int NDFileHDF5_metaBlockSize;
+    int NDFileHDF5_directIO;
+    int NDFileHDF5_rolloverVDS;
+    int NDFileHDF5_stripeCount;
+    int NDFileHDF5_stripeVDSFile;
     int NDFileHDF5_NDAttributeChunk;
     int NDFileHDF5_nExtraDims;
     int NDFileHDF5_extraDimOffsetX;
@@ -148,12 +169,20 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_storePerformance;
     int NDFileHDF5_totalRuntime;
     int NDFileHDF5_totalIoSpeed;
+    int NDFileHDF5_chunkCacheMax;
+    int NDFileHDF5_chunkCacheSize;
+    int NDFileHDF5_bytesWritten;
+    int NDFileHDF5_chunksFlushed;
+    int NDFileHDF5_chunkEvictions;
+    int NDFileHDF5_avgWriteTime;
     int NDFileHDF5_flushNthFrame;
     int NDFileHDF5_compressionType;
     int NDFileHDF5_nbitsPrecision;
     int NDFileHDF5_nbitsOffset;
     int NDFileHDF5_szipNumPixels;
     int NDFileHDF5_zCompressLevel;
+    int NDFileHDF5_zstdCompressLevel;
+    int NDFileHDF5_compressThreads;
     int NDFileHDF5_bloscCompressor;
     int NDFileHDF5_bloscCompressLevel;
     int NDFileHDF5_bloscShuffleType;
@@ -200,13 +229,17 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     asynStatus writeStringAttribute(hid_t element, const char* attrName, const char* attrStrValue);
     asynStatus calculateAttributeChunking(int *chunking, int *mdim_chunking);
     asynStatus writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets);
+    asynStatus flushAttributeBuffers(int flush);
     asynStatus closeAttributeDataset();
+    void configureStripe(NDFileOpenMode_t openMode);
     asynStatus configurePerformanceDataset();
     asynStatus createPerformanceDataset();
     asynStatus writePerformanceDataset();
     unsigned int calcIstorek();
+    hsize_t calcChunkCacheChunks();
     hsize_t calcChunkCacheBytes();
     hsize_t calcChunkCacheSlots();
+    void publishWriteStats();
 
     void checkForOpenFile();
     bool checkForSWMRMode();
@@ -214,6 +247,8 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     void addDefaultAttributes(NDArray *pArray);
     asynStatus writeDefaultDatasetAttributes(NDArray *pArray);
     asynStatus createNewFile(const char *fileName);
+    asynStatus loadLayoutXML();
+    asynStatus openFileForRead(const char *fileName);
     asynStatus createFileLayout(NDArray *pArray);
     asynStatus createAttributeDataset(NDArray *pArray);
     int isAttributeIndex(const std::string& attName);
@@ -243,6 +278,15 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     epicsEventId flushEventId;
     epicsMutex flushLock;
 
+    NDFileHDF5ChunkCompressor *chunkCompressor;  /** < Threads compressing chunks, NULL if HDF5_compressThreads is 0 */
+    NDFileHDF5VDS *rolloverVDS;                  /** < Files of a stream that rolled over, for the VDS master file */
+    std::string rolloverVDSFileName;             /** < Name of the VDS master file */
+    NDFileHDF5Reader *reader;                    /** < Reads the frames of a file opened in read mode */
+    hsize_t readFrame;                           /** < Next frame to read in read mode */
+    int stripeCount;                             /** < Writers in the striped group, 0 if this writer is not striped */
+    std::string stripeVDSFileName;               /** < Name of the VDS master file of the striped group */
+    std::vector<hsize_t> stripeFrames;           /** < uniqueId of each frame in the detector dataset of this file */
+
     std::list<NDFileHDF5AttributeDataset*> attrList;
 
     /* HDF5 handles and references */
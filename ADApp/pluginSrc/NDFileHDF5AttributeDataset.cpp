@@ -15,6 +15,8 @@
 #include "NDFileHDF5AttributeDataset.h"
 
 #define MAX_ATTRIBUTE_STRING_SIZE 256
+// Upper limit on the memory used to buffer the records of one attribute dataset
+#define MAX_ATTRIBUTE_BUFFER_SIZE 65536
 
 NDFileHDF5AttributeDataset::NDFileHDF5AttributeDataset(hid_t file, const std::string& name, NDAttrDataType_t type) :
   name_(name),
@@ -38,7 +40,12 @@ NDFileHDF5AttributeDataset::NDFileHDF5AttributeDataset(hid_t file, const std::st
   rank_(0),
   nextRecord_(0),
   extraDimensions_(0),
-  whenToSave_(hdf5::OnFrame)
+  whenToSave_(hdf5::OnFrame),
+  buffer_(NULL),
+  elementBytes_(0),
+  bufferRecords_(0),
+  bufferedRecords_(0),
+  bufferStart_(0)
 {
   //printf("Constructor called for %s\n", name.c_str());
   // Allocate enough memory for the fill value to accept any data type
@@ -55,6 +62,7 @@ NDFileHDF5AttributeDataset::~NDFileHDF5AttributeDataset()
   if (this->dims_        != NULL) free(this->dims_);
   if (this->offset_      != NULL) free(this->offset_);
   if (this->elementSize_ != NULL) free(this->elementSize_);
+  if (this->buffer_      != NULL) free(this->buffer_);
 }
 
 void NDFileHDF5AttributeDataset::setDsetName(const std::string& dsetName)
@@ -130,6 +138,22 @@ asynStatus NDFileHDF5AttributeDataset::createHDF5Dataset()
 
   memspace_ = H5Screate_simple(rank_, elementSize_, NULL);
 
+  // Attributes saved on every frame into a 1D dataset are buffered and written a block at a time.
+  // A block is a whole chunk unless that would exceed MAX_ATTRIBUTE_BUFFER_SIZE.
+  if (this->buffer_ != NULL) free(this->buffer_);
+  buffer_ = NULL;
+  bufferRecords_ = 0;
+  bufferedRecords_ = 0;
+  if (rank_ == 1 && whenToSave_ == hdf5::OnFrame && chunk_[0] > 1) {
+    elementBytes_ = H5Tget_size(datatype_);
+    bufferRecords_ = chunk_[0];
+    if (bufferRecords_ * elementBytes_ > MAX_ATTRIBUTE_BUFFER_SIZE) {
+      bufferRecords_ = MAX_ATTRIBUTE_BUFFER_SIZE / elementBytes_;
+    }
+    buffer_ = (char *)calloc(bufferRecords_, elementBytes_);
+    if (buffer_ == NULL) bufferRecords_ = 0;
+  }
+
   return status;
 }
 
@@ -149,6 +173,21 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
     if (ret == ND_ERROR) {
       memset(pDatavalue, 0, MAX_ATTRIBUTE_STRING_SIZE);
     }
+
+    if (bufferRecords_ > 0) {
+      // Append the value to the buffer, an undefined value is stored as the fill value
+      if (bufferedRecords_ == 0) bufferStart_ = offset_[0];
+      memcpy(buffer_ + bufferedRecords_*elementBytes_, isUndefined_ ? ptrFillValue_ : pDatavalue, elementBytes_);
+      bufferedRecords_++;
+      if (flush == 1) {
+        status = this->flushDataset();
+      } else if (bufferedRecords_ == bufferRecords_) {
+        status = this->writeBuffer();
+      }
+      nextRecord_++;
+      return status;
+    }
+
     // Work with HDF5 library to select a suitable hyperslab (one element) and write the new data to it
     H5Dset_extent(dataset_, dims_);
     filespace_ = H5Dget_space(dataset_);
@@ -215,9 +254,32 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
   return status;
 }
 
+/** Write the buffered records to the dataset with a single hyperslab write */
+asynStatus NDFileHDF5AttributeDataset::writeBuffer()
+{
+  asynStatus status = asynSuccess;
+  hid_t blockspace;
+  herr_t hdfstatus;
+
+  if (bufferedRecords_ == 0) return status;
+
+  H5Dset_extent(dataset_, dims_);
+  filespace_ = H5Dget_space(dataset_);
+  H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, &bufferStart_, NULL, &bufferedRecords_, NULL);
+  blockspace = H5Screate_simple(1, &bufferedRecords_, NULL);
+  hdfstatus = H5Dwrite(dataset_, datatype_, blockspace, filespace_, H5P_DEFAULT, buffer_);
+  if (hdfstatus < 0) status = asynError;
+  H5Sclose(blockspace);
+  H5Sclose(filespace_);
+  bufferedRecords_ = 0;
+
+  return status;
+}
+
 asynStatus NDFileHDF5AttributeDataset::closeAttributeDataset()
 {
   //printf("close called for %s\n", name_.c_str());
+  this->writeBuffer();
   H5Dclose(dataset_);
   H5Sclose(memspace_);
   H5Sclose(dataspace_);
@@ -460,6 +522,9 @@ asynStatus NDFileHDF5AttributeDataset::flushDataset()
 {
   asynStatus status = asynSuccess;
 
+  // Buffered records must be in the dataset before it is flushed
+  status = this->writeBuffer();
+
   // We cannot flush for SWMR if the HDF version doesn't support it
   #if H5_VERSION_GE(1,9,178)
 
@@ -31,6 +31,7 @@ public:
   asynStatus writeAttributeDataset(hdf5::When_t whenToSave, hsize_t *offsets, NDAttribute *ndAttr, int flush, int indexed);
   asynStatus closeAttributeDataset();
   asynStatus flushDataset();
+  asynStatus writeBuffer();
   std::string getName();
   hid_t getHandle();
 
@@ -66,6 +67,11 @@ private:
   int              nextRecord_;
   int              extraDimensions_;
   hdf5::When_t     whenToSave_;
+  char             *buffer_;         // Values of OnFrame records not yet written to the dataset
+  size_t           elementBytes_;    // Size of one record in buffer_
+  hsize_t          bufferRecords_;   // Capacity of buffer_ in records, 0 if writes are not buffered
+  hsize_t          bufferedRecords_; // Number of records in buffer_
+  hsize_t          bufferStart_;     // Dataset offset of the first record in buffer_
 
 };
 
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "NDPluginCodec.h"
+#include "NDFileHDF5ChunkCompressor.h"
+
+static const char *fileName = "NDFileHDF5ChunkCompressor";
+
+static void compressTaskC(void *drvPvt)
+{
+  NDFileHDF5ChunkCompressor *pCompressor = (NDFileHDF5ChunkCompressor *)drvPvt;
+  pCompressor->compressTask();
+}
+
+/** Constructor.
+ * \param[in] name - Name used for the compression threads.
+ * \param[in] numThreads - Number of compression threads to create.
+ * \param[in] pPool - Pool that the compressed chunks are allocated from.
+ */
+NDFileHDF5ChunkCompressor::NDFileHDF5ChunkCompressor(const char *name, int numThreads, NDArrayPool *pPool) :
+                                                     pPool_(pPool), numRunning_(0), exiting_(false)
+{
+  char threadName[64];
+  static const char *functionName = "NDFileHDF5ChunkCompressor";
+
+  this->mutexId_     = epicsMutexCreate();
+  this->workEventId_ = epicsEventCreate(epicsEventEmpty);
+  this->doneEventId_ = epicsEventCreate(epicsEventEmpty);
+  this->exitEventId_ = epicsEventCreate(epicsEventEmpty);
+
+  for (int i = 0; i < numThreads; i++){
+    epicsSnprintf(threadName, sizeof(threadName), "%s_Compress%d", name, i);
+    epicsThreadId threadId = epicsThreadCreate(threadName,
+                                               epicsThreadPriorityMedium,
+                                               epicsThreadGetStackSize(epicsThreadStackMedium),
+                                               (EPICSTHREADFUNC)compressTaskC,
+                                               this);
+    if (threadId == NULL){
+      printf("%s::%s epicsThreadCreate failure for %s\n", fileName, functionName, threadName);
+      break;
+    }
+    this->threads_.push_back(threadId);
+    epicsMutexLock(this->mutexId_);
+    this->numRunning_++;
+    epicsMutexUnlock(this->mutexId_);
+  }
+}
+
+NDFileHDF5ChunkCompressor::~NDFileHDF5ChunkCompressor()
+{
+  epicsMutexLock(this->mutexId_);
+  this->exiting_ = true;
+  epicsEventSignal(this->workEventId_);
+  while (this->numRunning_ > 0){
+    epicsMutexUnlock(this->mutexId_);
+    epicsEventWait(this->exitEventId_);
+    epicsMutexLock(this->mutexId_);
+  }
+  epicsMutexUnlock(this->mutexId_);
+  epicsMutexDestroy(this->mutexId_);
+  epicsEventDestroy(this->workEventId_);
+  epicsEventDestroy(this->doneEventId_);
+  epicsEventDestroy(this->exitEventId_);
+}
+
+/** Return the number of compression threads that are running. */
+int NDFileHDF5ChunkCompressor::getNumThreads()
+{
+  return (int)this->threads_.size();
+}
+
+/** Queue a chunk for compression.  The caller keeps ownership of the chunk and must
+ * call wait() for it before using its output.
+ * \param[in] pChunk - The chunk to compress.
+ */
+void NDFileHDF5ChunkCompressor::submit(NDFileHDF5Chunk *pChunk)
+{
+  pChunk->done = false;
+  pChunk->pOutput = NULL;
+  epicsMutexLock(this->mutexId_);
+  this->queue_.push_back(pChunk);
+  epicsMutexUnlock(this->mutexId_);
+  epicsEventSignal(this->workEventId_);
+}
+
+/** Wait until a submitted chunk has been compressed.
+ * \param[in] pChunk - The chunk to wait for.
+ */
+void NDFileHDF5ChunkCompressor::wait(NDFileHDF5Chunk *pChunk)
+{
+  epicsMutexLock(this->mutexId_);
+  while (!pChunk->done){
+    epicsMutexUnlock(this->mutexId_);
+    epicsEventWait(this->doneEventId_);
+    epicsMutexLock(this->mutexId_);
+  }
+  epicsMutexUnlock(this->mutexId_);
+}
+
+/** Return true if a submitted chunk has been compressed.
+ * \param[in] pChunk - The chunk to check.
+ */
+bool NDFileHDF5ChunkCompressor::isDone(NDFileHDF5Chunk *pChunk)
+{
+  epicsMutexLock(this->mutexId_);
+  bool done = pChunk->done;
+  epicsMutexUnlock(this->mutexId_);
+  return done;
+}
+
+/** Compression thread, takes chunks from the queue in order and compresses them. */
+void NDFileHDF5ChunkCompressor::compressTask()
+{
+  char errorMessage[256];
+  NDFileHDF5Chunk *pChunk;
+
+  epicsMutexLock(this->mutexId_);
+  while (1){
+    while (this->queue_.empty() && !this->exiting_){
+      epicsMutexUnlock(this->mutexId_);
+      epicsEventWait(this->workEventId_);
+      epicsMutexLock(this->mutexId_);
+    }
+    if (this->exiting_) break;
+    pChunk = this->queue_.front();
+    this->queue_.pop_front();
+    // Wake another thread for the rest of the queue
+    if (!this->queue_.empty()) epicsEventSignal(this->workEventId_);
+    epicsMutexUnlock(this->mutexId_);
+
+    // A chunk that can't be compressed here is left to the HDF5 filter by the dataset
+    NDArray *pOutput = compress(pChunk->pArray, pChunk->codec, this->pPool_, errorMessage);
+
+    epicsMutexLock(this->mutexId_);
+    pChunk->pOutput = pOutput;
+    pChunk->done = true;
+    epicsEventSignal(this->doneEventId_);
+  }
+  this->numRunning_--;
+  epicsMutexUnlock(this->mutexId_);
+  // Pass the exit request on to the next thread
+  epicsEventSignal(this->workEventId_);
+  epicsEventSignal(this->exitEventId_);
+}
+
+/** Return true if chunks for a dataset with this filter can be compressed by compress().
+ * \param[in] codec - The codec of the dataset filter.
+ */
+bool NDFileHDF5ChunkCompressor::canCompress(const Codec_t& codec)
+{
+  if (codec.name == codecName[NDCODEC_LZ4] ||
+      codec.name == codecName[NDCODEC_BSLZ4] ||
+      codec.name == codecName[NDCODEC_ZSTD] ||
+      codec.name == codecName[NDCODEC_BSZSTD] ||
+      codec.name == codecName[NDCODEC_BLOSC]) {
+    return true;
+  }
+#ifdef HAVE_ZLIB
+  if (codec.name == "zlib") return true;
+#endif
+  return false;
+}
+
+/** Compress a chunk exactly as the HDF5 filter of the dataset would, apart from the
+ * lz4 and bitshuffle headers which the dataset adds when it writes the chunk.
+ * \param[in] pArray - The uncompressed chunk.
+ * \param[in] codec - The codec of the dataset filter.
+ * \param[in] pPool - Pool to allocate the compressed chunk from; the pool of pArray if NULL.
+ * \param[out] errorMessage - Reason for a failure.
+ * \return The compressed chunk or NULL if it could not be compressed.
+ */
+NDArray *NDFileHDF5ChunkCompressor::compress(NDArray *pArray, const Codec_t& codec, NDArrayPool *pPool, char *errorMessage)
+{
+  NDArray *pOutput = NULL;
+  NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+  NDArrayInfo_t info;
+
+  pArray->getInfo(&info);
+  if (codec.name == codecName[NDCODEC_LZ4]) {
+    pOutput = compressLZ4(pArray, 0, 1, &codecStatus, errorMessage, pPool);
+  } else if (codec.name == codecName[NDCODEC_BSLZ4]) {
+    pOutput = compressBSLZ4(pArray, 0, 1, &codecStatus, errorMessage, pPool);
+  } else if (codec.name == codecName[NDCODEC_ZSTD]) {
+    pOutput = compressZstd(pArray, codec.level, 1, &codecStatus, errorMessage, pPool);
+  } else if (codec.name == codecName[NDCODEC_BSZSTD]) {
+    pOutput = compressBSZstd(pArray, codec.level, 0, 1, &codecStatus, errorMessage, pPool);
+  } else if (codec.name == codecName[NDCODEC_BLOSC]) {
+    pOutput = compressBlosc(pArray, codec.level, codec.shuffle, (NDCodecBloscComp_t)codec.compressor,
+                            1, &codecStatus, errorMessage, pPool);
+    // The HDF5 blosc filter fails rather than store a chunk that does not compress
+    if (pOutput && pOutput->compressedSize > info.totalBytes) {
+      sprintf(errorMessage, "Blosc output larger than the input");
+      pOutput->release();
+      pOutput = NULL;
+    }
+  }
+#ifdef HAVE_ZLIB
+  else if (codec.name == "zlib") {
+    // The HDF5 deflate filter is a single compress2() call at the configured level
+    uLongf compSize = compressBound((uLong)info.totalBytes);
+    char *pScratch = (char *)malloc(compSize);
+    if (pScratch == NULL) {
+      sprintf(errorMessage, "Failed to allocate zlib scratch buffer");
+      return NULL;
+    }
+    if (compress2((Bytef *)pScratch, &compSize, (const Bytef *)pArray->pData,
+                  (uLong)info.totalBytes, codec.level) != Z_OK) {
+      sprintf(errorMessage, "Internal zlib error");
+      free(pScratch);
+      return NULL;
+    }
+    NDArrayPool *pool = pPool ? pPool : pArray->pNDArrayPool;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    for (int i = 0; i < pArray->ndims; i++) dims[i] = pArray->dims[i].size;
+    if (pool) pOutput = pool->alloc(pArray->ndims, dims, pArray->dataType, compSize, NULL);
+    if (pOutput == NULL) {
+      sprintf(errorMessage, "Failed to allocate zlib output array");
+    } else {
+      memcpy(pOutput->pData, pScratch, compSize);
+      pOutput->codec.name = "zlib";
+      pOutput->codec.level = codec.level;
+      pOutput->compressedSize = compSize;
+    }
+    free(pScratch);
+  }
+#endif
+  else {
+    sprintf(errorMessage, "Unsupported codec %s", codec.name.c_str());
+  }
+  return pOutput;
+}
@@ -0,0 +1,56 @@
+#ifndef NDFILEHDF5CHUNKCOMPRESSOR_H_
+#define NDFILEHDF5CHUNKCOMPRESSOR_H_
+
+#include <deque>
+#include <vector>
+#include <hdf5.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <NDPluginAPI.h>
+#include "NDArray.h"
+
+/** A whole chunk of a dataset waiting to be compressed by NDFileHDF5ChunkCompressor
+  * and then written by the dataset with a direct chunk write.
+  */
+typedef struct NDFileHDF5Chunk {
+    NDArray *pArray;              /**< Uncompressed chunk; the chunk holds a reference to it */
+    NDArray *pOutput;             /**< Compressed chunk, NULL if it could not be compressed */
+    Codec_t codec;                /**< Codec of the dataset filter */
+    std::vector<hsize_t> offset;  /**< Offset of the chunk in the dataset */
+    std::vector<hsize_t> count;   /**< Size of the chunk in the dataset */
+    bool done;                    /**< Set by the compression thread when pOutput is ready */
+} NDFileHDF5Chunk;
+
+/** Pool of threads that compress dataset chunks for NDFileHDF5 with the same
+  * filter settings as the HDF5 filter pipeline, so that the writing thread only
+  * has to write the compressed chunks.
+  */
+class NDPLUGIN_API NDFileHDF5ChunkCompressor
+{
+  public:
+    NDFileHDF5ChunkCompressor(const char *name, int numThreads, NDArrayPool *pPool);
+    ~NDFileHDF5ChunkCompressor();
+
+    void submit(NDFileHDF5Chunk *pChunk);
+    void wait(NDFileHDF5Chunk *pChunk);
+    bool isDone(NDFileHDF5Chunk *pChunk);
+    int getNumThreads();
+    void compressTask();
+
+    static bool canCompress(const Codec_t& codec);
+    static NDArray *compress(NDArray *pArray, const Codec_t& codec, NDArrayPool *pPool, char *errorMessage);
+
+  private:
+    NDArrayPool *pPool_;          // Pool the compressed chunks are allocated from
+    std::deque<NDFileHDF5Chunk *> queue_;
+    std::vector<epicsThreadId> threads_;
+    int numRunning_;              // Threads that have not exited yet
+    bool exiting_;
+    epicsMutexId mutexId_;
+    epicsEventId workEventId_;
+    epicsEventId doneEventId_;
+    epicsEventId exitEventId_;
+};
+
+#endif
@@ -28,6 +28,17 @@ NDFileHDF5Dataset::NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& nam
   this->offset_      = NULL;
   this->virtualdims_ = NULL;
   this->virtualchunkdims_ = NULL;
+  this->stageArray_       = NULL;
+  this->stageFrameBytes_  = 0;
+  this->stagedFrames_     = 0;
+  this->stageStart_       = 0;
+  this->pPool_            = NULL;
+  this->pCompressor_      = NULL;
+  memset(&this->stats_, 0, sizeof(this->stats_));
+  this->cacheChunksPerFrame_ = 1;
+  this->cacheCapacity_       = 0;
+  this->cacheUsed_           = 0;
+  this->cacheUseCount_       = 0;
 }
 
 NDFileHDF5Dataset::~NDFileHDF5Dataset()
@@ -38,6 +49,16 @@ NDFileHDF5Dataset::~NDFileHDF5Dataset()
   if (this->offset_      != NULL) free(this->offset_);
   if (this->virtualdims_ != NULL) free(this->virtualdims_);
   if (this->virtualchunkdims_ != NULL) free(this->virtualchunkdims_);
+  if (this->stageArray_  != NULL) this->stageArray_->release();
+  // Chunks are normally written by writePendingChunks() before the dataset is closed
+  while (!this->chunks_.empty()) {
+    NDFileHDF5Chunk *pChunk = this->chunks_.front();
+    this->chunks_.pop_front();
+    this->pCompressor_->wait(pChunk);
+    if (pChunk->pOutput) pChunk->pOutput->release();
+    pChunk->pArray->release();
+    delete pChunk;
+  }
 }
 
 /** configureDims.
@@ -241,6 +262,17 @@ void NDFileHDF5Dataset::configureCompression(Codec_t codec)
   this->codec = codec;
 }
 
+/**
+ * Set where whole chunks are allocated and compressed
+ * \param[in] pPool - Pool to allocate staged and compressed chunks from, NULL to disable staging.
+ * \param[in] pCompressor - Threads to compress chunks with, NULL to compress them in the writing thread.
+ */
+void NDFileHDF5Dataset::configureChunkCompression(NDArrayPool *pPool, NDFileHDF5ChunkCompressor *pCompressor)
+{
+  this->pPool_ = pPool;
+  this->pCompressor_ = pCompressor;
+}
+
 /** writeFile.
  * Write the data using the HDF5 library calls.
  * \param[in] pArray - The NDArray containing the data to write.
@@ -251,8 +283,21 @@ void NDFileHDF5Dataset::configureCompression(Codec_t codec)
 asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize)
 {
   herr_t hdfstatus;
+  asynStatus status;
+  bool staged = false;
   static const char *functionName = "writeFile";
 
+  // Frames of a chunk that spans several frames are collected and written as a whole chunk
+  status = this->stageFrame(pArray, &staged);
+  if (staged){
+    if (status == asynSuccess) this->nextRecord_++;
+    return status;
+  }
+  // Anything written in the writing thread must follow the chunks still being compressed
+  if (!this->canSubmitFrame(pArray) && this->writeCompressedChunks(true) != asynSuccess) {
+    return asynError;
+  }
+
   // Increase the size of the dataset
   asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
             "%s::%s: set_extent dims={%d,%d,%d}\n",
@@ -265,6 +310,14 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
               fileName, functionName, this->name_.c_str());
     return asynError;
   }
+  // A frame that is a whole chunk is compressed by the compression threads
+  if (this->canSubmitFrame(pArray)){
+    pArray->reserve();
+    status = this->submitChunk(pArray, this->offset_, framesize);
+    if (status == asynSuccess) this->nextRecord_++;
+    return status;
+  }
+
   // Select a hyperslab.
   hid_t fspace = H5Dget_space(this->dataset_);
   if (fspace < 0){
@@ -288,54 +341,9 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
               "%s::%s NDArray correctly chunked. Using direct chunk write\n",
               fileName, functionName);
-    size_t size = pArray->compressedSize;
-    void *pData = pArray->pData;
-    char *temp=0;
-    NDArrayInfo_t info;
-    pArray->getInfo(&info);
-    if (pArray->codec.empty()) {
-        size = info.totalBytes;
-    }
-    else if (pArray->codec.name == codecName[NDCODEC_LZ4]) {
-        // We need to add a 16-byte header to the lz4 compressed data
-        temp = (char *)malloc(16 + size);
-        // First 8 bytes is the uncompressed array size
-        unsigned long long ui64 = htonll(info.totalBytes);
-        memcpy(temp, &ui64, 8);
-        // Next 4 bytes is the block size = uncompressed size as long as < 1GB which we assume here
-        epicsUInt32 ui32 = htonl((int)info.totalBytes);
-        memcpy(temp+8, &ui32, 4);
-        // Next 4 bytes is the compressed size
-        ui32 = htonl((int)size);
-        memcpy(temp+12, &ui32, 4);
-        // Now copy the data
-        memcpy(temp+16, pArray->pData, size);
-        pData = temp;
-        size += 16;
-    }
-    else if (pArray->codec.name == codecName[NDCODEC_BSLZ4]) {
-        // We need to add a 12-byte header to the bs/lz4 compressed data
-        temp = (char *)malloc(12 + size);
-        // First 8 bytes is the uncompressed array size
-        unsigned long long ui64 = htonll(info.totalBytes);
-        memcpy(temp, &ui64, 8);
-        // Next 4 bytes is the block size * elem_size;  8192 is the default in bitshuffle
-        epicsUInt32 ui32 = htonl(8192);
-        memcpy(temp+8, &ui32, 4);
-        // Now copy the data
-        memcpy(temp+12, pArray->pData, size);
-        pData = temp;
-        size += 12;
-    }
-    #if H5_VERSION_GE(1, 10, 3)
-    hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
-                               this->offset_, size, pData);
-    #else  // Use deprecated method
-    hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
-                                this->offset_, size, pData);
-    #endif
-    if (temp) {
-        free(temp);
+    if (this->writeChunk(pArray, this->offset_) != asynSuccess) {
+      H5Sclose(fspace);
+      return asynError;
     }
   } else {
     // Either direct chunk write is not available, or we need to use the HDF5 pipeline for
@@ -351,30 +359,502 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
               "%s::%s NDArray not correctly chunked. Using standard write\n",
               fileName, functionName);
+    epicsTimeStamp start;
+    NDArrayInfo_t info;
+    pArray->getInfo(&info);
+    epicsTimeGetCurrent(&start);
     hdfstatus = H5Dwrite(this->dataset_, datatype, dataspace, fspace, H5P_DEFAULT, pArray->pData);
+    this->addWriteTime(start, info.totalBytes);
+    this->cacheFrame(this->offset_);
+    if (hdfstatus){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Unable to write data to hyperslab\n",
+                fileName, functionName);
+      H5Sclose(fspace);
+      return asynError;
+    }
   }
 
+  hdfstatus = H5Sclose(fspace);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
-              "%s::%s ERROR Unable to write data to hyperslab\n",
+              "%s::%s ERROR Unable to close the dataspace\n",
               fileName, functionName);
-    H5Sclose(fspace);
     return asynError;
   }
 
-  hdfstatus = H5Sclose(fspace);
+  this->nextRecord_++;
+
+  return asynSuccess;
+}
+
+/** writeChunk.
+ * Write a whole chunk with the HDF5 direct chunk write, adding the header
+ * the HDF5 filter expects in front of compressed data.
+ * \param[in] pArray - The NDArray holding the chunk, compressed or not.
+ * \param[in] offset - The offset of the chunk in the dataset.
+ */
+asynStatus NDFileHDF5Dataset::writeChunk(NDArray *pArray, hsize_t *offset)
+{
+  herr_t hdfstatus = -1;
+  static const char *functionName = "writeChunk";
+
+#if H5_VERSION_GE(1, 8, 11)
+  size_t size = pArray->compressedSize;
+  void *pData = pArray->pData;
+  char *temp=0;
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+  if (pArray->codec.empty()) {
+      size = info.totalBytes;
+  }
+  else if ((pArray->codec.name == codecName[NDCODEC_LZ4]) && (pArray->codec.blockSize > 0)) {
+      // Blocked lz4 data already carries the HDF5 lz4 filter framing, write it as-is
+  }
+  else if (pArray->codec.name == codecName[NDCODEC_LZ4]) {
+      // We need to add a 16-byte header to the lz4 compressed data
+      temp = (char *)malloc(16 + size);
+      // First 8 bytes is the uncompressed array size
+      unsigned long long ui64 = htonll(info.totalBytes);
+      memcpy(temp, &ui64, 8);
+      // Next 4 bytes is the block size = uncompressed size as long as < 1GB which we assume here
+      epicsUInt32 ui32 = htonl((int)info.totalBytes);
+      memcpy(temp+8, &ui32, 4);
+      // Next 4 bytes is the compressed size
+      ui32 = htonl((int)size);
+      memcpy(temp+12, &ui32, 4);
+      // Now copy the data
+      memcpy(temp+16, pArray->pData, size);
+      pData = temp;
+      size += 16;
+  }
+  else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+      // The HDF5 zstd filter stores a plain zstd frame, write it as-is
+  }
+  else if ((pArray->codec.name == codecName[NDCODEC_BSLZ4]) ||
+           (pArray->codec.name == codecName[NDCODEC_BSZSTD])) {
+      // We need to add a 12-byte header to the bs/lz4 and bs/zstd compressed data
+      temp = (char *)malloc(12 + size);
+      // First 8 bytes is the uncompressed array size
+      unsigned long long ui64 = htonll(info.totalBytes);
+      memcpy(temp, &ui64, 8);
+      // Next 4 bytes is the block size * elem_size;  8192 is the default in bitshuffle
+      epicsUInt32 ui32 = htonl(8192);
+      memcpy(temp+8, &ui32, 4);
+      // Now copy the data
+      memcpy(temp+12, pArray->pData, size);
+      pData = temp;
+      size += 12;
+  }
+  epicsTimeStamp start;
+  epicsTimeGetCurrent(&start);
+  #if H5_VERSION_GE(1, 10, 3)
+  hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
+                             offset, size, pData);
+  #else  // Use deprecated method
+  hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
+                              offset, size, pData);
+  #endif
+  // A direct chunk write bypasses the chunk cache, the chunk goes to the file whole
+  this->addWriteTime(start, size);
+  if (hdfstatus == 0) this->stats_.chunksFlushed++;
+  if (temp) {
+      free(temp);
+  }
+#endif
+
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
-              "%s::%s ERROR Unable to close the dataspace\n",
-              fileName, functionName);
+              "%s::%s ERROR Unable to write chunk to dataset [%s]\n",
+              fileName, functionName, this->name_.c_str());
     return asynError;
   }
+  return asynSuccess;
+}
 
-  this->nextRecord_++;
+/** canSubmitFrame.
+ * Check whether an uncompressed frame is exactly one chunk of a compressed dataset,
+ * in which case it can be compressed by the compression threads.
+ * \param[in] pArray - The NDArray to check.
+ */
+bool NDFileHDF5Dataset::canSubmitFrame(NDArray *pArray)
+{
+  if (!H5_VERSION_GE(1, 8, 11) || this->pCompressor_ == NULL) return false;
+  if (!pArray->codec.empty() || !NDFileHDF5ChunkCompressor::canCompress(this->codec)) return false;
+  if (this->multiFrame_ && this->chunkdims_[pArray->ndims] != 1) return false;
+  for (int index = 0; index < pArray->ndims; index++) {
+    if (pArray->dims[index].size != this->chunkdims_[index]) return false;
+  }
+  for (int index = 0; index < this->extra_rank_; index++) {
+    if (this->virtualchunkdims_[index] > 1) return false;
+  }
+  return true;
+}
+
+/** stageFrame.
+ * When a chunk spans several frames, copy the frame into a staging array
+ * instead of handing it to the HDF5 chunk cache.  Once the chunk is complete it
+ * is compressed (if required) and written with a single direct chunk write.
+ * Staging is only used for uncompressed arrays that fill the frame dimensions of
+ * the chunk, without extra dimensions, and for datasets that are uncompressed or
+ * use a filter that NDFileHDF5ChunkCompressor can apply; anything else goes through
+ * the HDF5 filter pipeline as before.
+ * \param[in] pArray - The NDArray to stage.
+ * \param[out] staged - Set to true if the frame was taken by the staging array.
+ */
+asynStatus NDFileHDF5Dataset::stageFrame(NDArray *pArray, bool *staged)
+{
+  asynStatus status = asynSuccess;
+  int ndims = pArray->ndims;
+  NDArrayInfo_t info;
+  static const char *functionName = "stageFrame";
+
+  *staged = false;
+  if (!H5_VERSION_GE(1, 8, 11) || this->pPool_ == NULL) return asynSuccess;
+  if (!this->multiFrame_ || this->extra_rank_ != 1 || !pArray->codec.empty()) return asynSuccess;
+  if (ndims >= ND_ARRAY_MAX_DIMS || this->chunkdims_[ndims] <= 1) return asynSuccess;
+  for (int index = 0; index < ndims; index++) {
+    if (pArray->dims[index].size != this->chunkdims_[index]) return asynSuccess;
+  }
+  if (!this->codec.empty() && !NDFileHDF5ChunkCompressor::canCompress(this->codec)) return asynSuccess;
+  pArray->getInfo(&info);
+  hsize_t frame = this->offset_[0];
+
+  if (this->stagedFrames_ > 0) {
+    if (frame != this->stageStart_ + this->stagedFrames_ ||
+        info.totalBytes != this->stageFrameBytes_ || pArray->dataType != this->stageArray_->dataType) {
+      // Not the next frame of the chunk being collected, write out what we have
+      status = this->writeStagedFrames();
+      if (status != asynSuccess) return status;
+    }
+  }
+
+  if (this->stagedFrames_ == 0) {
+    // Only start collecting on a chunk boundary
+    if (frame % this->chunkdims_[ndims] != 0) return asynSuccess;
+    if (this->stageArray_ != NULL && this->stageArray_->dataType != pArray->dataType) {
+      this->stageArray_->release();
+      this->stageArray_ = NULL;
+    }
+    if (this->stageArray_ == NULL) {
+      size_t dims[ND_ARRAY_MAX_DIMS];
+      for (int index = 0; index < ndims; index++) {
+        dims[index] = pArray->dims[index].size;
+      }
+      dims[ndims] = (size_t)this->chunkdims_[ndims];
+      this->stageArray_ = this->pPool_->alloc(ndims+1, dims, pArray->dataType, 0, NULL);
+      if (this->stageArray_ == NULL) {
+        asynPrint(this->pAsynUser_, ASYN_TRACE_WARNING,
+                  "%s::%s WARNING Unable to allocate staging array for dataset [%s]\n",
+                  fileName, functionName, this->name_.c_str());
+        return asynSuccess;
+      }
+    }
+    this->stageStart_ = frame;
+    this->stageFrameBytes_ = info.totalBytes;
+  }
+
+  memcpy((char *)this->stageArray_->pData + this->stagedFrames_ * this->stageFrameBytes_,
+         pArray->pData, this->stageFrameBytes_);
+  this->stagedFrames_++;
+  *staged = true;
+
+  if (this->stagedFrames_ == (int)this->chunkdims_[ndims]) {
+    status = this->writeStagedFrames();
+  }
+  return status;
+}
+
+/** writeStagedFrames.
+ * Write the frames held in the staging array to the dataset.  A complete chunk
+ * is written with a direct chunk write, a partial chunk (at a flush, at the end
+ * of the acquisition or when frames arrive out of order) is written through the
+ * HDF5 pipeline.
+ */
+asynStatus NDFileHDF5Dataset::writeStagedFrames()
+{
+  herr_t hdfstatus;
+  asynStatus status = asynSuccess;
+  char errorMessage[256] = "";
+  static const char *functionName = "writeStagedFrames";
+
+  if (this->stagedFrames_ == 0) return asynSuccess;
+
+  int chunkFrames = (int)this->stageArray_->dims[this->stageArray_->ndims-1].size;
+  hsize_t *offset = (hsize_t *)calloc(this->rank_, sizeof(hsize_t));
+  hsize_t *count  = (hsize_t *)calloc(this->rank_, sizeof(hsize_t));
+  offset[0] = this->stageStart_;
+  count[0] = this->stagedFrames_;
+  for (int i = 1; i < this->rank_; i++) {
+    count[i] = this->maxdims_[i];
+  }
 
+  hdfstatus = H5Dset_extent(this->dataset_, this->dims_);
+  if (hdfstatus){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Increasing the size of the dataset [%s] failed\n",
+              fileName, functionName, this->name_.c_str());
+    status = asynError;
+  } else if (this->stagedFrames_ == chunkFrames && this->codec.empty()) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+              "%s::%s Writing %d staged frames of dataset [%s] with direct chunk write\n",
+              fileName, functionName, this->stagedFrames_, this->name_.c_str());
+    status = this->writeChunk(this->stageArray_, offset);
+  } else if (this->stagedFrames_ == chunkFrames && this->pCompressor_ != NULL) {
+    // The chunk now belongs to the compression threads, the next one is staged in a new array
+    status = this->submitChunk(this->stageArray_, offset, count);
+    this->stageArray_ = NULL;
+  } else {
+    NDArray *pOutput = NULL;
+    if (this->stagedFrames_ == chunkFrames) {
+      pOutput = NDFileHDF5ChunkCompressor::compress(this->stageArray_, this->codec, this->pPool_, errorMessage);
+      if (pOutput == NULL) {
+        asynPrint(this->pAsynUser_, ASYN_TRACE_WARNING,
+                  "%s::%s WARNING Unable to compress chunk of dataset [%s] (%s), using the HDF5 filter\n",
+                  fileName, functionName, this->name_.c_str(), errorMessage);
+      }
+    }
+    if (pOutput != NULL) {
+      status = this->writeChunk(pOutput, offset);
+      pOutput->release();
+    } else {
+      status = this->writeCompressedChunks(true);
+      if (this->writeHyperslab(this->stageArray_->pData, offset, count) != asynSuccess) status = asynError;
+    }
+  }
+
+  free(offset);
+  free(count);
+  this->stagedFrames_ = 0;
+  return status;
+}
+
+/** submitChunk.
+ * Queue a whole uncompressed chunk on the compression threads and write the chunks
+ * that are ready, in the order they were submitted.
+ * \param[in] pArray - The chunk; the dataset takes over a reference to it.
+ * \param[in] offset - The offset of the chunk in the dataset.
+ * \param[in] count - The size of the chunk in the dataset.
+ */
+asynStatus NDFileHDF5Dataset::submitChunk(NDArray *pArray, hsize_t *offset, hsize_t *count)
+{
+  NDFileHDF5Chunk *pChunk = new NDFileHDF5Chunk;
+  pChunk->pArray = pArray;
+  pChunk->codec = this->codec;
+  pChunk->offset.assign(offset, offset + this->rank_);
+  pChunk->count.assign(count, count + this->rank_);
+  this->pCompressor_->submit(pChunk);
+  this->chunks_.push_back(pChunk);
+  return this->writeCompressedChunks(false);
+}
+
+/** writeCompressedChunks.
+ * Write the chunks that the compression threads have finished, in order.
+ * \param[in] wait - Wait for all chunks, otherwise only wait when more than
+ *                   two chunks per compression thread are outstanding.
+ */
+asynStatus NDFileHDF5Dataset::writeCompressedChunks(bool wait)
+{
+  asynStatus status = asynSuccess;
+  static const char *functionName = "writeCompressedChunks";
+
+  while (!this->chunks_.empty()) {
+    NDFileHDF5Chunk *pChunk = this->chunks_.front();
+    if (!wait && this->chunks_.size() <= (size_t)(2 * this->pCompressor_->getNumThreads()) &&
+        !this->pCompressor_->isDone(pChunk)) {
+      break;
+    }
+    this->pCompressor_->wait(pChunk);
+    this->chunks_.pop_front();
+    if (pChunk->pOutput != NULL) {
+      if (this->writeChunk(pChunk->pOutput, &pChunk->offset[0]) != asynSuccess) status = asynError;
+      pChunk->pOutput->release();
+    } else {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_WARNING,
+                "%s::%s WARNING Unable to compress chunk of dataset [%s], using the HDF5 filter\n",
+                fileName, functionName, this->name_.c_str());
+      if (this->writeHyperslab(pChunk->pArray->pData, &pChunk->offset[0], &pChunk->count[0]) != asynSuccess) {
+        status = asynError;
+      }
+    }
+    pChunk->pArray->release();
+    delete pChunk;
+  }
+  return status;
+}
+
+/** writeHyperslab.
+ * Write a block of frames through the HDF5 pipeline.
+ * \param[in] pData - The data to write.
+ * \param[in] offset - The offset of the block in the dataset.
+ * \param[in] count - The size of the block in the dataset.
+ */
+asynStatus NDFileHDF5Dataset::writeHyperslab(void *pData, hsize_t *offset, hsize_t *count)
+{
+  herr_t hdfstatus = -1;
+  static const char *functionName = "writeHyperslab";
+
+  hid_t fspace = H5Dget_space(this->dataset_);
+  hid_t mspace = H5Screate_simple(this->rank_, count, NULL);
+  hid_t mtype  = H5Dget_type(this->dataset_);
+  if (fspace >= 0 && mspace >= 0 && mtype >= 0) {
+    hdfstatus = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, offset, NULL, count, NULL);
+    if (hdfstatus >= 0) {
+      epicsTimeStamp start;
+      size_t bytes = H5Tget_size(mtype);
+      for (int i = 0; i < this->rank_; i++) bytes *= (size_t)count[i];
+      epicsTimeGetCurrent(&start);
+      hdfstatus = H5Dwrite(this->dataset_, mtype, mspace, fspace, H5P_DEFAULT, pData);
+      this->addWriteTime(start, bytes);
+      // Blocks written here are frames along the first dimension only
+      std::vector<hsize_t> frame(offset, offset + this->rank_);
+      for (hsize_t i = 0; i < count[0]; i++, frame[0]++) this->cacheFrame(&frame[0]);
+    }
+  }
+  if (mtype  >= 0) H5Tclose(mtype);
+  if (mspace >= 0) H5Sclose(mspace);
+  if (fspace >= 0) H5Sclose(fspace);
+  if (hdfstatus){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to write to dataset [%s]\n",
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
   return asynSuccess;
 }
 
+/** writePendingChunks.
+ * Write the frames of a partial chunk and wait for the compression threads to
+ * finish, so that everything received so far is in the file.
+ */
+asynStatus NDFileHDF5Dataset::writePendingChunks()
+{
+  asynStatus status = this->writeStagedFrames();
+  if (this->writeCompressedChunks(true) != asynSuccess) status = asynError;
+  return status;
+}
+
+/** configureChunkCache.
+ * Set the chunk geometry that the chunk cache statistics are worked out from.
+ * \param[in] rank - Number of dimensions of the dataset.
+ * \param[in] extraRank - Number of extra dimensions, including the frame number dimension.
+ * \param[in] chunkdims - Chunk size of each dimension.
+ * \param[in] maxdims - Maximum size of each dimension, H5S_UNLIMITED if unlimited.
+ * \param[in] cacheChunks - Number of chunks that fit in the chunk cache of the dataset.
+ */
+void NDFileHDF5Dataset::configureChunkCache(int rank, int extraRank, hsize_t *chunkdims, hsize_t *maxdims, hsize_t cacheChunks)
+{
+  this->cacheChunkDims_.clear();
+  this->cacheMaxDims_.clear();
+  this->cacheChunks_.clear();
+  this->cacheChunksPerFrame_ = 1;
+  for (int i = 0; i < rank; i++) {
+    hsize_t chunk = chunkdims[i] > 0 ? chunkdims[i] : 1;
+    hsize_t dim = (maxdims[i] == H5S_UNLIMITED) ? 0 : maxdims[i];
+    if (i < extraRank) {
+      this->cacheChunkDims_.push_back(chunk);
+      this->cacheMaxDims_.push_back(dim);
+    } else {
+      this->cacheChunksPerFrame_ *= (dim + chunk - 1) / chunk;
+    }
+  }
+  this->cacheCapacity_ = cacheChunks;
+  this->cacheUsed_ = 0;
+  this->cacheUseCount_ = 0;
+}
+
+/** cacheFrame.
+ * Follow a frame written through the HDF5 chunk cache.  The chunks of the frame stay in
+ * the cache until every frame of their chunk has been written; when the cache is too small
+ * for all the chunks being filled the least recently used ones are evicted partly written
+ * and have to be read back from the file when their next frame arrives.
+ * \param[in] offset - The offset of the frame in the dataset.
+ */
+void NDFileHDF5Dataset::cacheFrame(hsize_t *offset)
+{
+  std::vector<hsize_t> key(this->cacheChunkDims_.size());
+  hsize_t rowFrames = 1;
+  for (size_t i = 0; i < key.size(); i++) {
+    hsize_t chunk = this->cacheChunkDims_[i];
+    key[i] = offset[i] / chunk;
+    // The last chunk of a dimension that is not a multiple of the chunk size is short
+    hsize_t frames = chunk;
+    if (this->cacheMaxDims_[i] > 0 && this->cacheMaxDims_[i] - key[i] * chunk < chunk) {
+      frames = this->cacheMaxDims_[i] - key[i] * chunk;
+    }
+    rowFrames *= frames;
+  }
+
+  NDFileHDF5CachedChunk& row = this->cacheChunks_[key];
+  if (!row.cached) {
+    // Make room for the row by evicting the least recently used rows
+    while (this->cacheUsed_ + this->cacheChunksPerFrame_ > this->cacheCapacity_ && this->cacheUsed_ > 0) {
+      std::map<std::vector<hsize_t>, NDFileHDF5CachedChunk>::iterator it, lru = this->cacheChunks_.end();
+      for (it = this->cacheChunks_.begin(); it != this->cacheChunks_.end(); ++it) {
+        if (it->second.cached && (lru == this->cacheChunks_.end() || it->second.lastUse < lru->second.lastUse)) {
+          lru = it;
+        }
+      }
+      lru->second.cached = false;
+      this->cacheUsed_ -= this->cacheChunksPerFrame_;
+      this->stats_.chunkEvictions += (int)this->cacheChunksPerFrame_;
+    }
+    if (this->cacheUsed_ + this->cacheChunksPerFrame_ <= this->cacheCapacity_) {
+      row.cached = true;
+      this->cacheUsed_ += this->cacheChunksPerFrame_;
+    }
+  }
+  row.frames++;
+  row.lastUse = ++this->cacheUseCount_;
+
+  if (row.frames >= rowFrames) {
+    this->stats_.chunksFlushed += (int)this->cacheChunksPerFrame_;
+    if (row.cached) this->cacheUsed_ -= this->cacheChunksPerFrame_;
+    this->cacheChunks_.erase(key);
+  } else if (!row.cached) {
+    // A row that does not fit in the cache at all is written partly on every frame
+    this->stats_.chunkEvictions += (int)this->cacheChunksPerFrame_;
+  }
+}
+
+/** closeChunkCache.
+ * Count the chunks that are still partly written as flushed, the HDF5 library writes
+ * them out when the dataset is closed.
+ */
+void NDFileHDF5Dataset::closeChunkCache()
+{
+  this->stats_.chunksFlushed += (int)(this->cacheChunks_.size() * this->cacheChunksPerFrame_);
+  this->cacheChunks_.clear();
+  this->cacheUsed_ = 0;
+}
+
+/** addWriteTime.
+ * Add a call to H5Dwrite or the direct chunk write to the write statistics.
+ * \param[in] start - Time the call was made.
+ * \param[in] bytes - Number of bytes passed to the call.
+ */
+void NDFileHDF5Dataset::addWriteTime(const epicsTimeStamp& start, size_t bytes)
+{
+  epicsTimeStamp end;
+  epicsTimeGetCurrent(&end);
+  this->stats_.writeTime += epicsTimeDiffInSeconds(&end, &start);
+  this->stats_.writeCalls++;
+  this->stats_.bytesWritten += (double)bytes;
+}
+
+/** getWriteStats.
+ * Add the write statistics of this dataset to pStats.
+ * \param[in,out] pStats - The statistics to add to.
+ */
+void NDFileHDF5Dataset::getWriteStats(NDFileHDF5WriteStats *pStats)
+{
+  pStats->bytesWritten   += this->stats_.bytesWritten;
+  pStats->chunksFlushed  += this->stats_.chunksFlushed;
+  pStats->chunkEvictions += this->stats_.chunkEvictions;
+  pStats->writeCalls     += this->stats_.writeCalls;
+  pStats->writeTime      += this->stats_.writeTime;
+}
+
 /** getHandle.
  * Returns the HDF5 handle to this dataset.
  */
@@ -386,6 +866,10 @@ hid_t NDFileHDF5Dataset::getHandle()
 asynStatus NDFileHDF5Dataset::flushDataset()
 {
   static const char *functionName = "flushDataset";
+
+  // Frames waiting for the rest of their chunk must reach the file before it is flushed
+  if (this->writePendingChunks() != asynSuccess) return asynError;
+
   // flushDataset is a no-op if the HDF version doesn't support it
   #if H5_VERSION_GE(1,9,178)
 
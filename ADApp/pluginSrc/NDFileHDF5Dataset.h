@@ -2,10 +2,34 @@
 #define NDFILEHDF5DATASET_H_
 
 #include <string>
+#include <deque>
+#include <map>
+#include <vector>
 #include <hdf5.h>
+#include <epicsTime.h>
 #include <NDPluginAPI.h>
 #include "NDPluginFile.h"
 #include "NDFileHDF5VersionCheck.h"
+#include "NDFileHDF5ChunkCompressor.h"
+
+/** Write statistics of a dataset, summed over the datasets of a file by NDFileHDF5.
+  */
+typedef struct NDFileHDF5WriteStats {
+    double bytesWritten;    /**< Bytes passed to H5Dwrite and the direct chunk write */
+    int chunksFlushed;      /**< Chunks that have been completely written */
+    int chunkEvictions;     /**< Chunks evicted from the chunk cache before they were complete */
+    int writeCalls;         /**< Number of H5Dwrite and direct chunk write calls */
+    double writeTime;       /**< Time spent in those calls in seconds */
+} NDFileHDF5WriteStats;
+
+/** A row of chunks (all chunks of the frame dimensions at one chunk position in the
+  * extra dimensions) that has been partly written through the HDF5 chunk cache.
+  */
+typedef struct NDFileHDF5CachedChunk {
+    hsize_t frames;         /**< Frames written to the row so far */
+    hsize_t lastUse;        /**< Order of the last write, for least recently used eviction */
+    bool cached;            /**< Whether the row is held in the chunk cache */
+} NDFileHDF5CachedChunk;
 
 /** Class used for writing a Dataset with the NDFileHDF5 plugin.
   */
@@ -20,15 +44,29 @@ class NDPLUGIN_API NDFileHDF5Dataset
     asynStatus extendDataSet(int extradims, hsize_t *offsets);
     asynStatus verifyChunking(NDArray *pArray);
     void configureCompression(Codec_t codec);
+    void configureChunkCompression(NDArrayPool *pPool, NDFileHDF5ChunkCompressor *pCompressor);
+    void configureChunkCache(int rank, int extraRank, hsize_t *chunkdims, hsize_t *maxdims, hsize_t cacheChunks);
+    void closeChunkCache();
+    void getWriteStats(NDFileHDF5WriteStats *pStats);
     asynStatus writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize);
     hid_t getHandle();
     asynStatus flushDataset();
+    asynStatus writePendingChunks();
     hsize_t getDim(int index);
     hsize_t getMaxDim(int index);
     hsize_t getOffset(int index);
     hsize_t getVirtualDim(int index);
 
   private:
+    bool canSubmitFrame(NDArray *pArray);
+    asynStatus stageFrame(NDArray *pArray, bool *staged);
+    asynStatus writeStagedFrames();
+    asynStatus submitChunk(NDArray *pArray, hsize_t *offset, hsize_t *count);
+    asynStatus writeCompressedChunks(bool wait);
+    asynStatus writeChunk(NDArray *pArray, hsize_t *offset);
+    asynStatus writeHyperslab(void *pData, hsize_t *offset, hsize_t *count);
+    void cacheFrame(hsize_t *offset);
+    void addWriteTime(const epicsTimeStamp& start, size_t bytes);
 
     asynUser    *pAsynUser_;   // Pointer to the asynUser structure
     std::string name_;         // Name of this dataset
@@ -45,6 +83,21 @@ class NDPLUGIN_API NDFileHDF5Dataset
     hsize_t     *virtualdims_; // The desired sizes of the extra (virtual) dimensions: {Y, X, n}
     hsize_t     *virtualchunkdims_;   // The chunk sizes of the extra (virtual) dimensions: {Y, X, n}
     Codec_t codec;             // Definition of codec used to compress the data.
+    NDArray     *stageArray_;       // Frames of the chunk being collected for a direct chunk write
+    size_t      stageFrameBytes_;   // Size of one staged frame in bytes
+    int         stagedFrames_;      // Number of frames currently held in stageArray_
+    hsize_t     stageStart_;        // Frame index of the first staged frame
+    NDArrayPool *pPool_;            // Pool for staged and compressed chunks
+    NDFileHDF5ChunkCompressor *pCompressor_;  // Compression threads, NULL to compress in the writing thread
+    std::deque<NDFileHDF5Chunk *> chunks_;    // Chunks being compressed, in the order they are written
+    NDFileHDF5WriteStats stats_;              // Write statistics of this dataset
+    std::vector<hsize_t> cacheChunkDims_;     // Chunk sizes of the extra dimensions
+    std::vector<hsize_t> cacheMaxDims_;       // Sizes of the extra dimensions, 0 if unlimited
+    hsize_t     cacheChunksPerFrame_;         // Chunks that make up one frame
+    hsize_t     cacheCapacity_;               // Chunks that fit in the chunk cache
+    hsize_t     cacheUsed_;                   // Chunks currently held in the chunk cache
+    hsize_t     cacheUseCount_;               // Counter for the least recently used order
+    std::map<std::vector<hsize_t>, NDFileHDF5CachedChunk> cacheChunks_;  // Partly written rows of chunks
 };
 
 
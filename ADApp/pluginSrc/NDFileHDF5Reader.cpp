@@ -0,0 +1,411 @@
+#include <string.h>
+
+#include "NDFileHDF5Reader.h"
+
+static const char *fileName = "NDFileHDF5Reader";
+
+/* Groups nested deeper than this are not searched for NDAttribute datasets */
+#define MAX_GROUP_DEPTH 16
+
+/** Return the NDArray data type and the memory type for an HDF5 integer or floating point type.
+ * \param[in] type - HDF5 type of the dataset in the file
+ * \param[out] pDataType - the NDDataType_t that holds the values
+ * \param[out] pMemType - native HDF5 type to read the values with
+ * \return false if the type has no NDArray data type
+ */
+static bool typeFromHdf(hid_t type, NDDataType_t *pDataType, hid_t *pMemType)
+{
+  size_t size = H5Tget_size(type);
+  bool isSigned = (H5Tget_sign(type) == H5T_SGN_2);
+
+  switch (H5Tget_class(type)){
+    case H5T_INTEGER:
+      switch (size){
+        case 1:
+          *pDataType = isSigned ? NDInt8 : NDUInt8;
+          *pMemType = isSigned ? H5T_NATIVE_INT8 : H5T_NATIVE_UINT8;
+          return true;
+        case 2:
+          *pDataType = isSigned ? NDInt16 : NDUInt16;
+          *pMemType = isSigned ? H5T_NATIVE_INT16 : H5T_NATIVE_UINT16;
+          return true;
+        case 4:
+          *pDataType = isSigned ? NDInt32 : NDUInt32;
+          *pMemType = isSigned ? H5T_NATIVE_INT32 : H5T_NATIVE_UINT32;
+          return true;
+        case 8:
+          *pDataType = isSigned ? NDInt64 : NDUInt64;
+          *pMemType = isSigned ? H5T_NATIVE_INT64 : H5T_NATIVE_UINT64;
+          return true;
+      }
+      break;
+    case H5T_FLOAT:
+      if (size == 4){
+        *pDataType = NDFloat32;
+        *pMemType = H5T_NATIVE_FLOAT;
+        return true;
+      } else if (size == 8){
+        *pDataType = NDFloat64;
+        *pMemType = H5T_NATIVE_DOUBLE;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+  return false;
+}
+
+/** Return the NDAttrSource_t for the NDAttrSourceType string that NDFileHDF5 writes. */
+static NDAttrSource_t sourceTypeFromString(const std::string& sourceType)
+{
+  if (sourceType == "NDAttrSourceDriver")  return NDAttrSourceDriver;
+  if (sourceType == "NDAttrSourceEPICSPV") return NDAttrSourceEPICSPV;
+  if (sourceType == "NDAttrSourceParam")   return NDAttrSourceParam;
+  if (sourceType == "NDAttrSourceFunct")   return NDAttrSourceFunct;
+  if (sourceType == "NDAttrSourceConst")   return NDAttrSourceConst;
+  return NDAttrSourceUndefined;
+}
+
+/** Constructor.
+ * \param[in] pAsynUser - asynUser that is used to control debugging output
+ */
+NDFileHDF5Reader::NDFileHDF5Reader(asynUser *pAsynUser) :
+  pAsynUser_(pAsynUser), file_(-1), dataset_(-1), memType_(-1), dataType_(NDUInt8),
+  frameRank_(0), numFrames_(0)
+{
+}
+
+NDFileHDF5Reader::~NDFileHDF5Reader()
+{
+  this->close();
+}
+
+/** Open a file and the detector dataset in it, and find its NDAttribute datasets.
+ * The frames are the last 2 dimensions of the dataset, or the last 3 if the ColorMode NDAttribute
+ * is one of the RGB modes; all of the dimensions before them count frames. A dataset with no more
+ * dimensions than one frame holds a single frame.
+ * \param[in] h5FileName - name of the file
+ * \param[in] dsetName - full path of the detector dataset in the file
+ */
+asynStatus NDFileHDF5Reader::open(const std::string& h5FileName, const std::string& dsetName)
+{
+  static const char *functionName = "open";
+  hid_t datatype, dataspace;
+  int rank;
+
+  this->close();
+  this->file_ = H5Fopen(h5FileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (this->file_ < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s cannot open %s\n",
+              fileName, functionName, h5FileName.c_str());
+    return asynError;
+  }
+  this->dataset_ = H5Dopen2(this->file_, dsetName.c_str(), H5P_DEFAULT);
+  if (this->dataset_ < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s no dataset %s in %s\n",
+              fileName, functionName, dsetName.c_str(), h5FileName.c_str());
+    this->close();
+    return asynError;
+  }
+  datatype = H5Dget_type(this->dataset_);
+  bool known = typeFromHdf(datatype, &this->dataType_, &this->memType_);
+  H5Tclose(datatype);
+  if (!known){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s unsupported data type of %s\n",
+              fileName, functionName, dsetName.c_str());
+    this->close();
+    return asynError;
+  }
+  dataspace = H5Dget_space(this->dataset_);
+  rank = H5Sget_simple_extent_ndims(dataspace);
+  if (rank > 0){
+    this->dims_.resize(rank);
+    H5Sget_simple_extent_dims(dataspace, &this->dims_[0], NULL);
+  }
+  H5Sclose(dataspace);
+  if (rank < 1){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s %s has %d dimensions\n",
+              fileName, functionName, dsetName.c_str(), rank);
+    this->close();
+    return asynError;
+  }
+
+  // Collect the NDAttribute datasets, they tell the frame rank from the ColorMode
+  this->visitGroup(this->file_, 0);
+
+  int colorMode = this->getColorMode();
+  this->frameRank_ = ((colorMode == NDColorModeRGB1) || (colorMode == NDColorModeRGB2) ||
+                      (colorMode == NDColorModeRGB3)) ? 3 : 2;
+  if (rank <= this->frameRank_){
+    this->frameRank_ = rank;
+    this->numFrames_ = 1;
+  } else {
+    this->numFrames_ = 1;
+    for (int i = 0; i < rank - this->frameRank_; i++) this->numFrames_ *= this->dims_[i];
+  }
+  if (this->frameRank_ > ND_ARRAY_MAX_DIMS){
+    this->close();
+    return asynError;
+  }
+  for (size_t i = 0; i < this->attributes_.size(); i++){
+    hsize_t points = 1;
+    for (size_t j = 0; j < this->attributes_[i].dims.size(); j++) points *= this->attributes_[i].dims[j];
+    this->attributes_[i].perFrame = (points == this->numFrames_);
+  }
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW, "%s::%s %s has %llu frames of %d dimensions and %d NDAttributes\n",
+            fileName, functionName, h5FileName.c_str(), (unsigned long long)this->numFrames_,
+            this->frameRank_, (int)this->attributes_.size());
+  return asynSuccess;
+}
+
+/** Close the file and the datasets opened by open(). */
+void NDFileHDF5Reader::close()
+{
+  for (size_t i = 0; i < this->attributes_.size(); i++){
+    H5Dclose(this->attributes_[i].dataset);
+    if (this->attributes_[i].dataType == NDAttrString) H5Tclose(this->attributes_[i].memType);
+  }
+  this->attributes_.clear();
+  if (this->dataset_ >= 0) H5Dclose(this->dataset_);
+  this->dataset_ = -1;
+  if (this->file_ >= 0) H5Fclose(this->file_);
+  this->file_ = -1;
+  this->dims_.clear();
+  this->frameRank_ = 0;
+  this->numFrames_ = 0;
+}
+
+/** Return true between a successful open() and close(). */
+bool NDFileHDF5Reader::isOpen()
+{
+  return (this->file_ >= 0);
+}
+
+/** Return the number of frames in the detector dataset. */
+hsize_t NDFileHDF5Reader::getNumFrames()
+{
+  return this->numFrames_;
+}
+
+/** Read one frame into a new NDArray from a pool, with its unique ID, time stamps and NDAttributes.
+ * \param[in] frame - index of the frame, counting through all of the frame dimensions
+ * \param[in] pPool - pool to allocate the NDArray from
+ * \param[out] ppArray - the NDArray, which the caller must release
+ */
+asynStatus NDFileHDF5Reader::read(hsize_t frame, NDArrayPool *pPool, NDArray **ppArray)
+{
+  static const char *functionName = "read";
+  int rank = (int)this->dims_.size();
+  std::vector<hsize_t> start(rank, 0), count(rank, 1);
+  size_t ndDims[ND_ARRAY_MAX_DIMS];
+  hid_t filespace, memspace;
+  herr_t hdfstatus;
+  NDArray *pArray;
+  hsize_t index = frame;
+
+  *ppArray = NULL;
+  if ((this->dataset_ < 0) || (frame >= this->numFrames_)) return asynError;
+
+  // The frame number counts through the leading dimensions, the last of them fastest
+  for (int i = rank - this->frameRank_ - 1; i >= 0; i--){
+    start[i] = index % this->dims_[i];
+    index /= this->dims_[i];
+  }
+  for (int i = 0; i < this->frameRank_; i++){
+    count[rank - this->frameRank_ + i] = this->dims_[rank - this->frameRank_ + i];
+    // NDArray dimensions are fastest first
+    ndDims[i] = (size_t)this->dims_[rank - 1 - i];
+  }
+  pArray = pPool->alloc(this->frameRank_, ndDims, this->dataType_, 0, NULL);
+  if (!pArray){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s cannot allocate NDArray for frame %llu\n",
+              fileName, functionName, (unsigned long long)frame);
+    return asynError;
+  }
+  filespace = H5Dget_space(this->dataset_);
+  H5Sselect_hyperslab(filespace, H5S_SELECT_SET, &start[0], NULL, &count[0], NULL);
+  memspace = H5Screate_simple(this->frameRank_, &this->dims_[rank - this->frameRank_], NULL);
+  hdfstatus = H5Dread(this->dataset_, this->memType_, memspace, filespace, H5P_DEFAULT, pArray->pData);
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+  if (hdfstatus < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s error reading frame %llu\n",
+              fileName, functionName, (unsigned long long)frame);
+    pArray->release();
+    return asynError;
+  }
+  for (size_t i = 0; i < this->attributes_.size(); i++){
+    this->readAttribute(this->attributes_[i], frame, pArray);
+  }
+  *ppArray = pArray;
+  return asynSuccess;
+}
+
+herr_t NDFileHDF5Reader::visitLink(hid_t group, const char *name, const H5L_info_t *info, void *pPvt)
+{
+  std::pair<NDFileHDF5Reader *, int> *pVisit = (std::pair<NDFileHDF5Reader *, int> *)pPvt;
+  hid_t object;
+
+  // Soft and external links lead to objects that are found elsewhere, or not in this file
+  if (info->type != H5L_TYPE_HARD) return 0;
+  object = H5Oopen(group, name, H5P_DEFAULT);
+  if (object < 0) return 0;
+  switch (H5Iget_type(object)){
+    case H5I_GROUP:
+      pVisit->first->visitGroup(object, pVisit->second + 1);
+      break;
+    case H5I_DATASET:
+      pVisit->first->addAttribute(object);
+      break;
+    default:
+      break;
+  }
+  H5Oclose(object);
+  return 0;
+}
+
+/** Search a group and its subgroups for NDAttribute datasets. */
+void NDFileHDF5Reader::visitGroup(hid_t group, int depth)
+{
+  std::pair<NDFileHDF5Reader *, int> visit(this, depth);
+
+  if (depth > MAX_GROUP_DEPTH) return;
+  H5Literate(group, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, NDFileHDF5Reader::visitLink, &visit);
+}
+
+/** Add a dataset to the NDAttributes if NDFileHDF5 wrote it for one. The same dataset can be found
+ * through several hard links, only the first is used. */
+void NDFileHDF5Reader::addAttribute(hid_t dataset)
+{
+  Attribute_t attribute;
+  NDDataType_t dataType;
+  hid_t datatype, dataspace;
+  int rank;
+
+  if (H5Aexists(dataset, "NDAttrName") <= 0) return;
+  attribute.name = this->readStringAttribute(dataset, "NDAttrName");
+  if (attribute.name.empty()) return;
+  for (size_t i = 0; i < this->attributes_.size(); i++){
+    if (this->attributes_[i].name == attribute.name) return;
+  }
+  attribute.description = this->readStringAttribute(dataset, "NDAttrDescription");
+  attribute.source = this->readStringAttribute(dataset, "NDAttrSource");
+  attribute.sourceType = sourceTypeFromString(this->readStringAttribute(dataset, "NDAttrSourceType"));
+
+  datatype = H5Dget_type(dataset);
+  if (H5Tget_class(datatype) == H5T_STRING){
+    if (H5Tis_variable_str(datatype) > 0){
+      H5Tclose(datatype);
+      return;
+    }
+    attribute.dataType = NDAttrString;
+    attribute.memType = H5Tcopy(datatype);
+  } else if (typeFromHdf(datatype, &dataType, &attribute.memType)){
+    attribute.dataType = (NDAttrDataType_t)dataType;
+  } else {
+    H5Tclose(datatype);
+    return;
+  }
+  H5Tclose(datatype);
+
+  dataspace = H5Dget_space(dataset);
+  rank = H5Sget_simple_extent_ndims(dataspace);
+  attribute.dims.resize(rank > 0 ? rank : 0);
+  if (rank > 0) H5Sget_simple_extent_dims(dataspace, &attribute.dims[0], NULL);
+  H5Sclose(dataspace);
+
+  // Keep the dataset open, visitLink closes the reference it was found with
+  H5Iinc_ref(dataset);
+  attribute.dataset = dataset;
+  attribute.perFrame = false;
+  this->attributes_.push_back(attribute);
+}
+
+/** Return the value of a fixed length string HDF5 attribute, or an empty string if there is none. */
+std::string NDFileHDF5Reader::readStringAttribute(hid_t object, const char *attrName)
+{
+  std::string value;
+  hid_t attr, datatype;
+
+  if (H5Aexists(object, attrName) <= 0) return value;
+  attr = H5Aopen(object, attrName, H5P_DEFAULT);
+  if (attr < 0) return value;
+  datatype = H5Aget_type(attr);
+  if ((H5Tget_class(datatype) == H5T_STRING) && (H5Tis_variable_str(datatype) <= 0)){
+    std::vector<char> buffer(H5Tget_size(datatype) + 1, 0);
+    if (H5Aread(attr, datatype, &buffer[0]) >= 0) value = &buffer[0];
+  }
+  H5Tclose(datatype);
+  H5Aclose(attr);
+  return value;
+}
+
+/** Read the value of an NDAttribute for one frame into an NDArray. */
+asynStatus NDFileHDF5Reader::readAttribute(const Attribute_t& attribute, hsize_t frame, NDArray *pArray)
+{
+  int rank = (int)attribute.dims.size();
+  std::vector<hsize_t> coords(rank > 0 ? rank : 1, 0);
+  std::vector<char> buffer;
+  hsize_t index = attribute.perFrame ? frame : 0;
+  hsize_t one = 1;
+  hid_t filespace, memspace;
+  herr_t hdfstatus;
+  NDAttribute *pAttribute;
+
+  for (int i = rank - 1; i >= 0; i--){
+    coords[i] = index % attribute.dims[i];
+    index /= attribute.dims[i];
+  }
+  buffer.resize(H5Tget_size(attribute.memType) + 1, 0);
+  filespace = H5Dget_space(attribute.dataset);
+  if (rank > 0) H5Sselect_elements(filespace, H5S_SELECT_SET, 1, &coords[0]);
+  memspace = H5Screate_simple(1, &one, NULL);
+  hdfstatus = H5Dread(attribute.dataset, attribute.memType, memspace, filespace, H5P_DEFAULT, &buffer[0]);
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+  if (hdfstatus < 0) return asynError;
+
+  if (attribute.name == "NDArrayUniqueId"){
+    pAttribute = new NDAttribute("", "", NDAttrSourceDriver, "", attribute.dataType, &buffer[0]);
+    pAttribute->getValue(NDAttrInt32, &pArray->uniqueId);
+    delete pAttribute;
+  } else if (attribute.name == "NDArrayTimeStamp"){
+    pAttribute = new NDAttribute("", "", NDAttrSourceDriver, "", attribute.dataType, &buffer[0]);
+    pAttribute->getValue(NDAttrFloat64, &pArray->timeStamp);
+    delete pAttribute;
+  } else if (attribute.name == "NDArrayEpicsTSSec"){
+    pAttribute = new NDAttribute("", "", NDAttrSourceDriver, "", attribute.dataType, &buffer[0]);
+    pAttribute->getValue(NDAttrUInt32, &pArray->epicsTS.secPastEpoch);
+    delete pAttribute;
+  } else if (attribute.name == "NDArrayEpicsTSnSec"){
+    pAttribute = new NDAttribute("", "", NDAttrSourceDriver, "", attribute.dataType, &buffer[0]);
+    pAttribute->getValue(NDAttrUInt32, &pArray->epicsTS.nsec);
+    delete pAttribute;
+  } else {
+    pAttribute = new NDAttribute(attribute.name.c_str(), attribute.description.c_str(), attribute.sourceType,
+                                 attribute.source.c_str(), attribute.dataType, &buffer[0]);
+    pArray->pAttributeList->add(pAttribute);
+  }
+  return asynSuccess;
+}
+
+/** Return the value of the ColorMode NDAttribute for the first frame, or NDColorModeMono if there is none. */
+int NDFileHDF5Reader::getColorMode()
+{
+  int colorMode = NDColorModeMono;
+  hsize_t one = 1;
+
+  for (size_t i = 0; i < this->attributes_.size(); i++){
+    const Attribute_t& attribute = this->attributes_[i];
+    if ((attribute.name != "ColorMode") || (attribute.dataType == NDAttrString)) continue;
+    hid_t filespace = H5Dget_space(attribute.dataset);
+    hid_t memspace = H5Screate_simple(1, &one, NULL);
+    std::vector<hsize_t> coords(attribute.dims.size() > 0 ? attribute.dims.size() : 1, 0);
+    if (attribute.dims.size() > 0) H5Sselect_elements(filespace, H5S_SELECT_SET, 1, &coords[0]);
+    H5Dread(attribute.dataset, H5T_NATIVE_INT, memspace, filespace, H5P_DEFAULT, &colorMode);
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+  }
+  return colorMode;
+}
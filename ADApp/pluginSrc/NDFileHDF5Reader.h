@@ -0,0 +1,60 @@
+#ifndef NDFILEHDF5READER_H_
+#define NDFILEHDF5READER_H_
+
+#include <string>
+#include <vector>
+#include <hdf5.h>
+#include <asynDriver.h>
+#include <NDPluginAPI.h>
+#include "NDArray.h"
+
+/** Reads the frames of a detector dataset written by NDFileHDF5 back into NDArrays.
+  * The NDAttribute datasets of the file, which NDFileHDF5 marks with an NDAttrName HDF5 attribute,
+  * are found when the file is opened, and each frame gets the value of every NDAttribute for that frame.
+  * The NDArrayUniqueId, NDArrayTimeStamp, NDArrayEpicsTSSec and NDArrayEpicsTSnSec datasets set the
+  * unique ID and time stamps of the NDArray rather than being added as NDAttributes.
+  */
+class NDPLUGIN_API NDFileHDF5Reader
+{
+  public:
+    NDFileHDF5Reader(asynUser *pAsynUser);
+    ~NDFileHDF5Reader();
+
+    asynStatus open(const std::string& h5FileName, const std::string& dsetName);
+    void close();
+    bool isOpen();
+    hsize_t getNumFrames();
+    asynStatus read(hsize_t frame, NDArrayPool *pPool, NDArray **ppArray);
+
+  private:
+    typedef struct {
+      hid_t dataset;             // The NDAttribute dataset
+      hid_t memType;             // Type of one value in memory
+      std::string name;
+      std::string description;
+      std::string source;
+      NDAttrSource_t sourceType;
+      NDAttrDataType_t dataType;
+      std::vector<hsize_t> dims; // Dimensions of the dataset, slowest first
+      bool perFrame;             // One value per frame, otherwise the first value is used for every frame
+    } Attribute_t;
+
+    static herr_t visitLink(hid_t group, const char *name, const H5L_info_t *info, void *pPvt);
+    void visitGroup(hid_t group, int depth);
+    void addAttribute(hid_t dataset);
+    std::string readStringAttribute(hid_t object, const char *attrName);
+    asynStatus readAttribute(const Attribute_t& attribute, hsize_t frame, NDArray *pArray);
+    int getColorMode();
+
+    asynUser *pAsynUser_;
+    hid_t file_;
+    hid_t dataset_;
+    hid_t memType_;                    // Type of the data in memory
+    NDDataType_t dataType_;
+    std::vector<hsize_t> dims_;        // Dimensions of the detector dataset, slowest first
+    int frameRank_;                    // Number of dimensions of one frame, the last ones of dims_
+    hsize_t numFrames_;
+    std::vector<Attribute_t> attributes_;
+};
+
+#endif
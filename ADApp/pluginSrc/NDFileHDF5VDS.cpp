@@ -0,0 +1,284 @@
+#include <string.h>
+
+#include "NDFileHDF5VDS.h"
+#include "NDFileHDF5VersionCheck.h"
+
+static const char *fileName = "NDFileHDF5VDS";
+
+/** Constructor.
+ * \param[in] pAsynUser - asynUser that is used to control debugging output
+ */
+NDFileHDF5VDS::NDFileHDF5VDS(asynUser *pAsynUser) : pAsynUser_(pAsynUser), datatype_(-1)
+{
+}
+
+NDFileHDF5VDS::~NDFileHDF5VDS()
+{
+  this->clear();
+}
+
+/** Forget all of the sources. */
+void NDFileHDF5VDS::clear()
+{
+  this->sources_.clear();
+  this->frameDims_.clear();
+  if (this->datatype_ >= 0) H5Tclose(this->datatype_);
+  this->datatype_ = -1;
+}
+
+/** Return the number of source files added since the last clear(). */
+int NDFileHDF5VDS::getNumSources()
+{
+  return (int)this->sources_.size();
+}
+
+/** Return the lowest frame number mapped by the sources, which is frame 0 of the virtual dataset. */
+hsize_t NDFileHDF5VDS::getFirstFrame()
+{
+  hsize_t firstFrame = 0;
+  bool found = false;
+  for (size_t i = 0; i < this->sources_.size(); i++){
+    for (size_t j = 0; j < this->sources_[i].runs.size(); j++){
+      if (!found || this->sources_[i].runs[j].start < firstFrame){
+        firstFrame = this->sources_[i].runs[j].start;
+        found = true;
+      }
+    }
+  }
+  return firstFrame;
+}
+
+/** Return the number of frames in the virtual dataset, including any gaps between the sources. */
+hsize_t NDFileHDF5VDS::getNumFrames()
+{
+  hsize_t lastFrame = 0;
+  bool found = false;
+  for (size_t i = 0; i < this->sources_.size(); i++){
+    for (size_t j = 0; j < this->sources_[i].runs.size(); j++){
+      const Run_t& run = this->sources_[i].runs[j];
+      if (!found || run.start + (run.count-1)*run.stride > lastFrame){
+        lastFrame = run.start + (run.count-1)*run.stride;
+        found = true;
+      }
+    }
+  }
+  return found ? lastFrame - this->getFirstFrame() + 1 : 0;
+}
+
+/** Read the frame count, dimensions and datatype of a source dataset and check that they match the
+ * previous sources; the first dimension must be the frame number.
+ */
+asynStatus NDFileHDF5VDS::checkSource(const std::string& fileName, const std::string& dsetName, hid_t dataset,
+                                      hsize_t *numFrames)
+{
+  hsize_t dims[H5S_MAX_RANK];
+  static const char *functionName = "checkSource";
+
+  hid_t dataspace = H5Dget_space(dataset);
+  if (dataspace < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s unable to get the dataspace of %s in %s\n",
+              ::fileName, functionName, dsetName.c_str(), fileName.c_str());
+    return asynError;
+  }
+  int rank = H5Sget_simple_extent_dims(dataspace, dims, NULL);
+  H5Sclose(dataspace);
+  if (rank < 1){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s %s in %s has no frame dimension\n",
+              ::fileName, functionName, dsetName.c_str(), fileName.c_str());
+    return asynError;
+  }
+
+  std::vector<hsize_t> frameDims(dims+1, dims+rank);
+  if (this->datatype_ < 0){
+    this->datatype_ = H5Dget_type(dataset);
+    this->frameDims_ = frameDims;
+  } else {
+    hid_t datatype = H5Dget_type(dataset);
+    bool same = (H5Tequal(datatype, this->datatype_) > 0);
+    H5Tclose(datatype);
+    if (!same || frameDims != this->frameDims_){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s %s in %s does not match the frames of the previous sources\n",
+                ::fileName, functionName, dsetName.c_str(), fileName.c_str());
+      return asynError;
+    }
+  }
+  *numFrames = dims[0];
+  return asynSuccess;
+}
+
+/** Add a source dataset that holds every stride'th frame of the virtual dataset from frame start.
+ * This must be called while the source dataset is still open, as its dimensions and datatype are read from it.
+ * \param[in] fileName - Name of the file that holds the source dataset.
+ * \param[in] dsetName - Full path of the source dataset in the file.
+ * \param[in] dataset - Handle of the open source dataset.
+ * \param[in] start - Frame number that the first frame of the source maps to.
+ * \param[in] stride - Frames of the virtual dataset between two consecutive frames of the source.
+ */
+asynStatus NDFileHDF5VDS::addSource(const std::string& fileName, const std::string& dsetName, hid_t dataset,
+                                    hsize_t start, hsize_t stride)
+{
+  Source_t source;
+  Run_t run;
+  static const char *functionName = "addSource";
+
+  if (this->checkSource(fileName, dsetName, dataset, &source.numFrames)) return asynError;
+  source.fileName = fileName;
+  source.dsetName = dsetName;
+  if (source.numFrames > 0){
+    run.srcStart = 0;
+    run.start = start;
+    run.stride = (stride < 1) ? 1 : stride;
+    run.count = source.numFrames;
+    source.runs.push_back(run);
+  }
+  this->sources_.push_back(source);
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW, "%s::%s %s:%s frames=%llu start=%llu stride=%llu\n",
+            ::fileName, functionName, fileName.c_str(), dsetName.c_str(),
+            (unsigned long long)source.numFrames, (unsigned long long)start, (unsigned long long)stride);
+  return asynSuccess;
+}
+
+/** Add a source dataset whose frames map to the given frame numbers of the virtual dataset, for example
+ * the NDArray uniqueIds of frames that were distributed over several files.  The frame numbers should
+ * increase; they are stored as runs with a constant stride, so a regular pattern costs a single mapping.
+ * This must be called while the source dataset is still open, as its dimensions and datatype are read from it.
+ * \param[in] fileName - Name of the file that holds the source dataset.
+ * \param[in] dsetName - Full path of the source dataset in the file.
+ * \param[in] dataset - Handle of the open source dataset.
+ * \param[in] frames - Frame number of each frame of the source; frames beyond the dataset are ignored.
+ */
+asynStatus NDFileHDF5VDS::addSource(const std::string& fileName, const std::string& dsetName, hid_t dataset,
+                                    const std::vector<hsize_t>& frames)
+{
+  Source_t source;
+  Run_t run;
+  static const char *functionName = "addSource";
+
+  if (this->checkSource(fileName, dsetName, dataset, &source.numFrames)) return asynError;
+  source.fileName = fileName;
+  source.dsetName = dsetName;
+  hsize_t numFrames = (frames.size() < source.numFrames) ? frames.size() : source.numFrames;
+  hsize_t index = 0;
+  while (index < numFrames){
+    run.srcStart = index;
+    run.start = frames[index];
+    run.stride = 1;
+    run.count = 1;
+    if (index+1 < numFrames && frames[index+1] > frames[index]){
+      run.stride = frames[index+1] - frames[index];
+      run.count = 2;
+      while (index+run.count < numFrames &&
+             frames[index+run.count] == frames[index+run.count-1] + run.stride){
+        run.count++;
+      }
+    }
+    source.runs.push_back(run);
+    index += run.count;
+  }
+  this->sources_.push_back(source);
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW, "%s::%s %s:%s frames=%llu runs=%d\n",
+            ::fileName, functionName, fileName.c_str(), dsetName.c_str(),
+            (unsigned long long)numFrames, (int)source.runs.size());
+  return asynSuccess;
+}
+
+/** Write the master file with a virtual dataset that maps all of the sources.
+ * \param[in] fileName - Name of the master file, an existing file is overwritten.
+ * \param[in] dsetName - Full path of the virtual dataset; missing groups are created.
+ */
+asynStatus NDFileHDF5VDS::write(const std::string& fileName, const std::string& dsetName)
+{
+  static const char *functionName = "write";
+
+  if (this->sources_.empty()){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s no sources for %s\n",
+              ::fileName, functionName, fileName.c_str());
+    return asynError;
+  }
+
+#if H5_VERSION_GE(1,10,0)
+  asynStatus status = asynSuccess;
+  int rank = (int)this->frameDims_.size() + 1;
+  std::vector<hsize_t> dims(rank), start(rank, 0), stride(rank, 1), count(rank, 1), block(rank);
+  hsize_t firstFrame = this->getFirstFrame();
+
+  dims[0] = this->getNumFrames();
+  block[0] = 1;
+  for (int i = 1; i < rank; i++){
+    dims[i] = this->frameDims_[i-1];
+    block[i] = dims[i];
+  }
+
+  // Sources in the directory of the master file are found relative to it
+  size_t pos = fileName.find_last_of("/\\");
+  std::string directory = (pos == std::string::npos) ? "" : fileName.substr(0, pos+1);
+
+  hid_t vspace = H5Screate_simple(rank, &dims[0], NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+  for (size_t i = 0; i < this->sources_.size() && status == asynSuccess; i++){
+    const Source_t& source = this->sources_[i];
+    std::string srcName = source.fileName;
+    pos = srcName.find_last_of("/\\");
+    std::string srcDirectory = (pos == std::string::npos) ? "" : srcName.substr(0, pos+1);
+    if (srcDirectory == directory) srcName = srcName.substr(srcDirectory.size());
+
+    std::vector<hsize_t> srcDims(dims);
+    srcDims[0] = source.numFrames;
+    hid_t srcspace = H5Screate_simple(rank, &srcDims[0], NULL);
+    for (size_t j = 0; j < source.runs.size() && status == asynSuccess; j++){
+      const Run_t& run = source.runs[j];
+      start[0] = run.srcStart;
+      stride[0] = 1;
+      count[0] = run.count;
+      H5Sselect_hyperslab(srcspace, H5S_SELECT_SET, &start[0], &stride[0], &count[0], &block[0]);
+      start[0] = run.start - firstFrame;
+      stride[0] = run.stride;
+      if (H5Sselect_hyperslab(vspace, H5S_SELECT_SET, &start[0], &stride[0], &count[0], &block[0]) < 0 ||
+          H5Pset_virtual(dcpl, vspace, srcName.c_str(), source.dsetName.c_str(), srcspace) < 0){
+        asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s unable to map %s:%s\n",
+                  ::fileName, functionName, srcName.c_str(), source.dsetName.c_str());
+        status = asynError;
+      }
+    }
+    H5Sclose(srcspace);
+  }
+  H5Sselect_all(vspace);
+
+  if (status == asynSuccess){
+    hid_t file = H5Fcreate(fileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file < 0){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s unable to create %s\n",
+                ::fileName, functionName, fileName.c_str());
+      status = asynError;
+    } else {
+      hid_t dataset = H5Dcreate2(file, dsetName.c_str(), this->datatype_, vspace, lcpl, dcpl, H5P_DEFAULT);
+      if (dataset < 0){
+        asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, "%s::%s unable to create %s in %s\n",
+                  ::fileName, functionName, dsetName.c_str(), fileName.c_str());
+        status = asynError;
+      } else {
+        H5Dclose(dataset);
+      }
+      H5Fclose(file);
+    }
+  }
+  H5Pclose(lcpl);
+  H5Pclose(dcpl);
+  H5Sclose(vspace);
+
+  if (status == asynSuccess){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW, "%s::%s wrote %s:%s with %d sources and %llu frames\n",
+              ::fileName, functionName, fileName.c_str(), dsetName.c_str(),
+              (int)this->sources_.size(), (unsigned long long)dims[0]);
+  }
+  return status;
+#else
+  asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+            "%s::%s virtual datasets need HDF5 1.10 or later, %s not written\n",
+            ::fileName, functionName, fileName.c_str());
+  return asynError;
+#endif
+}
@@ -0,0 +1,56 @@
+#ifndef NDFILEHDF5VDS_H_
+#define NDFILEHDF5VDS_H_
+
+#include <string>
+#include <vector>
+#include <hdf5.h>
+#include <asynDriver.h>
+#include <NDPluginAPI.h>
+
+/** Builds an HDF5 virtual dataset (VDS) master file that presents the frames of a
+  * dataset written to several files as one dataset.  Each source file holds a block
+  * of frames, every Nth frame, or any increasing set of frames of the virtual dataset,
+  * which starts at the lowest frame number of all the sources.  The master file refers
+  * to source files in its own directory by name only, so they can be moved together.
+  */
+class NDPLUGIN_API NDFileHDF5VDS
+{
+  public:
+    NDFileHDF5VDS(asynUser *pAsynUser);
+    ~NDFileHDF5VDS();
+
+    void clear();
+    int getNumSources();
+    hsize_t getNumFrames();
+    asynStatus addSource(const std::string& fileName, const std::string& dsetName, hid_t dataset,
+                         hsize_t start, hsize_t stride);
+    asynStatus addSource(const std::string& fileName, const std::string& dsetName, hid_t dataset,
+                         const std::vector<hsize_t>& frames);
+    asynStatus write(const std::string& fileName, const std::string& dsetName);
+
+  private:
+    typedef struct {
+      hsize_t srcStart;      // First frame of the run in the source
+      hsize_t start;         // Frame of the virtual dataset that the first frame of the run maps to
+      hsize_t stride;        // Frames of the virtual dataset between two frames of the run
+      hsize_t count;         // Number of frames in the run
+    } Run_t;
+
+    typedef struct {
+      std::string fileName;  // Source file name
+      std::string dsetName;  // Full path of the dataset in the source file
+      hsize_t numFrames;     // Number of frames in the source dataset
+      std::vector<Run_t> runs;
+    } Source_t;
+
+    asynStatus checkSource(const std::string& fileName, const std::string& dsetName, hid_t dataset,
+                           hsize_t *numFrames);
+    hsize_t getFirstFrame();
+
+    asynUser *pAsynUser_;
+    std::vector<Source_t> sources_;
+    std::vector<hsize_t> frameDims_;  // Dimensions of one frame, slowest first
+    hid_t datatype_;
+};
+
+#endif
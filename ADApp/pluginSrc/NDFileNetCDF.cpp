@@ -19,6 +19,9 @@
 
 #define MAX_ATTRIBUTE_STRING_SIZE 256
 
+/* uniqueId, timeStamp, epicsTSSec and epicsTSNsec come before the attributes in the scalar variables */
+#define NUM_ARRAY_SCALARS 4
+
 static const char *driverName = "NDFileNetCDF";
 
 /* Handle errors by printing an error message and exiting with a
@@ -28,10 +31,223 @@ static const char *driverName = "NDFileNetCDF";
                 driverName, functionName, nc_strerror(e)); \
                 return(asynError);}
 
+static void appendScalar(NDFileNetCDFScalar *pScalar, const void *pValue)
+{
+    const char *pBytes = (const char *)pValue;
+    pScalar->buffer.insert(pScalar->buffer.end(), pBytes, pBytes + pScalar->valueSize);
+}
+
+/** Adds a variable with one value per array to the scalar variables of the file.
+  * In NetCDF-4 files the variable is chunked in blocks of scalarBlock_ arrays, so that each
+  * block that is written is one chunk.
+  * \param[in] varId netCDF variable ID
+  * \param[in] valueSize Bytes per array in the file
+  * \param[in] numDims Number of dimensions of the variable, 1, or 2 for strings
+  * \param[in] dimIds Dimension IDs of the variable */
+asynStatus NDFileNetCDF::defineScalar(int varId, size_t valueSize, int numDims, const int *dimIds)
+{
+    NDFileNetCDFScalar scalar;
+    static const char *functionName = "defineScalar";
+
+    scalar.varId = varId;
+    scalar.numDims = numDims;
+    scalar.valueSize = valueSize;
+    this->scalars_.push_back(scalar);
+#ifdef NC_NETCDF4
+    if ((this->format_ == NDFileNetCDFFormatNetCDF4) && (this->scalarBlock_ > 1)) {
+        int retval;
+        size_t chunks[2] = {(size_t)this->scalarBlock_, valueSize};
+        if ((retval = nc_def_var_chunking(this->ncId, varId, NC_CHUNKED, chunks)))
+            ERR(retval);
+    }
+#endif
+    return asynSuccess;
+}
+
+/** Writes the buffered values of the scalar variables of the file. */
+asynStatus NDFileNetCDF::flushScalars()
+{
+    int retval;
+    size_t start[2], count[2];
+    static const char *functionName = "flushScalars";
+
+    if (this->numBufferedRecords_ == 0) return asynSuccess;
+    start[0] = this->firstBufferedRecord_;
+    start[1] = 0;
+    count[0] = this->numBufferedRecords_;
+    for (size_t i=0; i<this->scalars_.size(); i++) {
+        NDFileNetCDFScalar *pScalar = &this->scalars_[i];
+        count[1] = pScalar->valueSize;
+        if ((retval = nc_put_vara(this->ncId, pScalar->varId, start, count, &pScalar->buffer[0])))
+            ERR(retval);
+        pScalar->buffer.clear();
+    }
+    this->numBufferedRecords_ = 0;
+    return asynSuccess;
+}
+
+/** Returns the value of a text global attribute of the open file, or an empty string if there is none. */
+std::string NDFileNetCDF::getGlobalText(const char *name)
+{
+    size_t len;
+
+    if (nc_inq_attlen(this->ncId, NC_GLOBAL, name, &len) || (len == 0)) return "";
+    std::vector<char> text(len);
+    if (nc_get_att_text(this->ncId, NC_GLOBAL, name, &text[0])) return "";
+    return std::string(&text[0], len);
+}
+
+/** Opens a netCDF file written by this plugin to read its arrays with NDFileNetCDF::readFile.
+  * The data type and dimensions of the arrays come from the global attributes of the file,
+  * and an NDAttribute is made for each Attr_ variable of the file.
+  * \param[in] fileName  Absolute path name of the file to open. */
+asynStatus NDFileNetCDF::openFileForRead(const char *fileName)
+{
+    static const char *attrDataTypeStrings[] = {"Int8", "UInt8", "Int16", "UInt16", "Int32", "UInt32",
+                                                "Int64", "UInt64", "Float32", "Float64", "String"};
+    static const char *sourceTypeStrings[] = {"NDAttrSourceDriver", "NDAttrSourceParam", "NDAttrSourceEPICSPV",
+                                              "NDAttrSourceFunct", "NDAttrSourceConst"};
+    static const NDAttrSource_t sourceTypes[] = {NDAttrSourceDriver, NDAttrSourceParam, NDAttrSourceEPICSPV,
+                                                 NDAttrSourceFunct, NDAttrSourceConst};
+    int size[ND_ARRAY_MAX_DIMS], offset[ND_ARRAY_MAX_DIMS];
+    int binning[ND_ARRAY_MAX_DIMS], reverse[ND_ARRAY_MAX_DIMS];
+    char varName[NC_MAX_NAME+1];
+    char tempString[MAX_ATTRIBUTE_STRING_SIZE];
+    int dataType, ndims, numVars, dimId, varId;
+    double fileVersion;
+    size_t numArrays;
+    int retval;
+    int i;
+    static const char *functionName = "openFileForRead";
+
+    if ((retval = nc_open(fileName, NC_NOWRITE, &this->ncId))) {
+        this->ncId = 0;
+        ERR(retval);
+    }
+    this->readMode_ = true;
+    this->nextRecord = 0;
+    this->scalars_.clear();
+    this->pFileAttributes->clear();
+
+    if ((retval = nc_get_att_int(this->ncId, NC_GLOBAL, "dataType", &dataType)))
+        ERR(retval);
+    /* Files before version 3.1 did not have NDInt64 and NDUInt64, so NDFloat32 and NDFloat64 were 6 and 7 */
+    if (nc_get_att_double(this->ncId, NC_GLOBAL, "NDNetCDFFileVersion", &fileVersion)) fileVersion = 3.0;
+    if ((fileVersion < 3.1) && (dataType >= NDInt64)) dataType += NDFloat32 - NDInt64;
+    if ((dataType < NDInt8) || (dataType > NDFloat64)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, unknown array datatype=%d\n",
+            driverName, functionName, dataType);
+        return asynError;
+    }
+    this->readDataType_ = (NDDataType_t)dataType;
+    if ((retval = nc_get_att_int(this->ncId, NC_GLOBAL, "numArrayDims", &ndims)))
+        ERR(retval);
+    if ((ndims < 1) || (ndims > ND_ARRAY_MAX_DIMS)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, invalid number of dimensions=%d\n",
+            driverName, functionName, ndims);
+        return asynError;
+    }
+    this->readNDims_ = ndims;
+    if ((retval = nc_get_att_int(this->ncId, NC_GLOBAL, "dimSize", size)))
+        ERR(retval);
+    if ((retval = nc_get_att_int(this->ncId, NC_GLOBAL, "dimOffset", offset)))
+        ERR(retval);
+    if ((retval = nc_get_att_int(this->ncId, NC_GLOBAL, "dimBinning", binning)))
+        ERR(retval);
+    if ((retval = nc_get_att_int(this->ncId, NC_GLOBAL, "dimReverse", reverse)))
+        ERR(retval);
+    for (i=0; i<ndims; i++) {
+        this->readDims_[i].size    = size[i];
+        this->readDims_[i].offset  = offset[i];
+        this->readDims_[i].binning = binning[i];
+        this->readDims_[i].reverse = reverse[i];
+    }
+
+    if ((retval = nc_inq_dimid(this->ncId, "numArrays", &dimId)))
+        ERR(retval);
+    if ((retval = nc_inq_dimlen(this->ncId, dimId, &numArrays)))
+        ERR(retval);
+    this->numArraysInFile_ = (int)numArrays;
+
+    if ((retval = nc_inq_varid(this->ncId, "array_data", &this->arrayDataId)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(this->ncId, "uniqueId", &this->uniqueIdId)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(this->ncId, "timeStamp", &this->timeStampId)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(this->ncId, "epicsTSSec", &this->epicsTSSecId)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(this->ncId, "epicsTSNsec", &this->epicsTSNsecId)))
+        ERR(retval);
+
+    /* Make an NDAttribute for each Attr_ variable, with the description, source and data type
+     * from the global attributes of the file.  Their scalars_ are in the same order as pFileAttributes. */
+    if ((retval = nc_inq_nvars(this->ncId, &numVars)))
+        ERR(retval);
+    for (varId=0; varId<numVars; varId++) {
+        if ((retval = nc_inq_varname(this->ncId, varId, varName)))
+            ERR(retval);
+        if (strncmp(varName, "Attr_", 5) != 0) continue;
+        const char *attributeName = varName + 5;
+        epicsSnprintf(tempString, sizeof(tempString), "Attr_%s_DataType", attributeName);
+        std::string dataTypeString = this->getGlobalText(tempString);
+        epicsSnprintf(tempString, sizeof(tempString), "Attr_%s_Description", attributeName);
+        std::string description = this->getGlobalText(tempString);
+        epicsSnprintf(tempString, sizeof(tempString), "Attr_%s_Source", attributeName);
+        std::string source = this->getGlobalText(tempString);
+        epicsSnprintf(tempString, sizeof(tempString), "Attr_%s_SourceType", attributeName);
+        std::string sourceTypeString = this->getGlobalText(tempString);
+
+        NDAttrDataType_t attrDataType = NDAttrUndefined;
+        for (i=0; i<(int)(sizeof(attrDataTypeStrings)/sizeof(attrDataTypeStrings[0])); i++) {
+            if (dataTypeString == attrDataTypeStrings[i]) attrDataType = (NDAttrDataType_t)(NDAttrInt8 + i);
+        }
+        NDAttrSource_t sourceType = NDAttrSourceDriver;
+        for (i=0; i<(int)(sizeof(sourceTypes)/sizeof(sourceTypes[0])); i++) {
+            if (sourceTypeString == sourceTypeStrings[i]) sourceType = sourceTypes[i];
+        }
+        NDAttribute *pAttribute = new NDAttribute(attributeName, description.c_str(),
+                                                  sourceType, source.c_str(), attrDataType, NULL);
+        if (attrDataType != NDAttrUndefined) pAttribute->setDataType(attrDataType);
+        this->pFileAttributes->add(pAttribute);
+
+        NDFileNetCDFScalar scalar;
+        scalar.varId = varId;
+        scalar.numDims = (attrDataType == NDAttrString) ? 2 : 1;
+        switch (attrDataType) {
+            case NDAttrInt8:
+            case NDAttrUInt8:
+            case NDAttrUndefined:
+                scalar.valueSize = 1;
+                break;
+            case NDAttrInt16:
+            case NDAttrUInt16:
+                scalar.valueSize = 2;
+                break;
+            case NDAttrInt32:
+            case NDAttrUInt32:
+            case NDAttrFloat32:
+                scalar.valueSize = 4;
+                break;
+            case NDAttrString:
+                scalar.valueSize = MAX_ATTRIBUTE_STRING_SIZE;
+                break;
+            default:
+                scalar.valueSize = 8;
+                break;
+        }
+        this->scalars_.push_back(scalar);
+    }
+    return asynSuccess;
+}
+
 /** Opens a netCDF file.
   * In write mode if NDFileModeMultiple is set then the first dimension is set to NC_UNLIMITED to allow
   * multiple arrays to be written to the same file.
-  * NOTE: Does not currently support NDFileModeRead or NDFileModeAppend.
+  * In read mode the file must have been written by this plugin, see NDFileNetCDF::openFileForRead.
+  * NOTE: Does not currently support NDFileModeAppend.
   * \param[in] fileName  Absolute path name of the file to open.
   * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite, NDFileModeAppend.
   *           May also have the bit NDFileModeMultiple set if the file is to be opened to write or read multiple
@@ -56,16 +272,26 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     const char *dataTypeString=NULL;
     NDAttrDataType_t attrDataType;
     size_t attrSize;
-    int numAttributes, attrCount;
+    int attrCount;
     double fileVersion;
+    int varId, cmode;
+    int format, deflateLevel, shuffle, framesPerChunk, scalarBlock;
+    size_t valueSize;
+    NDArrayInfo_t arrayInfo;
     static const char *functionName = "openFile";
 
-    /* We don't support reading yet */
-    if (openMode & NDFileModeRead) return(asynError);
-
     /* We don't support opening an existing file for appending yet */
     if (openMode & NDFileModeAppend) return(asynError);
 
+    if (openMode & NDFileModeRead) {
+        if (this->openFileForRead(fileName)) {
+            this->closeFile();
+            return asynError;
+        }
+        return asynSuccess;
+    }
+    this->readMode_ = false;
+
     /* Construct an attribute list. We use a separate attribute list
      * from the one in pArray to avoid the need to copy the array. */
     /* First clear the list*/
@@ -79,9 +305,40 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     /* Set the next record in the file to 0 */
     this->nextRecord = 0;
 
+    this->lock();
+    getIntegerParam(NDFileNetCDFFormat, &format);
+    getIntegerParam(NDFileNetCDFDeflateLevel, &deflateLevel);
+    getIntegerParam(NDFileNetCDFShuffle, &shuffle);
+    getIntegerParam(NDFileNetCDFFramesPerChunk, &framesPerChunk);
+    getIntegerParam(NDFileNetCDFScalarBlock, &scalarBlock);
+    this->unlock();
+    if (framesPerChunk < 1) framesPerChunk = 1;
+    if (scalarBlock < 1) scalarBlock = 1;
+    /* A file with a single array has a single record */
+    if (!(openMode & NDFileModeMultiple)) {
+        framesPerChunk = 1;
+        scalarBlock = 1;
+    }
+    this->format_ = format;
+    this->scalarBlock_ = scalarBlock;
+    this->firstBufferedRecord_ = 0;
+    this->numBufferedRecords_ = 0;
+    this->scalars_.clear();
+
     /* Create the file. The NC_CLOBBER parameter tells netCDF to
      * overwrite this file, if it already exists.*/
-    if ((retval = nc_create(fileName, NC_CLOBBER, &this->ncId)))
+    cmode = NC_CLOBBER;
+    if (format == NDFileNetCDFFormatNetCDF4) {
+#ifdef NC_NETCDF4
+        cmode |= NC_NETCDF4;
+#else
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, the netCDF library does not support NetCDF-4\n",
+            driverName, functionName);
+        return asynError;
+#endif
+    }
+    if ((retval = nc_create(fileName, cmode, &this->ncId)))
         ERR(retval);
 
     /* Create global attribute for the data type because netCDF does not
@@ -183,31 +440,65 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     if ((retval = nc_def_var(this->ncId, "uniqueId", NC_INT, 1,
                  &dimIds[0], &this->uniqueIdId)))
         ERR(retval);
+    if (this->defineScalar(this->uniqueIdId, sizeof(epicsInt32), 1, dimIds)) return asynError;
 
     /* Define the timestamp data variable. */
     if ((retval = nc_def_var(this->ncId, "timeStamp", NC_DOUBLE, 1,
                  &dimIds[0], &this->timeStampId)))
         ERR(retval);
+    if (this->defineScalar(this->timeStampId, sizeof(double), 1, dimIds)) return asynError;
 
     /* Define the EPICS timestamp data variables. */
     if ((retval = nc_def_var(this->ncId, "epicsTSSec", NC_INT, 1,
                  &dimIds[0], &this->epicsTSSecId)))
         ERR(retval);
+    if (this->defineScalar(this->epicsTSSecId, sizeof(epicsInt32), 1, dimIds)) return asynError;
 
     if ((retval = nc_def_var(this->ncId, "epicsTSNsec", NC_INT, 1,
                  &dimIds[0], &this->epicsTSNsecId)))
         ERR(retval);
+    if (this->defineScalar(this->epicsTSNsecId, sizeof(epicsInt32), 1, dimIds)) return asynError;
 
     /* Define the array data variable. */
     if ((retval = nc_def_var(this->ncId, "array_data", ncType, pArray->ndims+1,
                  dimIds, &this->arrayDataId)))
         ERR(retval);
 
+#ifdef NC_NETCDF4
+    /* In NetCDF-4 files each chunk of the array data is framesPerChunk whole arrays,
+     * optionally shuffled and compressed with deflate */
+    if (format == NDFileNetCDFFormatNetCDF4) {
+        size_t chunks[ND_ARRAY_MAX_DIMS+1];
+        size_t cacheSize, cacheElements;
+        float cachePreemption;
+        chunks[0] = framesPerChunk;
+        for (i=0; i<pArray->ndims; i++) {
+            chunks[i+1] = pArray->dims[pArray->ndims - i - 1].size;
+        }
+        if ((retval = nc_def_var_chunking(this->ncId, this->arrayDataId, NC_CHUNKED, chunks)))
+            ERR(retval);
+        if ((deflateLevel > 0) || shuffle) {
+            if (deflateLevel > 9) deflateLevel = 9;
+            if ((retval = nc_def_var_deflate(this->ncId, this->arrayDataId, shuffle ? 1 : 0,
+                                             (deflateLevel > 0) ? 1 : 0, deflateLevel)))
+                ERR(retval);
+        }
+        /* A chunk being filled must stay in the chunk cache until it is complete */
+        pArray->getInfo(&arrayInfo);
+        if ((retval = nc_get_var_chunk_cache(this->ncId, this->arrayDataId, &cacheSize,
+                                             &cacheElements, &cachePreemption)))
+            ERR(retval);
+        if (cacheSize < framesPerChunk * arrayInfo.totalBytes) {
+            cacheSize = framesPerChunk * arrayInfo.totalBytes;
+            if ((retval = nc_set_var_chunk_cache(this->ncId, this->arrayDataId, cacheSize,
+                                                 cacheElements, cachePreemption)))
+                ERR(retval);
+        }
+    }
+#endif
+
     /* Create a variable for each attribute in the array */
-    free(this->pAttributeId);
-    numAttributes = this->pFileAttributes->count();
     attrCount = 0;
-    this->pAttributeId = (int *)calloc(numAttributes, sizeof(int));
     pAttribute = this->pFileAttributes->next(NULL);
     while (pAttribute) {
         const char *attributeName = pAttribute->getName();
@@ -282,28 +573,35 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
             case NDAttrInt8:
             case NDAttrUInt8:
                 ncType = NC_BYTE;
+                valueSize = 1;
                 break;
             case NDAttrInt16:
             case NDAttrUInt16:
                 ncType = NC_SHORT;
+                valueSize = 2;
                 break;
             case NDAttrInt32:
             case NDAttrUInt32:
                 ncType = NC_INT;
+                valueSize = 4;
                 break;
             case NDAttrFloat32:
                 ncType = NC_FLOAT;
+                valueSize = 4;
                 break;
             case NDAttrFloat64:
             case NDAttrInt64:
             case NDAttrUInt64:
                 ncType = NC_DOUBLE;
+                valueSize = 8;
                 break;
             case NDAttrString:
                 ncType = NC_CHAR;
+                valueSize = MAX_ATTRIBUTE_STRING_SIZE;
                 break;
             case NDAttrUndefined:
                 ncType = NC_BYTE;
+                valueSize = 1;
                 break;
             default:
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -315,13 +613,16 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
         epicsSnprintf(tempString, sizeof(tempString), "Attr_%s", pAttribute->getName());
         if (attrDataType == NDAttrString) {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 2,
-                    stringDimIds, &this->pAttributeId[attrCount++])))
+                    stringDimIds, &varId)))
                     ERR(retval);
+            if (this->defineScalar(varId, valueSize, 2, stringDimIds)) return asynError;
         } else {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 1,
-                    &dimIds[0], &this->pAttributeId[attrCount++])))
+                    &dimIds[0], &varId)))
                     ERR(retval);
+            if (this->defineScalar(varId, valueSize, 1, dimIds)) return asynError;
         }
+        attrCount++;
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
 
@@ -340,9 +641,7 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
 asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
 {
     int retval;
-    size_t stringCount[2];
     size_t start[ND_ARRAY_MAX_DIMS+1], count[ND_ARRAY_MAX_DIMS+1];
-    int attrId;
     NDAttrValue attrVal;
     int i, j;
     NDAttribute *pAttribute;
@@ -370,15 +669,6 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
     }
 
     /* Write the data to the file. */
-    if ((retval = nc_put_vara_int(this->ncId, this->uniqueIdId, start, count, &pArray->uniqueId)))
-                ERR(retval);
-    if ((retval = nc_put_vara_double(this->ncId, this->timeStampId, start, count, &pArray->timeStamp)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSSecId, start, count, (int *)&pArray->epicsTS.secPastEpoch)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSNsecId, start, count, (int *)&pArray->epicsTS.nsec)))
-                ERR(retval);
-
     switch (pArray->dataType) {
         case NDInt8:
             if ((retval = nc_put_vara_schar(this->ncId, this->arrayDataId, start, count, (signed char*)pArray->pData)))
@@ -415,63 +705,46 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
             return asynError;
             break;
     }
+    /* Buffer the unique ID, time stamps and attributes, they are written one block of arrays
+     * at a time rather than as one small write per variable per array.
+     * Numeric values are stored with the bytes of their netCDF type, as nc_put_vara_* did before.
+     * String attributes are stored as all MAX_ATTRIBUTE_STRING_SIZE characters, zero padded,
+     * where before only the characters of the string were written. */
+    if (this->numBufferedRecords_ == 0) this->firstBufferedRecord_ = this->nextRecord;
+    appendScalar(&this->scalars_[0], &pArray->uniqueId);
+    appendScalar(&this->scalars_[1], &pArray->timeStamp);
+    appendScalar(&this->scalars_[2], &pArray->epicsTS.secPastEpoch);
+    appendScalar(&this->scalars_[3], &pArray->epicsTS.nsec);
+
     /* Write the attributes.  Loop through the list of attributes.  These must not have changed since define time! */
     pAttribute = this->pFileAttributes->next(NULL);
     attrCount = 0;
-    while (pAttribute) {
+    while (pAttribute && (NUM_ARRAY_SCALARS + attrCount < (int)this->scalars_.size())) {
         pAttribute->getValueInfo(&attrDataType, &attrSize);
-        attrId = this->pAttributeId[attrCount++];
+        NDFileNetCDFScalar *pScalar = &this->scalars_[NUM_ARRAY_SCALARS + attrCount++];
         switch (attrDataType) {
             case NDAttrInt8:
             case NDAttrUInt8:
-                pAttribute->getValue(attrDataType, &attrVal.i8);
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
-                break;
             case NDAttrInt16:
             case NDAttrUInt16:
-                pAttribute->getValue(attrDataType, &attrVal.i16);
-                if ((retval = nc_put_vara_short(this->ncId, attrId, start, count, (short *)&attrVal.i16)))
-                    ERR(retval);
-                break;
             case NDAttrInt32:
             case NDAttrUInt32:
-                pAttribute->getValue(attrDataType, &attrVal.i32);
-                if ((retval = nc_put_vara_int(this->ncId, attrId, start, count, (int *)&attrVal.i32)))
-                    ERR(retval);
-                break;
             case NDAttrFloat32:
-                pAttribute->getValue(attrDataType, &attrVal.f32);
-                if ((retval = nc_put_vara_float(this->ncId, attrId, start, count, (float *)&attrVal.f32)))
-                    ERR(retval);
-                break;
             case NDAttrInt64:
-                pAttribute->getValue(attrDataType, &attrVal.i64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.i64)))
-                    ERR(retval);
-                break;
             case NDAttrUInt64:
-                pAttribute->getValue(attrDataType, &attrVal.ui64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.ui64)))
-                    ERR(retval);
-                break;
             case NDAttrFloat64:
-                pAttribute->getValue(attrDataType, &attrVal.f64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.f64)))
-                    ERR(retval);
+                pAttribute->getValue(attrDataType, &attrVal);
+                appendScalar(pScalar, &attrVal);
                 break;
             case NDAttrString:
+                memset(attrString, 0, sizeof(attrString));
                 pAttribute->getValue(attrDataType, attrString, sizeof(attrString));
-                stringCount[0] = 1;
-                stringCount[1] = strlen(attrString);
-                if ((retval = nc_put_vara_text(this->ncId, attrId, start, stringCount, attrString)))
-                    ERR(retval);
+                appendScalar(pScalar, attrString);
                 break;
             case NDAttrUndefined:
                 /* netCDF does not have a way of storing NaN, etc. We just use 0 byte */
                 attrVal.i8 = 0;
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
+                appendScalar(pScalar, &attrVal);
                 break;
             default:
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -483,16 +756,131 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
     this->nextRecord++;
+    this->numBufferedRecords_++;
+    if (this->numBufferedRecords_ >= this->scalarBlock_) return this->flushScalars();
     return(asynSuccess);
 }
 
-/** Read NDArray data from a netCDF file; NOTE: not implemented yet.
+/** Returns the number of arrays in the file opened with NDFileModeRead. */
+int NDFileNetCDF::getNumArraysInFile()
+{
+    return this->numArraysInFile_;
+}
+
+/** Read the next array of a netCDF file opened with NDFileModeRead into an NDArray.
+  * The NDArray is allocated from the pool of this plugin, with the unique ID, time stamps
+  * and attributes that were written with it.
   * \param[in] pArray Pointer to the address of an NDArray to read the data into.  */
 asynStatus NDFileNetCDF::readFile(NDArray **pArray)
 {
-    //static const char *functionName = "readFile";
+    int retval;
+    size_t start[ND_ARRAY_MAX_DIMS+1], count[ND_ARRAY_MAX_DIMS+1];
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDAttrValue attrVal;
+    char attrString[MAX_ATTRIBUTE_STRING_SIZE+1];
+    NDAttribute *pAttribute;
+    NDAttrDataType_t attrDataType;
+    size_t attrSize;
+    NDArray *pOut;
+    epicsInt32 int32Value;
+    size_t i;
+    int j;
+    static const char *functionName = "readFile";
+
+    if (!this->readMode_ || (this->ncId == 0)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, no file is open for reading\n",
+            driverName, functionName);
+        return asynError;
+    }
+    if (this->nextRecord >= this->numArraysInFile_) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, array %d is past the end of the file\n",
+            driverName, functionName, this->nextRecord);
+        return asynError;
+    }
+    for (j=0; j<this->readNDims_; j++) dims[j] = this->readDims_[j].size;
+    pOut = this->pNDArrayPool->alloc(this->readNDims_, dims, this->readDataType_, 0, NULL);
+    if (!pOut) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error allocating array\n",
+            driverName, functionName);
+        return asynError;
+    }
+    for (j=0; j<this->readNDims_; j++) pOut->dims[j] = this->readDims_[j];
+
+    /* The array data is stored with the bytes of its netCDF type, as in writeFile */
+    count[0] = 1;
+    start[0] = this->nextRecord;
+    for (j=0; j<this->readNDims_; j++) {
+        count[j+1] = this->readDims_[this->readNDims_ - j - 1].size;
+        start[j+1] = 0;
+    }
+    if ((retval = nc_get_vara(this->ncId, this->arrayDataId, start, count, pOut->pData))) {
+        pOut->release();
+        ERR(retval);
+    }
+    /* NDInt64 and NDUInt64 were written as the bits of their integers in a double variable,
+     * so the bytes read back are already the integers and must not be converted */
+
+    count[1] = MAX_ATTRIBUTE_STRING_SIZE;
+    start[1] = 0;
+    if ((retval = nc_get_vara(this->ncId, this->uniqueIdId, start, count, &int32Value))) {
+        pOut->release();
+        ERR(retval);
+    }
+    pOut->uniqueId = int32Value;
+    if ((retval = nc_get_vara(this->ncId, this->timeStampId, start, count, &pOut->timeStamp))) {
+        pOut->release();
+        ERR(retval);
+    }
+    if ((retval = nc_get_vara(this->ncId, this->epicsTSSecId, start, count, &int32Value))) {
+        pOut->release();
+        ERR(retval);
+    }
+    pOut->epicsTS.secPastEpoch = int32Value;
+    if ((retval = nc_get_vara(this->ncId, this->epicsTSNsecId, start, count, &int32Value))) {
+        pOut->release();
+        ERR(retval);
+    }
+    pOut->epicsTS.nsec = int32Value;
 
-    return asynError;
+    /* Set the values of the attributes of the file for this array and copy them to the array */
+    pAttribute = this->pFileAttributes->next(NULL);
+    i = 0;
+    while (pAttribute && (i < this->scalars_.size())) {
+        NDFileNetCDFScalar *pScalar = &this->scalars_[i++];
+        pAttribute->getValueInfo(&attrDataType, &attrSize);
+        memset(attrString, 0, sizeof(attrString));
+        if ((retval = nc_get_vara(this->ncId, pScalar->varId, start, count, attrString))) {
+            pOut->release();
+            ERR(retval);
+        }
+        switch (attrDataType) {
+            case NDAttrInt64:
+                memcpy(&attrVal.i64, attrString, sizeof(epicsInt64));
+                pAttribute->setValue(&attrVal);
+                break;
+            case NDAttrUInt64:
+                memcpy(&attrVal.ui64, attrString, sizeof(epicsUInt64));
+                pAttribute->setValue(&attrVal);
+                break;
+            case NDAttrString:
+                pAttribute->setValue(std::string(attrString));
+                break;
+            case NDAttrUndefined:
+                break;
+            default:
+                pAttribute->setValue(attrString);
+                break;
+        }
+        pAttribute = this->pFileAttributes->next(pAttribute);
+    }
+    this->pFileAttributes->copy(pOut->pAttributeList);
+
+    this->nextRecord++;
+    *pArray = pOut;
+    return asynSuccess;
 }
 
 
@@ -500,13 +888,18 @@ asynStatus NDFileNetCDF::readFile(NDArray **pArray)
 asynStatus NDFileNetCDF::closeFile()
 {
     int retval;
+    asynStatus status;
     static const char *functionName = "closeFile";
 
     if (this->ncId == 0) return asynSuccess;
-    if ((retval = nc_close(this->ncId)))
+    /* Write the scalar values of the last block of arrays */
+    status = this->readMode_ ? asynSuccess : this->flushScalars();
+    if ((retval = nc_close(this->ncId))) {
+        this->ncId = 0;
         ERR(retval);
+    }
     this->ncId = 0;
-    return asynSuccess;
+    return status;
 }
 
 
@@ -530,11 +923,29 @@ NDFileNetCDF::NDFileNetCDF(const char *portName, int queueSize, int blockingCall
 {
     //static const char *functionName = "NDFileNetCDF";
 
+    createParam(NDFileNetCDFFormatString,         asynParamInt32, &NDFileNetCDFFormat);
+    createParam(NDFileNetCDFDeflateLevelString,   asynParamInt32, &NDFileNetCDFDeflateLevel);
+    createParam(NDFileNetCDFShuffleString,        asynParamInt32, &NDFileNetCDFShuffle);
+    createParam(NDFileNetCDFFramesPerChunkString, asynParamInt32, &NDFileNetCDFFramesPerChunk);
+    createParam(NDFileNetCDFScalarBlockString,    asynParamInt32, &NDFileNetCDFScalarBlock);
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDFileNetCDF");
+    setIntegerParam(NDFileNetCDFFormat, NDFileNetCDFFormatClassic);
+    setIntegerParam(NDFileNetCDFDeflateLevel, 0);
+    setIntegerParam(NDFileNetCDFShuffle, 0);
+    setIntegerParam(NDFileNetCDFFramesPerChunk, 1);
+    setIntegerParam(NDFileNetCDFScalarBlock, 1);
     this->supportsMultipleArrays = 1;
-    this->pAttributeId = NULL;
     this->ncId = 0;
+    this->readMode_ = false;
+    this->numArraysInFile_ = 0;
+    this->readDataType_ = NDUInt8;
+    this->readNDims_ = 0;
+    this->format_ = NDFileNetCDFFormatClassic;
+    this->scalarBlock_ = 1;
+    this->firstBufferedRecord_ = 0;
+    this->numBufferedRecords_ = 0;
     this->pFileAttributes = new NDAttributeList;
 }
 
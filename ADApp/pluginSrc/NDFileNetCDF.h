@@ -8,6 +8,9 @@
 #ifndef DRV_NDFileNetCDF_H
 #define DRV_NDFileNetCDF_H
 
+#include <string>
+#include <vector>
+
 #include "NDPluginFile.h"
 
 /** This version number is an attribute in the netCDF file to allow readers
@@ -18,12 +21,34 @@
  * which changed the datatypes of NDFloat32 and NDFloat64 from 6-7 to 8-9.*/
 #define NDNetCDFFileVersion 3.1
 
+#define NDFileNetCDFFormatString         "NETCDF_FORMAT"           /* (asynInt32, r/w) NDFileNetCDFFormat_t */
+#define NDFileNetCDFDeflateLevelString   "NETCDF_DEFLATE_LEVEL"    /* (asynInt32, r/w) NetCDF-4 deflate level of the array data, 0 for none */
+#define NDFileNetCDFShuffleString        "NETCDF_SHUFFLE"          /* (asynInt32, r/w) NetCDF-4 byte shuffle of the array data */
+#define NDFileNetCDFFramesPerChunkString "NETCDF_FRAMES_PER_CHUNK" /* (asynInt32, r/w) NetCDF-4 arrays per chunk of the array data */
+#define NDFileNetCDFScalarBlockString    "NETCDF_SCALAR_BLOCK"     /* (asynInt32, r/w) Arrays whose scalar variables are written together */
+
+/** File formats written by NDFileNetCDF */
+typedef enum {
+    NDFileNetCDFFormatClassic,  /**< netCDF classic format */
+    NDFileNetCDFFormatNetCDF4   /**< NetCDF-4 format, stored in HDF5 */
+} NDFileNetCDFFormat_t;
+
+/** A variable with one value per array, such as the unique ID or an NDAttribute.
+  * The values are collected and written to the file one block of arrays at a time. */
+typedef struct NDFileNetCDFScalar {
+    int varId;                  /**< netCDF variable ID */
+    int numDims;                /**< 1, or 2 for strings */
+    size_t valueSize;           /**< Bytes per array in the file */
+    std::vector<char> buffer;   /**< Values of the arrays that have not been written */
+} NDFileNetCDFScalar;
+
 /** Writes NDArrays to files in the netCDF file format.
   * netCDF is an open-source, portable, self-describing binary format supported by Unidata at UCAR
   * (http://www.unidata.ucar.edu/software/netcdf).
   * The netCDF format supports arrays of any dimension and all of the data types supported by NDArray.
   * It can store multiple NDArrays in a single file, so it sets NDPluginFile::supportsMultipleArrays to 1.
   * If also can store all of the attributes associated with an NDArray.
+  * Files written by this class can be read back in NDFileModeRead, which NDPluginFile uses to replay them.
   * This class implements the 4 pure virtual functions from
   * NDPluginFile: openFile, readFile, writeFile and closeFile. */
 class NDPLUGIN_API NDFileNetCDF : public NDPluginFile {
@@ -37,8 +62,22 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual int getNumArraysInFile();
+
+protected:
+    int NDFileNetCDFFormat;
+    #define FIRST_NDFILE_NETCDF_PARAM NDFileNetCDFFormat
+    int NDFileNetCDFDeflateLevel;
+    int NDFileNetCDFShuffle;
+    int NDFileNetCDFFramesPerChunk;
+    int NDFileNetCDFScalarBlock;
 
 private:
+    asynStatus defineScalar(int varId, size_t valueSize, int numDims, const int *dimIds);
+    asynStatus flushScalars();
+    asynStatus openFileForRead(const char *fileName);
+    std::string getGlobalText(const char *name);
+
     int ncId;
     int arrayDataId;
     int uniqueIdId;
@@ -46,8 +85,17 @@ private:
     int epicsTSSecId;
     int epicsTSNsecId;
     int nextRecord;
-    int *pAttributeId;
     NDAttributeList *pFileAttributes;
+    int format_;                /* NDFileNetCDFFormat_t of the open file */
+    int scalarBlock_;           /* Arrays per block of scalar values */
+    int firstBufferedRecord_;   /* Record of the first buffered scalar values */
+    int numBufferedRecords_;    /* Arrays whose scalar values are buffered */
+    std::vector<NDFileNetCDFScalar> scalars_; /* uniqueId, timeStamp, epicsTSSec, epicsTSNsec, then the NDAttributes */
+    bool readMode_;             /* The open file was opened with NDFileModeRead */
+    int numArraysInFile_;       /* Arrays in the file opened for reading */
+    NDDataType_t readDataType_; /* Data type of the arrays in the file opened for reading */
+    int readNDims_;             /* Dimensions of the arrays in the file opened for reading */
+    NDDimension_t readDims_[ND_ARRAY_MAX_DIMS];
 };
 
 #endif
@@ -24,6 +24,14 @@
 #include <string.h>
 
 #include <iocsh.h>
+#include <epicsThread.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "tiffio.h"
 #include "NDFileTIFF.h"
@@ -32,6 +40,10 @@
 
 #define STRING_BUFFER_SIZE 2048
 
+/* Files whose image is larger than this are written as BigTIFF, leaving room for the tags
+ * and for strips that do not compress */
+#define MAX_CLASSIC_TIFF_IMAGE_BYTES (0xFFFFFFFFULL - 0x4000000ULL)
+
 static const char *driverName = "NDFileTIFF";
 
 
@@ -51,10 +63,22 @@ static TIFFFieldInfo tiffFieldInfo[NUM_CUSTOM_TIFF_TAGS] = {
     {TIFFTAG_EPICSTSNSEC, 1, 1, TIFF_LONG,FIELD_CUSTOM,   1, 0, (char *)"EPICSTSNsec"}
 };
 
+/* The TIFF library keeps a copy of the custom tags for every directory until the file is closed,
+ * so only as many attribute tags as files have needed are registered, rather than all of them
+ * for every page of a multi-page file */
+static int numCustomTIFFTags = 4;
+
 static void registerCustomTIFFTags(TIFF *tif)
 {
     /* Install the extended Tag field info */
-    TIFFMergeFieldInfo(tif, tiffFieldInfo, sizeof(tiffFieldInfo)/sizeof(tiffFieldInfo[0]));
+    TIFFMergeFieldInfo(tif, tiffFieldInfo, numCustomTIFFTags);
+}
+
+static void addCustomTIFFTags(int numAttributes)
+{
+    int numTags = 4 + numAttributes;
+    if (numTags > NUM_CUSTOM_TIFF_TAGS) numTags = NUM_CUSTOM_TIFF_TAGS;
+    if (numTags > numCustomTIFFTags) numCustomTIFFTags = numTags;
 }
 
 static void augmentLibTiffWithCustomTags() {
@@ -64,6 +88,12 @@ static void augmentLibTiffWithCustomTags() {
     TIFFSetTagExtender(registerCustomTIFFTags);
 }
 
+static void compressTaskC(void *drvPvt)
+{
+    NDFileTIFF *pPlugin = (NDFileTIFF *)drvPvt;
+    pPlugin->compressTask();
+}
+
 
 /** Opens a TIFF file.
   * \param[in] fileName The name of the file to open.
@@ -79,9 +109,10 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     size_t sizeX, sizeY, rowsPerStrip;
     int bitsPerSample=8, sampleFormat=SAMPLEFORMAT_INT, samplesPerPixel, photoMetric, planarConfig;
     int colorMode=NDColorModeMono;
+    int stripRows, tileWidth, tileLength, compression, compressLevel, bigTIFF;
+    NDArrayInfo_t arrayInfo;
     NDAttribute *pAttribute = NULL;
     char tagString[STRING_BUFFER_SIZE] = {0};
-    char attrString[STRING_BUFFER_SIZE] = {0};
     char tagName[STRING_BUFFER_SIZE] = {0};
     int i;
     TIFFFieldInfo fieldInfo = {0, 1, 1, TIFF_ASCII, FIELD_CUSTOM, 1, 0, tagName};
@@ -103,6 +134,7 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
     /* Open for reading */
     else if (openMode & NDFileModeRead) {
+        addCustomTIFFTags(NUM_CUSTOM_TIFF_TAGS);
         /* Open the file. */
         if ((this->tiff = TIFFOpen(fileName, "rc")) == NULL ) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -117,7 +149,19 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
     /* Open file for writing */
     else if (openMode & NDFileModeWrite) {
-        if ((this->tiff = TIFFOpen(fileName, "w")) == NULL ) {
+        this->lock();
+        getIntegerParam(NDFileTIFFRowsPerStrip, &stripRows);
+        getIntegerParam(NDFileTIFFTileWidth, &tileWidth);
+        getIntegerParam(NDFileTIFFTileLength, &tileLength);
+        getIntegerParam(NDFileTIFFCompression, &compression);
+        getIntegerParam(NDFileTIFFCompressLevel, &compressLevel);
+        getIntegerParam(NDFileTIFFBigTIFF, &bigTIFF);
+        this->unlock();
+        /* Classic TIFF files are limited to 4 GB */
+        pArray->getInfo(&arrayInfo);
+        if ((epicsUInt64)arrayInfo.totalBytes > MAX_CLASSIC_TIFF_IMAGE_BYTES) bigTIFF = 1;
+        addCustomTIFFTags(pArray->pAttributeList->count() + this->pAttributeList->count());
+        if ((this->tiff = TIFFOpen(fileName, bigTIFF ? "w8" : "w")) == NULL ) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s error opening file %s\n",
             driverName, functionName, fileName);
@@ -224,18 +268,76 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         return(asynError);
     }
 
-    TIFFSetField(this->tiff, TIFFTAG_NDTIMESTAMP, pArray->timeStamp);
-    TIFFSetField(this->tiff, TIFFTAG_UNIQUEID, pArray->uniqueId);
-    TIFFSetField(this->tiff, TIFFTAG_EPICSTSSEC, pArray->epicsTS.secPastEpoch);
-    TIFFSetField(this->tiff, TIFFTAG_EPICSTSNSEC, pArray->epicsTS.nsec);
-    TIFFSetField(this->tiff, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
-    TIFFSetField(this->tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat);
-    TIFFSetField(this->tiff, TIFFTAG_SAMPLESPERPIXEL, samplesPerPixel);
-    TIFFSetField(this->tiff, TIFFTAG_PHOTOMETRIC, photoMetric);
-    TIFFSetField(this->tiff, TIFFTAG_PLANARCONFIG, planarConfig);
-    TIFFSetField(this->tiff, TIFFTAG_IMAGEWIDTH, (epicsUInt32)sizeX);
-    TIFFSetField(this->tiff, TIFFTAG_IMAGELENGTH, (epicsUInt32)sizeY);
-    TIFFSetField(this->tiff, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);
+    /* Work out the tags of the pages here, writeFile writes them for every page */
+    NDFileTIFFLayout *pLayout = &this->layout_;
+    pLayout->dataType = pArray->dataType;
+    pLayout->ndims = pArray->ndims;
+    for (i=0; i<pArray->ndims; i++) pLayout->dims[i] = pArray->dims[i].size;
+    pLayout->bitsPerSample = bitsPerSample;
+    pLayout->sampleFormat = sampleFormat;
+    pLayout->samplesPerPixel = samplesPerPixel;
+    pLayout->photoMetric = photoMetric;
+    pLayout->planarConfig = planarConfig;
+    pLayout->sizeX = (epicsUInt32)sizeX;
+    pLayout->sizeY = (epicsUInt32)sizeY;
+
+    /* Row interleaved color is written one row per strip, anything else can be split
+     * into strips of stripRows rows or into tiles, whose sizes must be multiples of 16 */
+    this->tiled_ = false;
+    if (this->colorMode != NDColorModeRGB2) {
+        if ((tileWidth > 0) && (tileLength > 0) && (pArray->ndims > 1)) {
+            tileWidth  = (tileWidth + 15) & ~15;
+            tileLength = (tileLength + 15) & ~15;
+            this->tiled_ = true;
+        } else if ((stripRows > 0) && ((size_t)stripRows < sizeY)) {
+            rowsPerStrip = stripRows;
+        }
+    }
+    if (this->tiled_) {
+        pLayout->rowsPerStrip = 0;
+        pLayout->tileWidth = tileWidth;
+        pLayout->tileLength = tileLength;
+        this->lock();
+        setIntegerParam(NDFileTIFFTileWidth, tileWidth);
+        setIntegerParam(NDFileTIFFTileLength, tileLength);
+        this->unlock();
+    } else {
+        pLayout->rowsPerStrip = (epicsUInt32)rowsPerStrip;
+        pLayout->tileWidth = 0;
+        pLayout->tileLength = 0;
+    }
+
+    switch (compression) {
+        case NDFileTIFFCompressDeflate:
+            if (compressLevel < 1) compressLevel = 1;
+            if (compressLevel > 9) compressLevel = 9;
+            pLayout->tiffCompression = COMPRESSION_ADOBE_DEFLATE;
+            break;
+        case NDFileTIFFCompressLZW:
+            pLayout->tiffCompression = COMPRESSION_LZW;
+            break;
+#ifdef COMPRESSION_ZSTD
+        case NDFileTIFFCompressZstd:
+            if (!TIFFIsCODECConfigured(COMPRESSION_ZSTD)) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: the TIFF library does not support zstd, writing uncompressed\n",
+                    driverName, functionName);
+                compression = NDFileTIFFCompressNone;
+                pLayout->tiffCompression = COMPRESSION_NONE;
+                break;
+            }
+            if (compressLevel < 1) compressLevel = 1;
+            if (compressLevel > 22) compressLevel = 22;
+            pLayout->tiffCompression = COMPRESSION_ZSTD;
+            break;
+#endif
+        default:
+            compression = NDFileTIFFCompressNone;
+            pLayout->tiffCompression = COMPRESSION_NONE;
+            break;
+    }
+    this->compression_ = compression;
+    this->compressLevel_ = compressLevel;
 
     this->pFileAttributes->clear();
     this->getAttributes(this->pFileAttributes);
@@ -244,21 +346,79 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     pAttribute = this->pFileAttributes->find("Model");
     if (pAttribute) {
         pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
-        TIFFSetField(this->tiff, TIFFTAG_MODEL, tagString);
+        pLayout->model = tagString;
     } else {
-        TIFFSetField(this->tiff, TIFFTAG_MODEL, "Unknown");
+        pLayout->model = "Unknown";
     }
 
     pAttribute = this->pFileAttributes->find("Manufacturer");
     if (pAttribute) {
-        pAttribute->getValue(NDAttrString, tagString);
-        TIFFSetField(this->tiff, TIFFTAG_MAKE, tagString, sizeof(tagString)-1);
+        pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
+        pLayout->make = tagString;
     } else {
-        TIFFSetField(this->tiff, TIFFTAG_MAKE, "Unknown");
+        pLayout->make = "Unknown";
     }
 
+    this->numPages_ = 0;
+    this->multiPage_ = (openMode & NDFileModeMultiple) != 0;
+    this->lock();
+    setIntegerParam(NDFileTIFFNumPages, 0);
+    this->unlock();
+
+    return(asynSuccess);
+}
+
+/** Sets the tags of the page that is about to be written.  The tags that are the same
+  * for every page come from the layout worked out in openFile, the NDArray time stamps,
+  * unique ID and NDAttributes come from the array.
+  * \param[in] pArray Pointer to the NDArray of the page
+  */
+asynStatus NDFileTIFF::writePageTags(NDArray *pArray)
+{
+    NDFileTIFFLayout *pLayout = &this->layout_;
+    NDAttribute *pAttribute = NULL;
+    char tagString[STRING_BUFFER_SIZE] = {0};
+    char attrString[STRING_BUFFER_SIZE] = {0};
+    static const char *functionName = "writePageTags";
+
+    if (this->multiPage_) {
+        /* Only files opened for multiple arrays are marked as pages of a document.
+         * The total number of pages is not known until the file is closed */
+        TIFFSetField(this->tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+        TIFFSetField(this->tiff, TIFFTAG_PAGENUMBER, (epicsUInt16)this->numPages_, (epicsUInt16)0);
+    }
+    TIFFSetField(this->tiff, TIFFTAG_NDTIMESTAMP, pArray->timeStamp);
+    TIFFSetField(this->tiff, TIFFTAG_UNIQUEID, pArray->uniqueId);
+    TIFFSetField(this->tiff, TIFFTAG_EPICSTSSEC, pArray->epicsTS.secPastEpoch);
+    TIFFSetField(this->tiff, TIFFTAG_EPICSTSNSEC, pArray->epicsTS.nsec);
+    TIFFSetField(this->tiff, TIFFTAG_BITSPERSAMPLE, pLayout->bitsPerSample);
+    TIFFSetField(this->tiff, TIFFTAG_SAMPLEFORMAT, pLayout->sampleFormat);
+    TIFFSetField(this->tiff, TIFFTAG_SAMPLESPERPIXEL, pLayout->samplesPerPixel);
+    TIFFSetField(this->tiff, TIFFTAG_PHOTOMETRIC, pLayout->photoMetric);
+    TIFFSetField(this->tiff, TIFFTAG_PLANARCONFIG, pLayout->planarConfig);
+    TIFFSetField(this->tiff, TIFFTAG_IMAGEWIDTH, pLayout->sizeX);
+    TIFFSetField(this->tiff, TIFFTAG_IMAGELENGTH, pLayout->sizeY);
+    if (this->tiled_) {
+        TIFFSetField(this->tiff, TIFFTAG_TILEWIDTH, pLayout->tileWidth);
+        TIFFSetField(this->tiff, TIFFTAG_TILELENGTH, pLayout->tileLength);
+    } else {
+        TIFFSetField(this->tiff, TIFFTAG_ROWSPERSTRIP, pLayout->rowsPerStrip);
+    }
+    TIFFSetField(this->tiff, TIFFTAG_COMPRESSION, pLayout->tiffCompression);
+    if (pLayout->tiffCompression == COMPRESSION_ADOBE_DEFLATE)
+        TIFFSetField(this->tiff, TIFFTAG_ZIPQUALITY, this->compressLevel_);
+#ifdef COMPRESSION_ZSTD
+    if (pLayout->tiffCompression == COMPRESSION_ZSTD)
+        TIFFSetField(this->tiff, TIFFTAG_ZSTD_LEVEL, this->compressLevel_);
+#endif
+    TIFFSetField(this->tiff, TIFFTAG_MODEL, pLayout->model.c_str());
+    TIFFSetField(this->tiff, TIFFTAG_MAKE, pLayout->make.c_str());
     TIFFSetField(this->tiff, TIFFTAG_SOFTWARE, "EPICS areaDetector");
 
+    this->pFileAttributes->clear();
+    this->getAttributes(this->pFileAttributes);
+    pArray->pAttributeList->copy(this->pFileAttributes);
+
     // If the attribute TIFFImageDescription exists use it to set the TIFFTAG_IMAGEDESCRIPTION
     pAttribute = this->pFileAttributes->find("TIFFImageDescription");
     if (pAttribute) {
@@ -268,6 +428,8 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
     int count = 0;
     int tagId = TIFFTAG_FIRST_ATTRIBUTE;
+    /* Tags that were not registered when the file was opened can't be written */
+    int lastTagId = TIFFTAG_FIRST_ATTRIBUTE + numCustomTIFFTags - 4 - 1;
 
     numAttributes_ = this->pFileAttributes->count();
     asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
@@ -337,15 +499,15 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
             asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
                 "%s:%s : tagId: %d, tagString: %s\n",
                   driverName, functionName, tagId, tagString);
-            TIFFSetField(this->tiff, tagId, tagString);
-            ++count;
-            ++tagId;
-            if ((tagId > TIFFTAG_LAST_ATTRIBUTE) || (count > numAttributes_)) {
+            if (tagId > lastTagId) {
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                     "%s:%s error, Too many tags/attributes for file. tagId: %d, count: %d\n",
                     driverName, functionName, tagId, count);
                 break;
             }
+            TIFFSetField(this->tiff, tagId, tagString);
+            ++count;
+            ++tagId;
         }
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
@@ -358,10 +520,12 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
   */
 asynStatus NDFileTIFF::writeFile(NDArray *pArray)
 {
-    unsigned long stripSize;
-    tsize_t nwrite=0;
-    int strip, sizeY;
-    unsigned char *pRed, *pGreen, *pBlue;
+    NDFileTIFFLayout *pLayout = &this->layout_;
+    epicsUInt32 sizeX, sizeY, rowsPerStrip, tileWidth, tileLength;
+    int bitsPerSample, samplesPerPixel;
+    size_t rowBytes, pixelBytes, rowStride, numPlanes;
+    const char *planeBase[3];
+    asynStatus status;
     static const char *functionName = "writeFile";
 
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -375,28 +539,63 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
         return(asynError);
     }
 
-    stripSize = (unsigned long)TIFFStripSize(this->tiff);
-    TIFFGetField(this->tiff, TIFFTAG_IMAGELENGTH, &sizeY);
+    /* Every page of a file has the layout of the array the file was opened with */
+    bool sameLayout = (pArray->dataType == pLayout->dataType) && (pArray->ndims == pLayout->ndims);
+    for (int i=0; sameLayout && (i<pArray->ndims); i++) {
+        if (pArray->dims[i].size != pLayout->dims[i]) sameLayout = false;
+    }
+    if (!sameLayout) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: array dimensions or data type differ from the first array in the file\n",
+            driverName, functionName);
+        return(asynError);
+    }
 
+    /* The previous page is complete, start the directory of the next one */
+    if ((this->numPages_ > 0) && !TIFFWriteDirectory(this->tiff)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error writing TIFF directory\n",
+            driverName, functionName);
+        return(asynError);
+    }
+    status = this->writePageTags(pArray);
+    if (status != asynSuccess) return status;
+
+    sizeX = pLayout->sizeX;
+    sizeY = pLayout->sizeY;
+    bitsPerSample = pLayout->bitsPerSample;
+    samplesPerPixel = pLayout->samplesPerPixel;
+    rowsPerStrip = pLayout->rowsPerStrip;
+    tileWidth = pLayout->tileWidth;
+    tileLength = pLayout->tileLength;
+
+    /* Work out where each plane of the image starts in the array and how far apart its rows are */
     switch (this->colorMode) {
         case NDColorModeMono:
         case NDColorModeRGB1:
-            nwrite = TIFFWriteEncodedStrip(this->tiff, 0, pArray->pData, stripSize);
+            numPlanes = 1;
+            pixelBytes = samplesPerPixel * bitsPerSample/8;
+            rowBytes = sizeX * pixelBytes;
+            rowStride = rowBytes;
+            planeBase[0] = (const char *)pArray->pData;
             break;
         case NDColorModeRGB2:
             /* TIFF readers don't support row interleave, put all the red strips first, then all the blue, then green. */
-            for (strip=0; strip<sizeY; strip++) {
-                pRed   = (unsigned char *)pArray->pData + 3*strip*stripSize;
-                pGreen = pRed + stripSize;
-                pBlue  = pRed + 2*stripSize;
-                nwrite = TIFFWriteEncodedStrip(this->tiff, strip, pRed, stripSize);
-                nwrite = TIFFWriteEncodedStrip(this->tiff, sizeY+strip, pGreen, stripSize);
-                nwrite = TIFFWriteEncodedStrip(this->tiff, 2*sizeY+strip, pBlue, stripSize);
+            numPlanes = 3;
+            pixelBytes = bitsPerSample/8;
+            rowBytes = sizeX * pixelBytes;
+            rowStride = 3 * rowBytes;
+            for (size_t plane=0; plane<numPlanes; plane++) {
+                planeBase[plane] = (const char *)pArray->pData + plane*rowBytes;
             }
             break;
         case NDColorModeRGB3:
-            for (strip=0; strip<3; strip++) {
-                nwrite = TIFFWriteEncodedStrip(this->tiff, strip, (unsigned char *)pArray->pData+stripSize*strip, stripSize);
+            numPlanes = 3;
+            pixelBytes = bitsPerSample/8;
+            rowBytes = sizeX * pixelBytes;
+            rowStride = rowBytes;
+            for (size_t plane=0; plane<numPlanes; plane++) {
+                planeBase[plane] = (const char *)pArray->pData + plane*rowBytes*sizeY;
             }
             break;
         default:
@@ -406,14 +605,277 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
             return(asynError);
             break;
     }
-    if (nwrite <= 0) {
+
+    /* Describe each strip or tile.  The compression threads only start on them once
+     * writeSegments has set compressActive_ */
+    epicsMutexLock(this->compressMutex_);
+    this->numSegments_ = 0;
+    for (size_t plane=0; plane<numPlanes; plane++) {
+        for (epicsUInt32 y=0; y<sizeY; y += (this->tiled_ ? tileLength : rowsPerStrip)) {
+            for (epicsUInt32 x=0; x<sizeX; x += (this->tiled_ ? tileWidth : sizeX)) {
+                if (this->numSegments_ == this->segments_.size()) this->segments_.resize(this->numSegments_ + 1);
+                NDFileTIFFSegment *pSegment = &this->segments_[this->numSegments_++];
+                pSegment->pData = planeBase[plane] + y*rowStride + x*pixelBytes;
+                pSegment->rowStride = rowStride;
+                if (this->tiled_) {
+                    pSegment->index = TIFFComputeTile(this->tiff, x, y, 0, (uint16_t)plane);
+                    pSegment->rowBytes = ((sizeX - x < tileWidth) ? sizeX - x : tileWidth) * pixelBytes;
+                    pSegment->rows = (sizeY - y < tileLength) ? sizeY - y : tileLength;
+                    pSegment->fileRowBytes = tileWidth * pixelBytes;
+                    pSegment->size = pSegment->fileRowBytes * tileLength;
+                } else {
+                    pSegment->index = TIFFComputeStrip(this->tiff, y, (uint16_t)plane);
+                    pSegment->rowBytes = rowBytes;
+                    pSegment->rows = (sizeY - y < rowsPerStrip) ? sizeY - y : rowsPerStrip;
+                    pSegment->fileRowBytes = rowBytes;
+                    pSegment->size = pSegment->rows * rowBytes;
+                }
+                pSegment->outputSize = 0;
+                pSegment->done = false;
+            }
+        }
+    }
+    epicsMutexUnlock(this->compressMutex_);
+
+    status = this->writeSegments(this->tiled_);
+    this->numPages_++;
+    this->lock();
+    setIntegerParam(NDFileTIFFNumPages, this->numPages_);
+    callParamCallbacks();
+    this->unlock();
+    return status;
+}
+
+/** Returns the data of a strip or tile as it is stored in the file, before compression.
+  * A strip is part of the NDArray, a tile is copied out of it into the buffer of the segment.
+  * \param[in] pSegment The strip or tile
+  */
+const char *NDFileTIFF::getSegmentData(NDFileTIFFSegment *pSegment)
+{
+    if ((pSegment->rowBytes == pSegment->fileRowBytes) &&
+        ((pSegment->rows == 1) || (pSegment->rowStride == pSegment->rowBytes)) &&
+        (pSegment->size == pSegment->rows*pSegment->rowBytes)) {
+        return pSegment->pData;
+    }
+    /* The parts of edge tiles outside the image are written as zeros */
+    pSegment->buffer.assign(pSegment->size, 0);
+    for (size_t row=0; row<pSegment->rows; row++) {
+        memcpy(&pSegment->buffer[row*pSegment->fileRowBytes], pSegment->pData + row*pSegment->rowStride,
+               pSegment->rowBytes);
+    }
+    return &pSegment->buffer[0];
+}
+
+/** Compresses a strip or tile in the format of the TIFF library codec, so that any reader can decompress it.
+  * The bytes are not necessarily those the TIFF library would write, e.g. the zstd frame header here
+  * holds the size of the data.
+  * outputSize is left at 0 if the compression is not available here or fails,
+  * and the segment is then compressed by the TIFF library when it is written.
+  * \param[in] pSegment The strip or tile
+  */
+void NDFileTIFF::compressSegment(NDFileTIFFSegment *pSegment)
+{
+    const char *pIn = this->getSegmentData(pSegment);
+
+    pSegment->outputSize = 0;
+#ifdef HAVE_ZLIB
+    if (this->compression_ == NDFileTIFFCompressDeflate) {
+        /* The TIFF deflate codec stores a zlib stream */
+        uLongf compSize = compressBound((uLong)pSegment->size);
+        pSegment->output.resize(compSize);
+        if (compress2((Bytef *)&pSegment->output[0], &compSize, (const Bytef *)pIn,
+                      (uLong)pSegment->size, this->compressLevel_) == Z_OK) {
+            pSegment->outputSize = compSize;
+        }
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (this->compression_ == NDFileTIFFCompressZstd) {
+        /* The TIFF zstd codec stores a single zstd frame */
+        size_t compSize = ZSTD_compressBound(pSegment->size);
+        pSegment->output.resize(compSize);
+        compSize = ZSTD_compress(&pSegment->output[0], compSize, pIn, pSegment->size, this->compressLevel_);
+        if (!ZSTD_isError(compSize)) pSegment->outputSize = compSize;
+    }
+#endif
+}
+
+/** Creates compression threads until there are numThreads of them.
+  * The threads are kept for the lifetime of the plugin.
+  * \param[in] numThreads Number of threads required
+  */
+void NDFileTIFF::addCompressThreads(int numThreads)
+{
+    char threadName[64];
+    static const char *functionName = "addCompressThreads";
+
+    while (this->numCompressThreads_ < numThreads) {
+        epicsSnprintf(threadName, sizeof(threadName), "%s_Compress%d", this->portName, this->numCompressThreads_);
+        epicsThreadId threadId = epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                                                   epicsThreadGetStackSize(epicsThreadStackMedium),
+                                                   (EPICSTHREADFUNC)compressTaskC, this);
+        if (threadId == NULL) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: epicsThreadCreate failure for %s\n",
+                driverName, functionName, threadName);
+            break;
+        }
+        this->numCompressThreads_++;
+    }
+}
+
+/** Compression thread, takes the next strip or tile of the image being written and compresses it. */
+void NDFileTIFF::compressTask()
+{
+    NDFileTIFFSegment *pSegment;
+
+    epicsMutexLock(this->compressMutex_);
+    while (1) {
+        // Only claim a segment while writeSegments is waiting for the threads to compress the image;
+        // otherwise the plugin thread may be using the segments itself
+        while (!this->compressActive_ || (this->nextSegment_ >= this->numSegments_)) {
+            epicsMutexUnlock(this->compressMutex_);
+            epicsEventWait(this->workEvent_);
+            epicsMutexLock(this->compressMutex_);
+        }
+        pSegment = &this->segments_[this->nextSegment_++];
+        // Wake another thread for the rest of the image
+        if (this->compressActive_ && (this->nextSegment_ < this->numSegments_)) epicsEventSignal(this->workEvent_);
+        epicsMutexUnlock(this->compressMutex_);
+
+        this->compressSegment(pSegment);
+
+        epicsMutexLock(this->compressMutex_);
+        pSegment->done = true;
+        epicsEventSignal(this->doneEvent_);
+    }
+}
+
+/** Writes the strips or tiles of the image in order.  When compression threads are
+  * enabled and can apply the compression of the file, the segments are compressed
+  * in parallel and each is written as soon as it and the ones before it are ready.
+  * \param[in] tiled Whether the segments are tiles rather than strips
+  */
+asynStatus NDFileTIFF::writeSegments(bool tiled)
+{
+    int numThreads = 0;
+    bool parallel = false;
+    tmsize_t nwrite = 0;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeSegments";
+
+    this->lock();
+    getIntegerParam(NDFileTIFFCompressThreads, &numThreads);
+    this->unlock();
+#ifdef HAVE_ZLIB
+    if (this->compression_ == NDFileTIFFCompressDeflate) parallel = true;
+#endif
+#ifdef HAVE_ZSTD
+    if (this->compression_ == NDFileTIFFCompressZstd) parallel = true;
+#endif
+    if (numThreads < 1) parallel = false;
+
+    if (parallel) {
+        this->addCompressThreads(numThreads);
+        if (this->numCompressThreads_ < 1) parallel = false;
+    }
+    if (parallel) {
+        epicsMutexLock(this->compressMutex_);
+        this->nextSegment_ = 0;
+        this->compressActive_ = true;
+        epicsMutexUnlock(this->compressMutex_);
+        epicsEventSignal(this->workEvent_);
+    }
+
+    for (size_t i=0; i<this->numSegments_; i++) {
+        NDFileTIFFSegment *pSegment = &this->segments_[i];
+        if (parallel) {
+            epicsMutexLock(this->compressMutex_);
+            while (!pSegment->done) {
+                epicsMutexUnlock(this->compressMutex_);
+                epicsEventWait(this->doneEvent_);
+                epicsMutexLock(this->compressMutex_);
+            }
+            epicsMutexUnlock(this->compressMutex_);
+        }
+        if (parallel && (pSegment->outputSize > 0)) {
+            if (tiled) {
+                nwrite = TIFFWriteRawTile(this->tiff, pSegment->index, &pSegment->output[0], pSegment->outputSize);
+            } else {
+                nwrite = TIFFWriteRawStrip(this->tiff, pSegment->index, &pSegment->output[0], pSegment->outputSize);
+            }
+        } else {
+            void *pData = (void *)this->getSegmentData(pSegment);
+            if (tiled) {
+                nwrite = TIFFWriteEncodedTile(this->tiff, pSegment->index, pData, pSegment->size);
+            } else {
+                nwrite = TIFFWriteEncodedStrip(this->tiff, pSegment->index, pData, pSegment->size);
+            }
+        }
+        if (nwrite <= 0) status = asynError;
+    }
+
+    /* Stop the compression threads looking at the segments.  Every segment they claimed is done,
+     * because the loop above waited for each of them */
+    epicsMutexLock(this->compressMutex_);
+    this->compressActive_ = false;
+    this->numSegments_ = 0;
+    this->nextSegment_ = 0;
+    epicsMutexUnlock(this->compressMutex_);
+
+    if (status != asynSuccess) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s: error writing data to file\n",
             driverName, functionName);
-        return(asynError);
     }
+    return status;
+}
 
-    return(asynSuccess);
+/** Reads the tiles of a tiled TIFF file into an NDArray.
+  * \param[in] pImage NDArray to read into, it must have the size of the image
+  * \param[in] samplesPerPixel, bitsPerSample, planarConfig Sample layout of the file
+  */
+asynStatus NDFileTIFF::readTiles(NDArray *pImage, int samplesPerPixel, int bitsPerSample, int planarConfig)
+{
+    epicsUInt32 sizeX, sizeY, tileWidth, tileLength;
+    size_t numPlanes, pixelBytes, rowBytes, tileRowBytes;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "readTiles";
+
+    TIFFGetField(this->tiff, TIFFTAG_IMAGEWIDTH,  &sizeX);
+    TIFFGetField(this->tiff, TIFFTAG_IMAGELENGTH, &sizeY);
+    TIFFGetField(this->tiff, TIFFTAG_TILEWIDTH,   &tileWidth);
+    TIFFGetField(this->tiff, TIFFTAG_TILELENGTH,  &tileLength);
+    if (planarConfig == PLANARCONFIG_SEPARATE) {
+        numPlanes = samplesPerPixel;
+        pixelBytes = bitsPerSample/8;
+    } else {
+        numPlanes = 1;
+        pixelBytes = samplesPerPixel * bitsPerSample/8;
+    }
+    rowBytes = sizeX * pixelBytes;
+    tileRowBytes = tileWidth * pixelBytes;
+    std::vector<char> tile(TIFFTileSize(this->tiff));
+
+    for (size_t plane=0; plane<numPlanes; plane++) {
+        char *pPlane = (char *)pImage->pData + plane*rowBytes*sizeY;
+        for (epicsUInt32 y=0; y<sizeY; y+=tileLength) {
+            for (epicsUInt32 x=0; x<sizeX; x+=tileWidth) {
+                if (TIFFReadTile(this->tiff, &tile[0], x, y, 0, (uint16_t)plane) == -1) {
+                    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                        "%s::%s, error reading TIFF file\n",
+                        driverName, functionName);
+                    return asynError;
+                }
+                size_t rows = (sizeY - y < tileLength) ? sizeY - y : tileLength;
+                size_t copyBytes = ((sizeX - x < tileWidth) ? sizeX - x : tileWidth) * pixelBytes;
+                for (size_t row=0; row<rows; row++) {
+                    memcpy(pPlane + (y+row)*rowBytes + x*pixelBytes, &tile[row*tileRowBytes], copyBytes);
+                }
+            }
+        }
+    }
+    return status;
 }
 
 /** Reads single NDArray from a TIFF file;
@@ -511,6 +973,10 @@ asynStatus NDFileTIFF::readFile(NDArray **pArray)
     pImage = this->pNDArrayPool->alloc(ndims, dims, dataType, 0, 0);
     *pArray = pImage;
     buffer = (char *)pImage->pData;
+    if (TIFFIsTiled(this->tiff)) {
+        status = this->readTiles(pImage, samplesPerPixel, bitsPerSample, planarConfig);
+        numStrips = 0;
+    }
     for (strip=0; strip < numStrips; strip++) {
         size = (int)TIFFReadEncodedStrip(this->tiff, strip, buffer, pImage->dataSize-totalSize);
         if (size == -1) {
@@ -584,6 +1050,41 @@ asynStatus NDFileTIFF::closeFile()
     return asynSuccess;
 }
 
+/** Called when asyn clients call pasynInt32->write().
+  * MultiPage sets whether the arrays of a capture or stream are written to one file.
+  * For all parameters it sets the value in the parameter library and calls any registered callbacks.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileTIFF::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int capture;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    if (function < FIRST_NDFILE_TIFF_PARAM) {
+        /* If this parameter belongs to a base class call its method */
+        return NDPluginFile::writeInt32(pasynUser, value);
+    }
+
+    if (function == NDFileTIFFMultiPage) {
+        /* NDPluginFile decides how to open files from supportsMultipleArrays,
+         * so it can't change while a capture or stream is in progress */
+        getIntegerParam(NDFileCapture, &capture);
+        if (capture) {
+            asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: MultiPage can't be changed while capturing\n",
+                driverName, functionName);
+            status = asynError;
+        } else {
+            this->supportsMultipleArrays = value ? 1 : 0;
+        }
+    }
+    if (status == asynSuccess) setIntegerParam(function, value);
+    callParamCallbacks();
+    return status;
+}
+
 
 /** Constructor for NDFileTIFF; all parameters are simply passed to NDPluginFile::NDPluginFile.
   * \param[in] portName The name of the asyn port driver to be created.
@@ -609,14 +1110,39 @@ NDFileTIFF::NDFileTIFF(const char *portName, int queueSize, int blockingCallback
                    NDArrayPort, NDArrayAddr, 1,
                    2, 0, asynGenericPointerMask, asynGenericPointerMask,
                    ASYN_CANBLOCK, 1, priority, stackSize, 1),
-    numAttributes_(0)
+    numAttributes_(0), numPages_(0), multiPage_(false), tiled_(false), compression_(NDFileTIFFCompressNone), compressLevel_(6),
+    numSegments_(0), nextSegment_(0), compressActive_(false), numCompressThreads_(0)
 {
     //static const char *functionName = "NDFileTIFF";
 
+    createParam(NDFileTIFFRowsPerStripString,    asynParamInt32, &NDFileTIFFRowsPerStrip);
+    createParam(NDFileTIFFTileWidthString,       asynParamInt32, &NDFileTIFFTileWidth);
+    createParam(NDFileTIFFTileLengthString,      asynParamInt32, &NDFileTIFFTileLength);
+    createParam(NDFileTIFFCompressionString,     asynParamInt32, &NDFileTIFFCompression);
+    createParam(NDFileTIFFCompressLevelString,   asynParamInt32, &NDFileTIFFCompressLevel);
+    createParam(NDFileTIFFCompressThreadsString, asynParamInt32, &NDFileTIFFCompressThreads);
+    createParam(NDFileTIFFBigTIFFString,         asynParamInt32, &NDFileTIFFBigTIFF);
+    createParam(NDFileTIFFMultiPageString,       asynParamInt32, &NDFileTIFFMultiPage);
+    createParam(NDFileTIFFNumPagesString,        asynParamInt32, &NDFileTIFFNumPages);
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDFileTIFF");
     this->supportsMultipleArrays = 0;
 
+    setIntegerParam(NDFileTIFFRowsPerStrip, 0);
+    setIntegerParam(NDFileTIFFTileWidth, 0);
+    setIntegerParam(NDFileTIFFTileLength, 0);
+    setIntegerParam(NDFileTIFFCompression, NDFileTIFFCompressNone);
+    setIntegerParam(NDFileTIFFCompressLevel, 6);
+    setIntegerParam(NDFileTIFFCompressThreads, 0);
+    setIntegerParam(NDFileTIFFBigTIFF, 0);
+    setIntegerParam(NDFileTIFFMultiPage, 0);
+    setIntegerParam(NDFileTIFFNumPages, 0);
+
+    this->compressMutex_ = epicsMutexCreate();
+    this->workEvent_ = epicsEventCreate(epicsEventEmpty);
+    this->doneEvent_ = epicsEventCreate(epicsEventEmpty);
+
     this->pAttributeId = NULL;
     this->pFileAttributes = new NDAttributeList;
 }
@@ -8,6 +8,12 @@
 #ifndef DRV_NDFileTIFF_H
 #define DRV_NDFileTIFF_H
 
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+
 #include "NDPluginFile.h"
 #include "tiffio.h"
 
@@ -15,6 +21,59 @@
  * to handle changes in the file contents */
 #define NDTIFFFileVersion 1.0
 
+#define NDFileTIFFRowsPerStripString    "TIFF_ROWS_PER_STRIP"    /* (asynInt32, r/w) Rows per strip, 0 for one strip per image */
+#define NDFileTIFFTileWidthString       "TIFF_TILE_WIDTH"        /* (asynInt32, r/w) Tile width, 0 to write strips */
+#define NDFileTIFFTileLengthString      "TIFF_TILE_LENGTH"       /* (asynInt32, r/w) Tile length, 0 to write strips */
+#define NDFileTIFFCompressionString     "TIFF_COMPRESSION"       /* (asynInt32, r/w) Compression, NDFileTIFFCompression_t */
+#define NDFileTIFFCompressLevelString   "TIFF_COMPRESS_LEVEL"    /* (asynInt32, r/w) Deflate or zstd compression level */
+#define NDFileTIFFCompressThreadsString "TIFF_COMPRESS_THREADS"  /* (asynInt32, r/w) Threads compressing strips or tiles */
+#define NDFileTIFFBigTIFFString         "TIFF_BIGTIFF"           /* (asynInt32, r/w) Write BigTIFF files */
+#define NDFileTIFFMultiPageString       "TIFF_MULTI_PAGE"        /* (asynInt32, r/w) Write all arrays of a capture or stream to one file */
+#define NDFileTIFFNumPagesString        "TIFF_NUM_PAGES"         /* (asynInt32, r/o) Pages written to the current file */
+
+/** Compression of the strips or tiles of a TIFF file */
+typedef enum {
+    NDFileTIFFCompressNone,
+    NDFileTIFFCompressDeflate,
+    NDFileTIFFCompressLZW,
+    NDFileTIFFCompressZstd
+} NDFileTIFFCompression_t;
+
+/** The tags that are the same on every page of a file, worked out when the file is opened */
+typedef struct NDFileTIFFLayout {
+    NDDataType_t dataType;      /**< Data type of the arrays */
+    int ndims;                  /**< Dimensions of the arrays */
+    size_t dims[3];             /**< Dimensions of the arrays */
+    int bitsPerSample;
+    int sampleFormat;
+    int samplesPerPixel;
+    int photoMetric;
+    int planarConfig;
+    epicsUInt32 sizeX;
+    epicsUInt32 sizeY;
+    epicsUInt32 rowsPerStrip;   /**< Rows per strip, 0 when the file is tiled */
+    epicsUInt32 tileWidth;      /**< Tile width, 0 when the file is written in strips */
+    epicsUInt32 tileLength;     /**< Tile length, 0 when the file is written in strips */
+    int tiffCompression;        /**< TIFF library compression scheme */
+    std::string make;
+    std::string model;
+} NDFileTIFFLayout;
+
+/** A strip or tile of the image being written */
+typedef struct NDFileTIFFSegment {
+    uint32_t index;             /**< Strip or tile number in the file */
+    const char *pData;          /**< Start of the segment in the NDArray */
+    size_t rowBytes;            /**< Bytes per row of the segment in the NDArray */
+    size_t rowStride;           /**< Bytes between rows in the NDArray */
+    size_t rows;                /**< Rows of the segment in the NDArray */
+    size_t fileRowBytes;        /**< Bytes per row of the segment in the file */
+    size_t size;                /**< Size of the uncompressed segment in the file */
+    std::vector<char> buffer;   /**< Tile copied out of the NDArray */
+    std::vector<char> output;   /**< Compressed segment */
+    size_t outputSize;          /**< Size of the compressed segment, 0 if it could not be compressed */
+    bool done;                  /**< Set by the compression thread when output is ready */
+} NDFileTIFFSegment;
+
 /** Writes NDArrays in the TIFF file format.
     Tagged Image File Format is a file format for storing images.  The format was originally created by Aldus corporation and is
     currently developed by Adobe Systems Incorporated.  This plugin was developed using the libtiff library to write the file.
@@ -32,13 +91,48 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    void compressTask();
+
+protected:
+    int NDFileTIFFRowsPerStrip;
+    #define FIRST_NDFILE_TIFF_PARAM NDFileTIFFRowsPerStrip
+    int NDFileTIFFTileWidth;
+    int NDFileTIFFTileLength;
+    int NDFileTIFFCompression;
+    int NDFileTIFFCompressLevel;
+    int NDFileTIFFCompressThreads;
+    int NDFileTIFFBigTIFF;
+    int NDFileTIFFMultiPage;
+    int NDFileTIFFNumPages;
 
 private:
+    asynStatus writePageTags(NDArray *pArray);
+    const char *getSegmentData(NDFileTIFFSegment *pSegment);
+    void compressSegment(NDFileTIFFSegment *pSegment);
+    void addCompressThreads(int numThreads);
+    asynStatus writeSegments(bool tiled);
+    asynStatus readTiles(NDArray *pImage, int samplesPerPixel, int bitsPerSample, int planarConfig);
+
     TIFF *tiff;
     NDColorMode_t colorMode;
     int *pAttributeId;
     NDAttributeList *pFileAttributes;
     int numAttributes_;
+    NDFileTIFFLayout layout_;      /* Tags of every page of the open file */
+    int numPages_;                 /* Pages written to the open file */
+    bool multiPage_;               /* Whether the open file was opened with NDFileModeMultiple */
+    bool tiled_;                   /* Whether the open file is tiled */
+    int compression_;              /* NDFileTIFFCompression_t of the open file */
+    int compressLevel_;            /* Compression level of the open file */
+    std::vector<NDFileTIFFSegment> segments_;  /* Strips or tiles of the image being written */
+    size_t numSegments_;           /* Segments of the image being written */
+    size_t nextSegment_;           /* Next segment for a compression thread to take */
+    bool compressActive_;          /* writeSegments is waiting for the compression threads to compress the image */
+    int numCompressThreads_;       /* Compression threads that have been created */
+    epicsMutexId compressMutex_;
+    epicsEventId workEvent_;
+    epicsEventId doneEvent_;
 
 };
 
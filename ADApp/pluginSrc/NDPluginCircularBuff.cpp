@@ -16,12 +16,16 @@
 #include <iocsh.h>
 
 #include "NDPluginCircularBuff.h"
+#include "NDPluginCodec.h"
 
 #include <epicsExport.h>
 
 static const char *driverName="NDPluginCircularBuff";
 
 #define DEFAULT_TRIGGER_CALC "0"
+#define MEGABYTE_DBL 1048576.
+// Smallest block that an image is split into when it is compressed by several threads
+#define MIN_COMPRESS_BLOCK_SIZE 65536
 
 asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 {
@@ -81,6 +85,147 @@ asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 }
 
 
+/** Returns true if the pool of an upstream array can still provide at least
+  * NDCircBuffMinUpstreamFree more arrays of the same size, from its free list and
+  * its unallocated memory, so that the plugin can hold a reference to the array
+  * without starving the upstream driver.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+bool NDPluginCircularBuff::upstreamHasHeadroom(NDArray *pArray)
+{
+    NDArrayPool *pPool = pArray->pNDArrayPool;
+    NDArrayInfo_t arrayInfo;
+    int minFree;
+    size_t maxMemory, memorySize;
+    size_t numAvailable;
+
+    if (!pPool) return false;
+    getIntegerParam(NDCircBuffMinUpstreamFree, &minFree);
+
+    maxMemory = pPool->getMaxMemory();
+    // A pool with unlimited memory can always allocate another array
+    if (maxMemory == 0) return true;
+
+    pArray->getInfo(&arrayInfo);
+    numAvailable = pPool->getNumFree();
+    memorySize = pPool->getMemorySize();
+    if ((maxMemory > memorySize) && (arrayInfo.totalBytes > 0))
+        numAvailable += (maxMemory - memorySize) / arrayInfo.totalBytes;
+    return numAvailable >= (size_t)minFree;
+}
+
+/** Returns an array to be held in the pre-trigger ring.
+  * If NDCircBuffZeroCopy is set, compression is disabled and the upstream pool has headroom
+  * this is a reference to the array itself. Otherwise the array is copied into this plugin's pool.
+  * If compression is enabled the copy is compressed, so the ring holds only the
+  * compressed size of each image.  If compression fails the array is copied uncompressed.
+  * It is called with the mutex locked and unlocks it while compressing.
+  * \param[in] pArray  The NDArray from the callback.
+  * \return The stored array, or NULL if it could not be allocated.
+  */
+NDArray *NDPluginCircularBuff::storeArray(NDArray *pArray)
+{
+    int compression, numThreads, zeroCopy;
+    size_t blockSize = 0;
+    NDArray *pArrayOut = NULL;
+    NDArrayInfo_t arrayInfo;
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    char errorMessage[256];
+    static const char *functionName = "storeArray";
+
+    getIntegerParam(NDCircBuffCompression,     &compression);
+    getIntegerParam(NDCircBuffCompressThreads, &numThreads);
+    getIntegerParam(NDCircBuffZeroCopy,        &zeroCopy);
+
+    if (compression == NDCircBuffCompressNone) {
+        if (zeroCopy && upstreamHasHeadroom(pArray)) {
+            pArray->reserve();
+            return pArray;
+        }
+        return this->pNDArrayPool->copy(pArray, NULL, 1);
+    }
+
+    // Give each thread one block of the image
+    if (numThreads > 1) {
+        pArray->getInfo(&arrayInfo);
+        blockSize = (arrayInfo.totalBytes + numThreads - 1) / numThreads;
+        if (blockSize < MIN_COMPRESS_BLOCK_SIZE) blockSize = MIN_COMPRESS_BLOCK_SIZE;
+    }
+
+    // The compression does not access any private data, so we can release the lock
+    this->unlock();
+    if (compression == NDCircBuffCompressLZ4)
+        pArrayOut = compressLZ4(pArray, blockSize, numThreads, &codecStatus, errorMessage, this->pNDArrayPool);
+    else
+        pArrayOut = compressBSLZ4(pArray, blockSize, numThreads, &codecStatus, errorMessage, this->pNDArrayPool);
+    this->lock();
+
+    if (!pArrayOut) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error compressing array, storing it uncompressed: %s\n",
+            driverName, functionName, errorMessage);
+        pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
+    }
+    return pArrayOut;
+}
+
+/** Adds a stored array to the end of the pre-trigger ring.
+  * Releases the oldest arrays that are overwritten, or that have to be dropped to keep the
+  * ring within the memory limit set by NDCircBuffPreTriggerMaxMem.  A ring sized by the memory
+  * limit only drops arrays for that limit.
+  * \param[in] pArray  The array returned by storeArray.
+  * \return true if an older array was dropped from the ring.
+  */
+bool NDPluginCircularBuff::addToPreBuffer(NDArray *pArray)
+{
+    double maxMemory;
+    int preCount;
+    bool dropped = false;
+
+    getDoubleParam(NDCircBuffPreTriggerMaxMem, &maxMemory);
+
+    preBufferBytes_ += pArray->dataSize;
+    if (pArray->pNDArrayPool != this->pNDArrayPool) preBufferHeld_++;
+    pOldArray_ = preBuffer_->addToEnd(pArray);
+    // If we overwrote an existing array in the ring, release it here
+    if (pOldArray_){
+      releaseFromPreBuffer(pOldArray_);
+      pOldArray_ = NULL;
+      dropped = true;
+    }
+    // Drop the oldest arrays until the ring fits in the memory limit
+    while ((maxMemory > 0) && (preBufferBytes_ > maxMemory * MEGABYTE_DBL) &&
+           (pOldArray_ = preBuffer_->removeFromStart()) != NULL) {
+      releaseFromPreBuffer(pOldArray_);
+      pOldArray_ = NULL;
+      dropped = true;
+    }
+    // If the memory limit was removed after the ring was created it falls back to PreCount
+    if (preBufferBySize_ && (maxMemory <= 0)) {
+      getIntegerParam(NDCircBuffPreTrigger, &preCount);
+      while ((preBuffer_->size() > preCount) &&
+             (pOldArray_ = preBuffer_->removeFromStart()) != NULL) {
+        releaseFromPreBuffer(pOldArray_);
+        pOldArray_ = NULL;
+        dropped = true;
+      }
+    }
+    setDoubleParam(NDCircBuffPreTriggerMem, preBufferBytes_ / MEGABYTE_DBL);
+    setIntegerParam(NDCircBuffNumHeld, preBufferHeld_);
+    return dropped;
+}
+
+/** Releases an array that has been taken out of the pre-trigger ring and
+  * removes it from the memory and reference counts of the ring.
+  * \param[in] pArray  The array taken out of the ring.
+  */
+void NDPluginCircularBuff::releaseFromPreBuffer(NDArray *pArray)
+{
+    preBufferBytes_ -= pArray->dataSize;
+    if (pArray->pNDArrayPool != this->pNDArrayPool) preBufferHeld_--;
+    pArray->release();
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Stores the number of pre-trigger images prior to the trigger in a ring buffer.
   * Once the trigger has been received stores the number of post-trigger buffers
@@ -94,7 +239,7 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
      * structures don't need to be protected.
      */
     int scopeControl, preCount, postCount, currentImage, currentPostCount, softTrigger;
-    int presetTriggerCount, actualTriggerCount;
+    int presetTriggerCount, actualTriggerCount, zeroCopy;
     NDArray *pArrayCpy = NULL;
     NDArrayInfo arrayInfo;
     int triggered = 0;
@@ -133,25 +278,30 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
         }
       }
 
-      // First copy the buffer into our buffer pool so we can release the resource on the driver
-      pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      // First copy the buffer into our buffer pool so we can release the resource on the driver.
+      // Pre-trigger arrays are compressed into the copy if compression is enabled.
+      // In zero-copy mode post-trigger arrays are passed straight through.
+      getIntegerParam(NDCircBuffZeroCopy, &zeroCopy);
+      if (!triggered) {
+        pArrayCpy = storeArray(pArray);
+      } else if (zeroCopy) {
+        pArray->reserve();
+        pArrayCpy = pArray;
+      } else {
+        pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      }
 
       if (pArrayCpy){
 
         // Have we detected a trigger event yet?
         if (!triggered) {
           // No trigger so add the NDArray to the pre-trigger ring
-          pOldArray_ = preBuffer_->addToEnd(pArrayCpy);
-          // If we overwrote an existing array in the ring, release it here
-          if (pOldArray_){
-            pOldArray_->release();
-            pOldArray_ = NULL;
-          }
+          bool dropped = addToPreBuffer(pArrayCpy);
           // Set the size
           setIntegerParam(NDCircBuffCurrentImage,  preBuffer_->size());
-          if (preBuffer_->size() == preCount){
+          if (dropped || (!preBufferBySize_ && (preBuffer_->size() == preCount))){
             setStringParam(NDCircBuffStatus,
-                preCount ? "Buffer Wrapping" : "Dropping frames");
+                (preCount || preBufferBySize_) ? "Buffer Wrapping" : "Dropping frames");
           }
         } else {
           // Trigger detected
@@ -188,7 +338,7 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
             setIntegerParam(NDCircBuffTriggered, 0);
             setIntegerParam(NDCircBuffPostCount, 0);
             setStringParam(NDCircBuffStatus,
-                preCount ? "Buffer filling" : "Dropping frames");
+                (preCount || preBufferBySize_) ? "Buffer filling" : "Dropping frames");
           } else {
             setIntegerParam(NDCircBuffTriggered, 0);
             setIntegerParam(NDCircBuffControl, 0);
@@ -207,14 +357,40 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
 
 void NDPluginCircularBuff::flushPreBuffer()
 {
+    NDArray *pArray, *pArrayOut;
+    int numThreads;
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    char errorMessage[256];
+    static const char *functionName = "flushPreBuffer";
+
     if (NULL == preBuffer_) return;
-    if (preBuffer_->size() > 0) {
-      doCallbacksGenericPointer(preBuffer_->readFromStart(), NDArrayData, 0);
-      while (preBuffer_->hasNext()) {
-        doCallbacksGenericPointer(preBuffer_->readNext(), NDArrayData, 0);
+    getIntegerParam(NDCircBuffCompressThreads, &numThreads);
+
+    // Take the arrays out oldest first, so each is released as soon as it has been passed on
+    while ((pArray = preBuffer_->removeFromStart()) != NULL) {
+      if (pArray->codec.empty()) {
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+      } else {
+        // The array was compressed by storeArray, so decompress it before passing it on
+        if (pArray->codec.name == codecName[NDCODEC_LZ4])
+          pArrayOut = decompressLZ4(pArray, numThreads, &codecStatus, errorMessage);
+        else
+          pArrayOut = decompressBSLZ4(pArray, numThreads, &codecStatus, errorMessage);
+        if (pArrayOut) {
+          doCallbacksGenericPointer(pArrayOut, NDArrayData, 0);
+          pArrayOut->release();
+        } else {
+          asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s error decompressing array, dropping it: %s\n",
+              driverName, functionName, errorMessage);
+        }
       }
-      preBuffer_->clear();
+      pArray->release();
     }
+    preBufferBytes_ = 0;
+    preBufferHeld_ = 0;
+    setDoubleParam(NDCircBuffPreTriggerMem, 0.0);
+    setIntegerParam(NDCircBuffNumHeld, 0);
 }
 
 /** Called when asyn clients call pasynInt32->write().
@@ -227,20 +403,32 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
     int function = pasynUser->reason;
     asynStatus status = asynSuccess;
     int scopeControl, preCount;
+    double maxMemory;
     static const char *functionName = "writeInt32";
 
     if (function == NDCircBuffControl){
         if (value == 1){
-          // If the control is turned on then create our new ring buffer
+          // If the control is turned on then create our new ring buffer.
+          // With a memory limit the ring is sized by the memory of the images rather than by
+          // PreCount, so it grows until the limit is reached and then drops the oldest images.
           getIntegerParam(NDCircBuffPreTrigger,  &preCount);
+          getDoubleParam(NDCircBuffPreTriggerMaxMem, &maxMemory);
           if (preBuffer_){
             delete preBuffer_;
           }
-          preBuffer_ = new NDArrayRing(preCount);
+          preBufferBySize_ = (maxMemory > 0);
+          if (preBufferBySize_)
+            preBuffer_ = new NDArrayRing(0, true);
+          else
+            preBuffer_ = new NDArrayRing(preCount);
           if (pOldArray_){
             pOldArray_->release();
           }
           pOldArray_ = NULL;
+          preBufferBytes_ = 0;
+          preBufferHeld_ = 0;
+          setDoubleParam(NDCircBuffPreTriggerMem, 0.0);
+          setIntegerParam(NDCircBuffNumHeld, 0);
 
           previousTrigger_ = 0;
 
@@ -250,7 +438,7 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
           setIntegerParam(NDCircBuffPostCount, 0);
           setIntegerParam(NDCircBuffActualTriggerCount, 0);
           setStringParam(NDCircBuffStatus,
-              preCount ? "Buffer filling" : "Dropping frames");
+              (preCount || preBufferBySize_) ? "Buffer filling" : "Dropping frames");
         } else {
           // Control is turned off, before we have finished
           // Set the trigger value off, reset counter
@@ -290,6 +478,12 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
           // Set the parameter in the parameter library.
           status = (asynStatus) setIntegerParam(function, value);
         }
+    }  else if (function == NDCircBuffCompressThreads){
+        if (value < 1) value = 1;
+        status = (asynStatus) setIntegerParam(function, value);
+    }  else if (function == NDCircBuffMinUpstreamFree){
+        if (value < 0) value = 0;
+        status = (asynStatus) setIntegerParam(function, value);
     } else {
         // Set the parameter in the parameter library.
         status = (asynStatus) setIntegerParam(function, value);
@@ -403,6 +597,9 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
 {
     //const char *functionName = "NDPluginCircularBuff";
     preBuffer_ = NULL;
+    preBufferBytes_ = 0;
+    preBufferBySize_ = false;
+    preBufferHeld_ = 0;
 
     maxBuffers_ = maxBuffers;
 
@@ -424,6 +621,13 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     createParam(NDCircBuffSoftTriggerString,        asynParamInt32,      &NDCircBuffSoftTrigger);
     createParam(NDCircBuffTriggeredString,          asynParamInt32,      &NDCircBuffTriggered);
     createParam(NDCircBuffFlushOnSoftTrigString,    asynParamInt32,      &NDCircBuffFlushOnSoftTrig);
+    createParam(NDCircBuffCompressionString,        asynParamInt32,      &NDCircBuffCompression);
+    createParam(NDCircBuffCompressThreadsString,    asynParamInt32,      &NDCircBuffCompressThreads);
+    createParam(NDCircBuffPreTriggerMaxMemString,   asynParamFloat64,    &NDCircBuffPreTriggerMaxMem);
+    createParam(NDCircBuffPreTriggerMemString,      asynParamFloat64,    &NDCircBuffPreTriggerMem);
+    createParam(NDCircBuffZeroCopyString,           asynParamInt32,      &NDCircBuffZeroCopy);
+    createParam(NDCircBuffMinUpstreamFreeString,    asynParamInt32,      &NDCircBuffMinUpstreamFree);
+    createParam(NDCircBuffNumHeldString,            asynParamInt32,      &NDCircBuffNumHeld);
 
     // Set the plugin type string
     setStringParam(NDPluginDriverPluginType, "NDPluginCircularBuff");
@@ -448,6 +652,17 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
 
     setIntegerParam(NDCircBuffFlushOnSoftTrig, 0);
 
+    // Pre-trigger images are stored uncompressed and limited only by the pre-count
+    setIntegerParam(NDCircBuffCompression, NDCircBuffCompressNone);
+    setIntegerParam(NDCircBuffCompressThreads, 1);
+    setDoubleParam(NDCircBuffPreTriggerMaxMem, 0.0);
+    setDoubleParam(NDCircBuffPreTriggerMem, 0.0);
+
+    // Copy the arrays by default. In zero-copy mode keep 10 arrays available upstream
+    setIntegerParam(NDCircBuffZeroCopy, 0);
+    setIntegerParam(NDCircBuffMinUpstreamFree, 10);
+    setIntegerParam(NDCircBuffNumHeld, 0);
+
     // Enable ArrayCallbacks.
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
     setIntegerParam(NDArrayCallbacks, 1);
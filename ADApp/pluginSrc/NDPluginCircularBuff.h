@@ -25,6 +25,20 @@
 #define NDCircBuffSoftTriggerString         "CIRC_BUFF_SOFT_TRIGGER"          /* (asynInt32,        r/w) Force a soft trigger */
 #define NDCircBuffTriggeredString           "CIRC_BUFF_TRIGGERED"             /* (asynInt32,        r/o) Have we had a trigger event */
 #define NDCircBuffFlushOnSoftTrigString     "CIRC_BUFF_FLUSH_ON_SOFTTRIGGER"  /* (asynInt32,        r/w) Flush buffer immediatelly when software trigger obtained */
+#define NDCircBuffCompressionString         "CIRC_BUFF_COMPRESSION"           /* (asynInt32,        r/w) Compression of pre-trigger images, NDCircBuffCompression_t */
+#define NDCircBuffCompressThreadsString     "CIRC_BUFF_COMPRESS_THREADS"      /* (asynInt32,        r/w) Number of threads to [de]compress each image */
+#define NDCircBuffPreTriggerMaxMemString    "CIRC_BUFF_PRE_TRIGGER_MAX_MEM"   /* (asynFloat64,      r/w) Memory limit of the pre-trigger images in MB, 0=no limit */
+#define NDCircBuffPreTriggerMemString       "CIRC_BUFF_PRE_TRIGGER_MEM"       /* (asynFloat64,      r/o) Memory used by the pre-trigger images in MB */
+#define NDCircBuffZeroCopyString            "CIRC_BUFF_ZERO_COPY"             /* (asynInt32,        r/w) Hold references to upstream arrays rather than copying them */
+#define NDCircBuffMinUpstreamFreeString     "CIRC_BUFF_MIN_UPSTREAM_FREE"     /* (asynInt32,        r/w) Arrays the upstream pool must still be able to provide to hold a reference */
+#define NDCircBuffNumHeldString             "CIRC_BUFF_NUM_HELD"              /* (asynInt32,        r/o) Number of pre-trigger images held as references */
+
+/** Compression of the images held in the pre-trigger ring */
+typedef enum {
+    NDCircBuffCompressNone,
+    NDCircBuffCompressLZ4,
+    NDCircBuffCompressBSLZ4
+} NDCircBuffCompression_t;
 
 
 /** Performs a scope like capture.  Records a quantity
@@ -64,14 +78,28 @@ protected:
     int NDCircBuffSoftTrigger;
     int NDCircBuffTriggered;
     int NDCircBuffFlushOnSoftTrig;
+    int NDCircBuffCompression;
+    int NDCircBuffCompressThreads;
+    int NDCircBuffPreTriggerMaxMem;
+    int NDCircBuffPreTriggerMem;
+    int NDCircBuffZeroCopy;
+    int NDCircBuffMinUpstreamFree;
+    int NDCircBuffNumHeld;
 
     void flushPreBuffer();
 
 private:
 
     asynStatus calculateTrigger(NDArray *pArray, int *trig);
+    bool upstreamHasHeadroom(NDArray *pArray);
+    NDArray *storeArray(NDArray *pArray);
+    bool addToPreBuffer(NDArray *pArray);
+    void releaseFromPreBuffer(NDArray *pArray);
     NDArrayRing *preBuffer_;
     NDArray *pOldArray_;
+    size_t preBufferBytes_;
+    bool preBufferBySize_;   /* The ring is sized by NDCircBuffPreTriggerMaxMem rather than NDCircBuffPreTrigger */
+    int preBufferHeld_;
     int previousTrigger_;
     int maxBuffers_;
     char triggerCalcInfix_[MAX_INFIX_SIZE];
@@ -23,7 +23,8 @@
  * Compressed NDArrays:
  *
  *  - `codec` holds the name of the codec that was used to compress the data.
- *    This plugin currently supports two codecs: "jpeg" and "blosc".
+ *    This plugin currently supports the codecs "jpeg", "blosc", "lz4", "bslz4",
+ *    "zstd" and "bszstd".
  *
  *  - `compressedSize` holds the length of the compressed data in `pData`, in
  *    bytes.
@@ -34,6 +35,24 @@
  *
  *  - `dataType` holds the data type of the *uncompressed* data. This will be
  *    used for decompression.
+ *
+ * Blocked NDArrays:
+ *
+ *  - LZ4 and BSLZ4 arrays may be compressed as independent blocks of
+ *    `codec.blockSize` uncompressed bytes, so that they can be compressed and
+ *    decompressed in parallel. `codec.blockOffsets` holds the byte offset in
+ *    `pData` at which each block starts; block i ends where block i+1 starts
+ *    (or at `compressedSize` for the last block).
+ *
+ *  - Blocked LZ4 data uses the framing of the HDF5 LZ4 filter (ID 32004): an
+ *    8-byte big-endian uncompressed size, a 4-byte big-endian block size, and
+ *    then for each block a 4-byte big-endian compressed size followed by the
+ *    block data. A block whose compressed size equals its uncompressed size is
+ *    stored uncompressed. The framing is self-describing, so decompressLZ4()
+ *    recognizes it even if the block index was lost in transport.
+ *
+ *  - Blocked BSLZ4 and BSZSTD data is byte-for-byte identical to the unblocked
+ *    stream, since each block is a whole number of bitshuffle blocks.
  */
 
 #include <string>
@@ -43,10 +62,15 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <osiSock.h>
 #include <iocsh.h>
 
 #include "Codec.h"
 #include "NDPluginCodec.h"
+#include "NDCodecBlockPool.h"
 
 #include <epicsExport.h>
 
@@ -58,13 +82,14 @@ using std::string;
 static const char *driverName="NDPluginCodec";
 
 /* Allocate a new NDArray to hold [un]compressed data.
- * Since there's no way to know the final size of the compressed data, always
- * allocate an array of the same size as the uncompressed one.
+ * If dataSize is 0 the array is allocated with the size of the uncompressed data.
+ * The array is allocated from pPool, or from the pool of the input array if pPool is NULL.
  */
-static NDArray *allocArray(NDArray *input, int dataType = -1, size_t dataSize=0, void *pData=NULL)
+static NDArray *allocArray(NDArray *input, int dataType = -1, size_t dataSize=0, void *pData=NULL,
+                           NDArrayPool *pPool=NULL)
 {
     NDDataType_t dt;
-    NDArrayPool *pool = input->pNDArrayPool;
+    NDArrayPool *pool = pPool ? pPool : input->pNDArrayPool;
 
     if (dataType == -1)
         dt = input->dataType;
@@ -84,6 +109,92 @@ static NDArray *allocArray(NDArray *input, int dataType = -1, size_t dataSize=0,
 
 }
 
+/* The compressors write into a scratch buffer owned by the calling thread that is
+ * sized for the worst case, and then copy the result into a pool array of exactly the
+ * compressed size. A frame that compresses well thus only holds the memory it needs
+ * while it waits in downstream queues. The scratch buffer grows as needed and is kept
+ * for the lifetime of the thread; it is not counted against the pool's maxMemory.
+ */
+typedef struct codecScratch {
+    char *pData;
+    size_t size;
+} codecScratch;
+
+static epicsThreadPrivateId scratchId;
+
+static void createScratchId(void *)
+{
+    scratchId = epicsThreadPrivateCreate();
+}
+
+static char *getScratch(size_t size)
+{
+    static epicsThreadOnceId onceId = EPICS_THREAD_ONCE_INIT;
+
+    epicsThreadOnce(&onceId, createScratchId, NULL);
+    codecScratch *pScratch = (codecScratch *)epicsThreadPrivateGet(scratchId);
+    if (!pScratch) {
+        pScratch = (codecScratch *)calloc(1, sizeof(codecScratch));
+        if (!pScratch) return NULL;
+        epicsThreadPrivateSet(scratchId, pScratch);
+    }
+    if (pScratch->size < size) {
+        free(pScratch->pData);
+        pScratch->pData = (char *)malloc(size);
+        pScratch->size = pScratch->pData ? size : 0;
+    }
+    return pScratch->pData;
+}
+
+/* Allocate an output array of exactly compSize bytes and copy the compressed data into it */
+static NDArray *allocCompressedArray(NDArray *input, const void *pData, size_t compSize,
+                                     NDArrayPool *pPool=NULL)
+{
+    NDArray *output = allocArray(input, -1, compSize, NULL, pPool);
+
+    if (output)
+        memcpy(output->pData, pData, compSize);
+    return output;
+}
+
+static void setBlockFailed(codecBlockJob *pJob)
+{
+    epicsMutexLock(pJob->lock);
+    pJob->failed = true;
+    epicsMutexUnlock(pJob->lock);
+}
+
+static size_t blockBytes(codecBlockJob *pJob, size_t block)
+{
+    size_t offset = block * pJob->blockSize;
+    size_t remaining = pJob->totalBytes - offset;
+    return remaining < pJob->blockSize ? remaining : pJob->blockSize;
+}
+
+static void putBE32(char *p, epicsUInt32 value)
+{
+    value = htonl(value);
+    memcpy(p, &value, 4);
+}
+
+static epicsUInt32 getBE32(const char *p)
+{
+    epicsUInt32 value;
+    memcpy(&value, p, 4);
+    return ntohl(value);
+}
+
+static void putBE64(char *p, epicsUInt64 value)
+{
+    putBE32(p, (epicsUInt32)(value >> 32));
+    putBE32(p+4, (epicsUInt32)(value & 0xFFFFFFFF));
+}
+
+static epicsUInt64 getBE64(const char *p)
+{
+    return ((epicsUInt64)getBE32(p) << 32) | getBE32(p+4);
+}
+
 static int jpeg_clamp_quality(int quality)
 {
     if (quality < JPEG_MIN_QUALITY)
@@ -352,7 +463,7 @@ static const char* bloscCompName[] = {
 };
 
 NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp_t compressor,
-                       int numThreads, NDCodecStatus_t *status, char *errorMessage)
+                       int numThreads, NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
 {
     if (!input->codec.empty()) {
         sprintf(errorMessage, "Array is already compressed");
@@ -371,10 +482,11 @@ NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp
     NDArrayInfo_t info;
     input->getInfo(&info);
 
-    NDArray *output = allocArray(input, -1, info.totalBytes + BLOSC_MAX_OVERHEAD);
+    size_t scratchSize = info.totalBytes + BLOSC_MAX_OVERHEAD;
+    char *pScratch = getScratch(scratchSize);
 
-    if (!output) {
-        sprintf(errorMessage, "Failed to allocate Blosc output array");
+    if (!pScratch) {
+        sprintf(errorMessage, "Failed to allocate Blosc scratch buffer");
         *status = NDCODEC_ERROR;
         return NULL;
     }
@@ -382,16 +494,23 @@ NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp
     size_t blockSize = 0;
 
     int compSize = blosc_compress_ctx(clevel, shuffle, info.bytesPerElement,
-            info.totalBytes, input->pData, output->pData, output->dataSize,
+            info.totalBytes, input->pData, pScratch, scratchSize,
             compname, blockSize, numThreads);
 
     if (compSize < 0) {
-        output->release();
         sprintf(errorMessage, "Internal Blosc error");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
+    NDArray *output = allocCompressedArray(input, pScratch, compSize, pPool);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate Blosc output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
     output->codec.name = codecName[NDCODEC_BLOSC];
     output->codec.level = clevel;
     output->codec.shuffle = shuffle;
@@ -437,7 +556,7 @@ NDArray *decompressBlosc(NDArray *input, int numThreads, NDCodecStatus_t *status
 #else
 
 NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp_t compressor,
-                       int numThreads, NDCodecStatus_t *status, char *errorMessage)
+                       int numThreads, NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
 {
     sprintf(errorMessage, "No Blosc support");
     *status = NDCODEC_ERROR;
@@ -453,11 +572,273 @@ NDArray *decompressBlosc(NDArray *input, int numThreads, NDCodecStatus_t *status
 
 #endif // ifdef HAVE_BLOSC
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+
+/** Compresses an array with Zstandard.
+  * The output is a single zstd frame, which is also the chunk format of the HDF5 zstd filter (ID 32015).
+  * numThreads > 1 uses the multi-threaded compression of libzstd, if it was built with it.
+  */
+NDArray *compressZstd(NDArray *input, int clevel, int numThreads,
+                      NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    if (!input->codec.empty()) {
+        sprintf(errorMessage, "Array is already compressed");
+        *status = NDCODEC_WARNING;
+        return NULL;
+    }
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    size_t scratchSize = ZSTD_compressBound(info.totalBytes);
+    char *pScratch = getScratch(scratchSize);
+
+    if (!pScratch) {
+        sprintf(errorMessage, "Failed to allocate Zstd scratch buffer");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    if (!cctx) {
+        sprintf(errorMessage, "Failed to create Zstd context");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, clevel);
+    // This fails if libzstd was built without multi-threading, in which case compress in this thread
+    if (numThreads > 1)
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, numThreads);
+
+    size_t compSize = ZSTD_compress2(cctx, pScratch, scratchSize,
+                                     input->pData, info.totalBytes);
+    ZSTD_freeCCtx(cctx);
+
+    if (ZSTD_isError(compSize)) {
+        sprintf(errorMessage, "Internal Zstd error: %s", ZSTD_getErrorName(compSize));
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    NDArray *output = allocCompressedArray(input, pScratch, compSize, pPool);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate Zstd output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.name = codecName[NDCODEC_ZSTD];
+    output->codec.level = clevel;
+    output->compressedSize = compSize;
+
+    return output;
+}
+
+NDArray *decompressZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    // Sanity check
+    if (input->codec.name != codecName[NDCODEC_ZSTD]) {
+        sprintf(errorMessage, "Invalid codec '%s', expected '%s'",
+                input->codec.name.c_str(), codecName[NDCODEC_ZSTD].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    NDArray *output = allocArray(input);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate Zstd output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    size_t ret = ZSTD_decompress(output->pData, info.totalBytes,
+                                 input->pData, input->compressedSize);
+
+    if (ZSTD_isError(ret) || ret != info.totalBytes) {
+        output->release();
+        sprintf(errorMessage, "Failed to Zstd decompress");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.clear();
+
+    return output;
+}
+
+#else
+
+NDArray *compressZstd(NDArray *input, int clevel, int numThreads,
+                      NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    sprintf(errorMessage, "No Zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+NDArray *decompressZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    sprintf(errorMessage, "No Zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+#endif // ifdef HAVE_ZSTD
+
 #ifdef HAVE_BITSHUFFLE
+#if defined(HAVE_ZSTD) && !defined(ZSTD_SUPPORT)
+// bitshuffle.h only declares the zstd functions if ZSTD_SUPPORT is defined
+#define ZSTD_SUPPORT
+#endif
 #include <bitshuffle.h>
 #include <lz4.h>
 
+// Size of the header of blocked LZ4 data: uncompressed size and block size
+#define LZ4_BLOCKED_HEADER_SIZE 12
+
+static void compressLZ4Block(codecBlockJob *pJob, size_t block)
+{
+    size_t inBytes = blockBytes(pJob, block);
+    const char *pIn = pJob->pIn + block * pJob->blockSize;
+    char *pOut = pJob->pOut + block * pJob->slotSize;
+
+    int compSize = LZ4_compress_default(pIn, pOut + 4, (int)inBytes, (int)(pJob->slotSize - 4));
+
+    if (compSize <= 0) {
+        setBlockFailed(pJob);
+        return;
+    }
+    // Same convention as the HDF5 LZ4 filter: incompressible blocks are stored as-is
+    if ((size_t)compSize >= inBytes) {
+        memcpy(pOut + 4, pIn, inBytes);
+        compSize = (int)inBytes;
+    }
+    putBE32(pOut, (epicsUInt32)compSize);
+    pJob->pCompSizes[block] = 4 + compSize;
+}
+
+static void decompressLZ4Block(codecBlockJob *pJob, size_t block)
+{
+    size_t outBytes = blockBytes(pJob, block);
+    const char *pIn = pJob->pIn + pJob->pOffsets[block] + 4;
+    char *pOut = pJob->pOut + block * pJob->blockSize;
+    size_t compSize = pJob->pSizes[block] - 4;
+
+    if (compSize == outBytes) {
+        memcpy(pOut, pIn, outBytes);
+        return;
+    }
+    int ret = LZ4_decompress_safe(pIn, pOut, (int)compSize, (int)outBytes);
+
+    if (ret != (int)outBytes)
+        setBlockFailed(pJob);
+}
+
+/* Wrappers selecting the LZ4 or zstd variant of the bitshuffle functions */
+static size_t bshufCompressBound(int compressor, size_t size, size_t elemSize, size_t bshufBlock)
+{
+#ifdef HAVE_ZSTD
+    if (compressor == NDCODEC_BSZSTD)
+        return bshuf_compress_zstd_bound(size, elemSize, bshufBlock);
+#endif
+    return bshuf_compress_lz4_bound(size, elemSize, bshufBlock);
+}
+
+static int64_t bshufCompress(int compressor, const void *pIn, void *pOut, size_t size,
+                             size_t elemSize, size_t bshufBlock, int clevel)
+{
+#ifdef HAVE_ZSTD
+    if (compressor == NDCODEC_BSZSTD)
+        return bshuf_compress_zstd(pIn, pOut, size, elemSize, bshufBlock, clevel);
+#endif
+    return bshuf_compress_lz4(pIn, pOut, size, elemSize, bshufBlock);
+}
+
+static int64_t bshufDecompress(int compressor, const void *pIn, void *pOut, size_t size,
+                               size_t elemSize, size_t bshufBlock)
+{
+#ifdef HAVE_ZSTD
+    if (compressor == NDCODEC_BSZSTD)
+        return bshuf_decompress_zstd(pIn, pOut, size, elemSize, bshufBlock);
+#endif
+    return bshuf_decompress_lz4(pIn, pOut, size, elemSize, bshufBlock);
+}
+
+static void compressBitshuffleBlock(codecBlockJob *pJob, size_t block)
+{
+    size_t inBytes = blockBytes(pJob, block);
+    const char *pIn = pJob->pIn + block * pJob->blockSize;
+    char *pOut = pJob->pOut + block * pJob->slotSize;
+
+    int64_t compSize = bshufCompress(pJob->compressor, pIn, pOut, inBytes / pJob->elemSize,
+                                     pJob->elemSize, pJob->bshufBlock, pJob->clevel);
+
+    if (compSize < 0) {
+        setBlockFailed(pJob);
+        return;
+    }
+    pJob->pCompSizes[block] = (size_t)compSize;
+}
+
+static void decompressBitshuffleBlock(codecBlockJob *pJob, size_t block)
+{
+    size_t outBytes = blockBytes(pJob, block);
+    const char *pIn = pJob->pIn + pJob->pOffsets[block];
+    char *pOut = pJob->pOut + block * pJob->blockSize;
+
+    int64_t ret = bshufDecompress(pJob->compressor, pIn, pOut, outBytes / pJob->elemSize,
+                                  pJob->elemSize, pJob->bshufBlock);
+
+    if (ret != (int64_t)pJob->pSizes[block])
+        setBlockFailed(pJob);
+}
+
+/* Returns the total size of the compressed blocks */
+static size_t packedSize(codecBlockJob *pJob)
+{
+    size_t size = 0;
+
+    for (size_t i=0; i<pJob->nBlocks; i++)
+        size += pJob->pCompSizes[i];
+    return size;
+}
+
+/* Copies the compressed blocks, which were written to fixed size slots in pOut by the
+ * block threads, so that they are contiguous at pDest, and records the offset of each
+ * block relative to the start of the array data, which is baseOffset bytes before pDest.
+ */
+static void packBlocks(codecBlockJob *pJob, char *pDest, size_t baseOffset, std::vector<size_t>& offsets)
+{
+    size_t offset = 0;
+
+    offsets.resize(pJob->nBlocks);
+    for (size_t i=0; i<pJob->nBlocks; i++) {
+        memcpy(pDest + offset, pJob->pOut + i * pJob->slotSize, pJob->pCompSizes[i]);
+        offsets[i] = baseOffset + offset;
+        offset += pJob->pCompSizes[i];
+    }
+}
+
 NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    return compressLZ4(input, 0, 1, status, errorMessage);
+}
+
+/** Compresses an array with LZ4.
+  * If blockSize is 0 or not smaller than the array the result is a single raw LZ4 block.
+  * Otherwise the array is compressed as blocks of blockSize bytes using numThreads threads,
+  * with the framing of the HDF5 LZ4 filter.
+  * If pPool is not NULL the output array is allocated from it rather than from the pool of the input.
+  */
+NDArray *compressLZ4(NDArray *input, size_t blockSize, int numThreads,
+                     NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
 {
     if (!input->codec.empty()) {
         sprintf(errorMessage, "Array is already compressed");
@@ -467,32 +848,124 @@ NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage
 
     NDArrayInfo_t info;
     input->getInfo(&info);
+
+    if (blockSize > 0 && blockSize < info.totalBytes) {
+        codecBlockJob job;
+        std::vector<size_t> compSizes;
+
+        if (blockSize > (size_t)LZ4_MAX_INPUT_SIZE)
+            blockSize = (size_t)LZ4_MAX_INPUT_SIZE;
+        memset(&job, 0, sizeof(job));
+        job.blockFunc = compressLZ4Block;
+        job.totalBytes = info.totalBytes;
+        job.blockSize = blockSize;
+        job.nBlocks = (info.totalBytes + blockSize - 1) / blockSize;
+        job.slotSize = 4 + LZ4_compressBound((int)blockSize);
+        compSizes.resize(job.nBlocks);
+        job.pCompSizes = &compSizes[0];
+
+        job.pIn = (const char *)input->pData;
+        job.pOut = getScratch(job.nBlocks * job.slotSize);
+
+        if (!job.pOut) {
+            sprintf(errorMessage, "Failed to allocate LZ4 scratch buffer");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+
+        if (!NDCodecBlockPool::getInstance()->run(&job, numThreads)) {
+            sprintf(errorMessage, "Internal LZ4 error");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+
+        size_t compSize = LZ4_BLOCKED_HEADER_SIZE + packedSize(&job);
+        NDArray *output = allocArray(input, -1, compSize, NULL, pPool);
+
+        if (!output) {
+            sprintf(errorMessage, "Failed to allocate LZ4 output array");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+        putBE64((char *)output->pData, info.totalBytes);
+        putBE32((char *)output->pData + 8, (epicsUInt32)blockSize);
+        packBlocks(&job, (char *)output->pData + LZ4_BLOCKED_HEADER_SIZE, LZ4_BLOCKED_HEADER_SIZE,
+                   output->codec.blockOffsets);
+
+        output->codec.name = codecName[NDCODEC_LZ4];
+        output->codec.blockSize = blockSize;
+        output->compressedSize = compSize;
+
+        return output;
+    }
+
     int outputSize = LZ4_compressBound((int)info.totalBytes);
-    NDArray *output = allocArray(input, -1, outputSize);
+    char *pScratch = getScratch(outputSize);
 
-    if (!output) {
-        sprintf(errorMessage, "Failed to allocate BZLZ4 output array");
+    if (!pScratch) {
+        sprintf(errorMessage, "Failed to allocate LZ4 scratch buffer");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    int compSize = LZ4_compress_default((const char*)input->pData, (char*)output->pData, (int)info.totalBytes, outputSize);
+    int compSize = LZ4_compress_default((const char*)input->pData, pScratch, (int)info.totalBytes, outputSize);
 
     if (compSize <= 0) {
-        output->release();
         sprintf(errorMessage, "Internal Z4 error");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
+    NDArray *output = allocCompressedArray(input, pScratch, compSize, pPool);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate LZ4 output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
     output->codec.name = codecName[NDCODEC_LZ4];
     output->compressedSize = compSize;
 
     return output;
 }
 
+/* Walks the framing of blocked LZ4 data, returning false if the data is not framed
+ * or the framing is not consistent with the array size.
+ */
+static bool parseLZ4Blocks(NDArray *input, size_t totalBytes, size_t *blockSize,
+                           std::vector<size_t>& offsets, std::vector<size_t>& sizes)
+{
+    const char *pData = (const char *)input->pData;
+    size_t size = input->compressedSize;
+
+    if (size < LZ4_BLOCKED_HEADER_SIZE || getBE64(pData) != totalBytes)
+        return false;
+    *blockSize = getBE32(pData + 8);
+    if (*blockSize == 0)
+        return false;
+
+    size_t nBlocks = (totalBytes + *blockSize - 1) / *blockSize;
+    size_t offset = LZ4_BLOCKED_HEADER_SIZE;
+
+    offsets.resize(nBlocks);
+    sizes.resize(nBlocks);
+    for (size_t i=0; i<nBlocks; i++) {
+        if (offset + 4 > size)
+            return false;
+        offsets[i] = offset;
+        sizes[i] = 4 + getBE32(pData + offset);
+        offset += sizes[i];
+    }
+    return offset == size;
+}
 
 NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressLZ4(input, 1, status, errorMessage);
+}
+
+NDArray *decompressLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
 {
     // Sanity check
     if (input->codec.name != codecName[NDCODEC_LZ4]) {
@@ -513,6 +986,31 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
         return NULL;
     }
 
+    codecBlockJob job;
+    std::vector<size_t> offsets, sizes;
+    size_t blockSize;
+
+    if (parseLZ4Blocks(input, info.totalBytes, &blockSize, offsets, sizes)) {
+        memset(&job, 0, sizeof(job));
+        job.blockFunc = decompressLZ4Block;
+        job.pIn = (const char *)input->pData;
+        job.pOut = (char *)output->pData;
+        job.totalBytes = info.totalBytes;
+        job.blockSize = blockSize;
+        job.nBlocks = offsets.size();
+        job.pOffsets = &offsets[0];
+        job.pSizes = &sizes[0];
+
+        if (!NDCodecBlockPool::getInstance()->run(&job, numThreads)) {
+            output->release();
+            sprintf(errorMessage, "Failed to LZ4 decompress");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+        output->codec.clear();
+        return output;
+    }
+
     int ret = LZ4_decompress_fast((const char*)input->pData, (char*)output->pData, (int)info.totalBytes);
 
     if (ret <= 0){
@@ -528,53 +1026,150 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
 }
 
 
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+/** Compresses an array with bitshuffle followed by LZ4 (NDCODEC_BSLZ4) or zstd (NDCODEC_BSZSTD).
+  * If blockSize is 0 or not smaller than the array the array is compressed by the calling thread.
+  * Otherwise it is compressed as blocks of approximately blockSize bytes using numThreads threads.
+  * The block size is rounded down to a whole number of bitshuffle blocks, so the compressed
+  * stream is the same as if it had been compressed in one piece.
+  */
+static NDArray *compressBitshuffle(NDArray *input, NDCodecCompressor_t compressor, int clevel,
+                                   size_t blockSize, int numThreads,
+                                   NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool=NULL)
 {
+    const char *name = (compressor == NDCODEC_BSZSTD) ? "BSZSTD" : "BSLZ4";
+
     if (!input->codec.empty()) {
         sprintf(errorMessage, "Array is already compressed");
         *status = NDCODEC_WARNING;
         return NULL;
     }
 
+#ifndef HAVE_ZSTD
+    if (compressor == NDCODEC_BSZSTD) {
+        sprintf(errorMessage, "No Zstd support");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+#endif
+
     NDArrayInfo_t info;
     input->getInfo(&info);
 
-    NDArray *output = allocArray(input, -1, info.totalBytes);
+    size_t elemSize = info.bytesPerElement;
+    size_t bshufBlock = bshuf_default_block_size(elemSize);
+    size_t bshufBlockBytes = bshufBlock * elemSize;
 
-    if (!output) {
-        sprintf(errorMessage, "Failed to allocate BZLZ4 output array");
+    if (blockSize > 0) {
+        blockSize = (blockSize / bshufBlockBytes) * bshufBlockBytes;
+        if (blockSize == 0) blockSize = bshufBlockBytes;
+    }
+
+    if (blockSize > 0 && blockSize < info.totalBytes) {
+        codecBlockJob job;
+        std::vector<size_t> compSizes;
+
+        memset(&job, 0, sizeof(job));
+        job.blockFunc = compressBitshuffleBlock;
+        job.totalBytes = info.totalBytes;
+        job.blockSize = blockSize;
+        job.elemSize = elemSize;
+        job.bshufBlock = bshufBlock;
+        job.compressor = compressor;
+        job.clevel = clevel;
+        job.nBlocks = (info.totalBytes + blockSize - 1) / blockSize;
+        // The last block may hold the elements that do not fill a bitshuffle block, allow for these
+        job.slotSize = bshufCompressBound(compressor, blockSize / elemSize + bshufBlock, elemSize, bshufBlock);
+        compSizes.resize(job.nBlocks);
+        job.pCompSizes = &compSizes[0];
+
+        job.pIn = (const char *)input->pData;
+        job.pOut = getScratch(job.nBlocks * job.slotSize);
+
+        if (!job.pOut) {
+            sprintf(errorMessage, "Failed to allocate %s scratch buffer", name);
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+
+        if (!NDCodecBlockPool::getInstance()->run(&job, numThreads)) {
+            sprintf(errorMessage, "Internal %s error", name);
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+
+        size_t compSize = packedSize(&job);
+        NDArray *output = allocArray(input, -1, compSize, NULL, pPool);
+
+        if (!output) {
+            sprintf(errorMessage, "Failed to allocate %s output array", name);
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+        packBlocks(&job, (char *)output->pData, 0, output->codec.blockOffsets);
+
+        output->codec.name = codecName[compressor];
+        output->codec.blockSize = blockSize;
+        if (compressor == NDCODEC_BSZSTD) output->codec.level = clevel;
+        output->compressedSize = compSize;
+
+        return output;
+    }
+
+    char *pScratch = getScratch(bshufCompressBound(compressor, info.nElements, elemSize, bshufBlock));
+
+    if (!pScratch) {
+        sprintf(errorMessage, "Failed to allocate %s scratch buffer", name);
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    size_t blockSize = 0;
-
-    int64_t compSize = bshuf_compress_lz4(input->pData, output->pData, info.nElements,
-                                          info.bytesPerElement, blockSize);
+    int64_t compSize = bshufCompress(compressor, input->pData, pScratch, info.nElements,
+                                     elemSize, bshufBlock, clevel);
 
     if (compSize < 0) {
-        output->release();
-        sprintf(errorMessage, "Internal BSLZ4 error");
+        sprintf(errorMessage, "Internal %s error", name);
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    NDArray *output = allocCompressedArray(input, pScratch, (size_t)compSize, pPool);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate %s output array", name);
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    output->codec.name = codecName[NDCODEC_BSLZ4];
+    output->codec.name = codecName[compressor];
+    if (compressor == NDCODEC_BSZSTD) output->codec.level = clevel;
     output->compressedSize = (size_t)compSize;
 
     return output;
 }
 
-
-NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+/** Decompresses a bitshuffle/LZ4 or bitshuffle/zstd array.
+  * If the array carries a block index the blocks are decompressed using numThreads threads.
+  */
+static NDArray *decompressBitshuffle(NDArray *input, NDCodecCompressor_t compressor, int numThreads,
+                                     NDCodecStatus_t *status, char *errorMessage)
 {
+    const char *name = (compressor == NDCODEC_BSZSTD) ? "BSZSTD" : "BSLZ4";
+
     // Sanity check
-    if (input->codec.name != codecName[NDCODEC_BSLZ4]) {
+    if (input->codec.name != codecName[compressor]) {
         sprintf(errorMessage, "Invalid codec '%s', expected '%s'",
-                input->codec.name.c_str(), codecName[NDCODEC_BSLZ4].c_str());
+                input->codec.name.c_str(), codecName[compressor].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+#ifndef HAVE_ZSTD
+    if (compressor == NDCODEC_BSZSTD) {
+        sprintf(errorMessage, "No Zstd support");
         *status = NDCODEC_ERROR;
         return NULL;
     }
+#endif
 
     NDArrayInfo_t info;
     input->getInfo(&info);
@@ -582,19 +1177,53 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
     NDArray *output = allocArray(input);
 
     if (!output) {
-        sprintf(errorMessage, "Failed to allocate BSLZ4 output array");
+        sprintf(errorMessage, "Failed to allocate %s output array", name);
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    size_t blockSize = 0;
+    size_t elemSize = info.bytesPerElement;
+    size_t bshufBlock = bshuf_default_block_size(elemSize);
+    size_t nBlocks = input->codec.blockOffsets.size();
 
-    int64_t ret = bshuf_decompress_lz4(input->pData, output->pData, info.nElements,
-                                       info.bytesPerElement, blockSize);
+    if (nBlocks > 1 && input->codec.blockSize > 0 &&
+        (info.totalBytes + input->codec.blockSize - 1) / input->codec.blockSize == nBlocks) {
+        codecBlockJob job;
+        std::vector<size_t> sizes(nBlocks);
+
+        for (size_t i=0; i<nBlocks; i++) {
+            size_t end = (i+1 < nBlocks) ? input->codec.blockOffsets[i+1] : input->compressedSize;
+            sizes[i] = end - input->codec.blockOffsets[i];
+        }
+        memset(&job, 0, sizeof(job));
+        job.blockFunc = decompressBitshuffleBlock;
+        job.pIn = (const char *)input->pData;
+        job.pOut = (char *)output->pData;
+        job.totalBytes = info.totalBytes;
+        job.blockSize = input->codec.blockSize;
+        job.elemSize = elemSize;
+        job.bshufBlock = bshufBlock;
+        job.compressor = compressor;
+        job.nBlocks = nBlocks;
+        job.pOffsets = &input->codec.blockOffsets[0];
+        job.pSizes = &sizes[0];
+
+        if (!NDCodecBlockPool::getInstance()->run(&job, numThreads)) {
+            output->release();
+            sprintf(errorMessage, "Failed to %s decompress", name);
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+        output->codec.clear();
+        return output;
+    }
+
+    int64_t ret = bshufDecompress(compressor, input->pData, output->pData, info.nElements,
+                                  elemSize, bshufBlock);
 
     if (ret <= 0){
         output->release();
-        sprintf(errorMessage, "Failed to Blosc decompress");
+        sprintf(errorMessage, "Failed to %s decompress", name);
         *status = NDCODEC_ERROR;
         return NULL;
     }
@@ -603,6 +1232,39 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
 
     return output;
 }
+
+NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    return compressBSLZ4(input, 0, 1, status, errorMessage);
+}
+
+NDArray *compressBSLZ4(NDArray *input, size_t blockSize, int numThreads,
+                       NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    return compressBitshuffle(input, NDCODEC_BSLZ4, 0, blockSize, numThreads, status, errorMessage, pPool);
+}
+
+NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressBSLZ4(input, 1, status, errorMessage);
+}
+
+NDArray *decompressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressBitshuffle(input, NDCODEC_BSLZ4, numThreads, status, errorMessage);
+}
+
+NDArray *compressBSZstd(NDArray *input, int clevel, size_t blockSize, int numThreads,
+                        NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    return compressBitshuffle(input, NDCODEC_BSZSTD, clevel, blockSize, numThreads, status, errorMessage, pPool);
+}
+
+NDArray *decompressBSZstd(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressBitshuffle(input, NDCODEC_BSZSTD, numThreads, status, errorMessage);
+}
+
 #else
 
 NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
@@ -612,6 +1274,12 @@ NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage
     return NULL;
 }
 
+NDArray *compressLZ4(NDArray *input, size_t blockSize, int numThreads,
+                     NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    return compressLZ4(input, status, errorMessage);
+}
+
 NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
 {
     sprintf(errorMessage, "No LZ4 support");
@@ -619,6 +1287,11 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
     return NULL;
 }
 
+NDArray *decompressLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressLZ4(input, status, errorMessage);
+}
+
 NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
 {
     sprintf(errorMessage, "No Bitshuffle support");
@@ -626,6 +1299,12 @@ NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
     return NULL;
 }
 
+NDArray *compressBSLZ4(NDArray *input, size_t blockSize, int numThreads,
+                       NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    return compressBSLZ4(input, status, errorMessage);
+}
+
 NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
 {
     sprintf(errorMessage, "No Bitshuffle support");
@@ -633,10 +1312,36 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
     return NULL;
 }
 
+NDArray *decompressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressBSLZ4(input, status, errorMessage);
+}
+
+NDArray *compressBSZstd(NDArray *input, int clevel, size_t blockSize, int numThreads,
+                        NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool)
+{
+    return compressBSLZ4(input, status, errorMessage);
+}
+
+NDArray *decompressBSZstd(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
+{
+    return decompressBSLZ4(input, status, errorMessage);
+}
+
 #endif // ifdef HAVE_BITSHUFFLE
 
+/* Returns the speed in MB/s of processing nBytes of uncompressed data between tStart and tEnd */
+static double computeSpeed(size_t nBytes, epicsTimeStamp *tStart, epicsTimeStamp *tEnd)
+{
+    double elapsed = epicsTimeDiffInSeconds(tEnd, tStart);
+
+    if (elapsed <= 0.)
+        return 0.;
+    return (double)nBytes / elapsed / 1.e6;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
-  * Does JPEG or Blosc compression on the array.
+  * Does JPEG, Blosc, LZ4, BSLZ4, Zstd or BSZstd compression on the array.
   * If compression is None or fails the input array is passed on without
   * being changed.  Does callbacks to all registered clients on the asynGenericPointer
   * interface with the output array.
@@ -659,10 +1364,15 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
 
     NDArray *result = NULL;
     double factor = 1.0;
+    double speed = 0.0;
+    epicsTimeStamp tStart, tEnd;
 
-    int mode, algo;
+    int mode, algo, blockSize, blockThreads;
     getIntegerParam(NDCodecMode, &mode);
     getIntegerParam(NDCodecCompressor, &algo);
+    getIntegerParam(NDCodecBlockSize, &blockSize);
+    getIntegerParam(NDCodecBlockThreads, &blockThreads);
+    epicsTimeGetCurrent(&tStart);
 
     if (algo && mode == NDCODEC_COMPRESS && !pArray->codec.empty()) {
         sprintf(errorMessage, "Array already compressed");
@@ -705,14 +1415,37 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
 
         case NDCODEC_LZ4: {
             unlock();
-            result = compressLZ4(pArray, &codecStatus, errorMessage);
+            result = compressLZ4(pArray, blockSize, blockThreads, &codecStatus, errorMessage);
             lock();
             break;
         }
 
         case NDCODEC_BSLZ4: {
             unlock();
-            result = compressBSLZ4(pArray, &codecStatus, errorMessage);
+            result = compressBSLZ4(pArray, blockSize, blockThreads, &codecStatus, errorMessage);
+            lock();
+            break;
+        }
+
+        case NDCODEC_ZSTD: {
+            int clevel, numThreads;
+
+            getIntegerParam(NDCodecZstdCLevel, &clevel);
+            getIntegerParam(NDCodecZstdNumThreads, &numThreads);
+
+            unlock();
+            result = compressZstd(pArray, clevel, numThreads, &codecStatus, errorMessage);
+            lock();
+            break;
+        }
+
+        case NDCODEC_BSZSTD: {
+            int clevel;
+
+            getIntegerParam(NDCodecZstdCLevel, &clevel);
+
+            unlock();
+            result = compressBSZstd(pArray, clevel, blockSize, blockThreads, &codecStatus, errorMessage);
             lock();
             break;
         }
@@ -723,6 +1456,8 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
             NDArrayInfo_t info;
             pArray->getInfo(&info);
             factor = (double)info.totalBytes / (double)result->compressedSize;
+            epicsTimeGetCurrent(&tEnd);
+            speed = computeSpeed(info.totalBytes, &tStart, &tEnd);
         }
     } else {
         if (pArray->codec.empty()) {
@@ -743,14 +1478,24 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
             setIntegerParam(NDCodecCompressor, NDCODEC_BLOSC);
         } else if (pArray->codec.name == codecName[NDCODEC_LZ4]) {
             unlock();
-            result = decompressLZ4(pArray, &codecStatus, errorMessage);
+            result = decompressLZ4(pArray, blockThreads, &codecStatus, errorMessage);
             lock();
             setIntegerParam(NDCodecCompressor, NDCODEC_LZ4);
         } else if (pArray->codec.name == codecName[NDCODEC_BSLZ4]) {
             unlock();
-            result = decompressBSLZ4(pArray, &codecStatus, errorMessage);
+            result = decompressBSLZ4(pArray, blockThreads, &codecStatus, errorMessage);
             lock();
             setIntegerParam(NDCodecCompressor, NDCODEC_BSLZ4);
+        } else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+            unlock();
+            result = decompressZstd(pArray, &codecStatus, errorMessage);
+            lock();
+            setIntegerParam(NDCodecCompressor, NDCODEC_ZSTD);
+        } else if (pArray->codec.name == codecName[NDCODEC_BSZSTD]) {
+            unlock();
+            result = decompressBSZstd(pArray, blockThreads, &codecStatus, errorMessage);
+            lock();
+            setIntegerParam(NDCodecCompressor, NDCODEC_BSZSTD);
         } else {
             sprintf(errorMessage, "Unexpected codec: '%s'", pArray->codec.name.c_str());
             codecStatus = NDCODEC_ERROR;
@@ -760,6 +1505,8 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
             NDArrayInfo_t info;
             result->getInfo(&info);
             factor = (double)info.totalBytes / (double)pArray->compressedSize;
+            epicsTimeGetCurrent(&tEnd);
+            speed = computeSpeed(info.totalBytes, &tStart, &tEnd);
         }
     }
 
@@ -774,6 +1521,7 @@ finish:
     NDPluginDriver::endProcessCallbacks(result, result == pArray, true);
 
     setDoubleParam(NDCodecCompFactor, factor);
+    setDoubleParam(NDCodecCodecSpeed, speed);
     callParamCallbacks();
 }
 
@@ -805,6 +1553,20 @@ asynStatus NDPluginCodec::writeInt32(asynUser *pasynUser, epicsInt32 value)
     } else if (function == NDCodecBloscNumThreads) {
         if (value < 1)
             value = 1;
+    } else if (function == NDCodecZstdCLevel) {
+        if (value < 1)
+            value = 1;
+        else if (value > 22)
+            value = 22;
+    } else if (function == NDCodecZstdNumThreads) {
+        if (value < 1)
+            value = 1;
+    } else if (function == NDCodecBlockSize) {
+        if (value < 0)
+            value = 0;
+    } else if (function == NDCodecBlockThreads) {
+        if (value < 1)
+            value = 1;
     } else if (function < FIRST_NDCODEC_PARAM) {
         status = NDPluginDriver::writeInt32(pasynUser, value);
     }
@@ -877,6 +1639,11 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     createParam(NDCodecBloscCLevelString,     asynParamInt32,   &NDCodecBloscCLevel);
     createParam(NDCodecBloscShuffleString,    asynParamInt32,   &NDCodecBloscShuffle);
     createParam(NDCodecBloscNumThreadsString, asynParamInt32,   &NDCodecBloscNumThreads);
+    createParam(NDCodecZstdCLevelString,      asynParamInt32,   &NDCodecZstdCLevel);
+    createParam(NDCodecZstdNumThreadsString,  asynParamInt32,   &NDCodecZstdNumThreads);
+    createParam(NDCodecBlockSizeString,       asynParamInt32,   &NDCodecBlockSize);
+    createParam(NDCodecBlockThreadsString,    asynParamInt32,   &NDCodecBlockThreads);
+    createParam(NDCodecCodecSpeedString,      asynParamFloat64, &NDCodecCodecSpeed);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginCodec");
@@ -889,6 +1656,11 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     setIntegerParam(NDCodecBloscCompressor, NDCODEC_BLOSC_BLOSCLZ);
     setIntegerParam(NDCodecBloscCLevel,     5);
     setIntegerParam(NDCodecBloscNumThreads, 1);
+    setIntegerParam(NDCodecZstdCLevel,      3);
+    setIntegerParam(NDCodecZstdNumThreads,  1);
+    setIntegerParam(NDCodecBlockSize,       0);
+    setIntegerParam(NDCodecBlockThreads,    1);
+    setDoubleParam (NDCodecCodecSpeed,      0.0);
 
     // Enable ArrayCallbacks.
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
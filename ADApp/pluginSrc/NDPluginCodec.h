@@ -13,6 +13,11 @@
 #define NDCodecBloscCLevelString      "BLOSC_CLEVEL"     /* (int r/w) Blosc compression level */
 #define NDCodecBloscShuffleString     "BLOSC_SHUFFLE"    /* (bool r/w) Should Blosc apply shuffling? */
 #define NDCodecBloscNumThreadsString  "BLOSC_NUMTHREADS" /* (int r/w) Number of threads to be used by Blosc */
+#define NDCodecZstdCLevelString       "ZSTD_CLEVEL"      /* (int r/w) Zstd compression level */
+#define NDCodecZstdNumThreadsString   "ZSTD_NUMTHREADS"  /* (int r/w) Number of threads to be used by Zstd */
+#define NDCodecBlockSizeString        "BLOCK_SIZE"       /* (int r/w) Uncompressed bytes per independently compressed block (0 = whole frame) */
+#define NDCodecBlockThreadsString     "BLOCK_THREADS"    /* (int r/w) Number of threads compressing/decompressing blocks in parallel */
+#define NDCodecCodecSpeedString       "CODEC_SPEED"      /* (double r/o) Compression/decompression speed in MB/s of uncompressed data */
 
 /** Compress/decompress NDArrays according to available codecs.
   * This plugin is a source of NDArray callbacks, passing the (possibly
@@ -22,7 +27,13 @@
   * <ul>
   *  <li> JPEG</li>
   *  <li> Blosc</li>
+  *  <li> LZ4</li>
+  *  <li> Bitshuffle/LZ4</li>
+  *  <li> Zstd</li>
+  *  <li> Bitshuffle/Zstd</li>
   * </ul>
+  * LZ4, Bitshuffle/LZ4 and Bitshuffle/Zstd can split large frames into independently compressed
+  * blocks that are processed in parallel by a pool of worker threads.
   */
 
 typedef enum {
@@ -49,19 +60,32 @@ typedef enum {
 /*
  * The [de]compress* functions below take an input array and return a
  * pool-allocated output array on success or NULL on error. They are
- * thread-safe.
+ * thread-safe. Where a pPool argument is given the output array is
+ * allocated from that pool instead of the pool of the input array.
  */
 
 NDArray *compressJPEG(NDArray *input, int quality, NDCodecStatus_t *status, char *errorMessage);
 NDArray *decompressJPEG(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
 
 NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp_t compressor,
-                       int numThreads, NDCodecStatus_t *status, char *errorMessage);
+                       int numThreads, NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool=NULL);
 NDArray *decompressBlosc(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
 NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressLZ4(NDArray *input, size_t blockSize, int numThreads,
+                     NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool=NULL);
 NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *decompressLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
 NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressBSLZ4(NDArray *input, size_t blockSize, int numThreads,
+                       NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool=NULL);
 NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *decompressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressZstd(NDArray *input, int clevel, int numThreads,
+                      NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool=NULL);
+NDArray *decompressZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressBSZstd(NDArray *input, int clevel, size_t blockSize, int numThreads,
+                        NDCodecStatus_t *status, char *errorMessage, NDArrayPool *pPool=NULL);
+NDArray *decompressBSZstd(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
 
 
 class NDPLUGIN_API NDPluginCodec : public NDPluginDriver {
@@ -87,6 +111,11 @@ protected:
     int NDCodecBloscCLevel;
     int NDCodecBloscShuffle;
     int NDCodecBloscNumThreads;
+    int NDCodecZstdCLevel;
+    int NDCodecZstdNumThreads;
+    int NDCodecBlockSize;
+    int NDCodecBlockThreads;
+    int NDCodecCodecSpeed;
 
 };
 
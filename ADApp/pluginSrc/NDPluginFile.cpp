@@ -16,11 +16,36 @@
 #include <epicsString.h>
 
 #include "NDPluginFile.h"
+#include "NDFileCaptureArena.h"
 
 #include <epicsExport.h>
 
 static const char *driverName="NDPluginFile";
 
+#define MEGABYTE_DBL 1048576.
+/* Longest time that a thread waiting for the write-behind thread sleeps before it checks the queue again */
+#define WRITE_BEHIND_POLL_TIME 0.1
+
+static void writeBehindTaskC(void *drvPvt)
+{
+    NDPluginFile *pPvt = (NDPluginFile *)drvPvt;
+
+    pPvt->writeBehindTask();
+}
+
+static void replayReadTaskC(void *drvPvt)
+{
+    NDPluginFile *pPvt = (NDPluginFile *)drvPvt;
+
+    pPvt->replayReadTask();
+}
+
+static void replaySendTaskC(void *drvPvt)
+{
+    NDPluginFile *pPvt = (NDPluginFile *)drvPvt;
+
+    pPvt->replaySendTask();
+}
 
 
 /** Base method for opening a file
@@ -35,6 +60,9 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
     char errorMessage[256];
     static const char* functionName = "openFileBase";
 
+    /* Arrays queued for the previous file must be written before a new file is opened */
+    this->flushWriteQueue();
+
     if (this->useAttrFilePrefix)
         this->attrFileNameSet();
 
@@ -84,15 +112,18 @@ asynStatus NDPluginFile::closeFileBase()
 {
     /* Closes a file */
     asynStatus status = asynSuccess;
+    asynStatus flushStatus;
     char fullFileName[2*MAX_FILENAME_LEN];
     char tempSuffix[MAX_FILENAME_LEN];
-    char tempFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
     static const char* functionName = "closeFileBase";
 
     setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
     setStringParam(NDFileWriteMessage, "");
 
+    /* Wait for the write-behind thread to write any queued arrays; this reports any write error */
+    flushStatus = this->flushWriteQueue();
+
     getStringParam(NDFullFileName, sizeof(fullFileName), fullFileName);
     getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
 
@@ -106,16 +137,8 @@ asynStatus NDPluginFile::closeFileBase()
             "Error closing file, status=%d", status);
     }
 
-    if ( *tempSuffix != 0 &&
-         (strlen(fullFileName) - strlen(tempSuffix)) < sizeof(fullFileName) ) {
-        strcpy( tempFileName, fullFileName );
-        strcat( tempFileName, tempSuffix );
-        if ( rename( tempFileName, fullFileName ) != 0 ) {
-            epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
-                          "Error renaming temporary file %s to %s", tempFileName, fullFileName );
-            status=asynError;
-        }
-    }
+    if (status == asynSuccess)
+        status = this->renameTempFile(fullFileName, tempSuffix, errorMessage, sizeof(errorMessage));
 
     epicsMutexUnlock(this->fileMutexId);
     this->lock();
@@ -125,11 +148,142 @@ asynStatus NDPluginFile::closeFileBase()
               driverName, functionName, errorMessage);
         setIntegerParam(NDFileWriteStatus, NDFileWriteError);
         setStringParam(NDFileWriteMessage, errorMessage);
+    } else {
+        status = flushStatus;
     }
 
     return(status);
 }
 
+/** Renames a closed file that was written with NDFileTempSuffix appended to its name.
+  * Called with the file mutex held.
+  * \param[in] fullFileName The final name of the file.
+  * \param[in] tempSuffix The temporary suffix, nothing is done if this is empty.
+  * \param[out] errorMessage The reason for a failure.
+  * \param[in] maxChars The size of errorMessage. */
+asynStatus NDPluginFile::renameTempFile(const char *fullFileName, const char *tempSuffix,
+                                        char *errorMessage, size_t maxChars)
+{
+    char tempFileName[2*MAX_FILENAME_LEN];
+
+    if ( *tempSuffix == 0 ||
+         (strlen(fullFileName) + strlen(tempSuffix)) >= sizeof(tempFileName) ) {
+        return asynSuccess;
+    }
+    strcpy( tempFileName, fullFileName );
+    strcat( tempFileName, tempSuffix );
+    if ( rename( tempFileName, fullFileName ) != 0 ) {
+        epicsSnprintf(errorMessage, maxChars-1,
+                      "Error renaming temporary file %s to %s", tempFileName, fullFileName );
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+/** Starts the next file of a stream once the current file holds NDFileRolloverFrames arrays or NDFileRolloverSize MB.
+  * The next file always gets the next NDFileNumber, even if NDAutoIncrement is off.
+  * With write-behind the close of the current file and the open of the next one are queued to the I/O thread,
+  * so this thread carries on with the next array at once; otherwise they are done here.
+  * Called with the asyn port lock held.
+  * \param[in] pArray The first NDArray for the next file.
+  * \param[in] writeBehind true if the arrays of this stream are written by the write-behind thread. */
+asynStatus NDPluginFile::rolloverFileBase(NDArray *pArray, bool writeBehind)
+{
+    NDFileWriteRequest_t request;
+    asynStatus status, openStatus;
+    char closeFileName[2*MAX_FILENAME_LEN];
+    char openFileName[2*MAX_FILENAME_LEN];
+    char tempSuffix[MAX_FILENAME_LEN];
+    int autoIncrement, fileNumber, numCaptured, rolloverCount;
+    static const char* functionName = "rolloverFileBase";
+
+    this->rolloverPending = false;
+    getIntegerParam(NDAutoIncrement, &autoIncrement);
+    if (!autoIncrement) {
+        getIntegerParam(NDFileNumber, &fileNumber);
+        setIntegerParam(NDFileNumber, fileNumber+1);
+    }
+    getIntegerParam(NDFileNumCaptured, &numCaptured);
+    getIntegerParam(NDFileRolloverCount, &rolloverCount);
+    setIntegerParam(NDFileRolloverCount, rolloverCount+1);
+
+    if (!writeBehind || !this->writeBehindThreadId) {
+        /* The next file is opened even if the current one could not be closed cleanly */
+        this->flushWriteQueue();
+        this->rollingOver = true;
+        status = this->closeFileBase();
+        this->fileFirstCaptured = numCaptured;
+        this->framesInFile = 0;
+        this->bytesInFile = 0;
+        openStatus = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, pArray);
+        this->rollingOver = false;
+        return status ? status : openStatus;
+    }
+
+    getStringParam(NDFullFileName, sizeof(closeFileName), closeFileName);
+    getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
+    status = (asynStatus)createFileName(sizeof(openFileName), openFileName);
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s error creating full file name, fullFileName=%s, status=%d\n",
+              driverName, functionName, openFileName, status);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, "Error creating full file name");
+        return(status);
+    }
+    setStringParam(NDFullFileName, openFileName);
+    this->registerInitFrameInfo(pArray);
+
+    request.pArray = pArray;
+    request.bytes = 0;
+    request.numCaptured = numCaptured - this->fileFirstCaptured;
+    request.rollover = true;
+    request.closeFileName = closeFileName;
+    request.openFileName = openFileName;
+    request.tempSuffix = tempSuffix;
+    this->fileFirstCaptured = numCaptured;
+    this->framesInFile = 0;
+    this->bytesInFile = 0;
+    return this->queueRequest(request);
+}
+
+/** Closes the current file and opens the next one for a rollover queued by rolloverFileBase.
+  * Called from the write-behind thread without the asyn port lock.
+  * \param[in] request The rollover request. */
+asynStatus NDPluginFile::rolloverFile(const NDFileWriteRequest_t& request)
+{
+    asynStatus status, openStatus;
+    std::string fileName = request.openFileName + request.tempSuffix;
+    char errorMessage[256];
+    static const char* functionName = "rolloverFile";
+
+    epicsMutexLock(this->fileMutexId);
+    this->rollingOver = true;
+    status = this->closeFile();
+    if (status) {
+        epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+            "Error closing file %s, status=%d", request.closeFileName.c_str(), status);
+    } else {
+        status = this->renameTempFile(request.closeFileName.c_str(), request.tempSuffix.c_str(),
+                                      errorMessage, sizeof(errorMessage));
+    }
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s %s\n",
+              driverName, functionName, errorMessage);
+    }
+    openStatus = this->openFile(fileName.c_str(), NDFileModeWrite | NDFileModeMultiple, request.pArray);
+    if (openStatus) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s Error opening file %s, status=%d\n",
+              driverName, functionName, fileName.c_str(), openStatus);
+        if (!status) status = openStatus;
+    }
+    this->rollingOver = false;
+    epicsMutexUnlock(this->fileMutexId);
+    return status;
+}
+
 /** Base method for reading a file
   * Creates the file name with asynNDArrayDriver::createFileName, then calls the pure virtual functions openFile,
   * readFile and closeFile in the derived class.  Does callbacks with the NDArray that was read in. */
@@ -141,6 +295,7 @@ asynStatus NDPluginFile::readFileBase(void)
     char errorMessage[256];
     static const char* functionName = "readFileBase";
 
+    this->flushWriteQueue();
     setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
     setStringParam(NDFileWriteMessage, "");
 
@@ -205,7 +360,11 @@ asynStatus NDPluginFile::writeFileBase()
     int numCapture, numCaptured;
     bool doLazyOpen;
     int deleteDriverFile;
+    int writeBehind;
+    bool useWriteBehind;
+    size_t numArrays;
     NDArray *pArray;
+    NDArrayInfo_t arrayInfo;
     NDAttribute *pAttribute;
     char driverFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
@@ -227,6 +386,8 @@ asynStatus NDPluginFile::writeFileBase()
     getIntegerParam(NDFileWriteMode, &fileWriteMode);
     getIntegerParam(NDFileNumCapture, &numCapture);
     getIntegerParam(NDFileNumCaptured, &numCaptured);
+    getIntegerParam(NDFileDeleteDriverFile, &deleteDriverFile);
+    getIntegerParam(NDFileWriteBehind, &writeBehind);
 
     setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
     setStringParam(NDFileWriteMessage, "");
@@ -245,9 +406,7 @@ asynStatus NDPluginFile::writeFileBase()
             status = this->openFileBase(NDFileModeWrite, pArrayOut);
             if (status == asynSuccess) {
                 this->unlock();
-                epicsMutexLock(this->fileMutexId);
-                status = this->writeFile(pArrayOut);
-                epicsMutexUnlock(this->fileMutexId);
+                status = this->writeFileTimed(pArrayOut);
                 this->lock();
                 NDPluginDriver::endProcessCallbacks(pArrayOut, true, true);
                 if (status) {
@@ -267,7 +426,8 @@ asynStatus NDPluginFile::writeFileBase()
             break;
         case NDFileModeCapture:
             /* Write the file */
-            if (pCapture.size() == 0) {
+            numArrays = this->pCaptureArena ? this->pCaptureArena->count() : pCapture.size();
+            if (numArrays == 0) {
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                     "%s::%s: ERROR, capture buffer is empty\n",
                     driverName, functionName);
@@ -285,18 +445,30 @@ asynStatus NDPluginFile::writeFileBase()
                 getIntegerParam(NDArrayCounter, &arrayCounter);
                 arrayCounterStart = arrayCounter;
                 getIntegerParam(NDFileNumCaptured, &numCaptured);
-                for (size_t i=0; i<pCapture.size(); i++) {
+                for (size_t i=0; i<numArrays; i++) {
                     epicsTime tStart = epicsTime::getCurrent();
-                    pArray = pCapture[i];
+                    if (this->pCaptureArena) {
+                        /* The array is rebuilt from the arena and released as soon as it has been written */
+                        pArray = this->pCaptureArena->get(i, this->pNDArrayPool);
+                        if (!pArray) {
+                            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                                "%s::%s: ERROR, cannot allocate array to write from capture arena\n",
+                                driverName, functionName);
+                            setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+                            setStringParam(NDFileWriteMessage, "ERROR, cannot allocate array from capture arena");
+                            status = asynError;
+                            break;
+                        }
+                    } else {
+                        pArray = pCapture[i];
+                    }
                     if (!this->supportsMultipleArrays)
                         status = this->openFileBase(NDFileModeWrite, pArray);
                     else
                         this->attrFileNameCheck();
                     if (status == asynSuccess) {
                         this->unlock();
-                        epicsMutexLock(this->fileMutexId);
-                        status = this->writeFile(pArray);
-                        epicsMutexUnlock(this->fileMutexId);
+                        status = this->writeFileTimed(pArray);
                         this->lock();
                         NDPluginDriver::endProcessCallbacks(pArray, true, true);
                         if (status) {
@@ -312,6 +484,7 @@ asynStatus NDPluginFile::writeFileBase()
                                 status = this->closeFileBase();
                         }
                     }
+                    if (this->pCaptureArena) pArray->release();
                     numCaptured--;
                     setIntegerParam(NDFileNumCaptured, numCaptured);
                     arrayCounter++;
@@ -335,17 +508,26 @@ asynStatus NDPluginFile::writeFileBase()
                 status = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, pArrayOut);
             else
                 this->attrFileNameCheck();
+            /* The original driver file must not be deleted before the array has been written,
+             * so that case is always written by this thread. */
+            useWriteBehind = writeBehind && this->supportsMultipleArrays && !deleteDriverFile;
+            if ((status == asynSuccess) && this->rolloverPending)
+                status = this->rolloverFileBase(pArrayOut, useWriteBehind);
             if (!this->isFrameValid(pArrayOut)) {
                 setIntegerParam(NDFileWriteStatus, NDFileWriteError);
                 setStringParam(NDFileWriteMessage, "Invalid frame. Ignoring.");
                 status = asynError;
             }
             if (status == asynSuccess) {
-                this->unlock();
-                epicsMutexLock(this->fileMutexId);
-                status = this->writeFile(pArrayOut);
-                epicsMutexUnlock(this->fileMutexId);
-                this->lock();
+                /* With write-behind the array is handed to the I/O thread and this thread carries on
+                 * with the next array. */
+                if (useWriteBehind) {
+                    status = this->queueWrite(pArrayOut);
+                } else {
+                    this->unlock();
+                    status = this->writeFileTimed(pArrayOut);
+                    this->lock();
+                }
                 NDPluginDriver::endProcessCallbacks(pArrayOut, true, true);
                 if (status) {
                     epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
@@ -357,8 +539,17 @@ asynStatus NDPluginFile::writeFileBase()
                     setStringParam(NDFileWriteMessage, errorMessage);
                 } else {
                     status = this->attrFileCloseCheck();
-                    if (!this->supportsMultipleArrays)
+                    if (!this->supportsMultipleArrays) {
                         status = this->closeFileBase();
+                    } else if ((this->rolloverFrames > 0) || (this->rolloverBytes > 0)) {
+                        /* The next file is only opened when the next array arrives */
+                        pArrayOut->getInfo(&arrayInfo);
+                        this->framesInFile++;
+                        this->bytesInFile += pArrayOut->codec.empty() ? arrayInfo.totalBytes : pArrayOut->compressedSize;
+                        if (((this->rolloverFrames > 0) && (this->framesInFile >= this->rolloverFrames)) ||
+                            ((this->rolloverBytes > 0) && (this->bytesInFile >= this->rolloverBytes)))
+                            this->rolloverPending = true;
+                    }
                 }
             }
             break;
@@ -375,7 +566,6 @@ asynStatus NDPluginFile::writeFileBase()
      *  - There were no errors above
      *  - The NDFullFileName attribute is present and contains a non-blank string
      */
-    getIntegerParam(NDFileDeleteDriverFile, &deleteDriverFile);
     if ((status == asynSuccess) && deleteDriverFile) {
         pAttribute = pArrayOut->pAttributeList->find("DriverFileName");
         if (pAttribute) {
@@ -400,8 +590,17 @@ asynStatus NDPluginFile::writeFileBase()
 void NDPluginFile::freeCaptureBuffer()
 {
     NDArray *pArray;
+    static const char* functionName = "freeCaptureBuffer";
 
     setIntegerParam(NDFileNumCaptured, 0);
+    if (this->pCaptureArena) {
+        if (this->pCaptureArena->clear()) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s cannot free the disk blocks of the capture arena file\n",
+                driverName, functionName);
+        }
+        setDoubleParam(NDFileCaptureArenaUsed, 0.0);
+    }
     if (pCapture.size() == 0) return;
     /* Free the capture buffer */
     for (size_t i=0; i<pCapture.size(); i++) {
@@ -412,6 +611,41 @@ void NDPluginFile::freeCaptureBuffer()
     pCapture.clear();
 }
 
+/** Creates, keeps or removes the memory mapped Capture mode buffer according to NDFileCaptureArenaSize
+  * and NDFileCaptureArenaFile.  Called when capture is started, after the previous capture has been freed.
+  * The buffer is kept for the next capture if its size and file have not changed. */
+asynStatus NDPluginFile::createCaptureArena()
+{
+    double arenaSize;
+    char arenaFile[MAX_FILENAME_LEN];
+    char errorMessage[256];
+    size_t capacity;
+    static const char* functionName = "createCaptureArena";
+
+    getDoubleParam(NDFileCaptureArenaSize, &arenaSize);
+    getStringParam(NDFileCaptureArenaFile, sizeof(arenaFile), arenaFile);
+    capacity = (arenaSize > 0) ? (size_t)(arenaSize * MEGABYTE_DBL) : 0;
+    if (capacity == 0) {
+        delete this->pCaptureArena;
+        this->pCaptureArena = NULL;
+        return asynSuccess;
+    }
+    if (this->pCaptureArena && this->pCaptureArena->matches(capacity, arenaFile))
+        return asynSuccess;
+    if (!this->pCaptureArena) this->pCaptureArena = new NDFileCaptureArena();
+    if (this->pCaptureArena->create(capacity, arenaFile, errorMessage, sizeof(errorMessage))) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s ERROR: %s\n",
+            driverName, functionName, errorMessage);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, errorMessage);
+        delete this->pCaptureArena;
+        this->pCaptureArena = NULL;
+        return asynError;
+    }
+    return asynSuccess;
+}
+
 /** Handles the logic for when NDFileCapture changes state, starting or stopping capturing or streaming NDArrays
   * to a file.
   * \param[in] capture Flag to start or stop capture; 1=start capture, 0=stop capture. */
@@ -423,6 +657,7 @@ asynStatus NDPluginFile::doCapture(int capture)
     NDArray *pArray = this->pArrays[0];
     NDArrayInfo_t arrayInfo;
     int numCapture;
+    double rolloverSize;
     static const char* functionName = "doCapture";
 
     /* Make sure there is a valid array if capture is set to 1 */
@@ -467,6 +702,8 @@ asynStatus NDPluginFile::doCapture(int capture)
                     return(asynError);
                 }
                 pArray->getInfo(&arrayInfo);
+                status = this->createCaptureArena();
+                if (status) return status;
                 this->registerInitFrameInfo(pArray);
             } else {
                 /* Stop capturing, nothing to do, setting the parameter is all that is needed */
@@ -475,6 +712,19 @@ asynStatus NDPluginFile::doCapture(int capture)
         case NDFileModeStream:
             if (capture) {
                 /* Streaming was just started */
+                getIntegerParam(NDFileRolloverFrames, &this->rolloverFrames);
+                getDoubleParam(NDFileRolloverSize, &rolloverSize);
+                this->rolloverBytes = rolloverSize * MEGABYTE_DBL;
+                /* Files named by NDArray attributes are never rolled over */
+                if (!this->supportsMultipleArrays || this->useAttrFilePrefix) {
+                    this->rolloverFrames = 0;
+                    this->rolloverBytes = 0;
+                }
+                this->rolloverPending = false;
+                this->fileFirstCaptured = 0;
+                this->framesInFile = 0;
+                this->bytesInFile = 0;
+                setIntegerParam(NDFileRolloverCount, 0);
                 if (this->supportsMultipleArrays && !this->useAttrFilePrefix && !this->lazyOpen)
                     status = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, pArray);
                 freeCaptureBuffer();
@@ -704,6 +954,528 @@ bool NDPluginFile::isFrameValid(NDArray *pArray)
     return valid;
 }
 
+/** Calls writeFile in the derived class with the file mutex held and records the time it took.
+  * This is called without the asyn port lock, from the plugin thread or the write-behind thread.
+  * \param[in] pArray The NDArray to write. */
+asynStatus NDPluginFile::writeFileTimed(NDArray *pArray)
+{
+    asynStatus status;
+    epicsTimeStamp tStart, tEnd;
+    double writeTime;
+
+    epicsMutexLock(this->fileMutexId);
+    epicsTimeGetCurrent(&tStart);
+    status = this->writeFile(pArray);
+    epicsTimeGetCurrent(&tEnd);
+    epicsMutexUnlock(this->fileMutexId);
+    writeTime = epicsTimeDiffInSeconds(&tEnd, &tStart)*1000.;
+
+    epicsMutexLock(this->writeBehindMutexId);
+    if (writeTime > this->maxWriteTime) this->maxWriteTime = writeTime;
+    epicsMutexUnlock(this->writeBehindMutexId);
+    return status;
+}
+
+/** Hands an array to the write-behind thread, creating the thread the first time it is needed.
+  * If the queue already holds NDFileWriteBehindQueueSize arrays or NDFileWriteBehindMaxMem MB this blocks,
+  * with the asyn port lock released, until the I/O thread has written enough arrays to make room.
+  * Called with the asyn port lock held.
+  * \param[in] pArray The NDArray to write; it is reserved until it has been written.
+  * \return The status of the first failed write since the last call, or asynSuccess. */
+asynStatus NDPluginFile::queueWrite(NDArray *pArray)
+{
+    NDFileWriteRequest_t request;
+    NDArrayInfo_t arrayInfo;
+    asynStatus status;
+    char taskName[100];
+    static const char *functionName = "queueWrite";
+
+    if (!this->writeBehindThreadId) {
+        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_WriteBehind", this->portName);
+        this->writeBehindThreadId = epicsThreadCreate(taskName,
+                                                      epicsThreadPriorityMedium,
+                                                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                                                      (EPICSTHREADFUNC)writeBehindTaskC, this);
+        if (!this->writeBehindThreadId) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error creating write-behind thread, writing synchronously\n",
+                driverName, functionName);
+            this->unlock();
+            status = this->writeFileTimed(pArray);
+            this->lock();
+            return status;
+        }
+    }
+
+    pArray->getInfo(&arrayInfo);
+    request.pArray = pArray;
+    request.bytes = pArray->codec.empty() ? arrayInfo.totalBytes : pArray->compressedSize;
+    /* The I/O thread must see NDFileNumCaptured as it is now, not as it is when the array is written */
+    request.numCaptured = this->getNumCapturedForWrite();
+    request.rollover = false;
+    return this->queueRequest(request);
+}
+
+/** Adds a request to the write-behind queue once there is room for it; the write-behind thread must exist.
+  * Called with the asyn port lock held.
+  * \param[in] request The request; its array is reserved until the request has been done.
+  * \return The status of the first failed request since the last call, or asynSuccess. */
+asynStatus NDPluginFile::queueRequest(NDFileWriteRequest_t& request)
+{
+    int queueSize;
+    double maxMemory;
+    asynStatus status;
+
+    getIntegerParam(NDFileWriteBehindQueueSize, &queueSize);
+    getDoubleParam(NDFileWriteBehindMaxMem, &maxMemory);
+
+    epicsMutexLock(this->writeBehindMutexId);
+    /* An array larger than the memory limit is still queued once the queue is empty.
+     * flushWriteQueue waits for this request while it is blocked here, so it is never queued after closeFile. */
+    this->writeQueueBlocked++;
+    while (!this->writeQueue.empty() &&
+           (((queueSize > 0) && ((int)this->writeQueue.size() >= queueSize)) ||
+            ((maxMemory > 0) && (this->writeQueueBytes + request.bytes > maxMemory * MEGABYTE_DBL)))) {
+        this->waitForWriteBehind();
+    }
+    this->writeQueueBlocked--;
+    request.pArray->reserve();
+    this->writeQueue.push_back(request);
+    this->writeQueueBytes += request.bytes;
+    if ((int)this->writeQueue.size() > this->writeQueueHighWater)
+        this->writeQueueHighWater = (int)this->writeQueue.size();
+    status = this->writeBehindStatus;
+    this->writeBehindStatus = asynSuccess;
+    epicsMutexUnlock(this->writeBehindMutexId);
+    epicsEventSignal(this->writeBehindEventId);
+    return status;
+}
+
+/** Waits until the write-behind thread has done a request, or WRITE_BEHIND_POLL_TIME has passed, with the asyn
+  * port lock and writeBehindMutexId released.
+  * Both the plugin thread in queueRequest and a thread in flushWriteQueue can wait at once, but the write-behind
+  * thread signals writeDoneEventId once per request, which wakes only one of them.  So a waiter passes the signal
+  * on when another thread is still waiting, and every caller checks its condition again in a loop, which the
+  * timeout also covers.  Called with the asyn port lock and writeBehindMutexId held. */
+void NDPluginFile::waitForWriteBehind()
+{
+    this->writeBehindWaiters++;
+    epicsMutexUnlock(this->writeBehindMutexId);
+    this->unlock();
+    epicsEventWaitWithTimeout(this->writeDoneEventId, WRITE_BEHIND_POLL_TIME);
+    this->lock();
+    epicsMutexLock(this->writeBehindMutexId);
+    this->writeBehindWaiters--;
+    if (this->writeBehindWaiters > 0) epicsEventSignal(this->writeDoneEventId);
+}
+
+/** Waits until the write-behind thread has written all queued arrays, including any that queueRequest
+  * is waiting to add.
+  * Called with the asyn port lock held; the lock is released while waiting.
+  * \return The status of the first failed write since the last call, or asynSuccess. */
+asynStatus NDPluginFile::flushWriteQueue()
+{
+    asynStatus status;
+    char errorMessage[256];
+    static const char *functionName = "flushWriteQueue";
+
+    if (!this->writeBehindThreadId) return asynSuccess;
+
+    epicsMutexLock(this->writeBehindMutexId);
+    /* A request that queueRequest is waiting to add belongs to the file being flushed, so wait for it too */
+    while (!this->writeQueue.empty() || (this->writeQueueBlocked > 0)) {
+        this->waitForWriteBehind();
+    }
+    status = this->writeBehindStatus;
+    this->writeBehindStatus = asynSuccess;
+    epicsMutexUnlock(this->writeBehindMutexId);
+
+    if (status) {
+        epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+            "Error writing file, status=%d", status);
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s %s\n",
+              driverName, functionName, errorMessage);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, errorMessage);
+    }
+    this->updateWriteStats();
+    return status;
+}
+
+/** Clears the write statistics; called when capture or streaming is started */
+void NDPluginFile::resetWriteStats()
+{
+    epicsMutexLock(this->writeBehindMutexId);
+    this->writeQueueHighWater = (int)this->writeQueue.size();
+    this->maxWriteTime = 0.;
+    epicsMutexUnlock(this->writeBehindMutexId);
+    this->updateWriteStats();
+}
+
+/** Copies the write statistics kept by writeFileTimed and the write-behind thread to the parameter library.
+  * The write-behind thread does not update these parameters, but the writeFile, openFile and closeFile methods of
+  * derived classes that it calls may take the asyn port lock to read and set their own parameters.
+  * Called with the asyn port lock held. */
+void NDPluginFile::updateWriteStats()
+{
+    epicsMutexLock(this->writeBehindMutexId);
+    setIntegerParam(NDFileWriteBehindQueued, (int)this->writeQueue.size());
+    setIntegerParam(NDFileWriteBehindHighWater, this->writeQueueHighWater);
+    setDoubleParam(NDFileMaxWriteTime, this->maxWriteTime);
+    epicsMutexUnlock(this->writeBehindMutexId);
+}
+
+/** Returns the value of NDFileNumCaptured that belongs to the array being written, counted from the start
+  * of the current file when a stream rolls over to several files.
+  * Derived classes must use this in writeFile and closeFile rather than reading NDFileNumCaptured, because with
+  * write-behind the plugin thread has already moved on to later arrays when the write-behind thread calls them.
+  * Must be called with the asyn port lock held. */
+int NDPluginFile::getNumCapturedForWrite()
+{
+    int numCaptured;
+
+    if (this->writeBehindThreadId && (epicsThreadGetIdSelf() == this->writeBehindThreadId))
+        return this->writeBehindNumCaptured;
+    getIntegerParam(NDFileNumCaptured, &numCaptured);
+    return numCaptured - this->fileFirstCaptured;
+}
+
+/** Returns the number of arrays the file being opened will hold, for derived classes that size their files
+  * from NDFileNumCapture. This is NDFileRolloverFrames when a stream rolls over before NDFileNumCapture arrays.
+  * 0 means an unlimited number of arrays. Must be called with the asyn port lock held. */
+int NDPluginFile::getNumCaptureForFile()
+{
+    int numCapture, fileWriteMode;
+
+    getIntegerParam(NDFileNumCapture, &numCapture);
+    getIntegerParam(NDFileWriteMode, &fileWriteMode);
+    if ((fileWriteMode == NDFileModeStream) && (this->rolloverFrames > 0) &&
+        ((numCapture <= 0) || (this->rolloverFrames < numCapture)))
+        return this->rolloverFrames;
+    return numCapture;
+}
+
+/** Returns true while closeFile and openFile in the derived class are called to roll a stream over to the next file,
+  * so that the derived class can tell the parts of one stream from separate files. */
+bool NDPluginFile::isRollingOver()
+{
+    return this->rollingOver;
+}
+
+/** Write-behind I/O thread; writes the arrays queued by queueWrite and does the rollovers queued by
+  * rolloverFileBase in order.
+  * The front entry stays in the queue while it is being written, so an empty queue means
+  * that every queued array is in the file.
+  * The derived class methods called here run with the file mutex held and may take the asyn port lock, as
+  * NDFileHDF5::writeFile does.  So the order of the locks is the file mutex, then the asyn port lock, then
+  * writeBehindMutexId: no thread takes the file mutex with the asyn port lock held, and no thread takes another
+  * lock with writeBehindMutexId held.  Threads that wait for this one release the asyn port lock while waiting. */
+void NDPluginFile::writeBehindTask()
+{
+    NDFileWriteRequest_t request;
+    asynStatus status;
+    bool exitTask = false;
+
+    while (!exitTask) {
+        epicsEventMustWait(this->writeBehindEventId);
+        epicsMutexLock(this->writeBehindMutexId);
+        while (!this->writeQueue.empty() && !this->writeBehindExit) {
+            request = this->writeQueue.front();
+            this->writeBehindNumCaptured = request.numCaptured;
+            epicsMutexUnlock(this->writeBehindMutexId);
+            if (request.rollover)
+                status = this->rolloverFile(request);
+            else
+                status = this->writeFileTimed(request.pArray);
+            request.pArray->release();
+            epicsMutexLock(this->writeBehindMutexId);
+            this->writeQueue.pop_front();
+            this->writeQueueBytes -= request.bytes;
+            if (status && !this->writeBehindStatus) this->writeBehindStatus = status;
+            epicsEventSignal(this->writeDoneEventId);
+        }
+        exitTask = this->writeBehindExit;
+        epicsMutexUnlock(this->writeBehindMutexId);
+    }
+    epicsEventSignal(this->writeBehindExitEventId);
+}
+
+/** Returns the number of NDArrays in the file opened by openFile with NDFileModeRead and NDFileModeMultiple;
+  * readFile then returns them one after the other.  File plugins which can read several NDArrays from one file
+  * override this; the default is for plugins which read one NDArray per file. Called with the file lock held. */
+int NDPluginFile::getNumArraysInFile()
+{
+    return 1;
+}
+
+/** Returns true while a replay is running, from the start of the replay until its last array has been sent. */
+bool NDPluginFile::isReplaying()
+{
+    bool replaying;
+
+    epicsMutexLock(this->replayMutexId);
+    replaying = this->replayActive;
+    epicsMutexUnlock(this->replayMutexId);
+    return replaying;
+}
+
+/** Starts replaying the arrays of the file named by NDFilePath, NDFileName, NDFileNumber and NDFileTemplate.
+  * The file is opened with NDFileModeRead and NDFileModeMultiple. The replay read thread reads up to
+  * NDFileReplayReadAhead arrays ahead into the NDArrayPool, and the replay send thread does the callbacks
+  * with them in order at NDFileReplayRate arrays per second, or as fast as they can be read if it is 0.
+  * The arrays keep the unique IDs, time stamps and attributes they were read with.
+  * Called with the asyn port lock held. */
+asynStatus NDPluginFile::startReplay()
+{
+    asynStatus status;
+    char fullFileName[2*MAX_FILENAME_LEN];
+    char errorMessage[256];
+    char taskName[100];
+    int capture, readAhead, numArrays=0;
+    double rate;
+    static const char* functionName = "startReplay";
+
+    getIntegerParam(NDFileCapture, &capture);
+    epicsMutexLock(this->replayMutexId);
+    if (this->replayActive || capture) {
+        epicsMutexUnlock(this->replayMutexId);
+        epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+            capture ? "Cannot replay while capturing" : "Previous replay has not finished");
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s %s\n",
+            driverName, functionName, errorMessage);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, errorMessage);
+        return asynError;
+    }
+    /* Nothing else may open a file from here on */
+    this->replayActive = true;
+    epicsMutexUnlock(this->replayMutexId);
+
+    this->flushWriteQueue();
+    setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
+    setStringParam(NDFileWriteMessage, "");
+    setIntegerParam(NDFileReplayCount, 0);
+    getIntegerParam(NDFileReplayReadAhead, &readAhead);
+    if (readAhead < 1) readAhead = 1;
+    getDoubleParam(NDFileReplayRate, &rate);
+
+    status = (asynStatus)createFileName(2*MAX_FILENAME_LEN, fullFileName);
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s error creating full file name, fullFileName=%s, status=%d\n",
+              driverName, functionName, fullFileName, status);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, "Error creating full file name");
+        goto error;
+    }
+    setStringParam(NDFullFileName, fullFileName);
+
+    if (!this->replayReadThreadId) {
+        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_ReplayRead", this->portName);
+        this->replayReadThreadId = epicsThreadCreate(taskName,
+                                                     epicsThreadPriorityMedium,
+                                                     epicsThreadGetStackSize(epicsThreadStackBig),
+                                                     (EPICSTHREADFUNC)replayReadTaskC, this);
+    }
+    if (!this->replaySendThreadId) {
+        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_ReplaySend", this->portName);
+        this->replaySendThreadId = epicsThreadCreate(taskName,
+                                                     epicsThreadPriorityMedium,
+                                                     epicsThreadGetStackSize(epicsThreadStackMedium),
+                                                     (EPICSTHREADFUNC)replaySendTaskC, this);
+    }
+    if (!this->replayReadThreadId || !this->replaySendThreadId) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating replay threads\n",
+            driverName, functionName);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, "Error creating replay threads");
+        status = asynError;
+        goto error;
+    }
+
+    /* Open the file with the main lock released since it can be slow */
+    this->unlock();
+    epicsMutexLock(this->fileMutexId);
+    status = this->openFile(fullFileName, NDFileModeRead | NDFileModeMultiple, NULL);
+    if (status == asynSuccess) numArrays = this->getNumArraysInFile();
+    epicsMutexUnlock(this->fileMutexId);
+    this->lock();
+    if (status) {
+        epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+                "Error opening file %s, status=%d", fullFileName, status);
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s %s\n",
+                driverName, functionName, errorMessage);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, errorMessage);
+        goto error;
+    }
+    setIntegerParam(NDFileReplayNumArrays, numArrays);
+
+    epicsMutexLock(this->replayMutexId);
+    this->replayNumArrays = numArrays;
+    this->replayNextRead = 0;
+    this->replayReadAhead = readAhead;
+    this->replayRate = rate;
+    this->replayStop = false;
+    this->replayReadDone = false;
+    this->replayStatus = asynSuccess;
+    epicsMutexUnlock(this->replayMutexId);
+    epicsEventSignal(this->replayReadEventId);
+    return asynSuccess;
+
+error:
+    epicsMutexLock(this->replayMutexId);
+    this->replayActive = false;
+    epicsMutexUnlock(this->replayMutexId);
+    return status;
+}
+
+/** Stops a replay; the arrays that have been read ahead are released without being sent.
+  * The replay threads set NDFileReplay to 0 once the file has been closed. */
+void NDPluginFile::stopReplay()
+{
+    epicsMutexLock(this->replayMutexId);
+    if (this->replayActive) this->replayStop = true;
+    epicsMutexUnlock(this->replayMutexId);
+    epicsEventSignal(this->replayReadEventId);
+    epicsEventSignal(this->replaySendEventId);
+}
+
+/** Replay read thread; reads the arrays of the file being replayed into the replay queue, keeping up to
+  * NDFileReplayReadAhead arrays ahead of the replay send thread, and closes the file when it has read
+  * all of them, when the replay is stopped or when a read fails. */
+void NDPluginFile::replayReadTask()
+{
+    NDArray *pArray;
+    asynStatus status;
+    bool exitTask = false;
+    static const char* functionName = "replayReadTask";
+
+    while (!exitTask) {
+        epicsEventMustWait(this->replayReadEventId);
+        epicsMutexLock(this->replayMutexId);
+        while (this->replayActive && !this->replayReadDone && !this->replayExit) {
+            if (this->replayStop || this->replayStatus || (this->replayNextRead >= this->replayNumArrays)) {
+                epicsMutexUnlock(this->replayMutexId);
+                epicsMutexLock(this->fileMutexId);
+                this->closeFile();
+                epicsMutexUnlock(this->fileMutexId);
+                epicsMutexLock(this->replayMutexId);
+                this->replayReadDone = true;
+                epicsEventSignal(this->replaySendEventId);
+                break;
+            }
+            if ((int)this->replayQueue.size() >= this->replayReadAhead) break;
+            epicsMutexUnlock(this->replayMutexId);
+            pArray = NULL;
+            epicsMutexLock(this->fileMutexId);
+            status = this->readFile(&pArray);
+            epicsMutexUnlock(this->fileMutexId);
+            epicsMutexLock(this->replayMutexId);
+            if (status || !pArray) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s error reading array %d, status=%d\n",
+                    driverName, functionName, this->replayNextRead, status);
+                if (pArray) pArray->release();
+                this->replayStatus = asynError;
+                continue;
+            }
+            this->replayQueue.push_back(pArray);
+            this->replayNextRead++;
+            epicsEventSignal(this->replaySendEventId);
+        }
+        exitTask = this->replayExit;
+        epicsMutexUnlock(this->replayMutexId);
+    }
+    epicsEventSignal(this->replayReadExitEventId);
+}
+
+/** Replay send thread; does the callbacks with the arrays in the replay queue, at NDFileReplayRate arrays
+  * per second if it is not 0. Downstream plugins with NDPluginDriverBlockingCallbacks=1 are called from this
+  * thread, so a replay runs no faster than they process the arrays.
+  * When the last array has been sent, or the replay was stopped, it sets NDFileReplay to 0. */
+void NDPluginFile::replaySendTask()
+{
+    NDArray *pArray;
+    epicsTimeStamp tStart, tNow;
+    double delay;
+    int numSent = 0;
+    int failedArray;
+    asynStatus status;
+    char errorMessage[256];
+    bool stop;
+    bool exitTask = false;
+
+    while (!exitTask) {
+        epicsEventMustWait(this->replaySendEventId);
+        epicsMutexLock(this->replayMutexId);
+        while (this->replayActive && !this->replayExit) {
+            if (this->replayQueue.empty() || this->replayStop) {
+                /* Wait for the read thread unless it has closed the file */
+                if (!this->replayReadDone) break;
+                while (!this->replayQueue.empty()) {
+                    this->replayQueue.front()->release();
+                    this->replayQueue.pop_front();
+                }
+                status = this->replayStatus;
+                failedArray = this->replayNextRead;
+                epicsMutexUnlock(this->replayMutexId);
+                /* The replay ends with the asyn port lock held so that a new one cannot start in between */
+                this->lock();
+                epicsMutexLock(this->replayMutexId);
+                this->replayActive = false;
+                epicsMutexUnlock(this->replayMutexId);
+                setIntegerParam(NDFileReplay, 0);
+                if (status) {
+                    epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+                        "Error reading array %d for replay", failedArray);
+                    setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+                    setStringParam(NDFileWriteMessage, errorMessage);
+                }
+                callParamCallbacks();
+                this->unlock();
+                numSent = 0;
+                epicsMutexLock(this->replayMutexId);
+                break;
+            }
+            pArray = this->replayQueue.front();
+            this->replayQueue.pop_front();
+            epicsMutexUnlock(this->replayMutexId);
+            epicsEventSignal(this->replayReadEventId);
+
+            /* Hold each array back until its time at NDFileReplayRate */
+            if (numSent == 0) epicsTimeGetCurrent(&tStart);
+            if (this->replayRate > 0) {
+                while (true) {
+                    epicsTimeGetCurrent(&tNow);
+                    delay = numSent/this->replayRate - epicsTimeDiffInSeconds(&tNow, &tStart);
+                    epicsMutexLock(this->replayMutexId);
+                    stop = this->replayStop || this->replayExit;
+                    epicsMutexUnlock(this->replayMutexId);
+                    if ((delay <= 0) || stop) break;
+                    epicsEventWaitWithTimeout(this->replaySendEventId, delay);
+                }
+            }
+
+            this->lock();
+            NDPluginDriver::beginProcessCallbacks(pArray);
+            NDPluginDriver::endProcessCallbacks(pArray, false, true);
+            numSent++;
+            setIntegerParam(NDFileReplayCount, numSent);
+            callParamCallbacks();
+            this->unlock();
+            epicsMutexLock(this->replayMutexId);
+        }
+        exitTask = this->replayExit;
+        epicsMutexUnlock(this->replayMutexId);
+    }
+    epicsEventSignal(this->replaySendExitEventId);
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Saves a single file if NDFileWriteMode=NDFileModeSingle and NDAutoSave=1.
   * Stores array in a capture buffer if NDFileWriteMode=NDFileModeCapture and NDFileCapture=1.
@@ -717,13 +1489,18 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
     int fileWriteMode, autoSave, capture;
     int arrayCounter;
     int numCapture, numCaptured;
+    bool arenaFull = false;
     asynStatus status = asynSuccess;
-    //static const char* functionName = "processCallbacks";
+    static const char* functionName = "processCallbacks";
 
     /* First check if the callback is really for this file saving plugin */
     if (!this->attrIsProcessingRequired(pArray->pAttributeList))
         return;
 
+    /* Nothing is written while a file is replayed, the derived class has that file open */
+    if (this->isReplaying())
+        return;
+
     /* Most plugins want to increment the arrayCounter each time they are called, which NDPluginDriver
      * does.  However, for this plugin we only want to increment it when we actually got a callback we were
      * supposed to save.  So we save the array counter before calling base method, increment it here */
@@ -754,18 +1531,38 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
         case NDFileModeCapture:
             if (capture) {
                 if (numCaptured < numCapture && this->isFrameValid(pArray)) {
-                    pArray->reserve();
-                    pCapture.push_back(pArray);
-                    numCaptured = pCapture.size();
-                    arrayCounter++;
+                    if (this->pCaptureArena) {
+                        /* The array is copied, so the driver can reuse it straight away */
+                        if (this->pCaptureArena->add(pArray) == asynSuccess) {
+                            numCaptured = (int)this->pCaptureArena->count();
+                            arrayCounter++;
+                            setDoubleParam(NDFileCaptureArenaUsed, this->pCaptureArena->used() / MEGABYTE_DBL);
+                        } else {
+                            arenaFull = true;
+                            asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                                "%s::%s: capture arena full after %d arrays, capture stopped\n",
+                                driverName, functionName, numCaptured);
+                        }
+                    } else {
+                        pArray->reserve();
+                        pCapture.push_back(pArray);
+                        numCaptured = pCapture.size();
+                        arrayCounter++;
+                    }
                     setIntegerParam(NDFileNumCaptured, numCaptured);
                 }
-                if (numCaptured == numCapture) {
+                if ((numCaptured == numCapture) || arenaFull) {
                     if (autoSave) {
                         writeFileBase();
                     }
                     capture = 0;
                     setIntegerParam(NDFileCapture, capture);
+                    if (arenaFull) {
+                        int writeStatus;
+                        getIntegerParam(NDFileWriteStatus, &writeStatus);
+                        if (writeStatus == NDFileWriteOK)
+                            setStringParam(NDFileWriteMessage, "Capture arena full, capture stopped");
+                    }
                 }
             }
             break;
@@ -785,6 +1582,7 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
     }
 
     /* Update the parameters.  */
+    this->updateWriteStats();
     setIntegerParam(NDArrayCounter, arrayCounter);
     callParamCallbacks();
 }
@@ -802,6 +1600,18 @@ asynStatus NDPluginFile::writeInt32(asynUser *pasynUser, epicsInt32 value)
     asynStatus status = asynSuccess;
     static const char* functionName = "writeInt32";
 
+    /* No other file may be opened while a file is replayed */
+    if (value && this->isReplaying() &&
+        ((function == NDWriteFile) || (function == NDReadFile) || (function == NDFileCapture))) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+            "%s::%s: ERROR, cannot open a file while replaying\n",
+            driverName, functionName);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, "Cannot open a file while replaying");
+        callParamCallbacks();
+        return asynError;
+    }
+
     /* Set the parameter in the parameter library. */
     status = (asynStatus) setIntegerParam(function, value);
 
@@ -845,6 +1655,7 @@ asynStatus NDPluginFile::writeInt32(asynUser *pasynUser, epicsInt32 value)
             setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
             setStringParam(NDFileWriteMessage, "");
             setStringParam(NDFullFileName, "");
+            this->resetWriteStats();
         }
         /* Must call doCapture if capturing was just started or stopped */
         status = doCapture(value);
@@ -856,6 +1667,13 @@ asynStatus NDPluginFile::writeInt32(asynUser *pasynUser, epicsInt32 value)
         }
     } else if (function == NDFileFreeCapture) {
         freeCaptureBuffer();
+    } else if (function == NDFileReplay) {
+        if (value) {
+            status = startReplay();
+            if (status && !this->isReplaying()) setIntegerParam(NDFileReplay, 0);
+        } else {
+            stopReplay();
+        }
     } else {
         /* This was not a parameter that this driver understands, try the base class */
         status = NDPluginDriver::writeInt32(pasynUser, value);
@@ -936,10 +1754,49 @@ NDPluginFile::NDPluginFile(const char *portName, int queueSize, int blockingCall
     //static const char *functionName = "NDPluginFile";
 
     this->ndArrayInfoInit = NULL;
+    this->pCaptureArena = NULL;
     this->lazyOpen = false;
+    this->rolloverFrames = 0;
+    this->rolloverBytes = 0;
+    this->rolloverPending = false;
+    this->rollingOver = false;
+    this->fileFirstCaptured = 0;
+    this->framesInFile = 0;
+    this->bytesInFile = 0;
 
     this->useAttrFilePrefix = false;
     this->fileMutexId = epicsMutexCreate();
+
+    this->writeQueueBytes = 0;
+    this->writeQueueHighWater = 0;
+    this->maxWriteTime = 0.;
+    this->writeBehindNumCaptured = 0;
+    this->writeBehindStatus = asynSuccess;
+    this->writeBehindWaiters = 0;
+    this->writeQueueBlocked = 0;
+    this->writeBehindExit = false;
+    this->writeBehindMutexId = epicsMutexCreate();
+    this->writeBehindEventId = epicsEventCreate(epicsEventEmpty);
+    this->writeDoneEventId = epicsEventCreate(epicsEventEmpty);
+    this->writeBehindExitEventId = epicsEventCreate(epicsEventEmpty);
+    this->writeBehindThreadId = 0;
+
+    this->replayNumArrays = 0;
+    this->replayNextRead = 0;
+    this->replayReadAhead = 1;
+    this->replayRate = 0.;
+    this->replayActive = false;
+    this->replayStop = false;
+    this->replayReadDone = false;
+    this->replayExit = false;
+    this->replayStatus = asynSuccess;
+    this->replayMutexId = epicsMutexCreate();
+    this->replayReadEventId = epicsEventCreate(epicsEventEmpty);
+    this->replaySendEventId = epicsEventCreate(epicsEventEmpty);
+    this->replayReadExitEventId = epicsEventCreate(epicsEventEmpty);
+    this->replaySendExitEventId = epicsEventCreate(epicsEventEmpty);
+    this->replayReadThreadId = 0;
+    this->replaySendThreadId = 0;
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginFile");
 
@@ -950,3 +1807,45 @@ NDPluginFile::NDPluginFile(const char *portName, int queueSize, int blockingCall
     /* Try to connect to the NDArray port */
     connectToArrayPort();
 }
+
+/** Destructor for NDPluginFile; stops the write-behind and replay threads.
+  * The derived class has already been destroyed, so arrays still in the queue are released without being written. */
+NDPluginFile::~NDPluginFile()
+{
+    epicsMutexLock(this->replayMutexId);
+    this->replayExit = true;
+    epicsMutexUnlock(this->replayMutexId);
+    if (this->replayReadThreadId) {
+        epicsEventSignal(this->replayReadEventId);
+        epicsEventMustWait(this->replayReadExitEventId);
+    }
+    if (this->replaySendThreadId) {
+        epicsEventSignal(this->replaySendEventId);
+        epicsEventMustWait(this->replaySendExitEventId);
+    }
+    while (!this->replayQueue.empty()) {
+        this->replayQueue.front()->release();
+        this->replayQueue.pop_front();
+    }
+    if (this->writeBehindThreadId) {
+        epicsMutexLock(this->writeBehindMutexId);
+        this->writeBehindExit = true;
+        epicsMutexUnlock(this->writeBehindMutexId);
+        epicsEventSignal(this->writeBehindEventId);
+        epicsEventMustWait(this->writeBehindExitEventId);
+        while (!this->writeQueue.empty()) {
+            this->writeQueue.front().pArray->release();
+            this->writeQueue.pop_front();
+        }
+    }
+    epicsEventDestroy(this->writeBehindEventId);
+    epicsEventDestroy(this->writeDoneEventId);
+    epicsEventDestroy(this->writeBehindExitEventId);
+    epicsMutexDestroy(this->writeBehindMutexId);
+    epicsEventDestroy(this->replayReadEventId);
+    epicsEventDestroy(this->replaySendEventId);
+    epicsEventDestroy(this->replayReadExitEventId);
+    epicsEventDestroy(this->replaySendExitEventId);
+    epicsMutexDestroy(this->replayMutexId);
+    delete this->pCaptureArena;
+}
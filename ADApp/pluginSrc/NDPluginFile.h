@@ -1,8 +1,13 @@
 #ifndef NDPluginFile_H
 #define NDPluginFile_H
 
+#include <deque>
+#include <string>
+
 #include <epicsTypes.h>
 #include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
 
 #include "NDPluginDriver.h"
 
@@ -21,6 +26,19 @@ typedef int NDFileOpenMode_t;
 #define FILEPLUGIN_DESTINATION "FilePluginDestination"
 #define FILEPLUGIN_CLOSE       "FilePluginClose"
 
+class NDFileCaptureArena;
+
+/** An array waiting to be written by the write-behind I/O thread, or a file rollover */
+typedef struct {
+    NDArray *pArray;    /**< The array to write; reserved while it is in the queue */
+    size_t bytes;       /**< Memory used by the array, counted against NDFileWriteBehindMaxMem */
+    int numCaptured;    /**< Arrays captured in the current file when it was queued */
+    bool rollover;      /**< Close closeFileName and open openFileName, pArray describes the arrays */
+    std::string closeFileName; /**< File to close on rollover, without NDFileTempSuffix */
+    std::string openFileName;  /**< File to open on rollover, without NDFileTempSuffix */
+    std::string tempSuffix;    /**< NDFileTempSuffix when the rollover was queued */
+} NDFileWriteRequest_t;
+
 /** Base class for NDArray file writing plugins; actual file writing plugins inherit from this class.
   * This class handles the logic of single file per image, capture into buffer or streaming multiple images
   * to a single file.
@@ -32,6 +50,7 @@ public:
                  int maxBuffers, size_t maxMemory, int interfaceMask, int interruptMask,
                  int asynFlags, int autoConnect, int priority, int stackSize, int maxThreads,
                  bool compressionAware = false);
+    ~NDPluginFile();
 
     /* These methods override those in the base class */
     virtual void processCallbacks(NDArray *pArray);
@@ -63,15 +82,30 @@ public:
       * pure virtual function that must be implemented by derived classes. */
     virtual asynStatus closeFile() = 0;
 
+    virtual int getNumArraysInFile();
+
     int supportsMultipleArrays; /**< Derived classes must set this flag to 0/1 if they cannot/can write
                                   * multiple NDArrays to a single file. Used in capture and stream modes. */
+    void writeBehindTask();
+    void replayReadTask();
+    void replaySendTask();
+
+protected:
+    int getNumCapturedForWrite();
+    int getNumCaptureForFile();
+    bool isRollingOver();
 
 private:
     asynStatus openFileBase(NDFileOpenMode_t openMode, NDArray *pArray);
     asynStatus readFileBase();
     asynStatus writeFileBase();
     asynStatus closeFileBase();
+    asynStatus rolloverFileBase(NDArray *pArray, bool writeBehind);
+    asynStatus rolloverFile(const NDFileWriteRequest_t& request);
+    asynStatus renameTempFile(const char *fullFileName, const char *tempSuffix,
+                              char *errorMessage, size_t maxChars);
     asynStatus doCapture(int capture);
+    asynStatus createCaptureArena();
     void       freeCaptureBuffer();
     asynStatus attrFileCloseCheck();
     asynStatus attrFileNameCheck();
@@ -79,13 +113,63 @@ private:
     bool attrIsProcessingRequired(NDAttributeList* pAttrList);
     void registerInitFrameInfo(NDArray *pArray); /**< Grab a copy of the NDArrayInfo_t structure for future reference */
     bool isFrameValid(NDArray *pArray); /**< Compare pArray dimensions and datatype against latched NDArrayInfo_t structure */
+    asynStatus writeFileTimed(NDArray *pArray);
+    asynStatus queueWrite(NDArray *pArray);
+    asynStatus queueRequest(NDFileWriteRequest_t& request);
+    asynStatus flushWriteQueue();
+    void waitForWriteBehind();
+    void resetWriteStats();
+    void updateWriteStats();
+    asynStatus startReplay();
+    void stopReplay();
+    bool isReplaying();
 
     std::vector<NDArray*> pCapture;
+    NDFileCaptureArena *pCaptureArena; /**< Capture mode buffer when NDFileCaptureArenaSize > 0, otherwise pCapture is used */
     epicsMutexId fileMutexId;
     bool useAttrFilePrefix;
     bool lazyOpen;
+    int rolloverFrames;            /**< NDFileRolloverFrames latched when streaming started */
+    double rolloverBytes;          /**< NDFileRolloverSize in bytes latched when streaming started */
+    bool rolloverPending;          /**< The current file is full, the next array starts a new file */
+    bool rollingOver;              /**< Set while the derived class closes and opens files for a rollover */
+    int fileFirstCaptured;         /**< NDFileNumCaptured when the current file was opened */
+    int framesInFile;
+    double bytesInFile;
     NDArrayInfo_t *ndArrayInfoInit; /**< The NDArray information at file open time.
                                       *  Used to check against changes in incoming frames dimensions or datatype */
+    std::deque<NDFileWriteRequest_t> writeQueue; /**< Arrays waiting for the write-behind thread; the front
+                                                   *  entry stays in the queue until it has been written */
+    size_t writeQueueBytes;
+    int writeQueueHighWater;
+    double maxWriteTime;
+    int writeBehindNumCaptured;    /**< numCaptured of the array the write-behind thread is writing */
+    asynStatus writeBehindStatus;  /**< First error from the write-behind thread, reported by the plugin thread */
+    int writeBehindWaiters;        /**< Threads waiting in waitForWriteBehind */
+    int writeQueueBlocked;         /**< Requests that queueRequest is waiting to add to the full queue */
+    bool writeBehindExit;
+    epicsMutexId writeBehindMutexId;
+    epicsEventId writeBehindEventId;
+    epicsEventId writeDoneEventId;
+    epicsEventId writeBehindExitEventId;
+    epicsThreadId writeBehindThreadId;
+    std::deque<NDArray*> replayQueue; /**< Arrays read ahead by the replay read thread, waiting to be sent */
+    int replayNumArrays;           /**< Number of arrays in the file being replayed */
+    int replayNextRead;            /**< Index of the next array the replay read thread reads */
+    int replayReadAhead;           /**< NDFileReplayReadAhead latched when the replay started */
+    double replayRate;             /**< NDFileReplayRate latched when the replay started */
+    bool replayActive;             /**< Set from the start of a replay until its last array has been sent */
+    bool replayStop;
+    bool replayReadDone;           /**< The replay read thread has closed the file */
+    bool replayExit;
+    asynStatus replayStatus;       /**< First error from the replay read thread */
+    epicsMutexId replayMutexId;
+    epicsEventId replayReadEventId;
+    epicsEventId replaySendEventId;
+    epicsEventId replayReadExitEventId;
+    epicsEventId replaySendExitEventId;
+    epicsThreadId replayReadThreadId;
+    epicsThreadId replaySendThreadId;
 };
 
 #endif
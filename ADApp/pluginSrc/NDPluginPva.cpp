@@ -11,6 +11,7 @@
 #include <ntndArrayConverter.h>
 
 #include "NDPluginPva.h"
+#include "NDPluginCodec.h"
 
 #include <epicsExport.h>
 
@@ -85,6 +86,182 @@ void NTNDArrayRecord::update(NDArray *pArray)
     unlock();
 }
 
+/** Bins the array by the same factor in every dimension except the color dimension.
+  * Each output element is the mean of its bin, so the output has the data type and range of the input.
+  * Returns the input array with another reference if there is nothing to bin.
+  * \param[in] pArray  The input array.
+  * \param[in] binning The binning factor.
+  */
+NDArray *NDPluginPva::binArray(NDArray *pArray, int binning)
+{
+    NDArrayInfo_t arrayInfo;
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pScratch = NULL;
+    NDArray *pOutput = NULL;
+    double scale = 1.;
+    double *pData;
+    size_t i;
+    int dim;
+
+    if ((binning <= 1) || !pArray->codec.empty()) {
+        pArray->reserve();
+        return pArray;
+    }
+
+    pArray->getInfo(&arrayInfo);
+    for (dim=0; dim<pArray->ndims; dim++) {
+        pArray->initDimension(&dims[dim], pArray->dims[dim].size);
+        if ((pArray->ndims == 3) && (arrayInfo.colorMode != NDColorModeMono) && (dim == arrayInfo.colorDim))
+            continue;
+        dims[dim].binning = (binning < (int)dims[dim].size) ? binning : (int)dims[dim].size;
+        scale *= dims[dim].binning;
+    }
+
+    /* Bin in double precision and divide by the number of elements in a bin, the same way
+     * NDPluginROI scales, so integer data neither overflows nor loses its fraction before rounding */
+    if (this->pNDArrayPool->convert(pArray, &pScratch, NDFloat64, dims)) return NULL;
+    pScratch->getInfo(&arrayInfo);
+    pData = (double *)pScratch->pData;
+    for (i=0; i<arrayInfo.nElements; i++) pData[i] /= scale;
+    this->pNDArrayPool->convert(pScratch, &pOutput, pArray->dataType);
+    pScratch->release();
+    return pOutput;
+}
+
+/** Returns the array to publish on one channel, with a reference held in channels[channel].
+  * An earlier channel with the same binning shares its binned array, and one that also has the
+  * same compression shares its output array, so each is only computed once per input array.
+  * \param[in] pArray   The input array.
+  * \param[in] channels The arrays of all the channels for this input array.
+  * \param[in] channel  The channel.
+  */
+NDArray *NDPluginPva::channelArray(NDArray *pArray, std::vector<NDPvaChannelArray_t>& channels, int channel)
+{
+    NDPvaChannelArray_t& ch = channels[channel];
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    char errorMessage[256] = "";
+    static const char *functionName = "channelArray";
+
+    for (int i=0; i<channel; i++) {
+        NDPvaChannelArray_t& other = channels[i];
+        if (!other.pBinned || (other.binning != ch.binning)) continue;
+        ch.pBinned = other.pBinned;
+        ch.pBinned->reserve();
+        if (other.pOutput && (other.compression == ch.compression) &&
+            ((ch.compression != NDPvaCompressJPEG) || (other.jpegQuality == ch.jpegQuality))) {
+            ch.pOutput = other.pOutput;
+            ch.pOutput->reserve();
+            return ch.pOutput;
+        }
+        break;
+    }
+
+    if (!ch.pBinned) ch.pBinned = binArray(pArray, ch.binning);
+    if (!ch.pBinned) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error binning array for channel %d\n",
+            driverName, functionName, channel);
+        return NULL;
+    }
+
+    if (!ch.pBinned->codec.empty()) {
+        ch.pOutput = ch.pBinned;
+        ch.pOutput->reserve();
+        return ch.pOutput;
+    }
+
+    switch (ch.compression) {
+        case NDPvaCompressJPEG:
+            ch.pOutput = compressJPEG(ch.pBinned, ch.jpegQuality, &codecStatus, errorMessage);
+            break;
+        case NDPvaCompressLZ4:
+            ch.pOutput = compressLZ4(ch.pBinned, 0, 1, &codecStatus, errorMessage, this->pNDArrayPool);
+            break;
+        case NDPvaCompressBSLZ4:
+            ch.pOutput = compressBSLZ4(ch.pBinned, 0, 1, &codecStatus, errorMessage, this->pNDArrayPool);
+            break;
+        default:
+            ch.pOutput = ch.pBinned;
+            ch.pOutput->reserve();
+            break;
+    }
+    if (!ch.pOutput) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error compressing array for channel %d: %s\n",
+            driverName, functionName, channel, errorMessage);
+    }
+    return ch.pOutput;
+}
+
+/** Publishes the array on each enabled channel that is not over its maximum rate.
+  * Called with the lock taken, which is released while the arrays are binned, compressed and converted.
+  * \param[in] pArray  The input array.
+  */
+void NDPluginPva::publishChannels(NDArray *pArray)
+{
+    int numChannels = (int)m_records.size();
+    std::vector<NDPvaChannelArray_t> channels(numChannels);
+    std::vector<bool> published(numChannels, false);
+    epicsTimeStamp now;
+    double maxRate;
+    int enable, counter;
+    int i;
+    static const char *functionName = "publishChannels";
+
+    epicsTimeGetCurrent(&now);
+    for (i=0; i<numChannels; i++) {
+        NDPvaChannelArray_t& ch = channels[i];
+        ch.publish = false;
+        ch.pBinned = NULL;
+        ch.pOutput = NULL;
+        getIntegerParam(i, NDPluginPvaEnable,      &enable);
+        getIntegerParam(i, NDPluginPvaBinning,     &ch.binning);
+        getIntegerParam(i, NDPluginPvaCompression, &ch.compression);
+        getIntegerParam(i, NDPluginPvaJPEGQuality, &ch.jpegQuality);
+        getDoubleParam (i, NDPluginPvaMaxRate,     &maxRate);
+        if (!enable) continue;
+        if ((maxRate > 0) && (epicsTimeDiffInSeconds(&now, &m_lastPublished[i]) < 1./maxRate)) {
+            getIntegerParam(i, NDPluginPvaSkippedArrays, &counter);
+            setIntegerParam(i, NDPluginPvaSkippedArrays, ++counter);
+            continue;
+        }
+        m_lastPublished[i] = now;
+        ch.publish = true;
+    }
+
+    this->unlock();
+    for (i=0; i<numChannels; i++) {
+        if (!channels[i].publish) continue;
+        NDArray *pOutput = channelArray(pArray, channels, i);
+        if (!pOutput) continue;
+        try {
+            m_records[i]->update(pOutput);
+            published[i] = true;
+        }
+        catch(std::exception& e) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error publishing array on channel %d: %s\n",
+                driverName, functionName, i, e.what());
+        }
+    }
+    for (i=0; i<numChannels; i++) {
+        if (channels[i].pOutput) channels[i].pOutput->release();
+        if (channels[i].pBinned) channels[i].pBinned->release();
+    }
+    this->lock();
+
+    for (i=0; i<numChannels; i++) {
+        if (!channels[i].publish) continue;
+        if (published[i]) {
+            getIntegerParam(i, NDPluginPvaArrayCounter, &counter);
+            setIntegerParam(i, NDPluginPvaArrayCounter, ++counter);
+        } else {
+            getIntegerParam(i, NDPluginPvaSkippedArrays, &counter);
+            setIntegerParam(i, NDPluginPvaSkippedArrays, ++counter);
+        }
+    }
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray
   * data.
   * \param[in] pArray  The NDArray from the callback.
@@ -111,19 +288,33 @@ void NDPluginPva::processCallbacks(NDArray *pArray)
         arrayCounter--;
         setIntegerParam(NDArrayCounter, arrayCounter);
     } else {
-        this->unlock();             // Function called with the lock taken
-        m_record->update(pArray);
-        this->lock();               // Must return locked
+        publishChannels(pArray);    // Function called with the lock taken, returns locked
     }
 
-    // Do NDArray callbacks.  We need to copy the array and get the attributes
-    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    // Do NDArray callbacks.  This plugin does not change the array, so downstream plugins get the
+    // input array itself with another reference, rather than a copy.  It is only copied if this plugin
+    // has attributes of its own to add, which must not change an array that other plugins share.
+    if (this->pAttributeList->count() == 0) {
+        pArray->reserve();
+        NDPluginDriver::endProcessCallbacks(pArray, false, false);
+    } else {
+        NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    }
 
-    callParamCallbacks();
+    for (int i=0; i<(int)m_records.size(); i++) callParamCallbacks(i);
+}
+
+/* Number of channels, one per name in the comma separated list of PV names */
+static int countPvNames(const char *pvName)
+{
+    int count = 1;
+    for (const char *p = pvName; *p; p++)
+        if (*p == ',') count++;
+    return count;
 }
 
 /** Constructor for NDPluginPva
-  * This plugin cannot block (ASYN_CANBLOCK=0) and is not multi-device (ASYN_MULTIDEVICE=0).
+  * This plugin cannot block (ASYN_CANBLOCK=0) and is multi-device (ASYN_MULTIDEVICE=1), with one address per channel.
   * \param[in] portName The name of the asyn port driver to be created.
   * \param[in] queueSize The number of NDArrays that the input queue for this
   *            plugin can hold when NDPluginDriverBlockingCallbacks=0.
@@ -139,6 +330,8 @@ void NDPluginPva::processCallbacks(NDArray *pArray)
   * \param[in] NDArrayAddr asyn port driver address for initial source of
   *            NDArray callbacks.
   * \param[in] pvName Name of the PV that will be served by the EPICSv4 server.
+  *            A comma separated list of names serves one channel per name, the first on asyn address 0,
+  *            the second on address 1, and so on.
   * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
   *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
   * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
@@ -153,29 +346,56 @@ NDPluginPva::NDPluginPva(const char *portName, int queueSize,
         const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize)
     /* Invoke the base class constructor */
     : NDPluginDriver(portName, queueSize, blockingCallbacks,
-            NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory, 0, 0,
-            0, 1, priority, stackSize, 1, true),
-            m_record(NTNDArrayRecord::create(pvName))
+            NDArrayPort, NDArrayAddr, countPvNames(pvName), maxBuffers, maxMemory, 0, 0,
+            ASYN_MULTIDEVICE, 1, priority, stackSize, 1, true)
 {
-    createParam(NDPluginPvaPvNameString, asynParamOctet, &NDPluginPvaPvName);
-
-    if(!m_record.get())
-        throw runtime_error("failed to create NTNDArrayRecord");
+    string names(pvName);
+    size_t start = 0, end;
+
+    createParam(NDPluginPvaPvNameString,        asynParamOctet,   &NDPluginPvaPvName);
+    createParam(NDPluginPvaEnableString,        asynParamInt32,   &NDPluginPvaEnable);
+    createParam(NDPluginPvaBinningString,       asynParamInt32,   &NDPluginPvaBinning);
+    createParam(NDPluginPvaCompressionString,   asynParamInt32,   &NDPluginPvaCompression);
+    createParam(NDPluginPvaJPEGQualityString,   asynParamInt32,   &NDPluginPvaJPEGQuality);
+    createParam(NDPluginPvaMaxRateString,       asynParamFloat64, &NDPluginPvaMaxRate);
+    createParam(NDPluginPvaArrayCounterString,  asynParamInt32,   &NDPluginPvaArrayCounter);
+    createParam(NDPluginPvaSkippedArraysString, asynParamInt32,   &NDPluginPvaSkippedArrays);
+
+    /* Create one record per channel */
+    do {
+        end = names.find(',', start);
+        string name(names.substr(start, end == string::npos ? string::npos : end - start));
+        NTNDArrayRecordPtr record(NTNDArrayRecord::create(name));
+        if(!record.get())
+            throw runtime_error("failed to create NTNDArrayRecord");
+
+        int addr = (int)m_records.size();
+        m_records.push_back(record);
+        setStringParam (addr, NDPluginPvaPvName,        name.c_str());
+        setIntegerParam(addr, NDPluginPvaEnable,        1);
+        setIntegerParam(addr, NDPluginPvaBinning,       1);
+        setIntegerParam(addr, NDPluginPvaCompression,   NDPvaCompressNone);
+        setIntegerParam(addr, NDPluginPvaJPEGQuality,   85);
+        setDoubleParam (addr, NDPluginPvaMaxRate,       0.);
+        setIntegerParam(addr, NDPluginPvaArrayCounter,  0);
+        setIntegerParam(addr, NDPluginPvaSkippedArrays, 0);
+        start = end + 1;
+    } while (end != string::npos);
+    m_lastPublished.resize(m_records.size());
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginPva");
 
-    /* Set PvName */
-    setStringParam(NDPluginPvaPvName, pvName);
-
     /* Try to connect to the NDArray port */
     connectToArrayPort();
 
     PVDatabasePtr master = PVDatabase::getMaster();
     ChannelProviderLocalPtr channelProvider = getChannelProviderLocal();
 
-    if(!master->addRecord(m_record))
-        throw runtime_error("couldn't add record to master database");
+    for (size_t i=0; i<m_records.size(); i++) {
+        if(!master->addRecord(m_records[i]))
+            throw runtime_error("couldn't add record to master database");
+    }
 }
 
 /* Configuration routine.  Called directly, or from the iocsh function */
@@ -7,14 +7,32 @@
 #include <pv/lock.h>
 #include <pv/pvData.h>
 #include <vector>
+#include <string>
 
-#define NDPluginPvaPvNameString "PV_NAME"
+#define NDPluginPvaPvNameString        "PV_NAME"            /* (asynOctet,   r/o) Name of the PV served by this channel */
+#define NDPluginPvaEnableString        "PVA_ENABLE"         /* (asynInt32,   r/w) Publish arrays on this channel */
+#define NDPluginPvaBinningString       "PVA_BINNING"        /* (asynInt32,   r/w) Binning of the X and Y dimensions for this channel */
+#define NDPluginPvaCompressionString   "PVA_COMPRESSION"    /* (asynInt32,   r/w) Compression for this channel, NDPvaCompression_t */
+#define NDPluginPvaJPEGQualityString   "PVA_JPEG_QUALITY"   /* (asynInt32,   r/w) JPEG quality when compression is JPEG */
+#define NDPluginPvaMaxRateString       "PVA_MAX_RATE"       /* (asynFloat64, r/w) Maximum arrays per second on this channel, 0=no limit */
+#define NDPluginPvaArrayCounterString  "PVA_ARRAY_COUNTER"  /* (asynInt32,   r/w) Number of arrays published on this channel */
+#define NDPluginPvaSkippedArraysString "PVA_SKIPPED_ARRAYS" /* (asynInt32,   r/w) Arrays not published because of MaxRate or an error */
+
+/** Compression of the arrays published on a channel */
+typedef enum {
+    NDPvaCompressNone,
+    NDPvaCompressJPEG,
+    NDPvaCompressLZ4,
+    NDPvaCompressBSLZ4
+} NDPvaCompression_t;
 
 class NTNDArrayRecord;
 typedef std::tr1::shared_ptr<NTNDArrayRecord> NTNDArrayRecordPtr;
 
 /** Converts NDArray callback data into EPICS V4 NTNDArray data and exposes it
-  * as an EPICS V4 PV  */
+  * as one or more EPICS V4 PVs.
+  * Each PV is a channel, with its own asyn address, that can bin and compress the arrays it publishes
+  * and limit their rate.  Channels with the same binning and compression share the same output array. */
 class NDPLUGIN_API NDPluginPva : public NDPluginDriver,
                      public std::tr1::enable_shared_from_this<NDPluginPva>
 {
@@ -29,9 +47,31 @@ public:
 
 protected:
     int NDPluginPvaPvName;
+    int NDPluginPvaEnable;
+    int NDPluginPvaBinning;
+    int NDPluginPvaCompression;
+    int NDPluginPvaJPEGQuality;
+    int NDPluginPvaMaxRate;
+    int NDPluginPvaArrayCounter;
+    int NDPluginPvaSkippedArrays;
 
 private:
-    NTNDArrayRecordPtr m_record;
+    /* The array published on one channel for the current input array */
+    typedef struct {
+        bool publish;
+        int binning;
+        int compression;
+        int jpegQuality;
+        NDArray *pBinned;
+        NDArray *pOutput;
+    } NDPvaChannelArray_t;
+
+    void publishChannels(NDArray *pArray);
+    NDArray *binArray(NDArray *pArray, int binning);
+    NDArray *channelArray(NDArray *pArray, std::vector<NDPvaChannelArray_t>& channels, int channel);
+
+    std::vector<NTNDArrayRecordPtr> m_records;
+    std::vector<epicsTimeStamp> m_lastPublished;
 };
 
 #endif
@@ -0,0 +1,243 @@
+/*
+ * NDPluginShmem.cpp
+ *
+ * Plugin that passes NDArrays to another process on the same host through a shared memory segment.
+ * Only a description of each array is written to the segment when the driver allocates its arrays from
+ * the segment with NDShmemUsePool, otherwise the data is copied into a slot of the segment once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <iocsh.h>
+
+#include "NDPluginShmem.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "NDPluginShmem";
+
+/** Publishes the array in the shared memory segment if a receiver is connected.
+  * \param[in] pArray The NDArray from the callback.
+  */
+void NDPluginShmem::processCallbacks(NDArray *pArray)
+{
+    int zeroCopyArrays, droppedOutputArrays;
+    bool zeroCopy = false;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "processCallbacks";
+
+    NDPluginDriver::beginProcessCallbacks(pArray);   // Base class method
+
+    if (shmem_.receiverConnected()) {
+        // This plugin has a single thread, which is the only one that publishes to the segment
+        this->unlock();
+        if ((pArray->pNDArrayPool == pShmemPool_) && (shmem_.publish(pArray) == asynSuccess)) {
+            zeroCopy = true;
+        } else {
+            NDArray *pShared = pShmemPool_->copy(pArray, NULL, true);
+            if (pShared) {
+                status = shmem_.publish(pShared);
+                pShared->release();
+            } else {
+                status = asynError;
+            }
+        }
+        this->lock();
+        if (status) {
+            getIntegerParam(NDPluginDriverDroppedOutputArrays, &droppedOutputArrays);
+            setIntegerParam(NDPluginDriverDroppedOutputArrays, ++droppedOutputArrays);
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s no free slot for array uniqueId=%d, or its attributes do not fit in the slot\n",
+                driverName, functionName, pArray->uniqueId);
+        } else if (zeroCopy) {
+            getIntegerParam(NDPluginShmemZeroCopyArrays, &zeroCopyArrays);
+            setIntegerParam(NDPluginShmemZeroCopyArrays, ++zeroCopyArrays);
+        }
+    }
+    setIntegerParam(NDPluginShmemReceiverConnected, shmem_.receiverConnected());
+    setIntegerParam(NDPluginShmemFreeSlots, shmem_.numFreeSlots());
+
+    // Do NDArray callbacks.  This plugin does not change the array, so downstream plugins get the
+    // input array itself with another reference, unless this plugin has attributes of its own to add.
+    if (this->pAttributeList->count() == 0) {
+        pArray->reserve();
+        NDPluginDriver::endProcessCallbacks(pArray, false, false);
+    } else {
+        NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    }
+
+    callParamCallbacks();
+}
+
+/** Return the pool that allocates the data of its arrays from the slots of the segment. */
+NDArrayShmemPool *NDPluginShmem::getShmemPool()
+{
+    return pShmemPool_;
+}
+
+/** Report status of the plugin.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then driver details are printed.
+  */
+void NDPluginShmem::report(FILE *fp, int details)
+{
+    fprintf(fp, "NDPluginShmem %s: segment=%s, slots=%d, free slots=%d, receiver connected=%d\n",
+            this->portName, shmem_.name(), shmem_.numSlots(), shmem_.numFreeSlots(),
+            shmem_.receiverConnected());
+    if (details > 0) {
+        fprintf(fp, "  Pool of arrays using the segment:\n");
+        pShmemPool_->report(fp, details);
+    }
+    /* Invoke the base class method */
+    NDPluginDriver::report(fp, details);
+}
+
+/** Constructor for NDPluginShmem; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * This plugin cannot block (ASYN_CANBLOCK=0) and is not multi-device (ASYN_MULTIDEVICE=0).
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] shmName Name of the shared memory segment, which the receiving process attaches to.
+  * \param[in] numSlots Number of slots in the segment, the most arrays that the two processes can use at once.
+  * \param[in] slotSize Bytes of array data in each slot, at least the size of the largest array.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginShmem::NDPluginShmem(const char *portName, int queueSize, int blockingCallbacks,
+                             const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                             int numSlots, size_t slotSize, int maxBuffers, size_t maxMemory,
+                             int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                     NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory, 0, 0,
+                     0, 1, priority, stackSize, 1, true)
+{
+    char errorMessage[256];
+    static const char *functionName = "NDPluginShmem";
+
+    createParam(NDPluginShmemNameString,              asynParamOctet, &NDPluginShmemName);
+    createParam(NDPluginShmemNumSlotsString,          asynParamInt32, &NDPluginShmemNumSlots);
+    createParam(NDPluginShmemSlotSizeString,          asynParamInt32, &NDPluginShmemSlotSize);
+    createParam(NDPluginShmemFreeSlotsString,         asynParamInt32, &NDPluginShmemFreeSlots);
+    createParam(NDPluginShmemReceiverConnectedString, asynParamInt32, &NDPluginShmemReceiverConnected);
+    createParam(NDPluginShmemZeroCopyArraysString,    asynParamInt32, &NDPluginShmemZeroCopyArrays);
+
+    if (shmem_.create(shmName, numSlots, slotSize, errorMessage, sizeof(errorMessage))) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s %s\n",
+            driverName, functionName, errorMessage);
+    }
+    pShmemPool_ = new NDArrayShmemPool(this, &shmem_, false);
+
+    setStringParam (NDPluginDriverPluginType,       "NDPluginShmem");
+    setStringParam (NDPluginShmemName,              shmName);
+    setIntegerParam(NDPluginShmemNumSlots,          shmem_.numSlots());
+    setIntegerParam(NDPluginShmemSlotSize,          (int)shmem_.slotBytes());
+    setIntegerParam(NDPluginShmemFreeSlots,         shmem_.numFreeSlots());
+    setIntegerParam(NDPluginShmemReceiverConnected, 0);
+    setIntegerParam(NDPluginShmemZeroCopyArrays,    0);
+
+    /* Try to connect to the NDArray port */
+    connectToArrayPort();
+}
+
+NDPluginShmem::~NDPluginShmem()
+{
+    shmem_.destroy();
+}
+
+/* Configuration routine.  Called directly, or from the iocsh function */
+extern "C" int NDShmemConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                                int numSlots, size_t slotSize, int maxBuffers, size_t maxMemory,
+                                int priority, int stackSize)
+{
+    NDPluginShmem *pPlugin = new NDPluginShmem(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                               shmName, numSlots, slotSize, maxBuffers, maxMemory,
+                                               priority, stackSize);
+    return pPlugin->start();
+}
+
+/** Make a driver allocate its arrays from the shared memory segment of an NDPluginShmem plugin,
+  * so that the plugin publishes them without copying them.
+  * Must be called before the driver allocates any arrays.
+  * \param[in] shmemPort The port name of the NDPluginShmem plugin.
+  * \param[in] driverPort The port name of the driver.
+  */
+extern "C" int NDShmemUsePool(const char *shmemPort, const char *driverPort)
+{
+    NDPluginShmem *pPlugin = dynamic_cast<NDPluginShmem *>((asynPortDriver *)findAsynPortDriver(shmemPort));
+    asynNDArrayDriver *pDriver = dynamic_cast<asynNDArrayDriver *>((asynPortDriver *)findAsynPortDriver(driverPort));
+
+    if (!pPlugin || !pDriver) {
+        printf("NDShmemUsePool: %s is not an NDPluginShmem port or %s is not an areaDetector driver port\n",
+               shmemPort, driverPort);
+        return asynError;
+    }
+    pDriver->pNDArrayPool = pPlugin->getShmemPool();
+    return asynSuccess;
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "shmName",iocshArgString};
+static const iocshArg initArg6 = { "numSlots",iocshArgInt};
+static const iocshArg initArg7 = { "slotSize",iocshArgInt};
+static const iocshArg initArg8 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg9 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg10 = { "priority",iocshArgInt};
+static const iocshArg initArg11 = { "stack size",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9,
+                                            &initArg10,
+                                            &initArg11};
+static const iocshFuncDef initFuncDef = {"NDShmemConfigure",12,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDShmemConfigure(args[0].sval, args[1].ival, args[2].ival,
+                     args[3].sval, args[4].ival, args[5].sval,
+                     args[6].ival, args[7].ival, args[8].ival,
+                     args[9].ival, args[10].ival, args[11].ival);
+}
+
+static const iocshArg usePoolArg0 = { "shmemPort",iocshArgString};
+static const iocshArg usePoolArg1 = { "driverPort",iocshArgString};
+static const iocshArg * const usePoolArgs[] = {&usePoolArg0,
+                                               &usePoolArg1};
+static const iocshFuncDef usePoolFuncDef = {"NDShmemUsePool",2,usePoolArgs};
+static void usePoolCallFunc(const iocshArgBuf *args)
+{
+    NDShmemUsePool(args[0].sval, args[1].sval);
+}
+
+extern "C" void NDShmemRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+    iocshRegister(&usePoolFuncDef,usePoolCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDShmemRegister);
+}
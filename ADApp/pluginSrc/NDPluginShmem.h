@@ -0,0 +1,45 @@
+#ifndef NDPluginShmem_H
+#define NDPluginShmem_H
+
+#include "NDPluginDriver.h"
+#include "NDArrayShmem.h"
+
+#define NDPluginShmemNameString              "SHMEM_NAME"               /* (asynOctet, r/o) Name of the shared memory segment */
+#define NDPluginShmemNumSlotsString          "SHMEM_NUM_SLOTS"          /* (asynInt32, r/o) Number of slots in the segment */
+#define NDPluginShmemSlotSizeString          "SHMEM_SLOT_SIZE"          /* (asynInt32, r/o) Bytes of array data in each slot */
+#define NDPluginShmemFreeSlotsString         "SHMEM_FREE_SLOTS"         /* (asynInt32, r/o) Slots used by neither process */
+#define NDPluginShmemReceiverConnectedString "SHMEM_RECEIVER_CONNECTED" /* (asynInt32, r/o) A receiver is attached to the segment */
+#define NDPluginShmemZeroCopyArraysString    "SHMEM_ZERO_COPY_ARRAYS"   /* (asynInt32, r/w) Arrays published without copying their data */
+
+/** Plugin that passes NDArrays to another process on the same host through a shared memory segment,
+  * where NDShmemSource does callbacks with them.
+  * Arrays from a driver whose pool allocates from the segment are published without copying them. */
+class NDPLUGIN_API NDPluginShmem : public NDPluginDriver {
+public:
+    NDPluginShmem(const char *portName, int queueSize, int blockingCallbacks,
+                  const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                  int numSlots, size_t slotSize, int maxBuffers, size_t maxMemory,
+                  int priority, int stackSize);
+    ~NDPluginShmem();
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    void report(FILE *fp, int details);
+
+    NDArrayShmemPool *getShmemPool();
+
+protected:
+    int NDPluginShmemName;
+    #define FIRST_NDPLUGIN_SHMEM_PARAM NDPluginShmemName
+    int NDPluginShmemNumSlots;
+    int NDPluginShmemSlotSize;
+    int NDPluginShmemFreeSlots;
+    int NDPluginShmemReceiverConnected;
+    int NDPluginShmemZeroCopyArrays;
+
+private:
+    NDArrayShmem shmem_;
+    NDArrayShmemPool *pShmemPool_;
+};
+
+#endif
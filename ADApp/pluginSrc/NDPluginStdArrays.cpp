@@ -10,6 +10,7 @@
  */
 
 #include <string.h>
+#include <limits>
 
 #include <iocsh.h>
 
@@ -19,9 +20,210 @@
 
 static const char *driverName="NDPluginStdArrays";
 
+/* Returns true if the data of an NDArray of type inType can be passed unchanged to an interface of type
+ * outputType, i.e. the types are the same or only differ in sign */
+static bool sameElementType(NDDataType_t inType, NDDataType_t outputType)
+{
+    if (inType == outputType) return true;
+    return (outputType <= NDInt64) && (inType == outputType + 1);
+}
+
+/* Returns the dimension of an NDArray that holds the colors, or -1 if it has none */
+static int getColorDim(NDArray *pArray)
+{
+    int colorMode = NDColorModeMono;
+    NDAttribute *pAttribute = pArray->pAttributeList->find("ColorMode");
+    if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
+    if (pArray->ndims != 3) return -1;
+    switch (colorMode) {
+        case NDColorModeRGB1: return 0;
+        case NDColorModeRGB2: return 1;
+        case NDColorModeRGB3: return 2;
+        default: return -1;
+    }
+}
+
+/* Bins an array of up to 3 dimensions with factors[i] input elements per output element in dimension i.
+ * Each output element is the input element at the centre of its bin, or the mean of the bin.
+ * The result is converted to the output type the same way as NDArrayPool::convert does, except that
+ * the mean keeps its fraction in floating point outputs. */
+template <typename epicsType, typename inType>
+static void decimateType(const inType *pIn, epicsType *pOut, const size_t *inDims, const size_t *outDims,
+                         const size_t *factors, bool mean)
+{
+    size_t f0 = factors[0], f1 = factors[1], f2 = factors[2];
+    size_t s0 = inDims[0], s1 = inDims[1];
+    double scale = 1.0 / (f0 * f1 * f2);
+
+    for (size_t z=0; z<outDims[2]; z++) {
+        for (size_t y=0; y<outDims[1]; y++) {
+            if (!mean) {
+                const inType *pRow = pIn + ((z*f2 + f2/2)*s1 + y*f1 + f1/2)*s0 + f0/2;
+                for (size_t x=0; x<outDims[0]; x++) {
+                    *pOut++ = (epicsType)pRow[x*f0];
+                }
+                continue;
+            }
+            for (size_t x=0; x<outDims[0]; x++) {
+                double sum = 0;
+                for (size_t k=0; k<f2; k++) {
+                    for (size_t j=0; j<f1; j++) {
+                        const inType *pBin = pIn + ((z*f2 + k)*s1 + y*f1 + j)*s0 + x*f0;
+                        for (size_t i=0; i<f0; i++) sum += pBin[i];
+                    }
+                }
+                // Integer outputs are converted from the input type, as NDArrayPool::convert does
+                if (std::numeric_limits<epicsType>::is_integer) *pOut++ = (epicsType)(inType)(sum * scale);
+                else *pOut++ = (epicsType)(sum * scale);
+            }
+        }
+    }
+}
+
+template <typename epicsType>
+static int decimateToType(NDArray *pIn, NDArray *pOut, const size_t *inDims, const size_t *outDims,
+                          const size_t *factors, bool mean)
+{
+    epicsType *pData = (epicsType *)pOut->pData;
+
+    switch (pIn->dataType) {
+        case NDInt8:
+            decimateType<epicsType, epicsInt8>((epicsInt8 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDUInt8:
+            decimateType<epicsType, epicsUInt8>((epicsUInt8 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDInt16:
+            decimateType<epicsType, epicsInt16>((epicsInt16 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDUInt16:
+            decimateType<epicsType, epicsUInt16>((epicsUInt16 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDInt32:
+            decimateType<epicsType, epicsInt32>((epicsInt32 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDUInt32:
+            decimateType<epicsType, epicsUInt32>((epicsUInt32 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDInt64:
+            decimateType<epicsType, epicsInt64>((epicsInt64 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDUInt64:
+            decimateType<epicsType, epicsUInt64>((epicsUInt64 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDFloat32:
+            decimateType<epicsType, epicsFloat32>((epicsFloat32 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        case NDFloat64:
+            decimateType<epicsType, epicsFloat64>((epicsFloat64 *)pIn->pData, pData, inDims, outDims, factors, mean);
+            break;
+        default:
+            return ND_ERROR;
+    }
+    return ND_SUCCESS;
+}
+
+/** Works out the decimation of an NDArray so it has no more than maxElements elements.
+  * The decimation is the smallest factor by which every dimension except the color dimension can be binned
+  * to bring the array within maxElements. Compressed arrays and arrays with more than 3 dimensions are
+  * not decimated.
+  * \param[in] pArray The NDArray.
+  * \param[in] maxElements Maximum number of elements, 0 for no limit.
+  * \param[out] outDims Dimensions of the decimated array.
+  * \return The decimation, 1 if the array is not decimated. */
+int NDPluginStdArrays::getDecimation(NDArray *pArray, int maxElements, size_t *outDims)
+{
+    NDArrayInfo_t arrayInfo;
+    int colorDim = getColorDim(pArray);
+    int decimation = 1;
+    size_t maxSize = 1;
+    int i;
+
+    for (i=0; i<pArray->ndims; i++) {
+        outDims[i] = pArray->dims[i].size;
+        if (outDims[i] > maxSize) maxSize = outDims[i];
+    }
+    pArray->getInfo(&arrayInfo);
+    if ((maxElements <= 0) || !pArray->codec.empty() || (pArray->ndims > 3) ||
+        (arrayInfo.nElements <= (size_t)maxElements)) return 1;
+
+    for (decimation=2; decimation<=(int)maxSize; decimation++) {
+        size_t numElements = 1;
+        for (i=0; i<pArray->ndims; i++) {
+            size_t size = pArray->dims[i].size;
+            if (i != colorDim) size = size / decimation;
+            if (size < 1) size = 1;
+            outDims[i] = size;
+            numElements *= size;
+        }
+        if (numElements <= (size_t)maxElements) break;
+    }
+    return decimation;
+}
+
+/** Allocates an NDArray of the output type and fills it with the decimated data of an NDArray,
+  * converting the data type in the same pass.
+  * \param[in] pArray The NDArray to decimate.
+  * \param[in] outputType The data type of the output array.
+  * \param[in] decimation The decimation from getDecimation.
+  * \param[in] decimateMode NDPluginStdArraysDecimateMode_t.
+  * \param[out] ppOutput The decimated array. */
+int NDPluginStdArrays::decimateArray(NDArray *pArray, NDDataType_t outputType, int decimation, int decimateMode,
+                                     NDArray **ppOutput)
+{
+    size_t inDims[3] = {1, 1, 1}, outDims[3] = {1, 1, 1}, factors[3] = {1, 1, 1};
+    int colorDim = getColorDim(pArray);
+    bool mean = (decimateMode == NDPluginStdArraysDecimateMean);
+    NDArray *pOutput;
+    int status;
+    int i;
+
+    for (i=0; i<pArray->ndims; i++) {
+        inDims[i] = pArray->dims[i].size;
+        factors[i] = (i == colorDim) ? 1 : decimation;
+        if (factors[i] > inDims[i]) factors[i] = inDims[i];
+        outDims[i] = inDims[i] / factors[i];
+    }
+    pOutput = this->pNDArrayPool->alloc(pArray->ndims, outDims, outputType, 0, NULL);
+    if (!pOutput) return ND_ERROR;
+    switch (outputType) {
+        case NDInt8:
+            status = decimateToType<epicsInt8>(pArray, pOutput, inDims, outDims, factors, mean);
+            break;
+        case NDInt16:
+            status = decimateToType<epicsInt16>(pArray, pOutput, inDims, outDims, factors, mean);
+            break;
+        case NDInt32:
+            status = decimateToType<epicsInt32>(pArray, pOutput, inDims, outDims, factors, mean);
+            break;
+        case NDInt64:
+            status = decimateToType<epicsInt64>(pArray, pOutput, inDims, outDims, factors, mean);
+            break;
+        case NDFloat32:
+            status = decimateToType<epicsFloat32>(pArray, pOutput, inDims, outDims, factors, mean);
+            break;
+        case NDFloat64:
+            status = decimateToType<epicsFloat64>(pArray, pOutput, inDims, outDims, factors, mean);
+            break;
+        default:
+            status = ND_ERROR;
+            break;
+    }
+    if (status) {
+        pOutput->release();
+        return status;
+    }
+    pOutput->uniqueId = pArray->uniqueId;
+    pOutput->timeStamp = pArray->timeStamp;
+    pOutput->epicsTS = pArray->epicsTS;
+    *ppOutput = pOutput;
+    return ND_SUCCESS;
+}
+
 template <typename epicsType, typename interruptType>
 void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pNDArrayPool,
-                            void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled)
+                            void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled,
+                            int decimation, int decimateMode)
 {
     ELLLIST *pclientList;
     interruptNode *pnode;
@@ -40,7 +242,26 @@ void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pND
             if (!*initialized) {
                 *initialized = 1;
                 pArray->getInfo(&arrayInfo);
-                if (pArray->codec.empty()) {
+                if (!pArray->codec.empty()) {
+                    // Need to handle compressed arrays differently
+                    pData = (epicsType *)pArray->pData;
+                    numElements = (pArray->compressedSize / arrayInfo.bytesPerElement) + 1;
+                } else if (decimation > 1) {
+                    status = this->decimateArray(pArray, signedType, decimation, decimateMode, &pOutput);
+                    if (status) {
+                        asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
+                                  "%s::arrayInterruptCallback: error allocating array in decimateArray()\n",
+                                   driverName);
+                        break;
+                    }
+                    pOutput->getInfo(&arrayInfo);
+                    pData = (epicsType *)pOutput->pData;
+                    numElements = arrayInfo.nElements;
+                } else if (sameElementType(pArray->dataType, signedType)) {
+                    // The clients copy the data, so they can be given the NDArray data itself
+                    pData = (epicsType *)pArray->pData;
+                    numElements = arrayInfo.nElements;
+                } else {
                     status = pNDArrayPool->convert(pArray, &pOutput, signedType);
                     if (status) {
                         asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
@@ -50,13 +271,9 @@ void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pND
                     }
                     pData = (epicsType *)pOutput->pData;
                     numElements = arrayInfo.nElements;
-                } else {
-                    // Need to handle compressed arrays differently
-                    pData = (epicsType *)pArray->pData;
-                    numElements = (pArray->compressedSize / arrayInfo.bytesPerElement) + 1;
                 }
             }
-            if (throttled(pOutput)) {
+            if (throttled(pOutput ? pOutput : pArray)) {
                 int droppedOutputArrays;
                 *wasThrottled = true;
                 getIntegerParam(NDPluginDriverDroppedOutputArrays, &droppedOutputArrays);
@@ -85,6 +302,8 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
     asynStatus status = asynSuccess;
     NDArray *pOutput, *myArray;
     NDArrayInfo_t arrayInfo;
+    size_t outDims[ND_ARRAY_MAX_DIMS];
+    int maxElements, decimateMode, decimation;
 
     myArray = this->pArrays[0];
     if (command == NDPluginStdArraysData) {
@@ -94,20 +313,30 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
             status = asynError;
             goto done;
         }
-        myArray->getInfo(&arrayInfo);
         if (myArray->codec.empty()) {
-            if (arrayInfo.nElements > nElements) {
-                /* We have been requested fewer pixels than we have.
-                 * Just pass the first nElements. */
-                 arrayInfo.nElements = nElements;
+            getIntegerParam(NDPluginStdArraysMaxElements, &maxElements);
+            getIntegerParam(NDPluginStdArraysDecimateMode, &decimateMode);
+            decimation = this->getDecimation(myArray, maxElements, outDims);
+            if (decimation > 1) {
+                status = (asynStatus)this->decimateArray(myArray, outputType, decimation, decimateMode, &pOutput);
+            } else if (sameElementType(myArray->dataType, outputType)) {
+                pOutput = myArray;
+                pOutput->reserve();
+            } else {
+                status = (asynStatus)this->pNDArrayPool->convert(myArray, &pOutput, outputType);
             }
-            status = (asynStatus)this->pNDArrayPool->convert(myArray, &pOutput, outputType);
             if (status) {
                 asynPrint(pasynUser, ASYN_TRACE_ERROR,
                           "%s::readArray: error allocating array in convert()\n",
                            driverName);
                goto done;
             }
+            pOutput->getInfo(&arrayInfo);
+            if (arrayInfo.nElements > nElements) {
+                /* We have been requested fewer pixels than we have.
+                 * Just pass the first nElements. */
+                 arrayInfo.nElements = nElements;
+            }
             /* Copy the data */
             *nIn = arrayInfo.nElements;
             memcpy(value, pOutput->pData, *nIn*sizeof(epicsType));
@@ -154,6 +383,9 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
     int float64Initialized=0;
     bool wasThrottled=false;
     NDArrayInfo_t arrayInfo;
+    size_t outDims[ND_ARRAY_MAX_DIMS];
+    int maxElements, decimateMode, decimation;
+    int i, size, dimsChanged;
     asynStandardInterfaces *pInterfaces = this->getAsynStdInterfaces();
     /* static const char* functionName = "processCallbacks"; */
 
@@ -162,6 +394,27 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
 
     pArray->getInfo(&arrayInfo);
 
+    getIntegerParam(NDPluginStdArraysMaxElements, &maxElements);
+    getIntegerParam(NDPluginStdArraysDecimateMode, &decimateMode);
+    decimation = this->getDecimation(pArray, maxElements, outDims);
+    setIntegerParam(NDPluginStdArraysDecimation, decimation);
+
+    /* NDDimensions gives clients the dimensions of the waveform data, which are those of the decimated array.
+     * Do the callbacks if they differ from the ones last given, including those given by beginProcessCallbacks */
+    for (i=0, dimsChanged=0; i<ND_ARRAY_MAX_DIMS; i++) {
+        size = (i < pArray->ndims) ? (int)pArray->dims[i].size : 0;
+        if (size != this->dimsIn_[i]) {
+            this->dimsIn_[i] = size;
+            if (decimation > 1) dimsChanged = 1;
+        }
+        if ((decimation > 1) && (i < pArray->ndims)) size = (int)outDims[i];
+        if (size != this->dimsOut_[i]) dimsChanged = 1;
+        this->dimsOut_[i] = size;
+    }
+    if (dimsChanged) {
+        doCallbacksInt32Array(this->dimsOut_, ND_ARRAY_MAX_DIMS, NDDimensions, 0);
+    }
+
     /* This function is called with the lock taken, and it must be set when we exit.
      * The following code can be exected without the mutex because we are not accessing pPvt */
     this->unlock();
@@ -169,32 +422,38 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
     /* Pass interrupts for int8Array data*/
     arrayInterruptCallback<epicsInt8, asynInt8ArrayInterrupt>(pArray, this->pNDArrayPool,
                              pInterfaces->int8ArrayInterruptPvt,
-                             &int8Initialized, NDInt8, &wasThrottled);
+                             &int8Initialized, NDInt8, &wasThrottled,
+                             decimation, decimateMode);
 
     /* Pass interrupts for int16Array data*/
     arrayInterruptCallback<epicsInt16,  asynInt16ArrayInterrupt>(pArray, this->pNDArrayPool,
                              pInterfaces->int16ArrayInterruptPvt,
-                             &int16Initialized, NDInt16, &wasThrottled);
+                             &int16Initialized, NDInt16, &wasThrottled,
+                             decimation, decimateMode);
 
     /* Pass interrupts for int32Array data*/
     arrayInterruptCallback<epicsInt32, asynInt32ArrayInterrupt>(pArray, this->pNDArrayPool,
                              pInterfaces->int32ArrayInterruptPvt,
-                             &int32Initialized, NDInt32, &wasThrottled);
+                             &int32Initialized, NDInt32, &wasThrottled,
+                             decimation, decimateMode);
 
     /* Pass interrupts for int64Array data*/
     arrayInterruptCallback<epicsInt64, asynInt64ArrayInterrupt>(pArray, this->pNDArrayPool,
                              pInterfaces->int64ArrayInterruptPvt,
-                             &int64Initialized, NDInt64, &wasThrottled);
+                             &int64Initialized, NDInt64, &wasThrottled,
+                             decimation, decimateMode);
 
     /* Pass interrupts for float32Array data*/
     arrayInterruptCallback<epicsFloat32, asynFloat32ArrayInterrupt>(pArray, this->pNDArrayPool,
                              pInterfaces->float32ArrayInterruptPvt,
-                             &float32Initialized, NDFloat32, &wasThrottled);
+                             &float32Initialized, NDFloat32, &wasThrottled,
+                             decimation, decimateMode);
 
     /* Pass interrupts for float64Array data*/
     arrayInterruptCallback<epicsFloat64, asynFloat64ArrayInterrupt>(pArray, this->pNDArrayPool,
                              pInterfaces->float64ArrayInterruptPvt,
-                             &float64Initialized, NDFloat64, &wasThrottled);
+                             &float64Initialized, NDFloat64, &wasThrottled,
+                             decimation, decimateMode);
 
     /* We must exit with the mutex locked */
     this->lock();
@@ -333,10 +592,20 @@ NDPluginStdArrays::NDPluginStdArrays(const char *portName, int queueSize, int bl
 {
     //static const char *functionName = "NDPluginStdArrays";
 
-    createParam(NDPluginStdArraysDataString, asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysDataString,         asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysMaxElementsString,  asynParamInt32,          &NDPluginStdArraysMaxElements);
+    createParam(NDPluginStdArraysDecimateModeString, asynParamInt32,          &NDPluginStdArraysDecimateMode);
+    createParam(NDPluginStdArraysDecimationString,   asynParamInt32,          &NDPluginStdArraysDecimation);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginStdArrays");
+    setIntegerParam(NDPluginStdArraysMaxElements, 0);
+    setIntegerParam(NDPluginStdArraysDecimateMode, NDPluginStdArraysDecimateNearest);
+    setIntegerParam(NDPluginStdArraysDecimation, 1);
+    for (int i=0; i<ND_ARRAY_MAX_DIMS; i++) {
+        this->dimsIn_[i] = 0;
+        this->dimsOut_[i] = 0;
+    }
 
     // Disable ArrayCallbacks.
     // This plugin currently does not do array callbacks, so make the setting reflect the behavior
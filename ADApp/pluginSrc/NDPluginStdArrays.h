@@ -3,12 +3,25 @@
 
 #include "NDPluginDriver.h"
 
-#define NDPluginStdArraysDataString "STD_ARRAY_DATA"           /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysDataString         "STD_ARRAY_DATA"          /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysMaxElementsString  "STD_ARRAY_MAX_ELEMENTS"  /* (asynInt32, r/w) Arrays with more elements are decimated, 0 for no limit */
+#define NDPluginStdArraysDecimateModeString "STD_ARRAY_DECIMATE_MODE" /* (asynInt32, r/w) NDPluginStdArraysDecimateMode_t */
+#define NDPluginStdArraysDecimationString   "STD_ARRAY_DECIMATION"    /* (asynInt32, r/o) Decimation of the last array, 1 if it was not decimated */
+
+/** How arrays larger than NDPluginStdArraysMaxElements are decimated */
+typedef enum {
+    NDPluginStdArraysDecimateNearest,   /**< Each output element is the input element at the centre of its bin */
+    NDPluginStdArraysDecimateMean       /**< Each output element is the mean of its bin */
+} NDPluginStdArraysDecimateMode_t;
 
 /** Converts NDArray callback data into standard asyn arrays (asynInt8Array, asynInt16Array, asynInt32Array, asynInt64Array,
   * asynFloat32Array or asynFloat64Array); normally used for putting NDArray data in EPICS waveform records.
   * It handles the data type conversion if the NDArray data type differs from the data type of the asyn interface.
-  * It flattens the NDArrays to a single dimension because asyn and EPICS do not support multi-dimensional arrays. */
+  * It flattens the NDArrays to a single dimension because asyn and EPICS do not support multi-dimensional arrays.
+  * If the NDArray data type already matches the asyn interface the NDArray data is passed without a copy.
+  * Arrays with more than NDPluginStdArraysMaxElements elements are binned by the same integer factor in every
+  * dimension except the color dimension, in the same pass as the data type conversion, for display clients
+  * that do not need the full resolution. */
 class NDPLUGIN_API NDPluginStdArrays : public NDPluginDriver {
 public:
     NDPluginStdArrays(const char *portName, int queueSize, int blockingCallbacks,
@@ -32,14 +45,22 @@ public:
 protected:
     int NDPluginStdArraysData;
     #define FIRST_NDPLUGIN_STDARRAYS_PARAM NDPluginStdArraysData
+    int NDPluginStdArraysMaxElements;
+    int NDPluginStdArraysDecimateMode;
+    int NDPluginStdArraysDecimation;
 private:
     /* These methods are just for this class */
     template <typename epicsType> asynStatus readArray(asynUser *pasynUser, epicsType *value,
                                         size_t nElements, size_t *nIn, NDDataType_t outputType);
     template <typename epicsType, typename interruptType> void arrayInterruptCallback(NDArray *pArray,
                             NDArrayPool *pNDArrayPool,
-                            void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled);
+                            void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled,
+                            int decimation, int decimateMode);
+    int getDecimation(NDArray *pArray, int maxElements, size_t *outDims);
+    int decimateArray(NDArray *pArray, NDDataType_t outputType, int decimation, int decimateMode, NDArray **ppOutput);
 
+    int dimsIn_[ND_ARRAY_MAX_DIMS];   /* Dimensions of the last NDArray */
+    int dimsOut_[ND_ARRAY_MAX_DIMS];  /* Dimensions of the waveform data given to clients in NDDimensions */
 };
 
 #endif
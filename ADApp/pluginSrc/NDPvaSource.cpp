@@ -0,0 +1,346 @@
+/*
+ * NDPvaSource.cpp
+ *
+ * Driver that converts the updates of an NTNDArray PV into NDArrays, so that the plugins of one
+ * IOC can process the arrays published by NDPluginPva in another.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsThread.h>
+#include <iocsh.h>
+
+#include <pv/nt.h>
+
+#include "NDPvaSource.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "NDPvaSource";
+
+using namespace epics::pvData;
+using namespace epics::nt;
+using std::string;
+
+static void pvaTaskC(void *drvPvt)
+{
+    NDPvaSource *pPvt = (NDPvaSource *)drvPvt;
+
+    pPvt->pvaTask();
+}
+
+/** Constructor for NDPvaSource.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] pvName The name of the NTNDArray PV to monitor.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  *            Arrays that use the received data without copying it are not counted.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPvaSource::NDPvaSource(const char *portName, const char *pvName, int maxBuffers, size_t maxMemory,
+                         int priority, int stackSize)
+    : ADDriver(portName, 1, 0, maxBuffers, maxMemory,
+               0, 0,        /* No interfaces beyond those set in ADDriver.cpp */
+               0, 1,        /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
+               priority, stackSize),
+      m_provider("pva"),
+      m_importPool(new NTNDArrayPool(this, 0)),
+      m_reconnect(true)
+{
+    static const char *functionName = "NDPvaSource";
+
+    createParam(NDPvaSourcePvNameString,    asynParamOctet, &NDPvaSourcePvName);
+    createParam(NDPvaSourceConnectedString, asynParamInt32, &NDPvaSourceConnected);
+    createParam(NDPvaSourceZeroCopyString,  asynParamInt32, &NDPvaSourceZeroCopy);
+    createParam(NDPvaSourceOverrunsString,  asynParamInt32, &NDPvaSourceOverruns);
+
+    setStringParam (ADManufacturer,       "EPICS");
+    setStringParam (ADModel,              "NTNDArray");
+    setStringParam (NDPvaSourcePvName,    pvName);
+    setIntegerParam(NDPvaSourceConnected, 0);
+    setIntegerParam(NDPvaSourceZeroCopy,  1);
+    setIntegerParam(NDPvaSourceOverruns,  0);
+    setIntegerParam(ADStatus,             ADStatusIdle);
+
+    if (epicsThreadCreate("NDPvaSourceTask",
+                          epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)pvaTaskC, this) == NULL) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s epicsThreadCreate failure for pvaTask\n",
+            driverName, functionName);
+    }
+}
+
+/** Converts one update of the PV into an NDArray and does the callbacks with it if acquiring.
+  * Called without the lock taken.
+  * \param[in] root The structure of the PV.
+  * \param[in] overrun Updates were dropped before this one.
+  */
+void NDPvaSource::processUpdate(const PVStructure::const_shared_pointer& root, bool overrun)
+{
+    int acquire, zeroCopy, counter, numImagesCounter;
+    int imageMode, numImages, arrayCallbacks;
+    NDArray *pArray = NULL;
+    NDArrayInfo_t arrayInfo;
+    static const char *functionName = "processUpdate";
+
+    this->lock();
+    if (overrun) {
+        getIntegerParam(NDPvaSourceOverruns, &counter);
+        setIntegerParam(NDPvaSourceOverruns, ++counter);
+    }
+    getIntegerParam(ADAcquire,           &acquire);
+    getIntegerParam(NDPvaSourceZeroCopy, &zeroCopy);
+    this->unlock();
+
+    if (acquire) {
+        try {
+            NTNDArrayPtr ntndArray(NTNDArray::wrap(std::tr1::const_pointer_cast<PVStructure>(root)));
+            if (!ntndArray)
+                throw std::runtime_error("PV is not an NTNDArray");
+            NTNDArrayConverter converter(ntndArray);
+            if (zeroCopy) {
+                pArray = converter.toArray(m_importPool);
+            } else {
+                NTNDArrayInfo_t info = converter.getInfo();
+                pArray = this->pNDArrayPool->alloc(info.ndims, info.dims, info.dataType, 0, NULL);
+                if (!pArray)
+                    throw std::runtime_error("failed to allocate NDArray");
+                pArray->pAttributeList->clear();
+                converter.toArray(pArray);
+            }
+        }
+        catch(std::exception& e) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error converting update: %s\n",
+                driverName, functionName, e.what());
+            if (pArray) pArray->release();
+            pArray = NULL;
+        }
+    }
+
+    this->lock();
+    if (pArray) {
+        getIntegerParam(NDArrayCounter, &counter);
+        setIntegerParam(NDArrayCounter, ++counter);
+        getIntegerParam(ADNumImagesCounter, &numImagesCounter);
+        setIntegerParam(ADNumImagesCounter, ++numImagesCounter);
+
+        pArray->getInfo(&arrayInfo);
+        setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
+        setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+        setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+        setIntegerParam(NDArraySizeZ, (int)arrayInfo.colorSize);
+        setIntegerParam(NDDataType,   pArray->dataType);
+        setIntegerParam(NDColorMode,  arrayInfo.colorMode);
+
+        /* Add the attributes of this driver to those received with the array */
+        this->getAttributes(pArray->pAttributeList);
+
+        getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+        if (arrayCallbacks) {
+            doCallbacksGenericPointer(pArray, NDArrayData, 0);
+        }
+        if (this->pArrays[0]) this->pArrays[0]->release();
+        this->pArrays[0] = pArray;
+
+        getIntegerParam(ADImageMode, &imageMode);
+        getIntegerParam(ADNumImages, &numImages);
+        if ((imageMode == ADImageSingle) ||
+            ((imageMode == ADImageMultiple) && (numImagesCounter >= numImages))) {
+            setIntegerParam(ADAcquire, 0);
+            setIntegerParam(ADStatus, ADStatusIdle);
+            setStringParam(ADStatusMessage, "Acquisition complete");
+        }
+    }
+    callParamCallbacks();
+    this->unlock();
+}
+
+/** Monitors the PV, and reconnects whenever the PV name changes. */
+void NDPvaSource::pvaTask()
+{
+    pvac::MonitorSync monitor;
+    bool haveMonitor = false;
+    string pvName;
+    static const char *functionName = "pvaTask";
+
+    while (1) {
+        this->lock();
+        bool reconnect = m_reconnect;
+        m_reconnect = false;
+        if (reconnect) {
+            getStringParam(NDPvaSourcePvName, pvName);
+            setIntegerParam(NDPvaSourceConnected, 0);
+            callParamCallbacks();
+        }
+        this->unlock();
+
+        if (reconnect) {
+            monitor = pvac::MonitorSync();
+            haveMonitor = false;
+            if (!pvName.empty()) {
+                try {
+                    monitor = m_provider.connect(pvName).monitor();
+                    haveMonitor = true;
+                }
+                catch(std::exception& e) {
+                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                        "%s::%s error monitoring %s: %s\n",
+                        driverName, functionName, pvName.c_str(), e.what());
+                }
+            }
+        }
+
+        if (!haveMonitor) {
+            epicsThreadSleep(0.1);
+            continue;
+        }
+        if (!monitor.wait(0.1))
+            continue;
+
+        switch (monitor.event.event) {
+        case pvac::MonitorEvent::Data:
+            this->lock();
+            setIntegerParam(NDPvaSourceConnected, 1);
+            this->unlock();
+            while (monitor.poll())
+                processUpdate(monitor.root, !monitor.overrun.isEmpty());
+            break;
+        case pvac::MonitorEvent::Disconnect:
+        case pvac::MonitorEvent::Fail:
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s monitor of %s disconnected: %s\n",
+                driverName, functionName, pvName.c_str(), monitor.event.message.c_str());
+            this->lock();
+            setIntegerParam(NDPvaSourceConnected, 0);
+            callParamCallbacks();
+            this->unlock();
+            break;
+        case pvac::MonitorEvent::Cancel:
+        default:
+            break;
+        }
+    }
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPvaSource::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    status = setIntegerParam(function, value);
+
+    if (function == ADAcquire) {
+        if (value) {
+            setIntegerParam(ADNumImagesCounter, 0);
+            setIntegerParam(ADStatus, ADStatusAcquire);
+            setStringParam(ADStatusMessage, "Acquiring");
+        } else {
+            setIntegerParam(ADStatus, ADStatusIdle);
+            setStringParam(ADStatusMessage, "Acquisition stopped");
+        }
+    } else if (function < FIRST_NDPVA_SOURCE_PARAM) {
+        status = ADDriver::writeInt32(pasynUser, value);
+    }
+
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s::%s error, status=%d function=%d, value=%d\n",
+              driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s::%s function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Called when asyn clients call pasynOctet->write().
+  * Writing the PV name reconnects the monitor to the new PV.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDPvaSource::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+
+    if (function == NDPvaSourcePvName) {
+        status = setStringParam(function, value);
+        m_reconnect = true;
+        callParamCallbacks();
+        *nActual = nChars;
+        return status;
+    }
+    return ADDriver::writeOctet(pasynUser, value, nChars, nActual);
+}
+
+/** Report status of the driver.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then driver details are printed.
+  */
+void NDPvaSource::report(FILE *fp, int details)
+{
+    string pvName;
+    int connected;
+
+    getStringParam(NDPvaSourcePvName, pvName);
+    getIntegerParam(NDPvaSourceConnected, &connected);
+    fprintf(fp, "NDPvaSource %s: PV=%s, connected=%d\n", this->portName, pvName.c_str(), connected);
+    if (details > 0) {
+        fprintf(fp, "  Pool of arrays using received data:\n");
+        m_importPool->report(fp, details);
+    }
+    /* Invoke the base class method */
+    ADDriver::report(fp, details);
+}
+
+/* Configuration routine.  Called directly, or from the iocsh function */
+extern "C" int NDPvaSourceConfig(const char *portName, const char *pvName, int maxBuffers, size_t maxMemory,
+                                 int priority, int stackSize)
+{
+    new NDPvaSource(portName, pvName, maxBuffers, maxMemory, priority, stackSize);
+    return asynSuccess;
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "pvName",iocshArgString};
+static const iocshArg initArg2 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg3 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg4 = { "priority",iocshArgInt};
+static const iocshArg initArg5 = { "stack size",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5};
+static const iocshFuncDef initFuncDef = {"NDPvaSourceConfig",6,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDPvaSourceConfig(args[0].sval, args[1].sval, args[2].ival,
+                      args[3].ival, args[4].ival, args[5].ival);
+}
+
+extern "C" void NDPvaSourceRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDPvaSourceRegister);
+}
@@ -0,0 +1,51 @@
+#ifndef NDPvaSource_H
+#define NDPvaSource_H
+
+#include <string>
+
+#include <epicsThread.h>
+#include <pv/pvData.h>
+#include <pva/client.h>
+
+#include <ntndArrayConverter.h>
+
+#include "ADDriver.h"
+#include <NDPluginAPI.h>
+
+#define NDPvaSourcePvNameString    "PVA_SOURCE_PV_NAME"    /* (asynOctet, r/w) Name of the NTNDArray PV to monitor */
+#define NDPvaSourceConnectedString "PVA_SOURCE_CONNECTED"  /* (asynInt32, r/o) The monitor of the PV is connected */
+#define NDPvaSourceZeroCopyString  "PVA_SOURCE_ZERO_COPY"  /* (asynInt32, r/w) NDArrays use the received data without copying it */
+#define NDPvaSourceOverrunsString  "PVA_SOURCE_OVERRUNS"   /* (asynInt32, r/w) Number of updates that followed dropped updates */
+
+/** Driver that monitors an NTNDArray PV, for example one served by NDPluginPva in another IOC,
+  * and does callbacks with an NDArray for each update while acquiring.
+  * By default the NDArrays use the data received by pvAccess rather than a copy of it. */
+class NDPLUGIN_API NDPvaSource : public ADDriver
+{
+public:
+    NDPvaSource(const char *portName, const char *pvName, int maxBuffers, size_t maxMemory,
+                int priority, int stackSize);
+
+    /* These are the methods that we override from ADDriver */
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+    virtual void report(FILE *fp, int details);
+
+    void pvaTask();  /**< Should be private, but gets called from C, so must be public */
+
+protected:
+    int NDPvaSourcePvName;
+    #define FIRST_NDPVA_SOURCE_PARAM NDPvaSourcePvName
+    int NDPvaSourceConnected;
+    int NDPvaSourceZeroCopy;
+    int NDPvaSourceOverruns;
+
+private:
+    void processUpdate(const epics::pvData::PVStructure::const_shared_pointer& root, bool overrun);
+
+    pvac::ClientProvider m_provider;
+    NTNDArrayPool *m_importPool;
+    bool m_reconnect;
+};
+
+#endif
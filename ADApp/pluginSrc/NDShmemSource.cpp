@@ -0,0 +1,352 @@
+/*
+ * NDShmemSource.cpp
+ *
+ * Driver that does callbacks with the NDArrays that NDPluginShmem in another process on the same host
+ * publishes in a shared memory segment, so that acquisition and analysis can run in separate IOCs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsThread.h>
+#include <iocsh.h>
+
+#include "NDShmemSource.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "NDShmemSource";
+
+/* Time to wait when no array has been published, and between attempts to attach to the segment */
+#define POLL_TIME 0.001
+#define ATTACH_RETRY_TIME 1.0
+
+using std::string;
+
+static void shmemTaskC(void *drvPvt)
+{
+    NDShmemSource *pPvt = (NDShmemSource *)drvPvt;
+
+    pPvt->shmemTask();
+}
+
+/** Constructor for NDShmemSource.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] shmName The name of the shared memory segment created by NDPluginShmem.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  *            Arrays that use the data in the segment without copying it are not counted.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDShmemSource::NDShmemSource(const char *portName, const char *shmName, int maxBuffers, size_t maxMemory,
+                             int priority, int stackSize)
+    : ADDriver(portName, 1, 0, maxBuffers, maxMemory,
+               0, 0,        /* No interfaces beyond those set in ADDriver.cpp */
+               0, 1,        /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
+               priority, stackSize),
+      m_reconnect(true)
+{
+    static const char *functionName = "NDShmemSource";
+
+    m_segment.pShmem = NULL;
+    m_segment.pPool = NULL;
+
+    createParam(NDShmemSourceNameString,      asynParamOctet, &NDShmemSourceName);
+    createParam(NDShmemSourceConnectedString, asynParamInt32, &NDShmemSourceConnected);
+    createParam(NDShmemSourceZeroCopyString,  asynParamInt32, &NDShmemSourceZeroCopy);
+    createParam(NDShmemSourceDroppedString,   asynParamInt32, &NDShmemSourceDropped);
+
+    setStringParam (ADManufacturer,         "EPICS");
+    setStringParam (ADModel,                "Shared memory");
+    setStringParam (NDShmemSourceName,      shmName);
+    setIntegerParam(NDShmemSourceConnected, 0);
+    setIntegerParam(NDShmemSourceZeroCopy,  1);
+    setIntegerParam(NDShmemSourceDropped,   0);
+    setIntegerParam(ADStatus,               ADStatusIdle);
+
+    if (epicsThreadCreate("NDShmemSourceTask",
+                          epicsThreadPriorityHigh,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)shmemTaskC, this) == NULL) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s epicsThreadCreate failure for shmemTask\n",
+            driverName, functionName);
+    }
+}
+
+/** Does the callbacks with an array received from the segment.
+  * Called without the lock taken.
+  * \param[in] pArray The array, whose reference this function takes over.
+  */
+void NDShmemSource::processArray(NDArray *pArray)
+{
+    int counter, numImagesCounter;
+    int imageMode, numImages, arrayCallbacks;
+    NDArrayInfo_t arrayInfo;
+
+    this->lock();
+    getIntegerParam(NDArrayCounter, &counter);
+    setIntegerParam(NDArrayCounter, ++counter);
+    getIntegerParam(ADNumImagesCounter, &numImagesCounter);
+    setIntegerParam(ADNumImagesCounter, ++numImagesCounter);
+
+    pArray->getInfo(&arrayInfo);
+    setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
+    setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+    setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+    setIntegerParam(NDArraySizeZ, (int)arrayInfo.colorSize);
+    setIntegerParam(NDDataType,   pArray->dataType);
+    setIntegerParam(NDColorMode,  arrayInfo.colorMode);
+
+    /* Add the attributes of this driver to those received with the array */
+    this->getAttributes(pArray->pAttributeList);
+
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (arrayCallbacks) {
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+    }
+    if (this->pArrays[0]) this->pArrays[0]->release();
+    this->pArrays[0] = pArray;
+
+    getIntegerParam(ADImageMode, &imageMode);
+    getIntegerParam(ADNumImages, &numImages);
+    if ((imageMode == ADImageSingle) ||
+        ((imageMode == ADImageMultiple) && (numImagesCounter >= numImages))) {
+        setIntegerParam(ADAcquire, 0);
+        setIntegerParam(ADStatus, ADStatusIdle);
+        setStringParam(ADStatusMessage, "Acquisition complete");
+    }
+    callParamCallbacks();
+    this->unlock();
+}
+
+/* Detach from the current segment.  The segment stays mapped until the arrays that use its slots are released. */
+void NDShmemSource::retireSegment()
+{
+    if (m_segment.pShmem) m_retired.push_back(m_segment);
+    m_segment.pShmem = NULL;
+    m_segment.pPool = NULL;
+}
+
+void NDShmemSource::deleteRetiredSegments()
+{
+    std::list<Segment_t>::iterator it = m_retired.begin();
+
+    while (it != m_retired.end()) {
+        if (it->pPool->getNumFree() == it->pPool->getNumBuffers()) {
+            it->pPool->emptyFreeList();
+            delete it->pPool;
+            delete it->pShmem;
+            it = m_retired.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+/** Attaches to the segment, again whenever its name changes or the sender creates it again,
+  * and takes the arrays published in it. */
+void NDShmemSource::shmemTask()
+{
+    char errorMessage[256];
+    string shmName;
+    bool reported = false;
+    epicsTimeStamp lastAttempt, now;
+    static const char *functionName = "shmemTask";
+
+    epicsTimeGetCurrent(&lastAttempt);
+    while (1) {
+        this->lock();
+        bool reconnect = m_reconnect;
+        m_reconnect = false;
+        if (reconnect) {
+            getStringParam(NDShmemSourceName, shmName);
+            reported = false;
+        }
+        this->unlock();
+
+        if (m_segment.pShmem && m_segment.pShmem->isClosed()) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s segment %s was closed by the sender\n",
+                driverName, functionName, shmName.c_str());
+            reconnect = true;
+        }
+        epicsTimeGetCurrent(&now);
+        if (!m_segment.pShmem && !shmName.empty() && (epicsTimeDiffInSeconds(&now, &lastAttempt) >= ATTACH_RETRY_TIME))
+            reconnect = true;
+
+        if (reconnect) {
+            retireSegment();
+            lastAttempt = now;
+            if (!shmName.empty()) {
+                NDArrayShmem *pShmem = new NDArrayShmem;
+                if (pShmem->attach(shmName.c_str(), errorMessage, sizeof(errorMessage)) == asynSuccess) {
+                    m_segment.pShmem = pShmem;
+                    m_segment.pPool = new NDArrayShmemPool(this, pShmem, true);
+                } else {
+                    // The sender may not have started yet, only report the first failure for each name
+                    if (!reported)
+                        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                            "%s::%s %s\n",
+                            driverName, functionName, errorMessage);
+                    reported = true;
+                    delete pShmem;
+                }
+            }
+            this->lock();
+            setIntegerParam(NDShmemSourceConnected, m_segment.pShmem != NULL);
+            callParamCallbacks();
+            this->unlock();
+        }
+        deleteRetiredSegments();
+
+        if (!m_segment.pShmem) {
+            epicsThreadSleep(POLL_TIME * 100);
+            continue;
+        }
+        m_segment.pShmem->heartbeat();
+
+        int acquire, zeroCopy, dropped;
+        NDArray *pArray;
+        this->lock();
+        getIntegerParam(ADAcquire,             &acquire);
+        getIntegerParam(NDShmemSourceZeroCopy, &zeroCopy);
+        this->unlock();
+
+        // Arrays published while not acquiring are taken and released, so that their slots are given back
+        asynStatus status = m_segment.pShmem->receive(zeroCopy ? m_segment.pPool : this->pNDArrayPool, &pArray);
+        if (status == asynTimeout) {
+            epicsThreadSleep(POLL_TIME);
+        } else if (status) {
+            this->lock();
+            getIntegerParam(NDShmemSourceDropped, &dropped);
+            setIntegerParam(NDShmemSourceDropped, ++dropped);
+            callParamCallbacks();
+            this->unlock();
+        } else if (acquire) {
+            processArray(pArray);
+        } else {
+            pArray->release();
+        }
+    }
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDShmemSource::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    status = setIntegerParam(function, value);
+
+    if (function == ADAcquire) {
+        if (value) {
+            setIntegerParam(ADNumImagesCounter, 0);
+            setIntegerParam(ADStatus, ADStatusAcquire);
+            setStringParam(ADStatusMessage, "Acquiring");
+        } else {
+            setIntegerParam(ADStatus, ADStatusIdle);
+            setStringParam(ADStatusMessage, "Acquisition stopped");
+        }
+    } else if (function < FIRST_NDSHMEM_SOURCE_PARAM) {
+        status = ADDriver::writeInt32(pasynUser, value);
+    }
+
+    callParamCallbacks();
+
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s::%s error, status=%d function=%d, value=%d\n",
+              driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s::%s function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Called when asyn clients call pasynOctet->write().
+  * Writing the segment name attaches to the new segment.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDShmemSource::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+
+    if (function == NDShmemSourceName) {
+        status = setStringParam(function, value);
+        m_reconnect = true;
+        callParamCallbacks();
+        *nActual = nChars;
+        return status;
+    }
+    return ADDriver::writeOctet(pasynUser, value, nChars, nActual);
+}
+
+/** Report status of the driver.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then driver details are printed.
+  */
+void NDShmemSource::report(FILE *fp, int details)
+{
+    string shmName;
+    int connected;
+
+    getStringParam(NDShmemSourceName, shmName);
+    getIntegerParam(NDShmemSourceConnected, &connected);
+    fprintf(fp, "NDShmemSource %s: segment=%s, connected=%d, retired segments=%d\n",
+            this->portName, shmName.c_str(), connected, (int)m_retired.size());
+    if ((details > 0) && m_segment.pPool) {
+        fprintf(fp, "  Pool of arrays using the segment:\n");
+        m_segment.pPool->report(fp, details);
+    }
+    /* Invoke the base class method */
+    ADDriver::report(fp, details);
+}
+
+/* Configuration routine.  Called directly, or from the iocsh function */
+extern "C" int NDShmemSourceConfig(const char *portName, const char *shmName, int maxBuffers, size_t maxMemory,
+                                   int priority, int stackSize)
+{
+    new NDShmemSource(portName, shmName, maxBuffers, maxMemory, priority, stackSize);
+    return asynSuccess;
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "shmName",iocshArgString};
+static const iocshArg initArg2 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg3 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg4 = { "priority",iocshArgInt};
+static const iocshArg initArg5 = { "stack size",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5};
+static const iocshFuncDef initFuncDef = {"NDShmemSourceConfig",6,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDShmemSourceConfig(args[0].sval, args[1].sval, args[2].ival,
+                        args[3].ival, args[4].ival, args[5].ival);
+}
+
+extern "C" void NDShmemSourceRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDShmemSourceRegister);
+}
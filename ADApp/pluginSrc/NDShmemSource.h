@@ -0,0 +1,54 @@
+#ifndef NDShmemSource_H
+#define NDShmemSource_H
+
+#include <list>
+
+#include "ADDriver.h"
+#include "NDArrayShmem.h"
+#include <NDPluginAPI.h>
+
+#define NDShmemSourceNameString      "SHMEM_SOURCE_NAME"       /* (asynOctet, r/w) Name of the shared memory segment to attach to */
+#define NDShmemSourceConnectedString "SHMEM_SOURCE_CONNECTED"  /* (asynInt32, r/o) Attached to the segment */
+#define NDShmemSourceZeroCopyString  "SHMEM_SOURCE_ZERO_COPY"  /* (asynInt32, r/w) NDArrays use the data in the segment without copying it */
+#define NDShmemSourceDroppedString   "SHMEM_SOURCE_DROPPED"    /* (asynInt32, r/w) Arrays received that could not be allocated */
+
+/** Driver that attaches to the shared memory segment of an NDPluginShmem plugin in another process
+  * on the same host, and does callbacks with an NDArray for each array published while acquiring.
+  * By default the NDArrays use the data in the segment rather than a copy of it. */
+class NDPLUGIN_API NDShmemSource : public ADDriver
+{
+public:
+    NDShmemSource(const char *portName, const char *shmName, int maxBuffers, size_t maxMemory,
+                  int priority, int stackSize);
+
+    /* These are the methods that we override from ADDriver */
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+    virtual void report(FILE *fp, int details);
+
+    void shmemTask();  /**< Should be private, but gets called from C, so must be public */
+
+protected:
+    int NDShmemSourceName;
+    #define FIRST_NDSHMEM_SOURCE_PARAM NDShmemSourceName
+    int NDShmemSourceConnected;
+    int NDShmemSourceZeroCopy;
+    int NDShmemSourceDropped;
+
+private:
+    /* A segment and the pool of the arrays that use its slots */
+    typedef struct {
+        NDArrayShmem *pShmem;
+        NDArrayShmemPool *pPool;
+    } Segment_t;
+
+    void processArray(NDArray *pArray);
+    void retireSegment();
+    void deleteRetiredSegments();
+
+    Segment_t m_segment;
+    std::list<Segment_t> m_retired;  /* Segments detached from that still have arrays in use */
+    bool m_reconnect;
+};
+
+#endif
@@ -41,6 +41,21 @@ struct NDArrayPoolFixture
     }
 };
 
+// A pool that lends its own buffer to alloc() and takes it back when the array is released
+class BorrowingPool : public NDArrayPool
+{
+public:
+    BorrowingPool(asynNDArrayDriver *pDriver, size_t maxMemory) : NDArrayPool(pDriver, maxMemory) {}
+    char buffer[1000];
+
+protected:
+    void onReleaseArray(NDArray *pArray)
+    {
+        if ((pArray->getReferenceCount() == 0) && (pArray->pData == buffer))
+            pArray->pData = NULL;
+    }
+};
+
 BOOST_FIXTURE_TEST_SUITE(NDArrayPoolTests, NDArrayPoolFixture)
 
 BOOST_AUTO_TEST_CASE(test_Pool)
@@ -129,4 +144,78 @@ BOOST_AUTO_TEST_CASE(test_Pool)
 
 }
 
+BOOST_AUTO_TEST_CASE(test_AlignedPool)
+{
+  size_t bufferSizes[3] = {100, 5000, 20000};
+  size_t roundedSizes[3] = {4096, 8192, 20480};
+  NDArray *pArrays[3];
+  size_t dims;
+  int i;
+
+  alignNDArrayData = 4096;
+  for (i=0; i<3; i++) {
+    dims = bufferSizes[i];
+    pArrays[i] = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArrays[i] != 0);
+#ifdef __linux__
+    BOOST_CHECK_EQUAL(((uintptr_t)pArrays[i]->pData) % 4096, 0);
+    // The pool accounts for the rounded up allocation, so maxMemory is enforced
+    BOOST_CHECK_EQUAL(pArrays[i]->dataSize, roundedSizes[i]);
+#else
+    BOOST_CHECK_EQUAL(pArrays[i]->dataSize, bufferSizes[i]);
+#endif
+    BOOST_CHECK_EQUAL(pArrays[i]->compressedSize, bufferSizes[i]);
+    memset(pArrays[i]->pData, i, bufferSizes[i]);
+  }
+#ifdef __linux__
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)32768);
+  // This array fits in MAX_MEMORY with its requested size, but not once it is rounded up
+  dims = MAX_MEMORY - 32768 - 100;
+  BOOST_CHECK(pPool->alloc(1, &dims, NDUInt8, 0, NULL) == NULL);
+#else
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)25100);
+#endif
+  for (i=0; i<3; i++) {
+    pArrays[i]->release();
+  }
+  pPool->emptyFreeList();
+  alignNDArrayData = 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_BorrowedData)
+{
+  BorrowingPool pool(dummy_driver, MAX_MEMORY);
+  size_t dims = sizeof(pool.buffer);
+
+  NDArray *pArray = pool.alloc(1, &dims, NDUInt8, dims, pool.buffer);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK(pArray->pData == pool.buffer);
+  BOOST_CHECK_EQUAL(pool.getMemorySize(), sizeof(pool.buffer));
+  pArray->release();
+  BOOST_CHECK(pArray->pData == 0);
+  BOOST_CHECK_EQUAL(pool.getNumFree(), 1);
+
+  // Reusing the array without a buffer allocates memory for it, and no longer counts the borrowed buffer
+  dims = 800;
+  NDArray *pArrayTest = pool.alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_CHECK_EQUAL(pArrayTest, pArray);
+  BOOST_REQUIRE(pArrayTest->pData != 0);
+  BOOST_CHECK(pArrayTest->pData != pool.buffer);
+  BOOST_CHECK_EQUAL(pArrayTest->dataSize, dims);
+  BOOST_CHECK_EQUAL(pool.getMemorySize(), dims);
+  memset(pArrayTest->pData, 0, dims);
+  pArrayTest->release();
+
+  // Lending the buffer again takes the array back from the free list
+  dims = sizeof(pool.buffer);
+  pArrayTest = pool.alloc(1, &dims, NDUInt8, dims, pool.buffer);
+  BOOST_CHECK_EQUAL(pArrayTest, pArray);
+  BOOST_CHECK_EQUAL(pool.getMemorySize(), sizeof(pool.buffer));
+  pArrayTest->release();
+
+  pool.emptyFreeList();
+  BOOST_CHECK_EQUAL(pool.getMemorySize(), (size_t)0);
+  BOOST_CHECK_EQUAL(pool.getNumBuffers(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
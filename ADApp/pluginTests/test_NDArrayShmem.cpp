@@ -0,0 +1,211 @@
+/*
+ * test_NDArrayShmem.cpp
+ *
+ * Passes arrays through a shared memory segment, with the sender and the receiver in this process.
+ */
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+#include <NDArrayShmem.h>
+
+#include <string.h>
+#include <epicsTypes.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define NUM_SLOTS 4
+#define SLOT_BYTES 1000
+
+struct NDArrayShmemFixture
+{
+    asynNDArrayDriver *driver;
+    NDArrayShmem sender;
+    NDArrayShmem receiver;
+    NDArrayShmemPool *pSendPool;
+    NDArrayShmemPool *pReceivePool;
+    std::string shmName;
+
+    NDArrayShmemFixture()
+    {
+        char errorMessage[256];
+        std::string dummy_port("shmemPort");
+        uniqueAsynPortName(dummy_port);
+        driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+
+        shmName = "ADCoreTest_" + dummy_port;
+        BOOST_REQUIRE_EQUAL(sender.create(shmName.c_str(), NUM_SLOTS, SLOT_BYTES, errorMessage, sizeof(errorMessage)),
+                            asynSuccess);
+        BOOST_REQUIRE_EQUAL(receiver.attach(shmName.c_str(), errorMessage, sizeof(errorMessage)), asynSuccess);
+        pSendPool = new NDArrayShmemPool(driver, &sender, false);
+        pReceivePool = new NDArrayShmemPool(driver, &receiver, true);
+    }
+    ~NDArrayShmemFixture()
+    {
+        delete pSendPool;
+        delete pReceivePool;
+        receiver.destroy();
+        sender.destroy();
+        delete driver;
+    }
+
+    NDArray *allocArray(int uniqueId)
+    {
+        size_t dims[2] = {10, 20};
+        double gain = 2.5;
+        NDArray *pArray = pSendPool->alloc(2, dims, NDUInt16, 0, NULL);
+        if (pArray) {
+            epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+            for (int i=0; i<200; i++) pData[i] = (epicsUInt16)(uniqueId + i);
+            pArray->uniqueId = uniqueId;
+            pArray->pAttributeList->add("Gain", "Detector gain", NDAttrFloat64, &gain);
+        }
+        return pArray;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDArrayShmemTests, NDArrayShmemFixture)
+
+BOOST_AUTO_TEST_CASE(test_ZeroCopy)
+{
+  BOOST_CHECK(sender.receiverConnected());
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS);
+
+  NDArray *pArray = allocArray(7);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK(sender.slotIndex(pArray->pData) >= 0);
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS-1);
+  BOOST_CHECK_EQUAL(sender.publish(pArray), asynSuccess);
+  // Publishing the same slot again before the receiver has given it back fails
+  BOOST_CHECK_EQUAL(sender.publish(pArray), asynError);
+  pArray->release();
+  // The receiver still has the slot
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS-1);
+
+  NDArray *pOut;
+  BOOST_REQUIRE_EQUAL(receiver.receive(pReceivePool, &pOut), asynSuccess);
+  BOOST_CHECK(receiver.slotIndex(pOut->pData) >= 0);
+  BOOST_CHECK_EQUAL(pOut->uniqueId, 7);
+  BOOST_CHECK_EQUAL(pOut->ndims, 2);
+  BOOST_CHECK_EQUAL(pOut->dims[0].size, 10);
+  BOOST_CHECK_EQUAL(pOut->dims[1].size, 20);
+  BOOST_CHECK_EQUAL(pOut->dataType, NDUInt16);
+  BOOST_CHECK_EQUAL(((epicsUInt16 *)pOut->pData)[199], 7+199);
+  double gain = 0;
+  NDAttribute *pAttribute = pOut->pAttributeList->find("Gain");
+  BOOST_REQUIRE(pAttribute != 0);
+  BOOST_CHECK_EQUAL(pAttribute->getValue(NDAttrFloat64, &gain), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(gain, 2.5);
+  BOOST_CHECK_EQUAL(std::string(pAttribute->getDescription()), "Detector gain");
+
+  // Nothing else has been published
+  NDArray *pNext;
+  BOOST_CHECK_EQUAL(receiver.receive(pReceivePool, &pNext), asynTimeout);
+  BOOST_CHECK(pNext == 0);
+  pOut->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ReleaseGivesSlotBack)
+{
+  NDArray *pArray = allocArray(1);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(sender.publish(pArray), asynSuccess);
+  pArray->release();
+
+  NDArray *pOut;
+  BOOST_REQUIRE_EQUAL(receiver.receive(pReceivePool, &pOut), asynSuccess);
+  pOut->release();
+  BOOST_CHECK(pOut->pData == 0);
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS);
+}
+
+BOOST_AUTO_TEST_CASE(test_Copy)
+{
+  NDArray *pArray = allocArray(3);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(sender.publish(pArray), asynSuccess);
+  pArray->release();
+
+  // Receiving into an ordinary pool copies the data and gives the slot back at once
+  NDArray *pOut;
+  BOOST_REQUIRE_EQUAL(receiver.receive(driver->pNDArrayPool, &pOut), asynSuccess);
+  BOOST_CHECK(receiver.slotIndex(pOut->pData) < 0);
+  BOOST_CHECK_EQUAL(((epicsUInt16 *)pOut->pData)[0], 3);
+  BOOST_CHECK(pOut->pAttributeList->find("Gain") != 0);
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS);
+  pOut->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_SlotsRunOut)
+{
+  NDArray *pArrays[NUM_SLOTS];
+  int i;
+
+  for (i=0; i<NUM_SLOTS; i++) {
+    pArrays[i] = allocArray(i);
+    BOOST_REQUIRE(pArrays[i] != 0);
+  }
+  BOOST_CHECK(allocArray(NUM_SLOTS) == 0);
+  for (i=0; i<NUM_SLOTS; i++) pArrays[i]->release();
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS);
+
+  // An array larger than a slot cannot be allocated
+  size_t dims = SLOT_BYTES + 1;
+  BOOST_CHECK(pSendPool->alloc(1, &dims, NDUInt8, 0, NULL) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_AttachRecovers)
+{
+  char errorMessage[256];
+  NDArray *pArray;
+  NDArray *pOut;
+
+  for (int i=0; i<2; i++) {
+    pArray = allocArray(i);
+    BOOST_REQUIRE(pArray != 0);
+    BOOST_CHECK_EQUAL(sender.publish(pArray), asynSuccess);
+    pArray->release();
+  }
+  // The first receiver takes one array and leaves the other on the ring
+  BOOST_REQUIRE_EQUAL(receiver.receive(driver->pNDArrayPool, &pOut), asynSuccess);
+  pOut->release();
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS-1);
+
+  // A new receiver skips the array that was not taken and gives its slot back
+  NDArrayShmem receiver2;
+  BOOST_REQUIRE_EQUAL(receiver2.attach(shmName.c_str(), errorMessage, sizeof(errorMessage)), asynSuccess);
+  BOOST_CHECK_EQUAL(sender.numFreeSlots(), NUM_SLOTS);
+  BOOST_CHECK_EQUAL(receiver2.receive(driver->pNDArrayPool, &pOut), asynTimeout);
+
+  // Arrays published after attaching are received
+  pArray = allocArray(5);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(sender.publish(pArray), asynSuccess);
+  pArray->release();
+  BOOST_REQUIRE_EQUAL(receiver2.receive(driver->pNDArrayPool, &pOut), asynSuccess);
+  BOOST_CHECK_EQUAL(pOut->uniqueId, 5);
+  pOut->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Closed)
+{
+  char errorMessage[256];
+
+  BOOST_CHECK(!receiver.isClosed());
+  // Creating the segment again closes the one the receiver is attached to
+  NDArrayShmem sender2;
+  BOOST_REQUIRE_EQUAL(sender2.create(shmName.c_str(), NUM_SLOTS, SLOT_BYTES, errorMessage, sizeof(errorMessage)),
+                      asynSuccess);
+  BOOST_CHECK(receiver.isClosed());
+  NDArrayShmem receiver2;
+  BOOST_CHECK_EQUAL(receiver2.attach(shmName.c_str(), errorMessage, sizeof(errorMessage)), asynSuccess);
+  BOOST_CHECK(!receiver2.isClosed());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,287 @@
+/*
+ * test_NDAttributeCodec.cpp
+ *
+ * Encodes and decodes attribute lists, and measures the throughput for lists of 50, 200 and 1000 attributes.
+ */
+#include <stdio.h>
+#include <stddef.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDAttributeList.h>
+#include <NDAttributeCodec.h>
+
+#include <string.h>
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+using namespace std;
+
+/* Fill a list with numAttributes attributes, a third each of Float64, Int32 and String */
+static void fillList(NDAttributeList *pList, int numAttributes, int frame)
+{
+  char name[32], text[32];
+
+  for (int i=0; i<numAttributes; i++) {
+    sprintf(name, "Attr%d", i);
+    if (i % 3 == 0) {
+      epicsFloat64 value = frame + i * 0.5;
+      pList->add(name, "Float64 attribute", NDAttrFloat64, &value);
+    } else if (i % 3 == 1) {
+      epicsInt32 value = frame * 1000 + i;
+      pList->add(name, "Int32 attribute", NDAttrInt32, &value);
+    } else {
+      sprintf(text, "frame %d value %d", frame, i);
+      pList->add(name, "String attribute", NDAttrString, text);
+    }
+  }
+}
+
+static void checkList(NDAttributeList *pList, int numAttributes, int frame)
+{
+  char name[32], text[32];
+  epicsFloat64 f64;
+  epicsInt32 i32;
+  std::string str;
+
+  BOOST_REQUIRE_EQUAL(pList->count(), numAttributes);
+  NDAttribute *pAttribute = pList->next(NULL);
+  for (int i=0; i<numAttributes; i++) {
+    sprintf(name, "Attr%d", i);
+    BOOST_REQUIRE(pAttribute != 0);
+    BOOST_CHECK_EQUAL(std::string(pAttribute->getName()), name);
+    if (i % 3 == 0) {
+      BOOST_CHECK_EQUAL(pAttribute->getValue(NDAttrFloat64, &f64), ND_SUCCESS);
+      BOOST_CHECK_EQUAL(f64, frame + i * 0.5);
+    } else if (i % 3 == 1) {
+      BOOST_CHECK_EQUAL(pAttribute->getValue(NDAttrInt32, &i32), ND_SUCCESS);
+      BOOST_CHECK_EQUAL(i32, frame * 1000 + i);
+    } else {
+      sprintf(text, "frame %d value %d", frame, i);
+      BOOST_CHECK_EQUAL(pAttribute->getValue(str), ND_SUCCESS);
+      BOOST_CHECK_EQUAL(str, text);
+    }
+    pAttribute = pList->next(pAttribute);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_RoundTrip)
+{
+  NDAttributeList in, out;
+  NDAttributeCodec encoder, decoder;
+  std::vector<char> buffer;
+  epicsInt8 i8 = -8;
+  epicsUInt16 ui16 = 16;
+  epicsInt64 i64 = -((epicsInt64)1 << 40);
+  epicsUInt64 ui64 = ((epicsUInt64)1 << 63) + 1;
+  epicsFloat32 f32 = 3.25;
+  epicsFloat64 f64 = 1e-300;
+  char text[] = "Some text";
+
+  in.add("Int8", "An Int8", NDAttrInt8, &i8);
+  in.add("UInt16", "A UInt16", NDAttrUInt16, &ui16);
+  in.add("Int64", "An Int64", NDAttrInt64, &i64);
+  in.add("UInt64", "A UInt64", NDAttrUInt64, &ui64);
+  in.add("Float32", "A Float32", NDAttrFloat32, &f32);
+  in.add("Float64", "A Float64", NDAttrFloat64, &f64);
+  in.add("String", "A string", NDAttrString, text);
+  in.add("Empty", "An empty string", NDAttrString, (void *)"");
+  in.add(new NDAttribute("Undefined", "No value", NDAttrSourceConst, "None", NDAttrUndefined, NULL));
+  in.add(new NDAttribute("Param", "From a parameter", NDAttrSourceParam, "GAIN", NDAttrInt8, &i8));
+
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+  BOOST_CHECK(encoder.schemaChanged());
+  BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  BOOST_CHECK(decoder.schemaChanged());
+  BOOST_CHECK_EQUAL(decoder.schemaId(), encoder.schemaId());
+  BOOST_REQUIRE_EQUAL(out.count(), in.count());
+
+  NDAttribute *pIn = in.next(NULL);
+  NDAttribute *pOut = out.next(NULL);
+  while (pIn) {
+    NDAttrDataType_t inType, outType;
+    NDAttrSource_t inSource, outSource;
+    size_t inSize, outSize;
+    char inValue[32], outValue[32];
+    BOOST_REQUIRE(pOut != 0);
+    BOOST_CHECK_EQUAL(std::string(pOut->getName()), pIn->getName());
+    BOOST_CHECK_EQUAL(std::string(pOut->getDescription()), pIn->getDescription());
+    BOOST_CHECK_EQUAL(std::string(pOut->getSourceInfo(&outSource)), pIn->getSourceInfo(&inSource));
+    BOOST_CHECK_EQUAL(outSource, inSource);
+    pIn->getValueInfo(&inType, &inSize);
+    pOut->getValueInfo(&outType, &outSize);
+    BOOST_CHECK_EQUAL(outType, inType);
+    BOOST_CHECK_EQUAL(outSize, inSize);
+    if (inSize > 0) {
+      pIn->getValue(inType, inValue, inSize);
+      pOut->getValue(outType, outValue, outSize);
+      BOOST_CHECK_EQUAL(memcmp(inValue, outValue, inSize), 0);
+    }
+    pIn = in.next(pIn);
+    pOut = out.next(pOut);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_SchemaSentOnce)
+{
+  NDAttributeList in, out;
+  NDAttributeCodec encoder, decoder, lateDecoder;
+  std::vector<char> first, second, withSchema;
+
+  fillList(&in, 30, 1);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, first, false), ND_SUCCESS);
+  fillList(&in, 30, 2);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, second, false), ND_SUCCESS);
+  BOOST_CHECK(!encoder.schemaChanged());
+  // The second buffer only has the values
+  BOOST_CHECK_EQUAL(first.size(), encoder.schema().size() + second.size());
+
+  BOOST_REQUIRE_EQUAL(decoder.decode(&first[0], first.size(), &out), ND_SUCCESS);
+  checkList(&out, 30, 1);
+  BOOST_REQUIRE_EQUAL(decoder.decode(&second[0], second.size(), &out), ND_SUCCESS);
+  BOOST_CHECK(!decoder.schemaChanged());
+  checkList(&out, 30, 2);
+
+  // A decoder that missed the schema cannot decode the values
+  NDAttributeList lateOut;
+  BOOST_CHECK_EQUAL(lateDecoder.decode(&second[0], second.size(), &lateOut), ND_ERROR);
+  BOOST_CHECK_EQUAL(lateOut.count(), 0);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, withSchema, true), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(lateDecoder.decode(&withSchema[0], withSchema.size(), &lateOut), ND_SUCCESS);
+  checkList(&lateOut, 30, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_SchemaChanges)
+{
+  NDAttributeList in, out;
+  NDAttributeCodec encoder, decoder;
+  std::vector<char> buffer;
+  epicsInt32 value = 5;
+
+  fillList(&in, 10, 1);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  epicsUInt32 firstId = encoder.schemaId();
+
+  // Adding an attribute sends the new schema
+  in.add("Extra", "Another attribute", NDAttrInt32, &value);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+  BOOST_CHECK(encoder.schemaChanged());
+  BOOST_CHECK(encoder.schemaId() != firstId);
+  BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  BOOST_CHECK(decoder.schemaChanged());
+  BOOST_REQUIRE_EQUAL(out.count(), 11);
+  value = 0;
+  BOOST_CHECK_EQUAL(out.find("Extra")->getValue(NDAttrInt32, &value), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(value, 5);
+
+  // So does changing the data type of an attribute
+  epicsFloat64 f64 = 5.5;
+  in.remove("Extra");
+  in.add("Extra", "Another attribute", NDAttrFloat64, &f64);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+  BOOST_CHECK(encoder.schemaChanged());
+  BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(out.find("Extra")->getDataType(), NDAttrFloat64);
+}
+
+BOOST_AUTO_TEST_CASE(test_DecodeInPlace)
+{
+  NDAttributeList in, out;
+  NDAttributeCodec encoder, decoder;
+  std::vector<char> buffer;
+
+  fillList(&in, 9, 1);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  NDAttribute *pFirst = out.next(NULL);
+
+  // The attributes already in the list are kept and only their values are set
+  fillList(&in, 9, 2);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+  BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  BOOST_CHECK(out.next(NULL) == pFirst);
+  checkList(&out, 9, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_InvalidBuffers)
+{
+  NDAttributeList in, out;
+  NDAttributeCodec encoder;
+  std::vector<char> buffer;
+
+  fillList(&in, 9, 1);
+  BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+
+  // Truncated
+  {
+    NDAttributeCodec decoder;
+    BOOST_CHECK_EQUAL(decoder.decode(&buffer[0], buffer.size() - 1, &out), ND_ERROR);
+    BOOST_CHECK_EQUAL(out.count(), 0);
+  }
+  // Another version
+  {
+    NDAttributeCodec decoder;
+    std::vector<char> copy(buffer);
+    epicsUInt16 version = NDATTRIBUTE_CODEC_VERSION + 1;
+    memcpy(&copy[offsetof(NDAttrBlockHeader_t, version)], &version, sizeof(version));
+    BOOST_CHECK_EQUAL(decoder.decode(&copy[0], copy.size(), &out), ND_ERROR);
+  }
+  // A corrupted schema does not match its id
+  {
+    NDAttributeCodec decoder;
+    std::vector<char> copy(buffer);
+    copy[sizeof(NDAttrBlockHeader_t) + 16]++;
+    BOOST_CHECK_EQUAL(decoder.decode(&copy[0], copy.size(), &out), ND_ERROR);
+  }
+  NDAttributeCodec decoder;
+  BOOST_CHECK_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+  checkList(&out, 9, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Throughput)
+{
+  static const int numAttributes[] = {50, 200, 1000};
+  epicsTimeStamp tStart, tEnd;
+
+  for (size_t n=0; n<sizeof(numAttributes)/sizeof(numAttributes[0]); n++) {
+    NDAttributeList in, out, fresh;
+    NDAttributeCodec encoder, decoder;
+    std::vector<char> buffer;
+    int numFrames = 200000 / numAttributes[n];
+    int i;
+
+    fillList(&in, numAttributes[n], 0);
+    BOOST_REQUIRE_EQUAL(encoder.encode(&in, buffer, false), ND_SUCCESS);
+    size_t schemaBytes = encoder.schema().size();
+    BOOST_REQUIRE_EQUAL(decoder.decode(&buffer[0], buffer.size(), &out), ND_SUCCESS);
+
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<numFrames; i++) encoder.encode(&in, buffer, false);
+    epicsTimeGetCurrent(&tEnd);
+    double encodeTime = epicsTimeDiffInSeconds(&tEnd, &tStart);
+
+    // Decoding into a list that already has the attributes only sets their values
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<numFrames; i++) decoder.decode(&buffer[0], buffer.size(), &out);
+    epicsTimeGetCurrent(&tEnd);
+    double decodeTime = epicsTimeDiffInSeconds(&tEnd, &tStart);
+
+    // Decoding into an empty list creates the attributes
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<numFrames; i++) {
+      fresh.clear();
+      decoder.decode(&buffer[0], buffer.size(), &fresh);
+    }
+    epicsTimeGetCurrent(&tEnd);
+    double createTime = epicsTimeDiffInSeconds(&tEnd, &tStart);
+    checkList(&fresh, numAttributes[n], 0);
+
+    BOOST_TEST_MESSAGE("NDAttributeCodec " << numAttributes[n] << " attributes: schema " << schemaBytes
+                       << " bytes, values " << buffer.size() << " bytes, encode " << 1e6 * encodeTime / numFrames
+                       << " us, decode " << 1e6 * decodeTime / numFrames << " us, decode new list "
+                       << 1e6 * createTime / numFrames << " us per frame");
+  }
+}
@@ -0,0 +1,183 @@
+/*
+ * test_NDCodecBlockPool.cpp
+ *
+ * Runs jobs directly on the worker threads that NDPluginCodec uses for blocked compression.
+ */
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDCodecBlockPool.h>
+
+#include <string.h>
+#include <vector>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+using namespace std;
+
+#define BLOCK_SIZE 4096
+// Enough threads to keep every worker created by these tests busy
+#define NUM_HOLD_BLOCKS 16
+
+// Writes each byte of the block mixed with its block number, and a checksum of the block in pCompSizes
+static void mixBlock(codecBlockJob *pJob, size_t block)
+{
+    size_t offset = block * pJob->blockSize;
+    size_t bytes = pJob->totalBytes - offset < pJob->blockSize ? pJob->totalBytes - offset : pJob->blockSize;
+    size_t sum = 0;
+
+    for (size_t i=0; i<bytes; i++) {
+        pJob->pOut[offset + i] = (char)(pJob->pIn[offset + i] ^ (block * 31));
+        sum = sum * 131 + (unsigned char)pJob->pOut[offset + i];
+    }
+    pJob->pCompSizes[block] = sum;
+}
+
+// Fails on the block given by the compression level
+static void failBlock(codecBlockJob *pJob, size_t block)
+{
+    if ((int)block == pJob->clevel) {
+        epicsMutexLock(pJob->lock);
+        pJob->failed = true;
+        epicsMutexUnlock(pJob->lock);
+    }
+}
+
+// Keeps its thread busy until the test releases it
+static epicsMutexId holdLock;
+static int numHeld;
+static bool holdReleased;
+static epicsEventId holdDone;
+
+static void holdBlock(codecBlockJob *, size_t)
+{
+    bool released = false;
+
+    epicsMutexLock(holdLock);
+    numHeld++;
+    epicsMutexUnlock(holdLock);
+    for (int i=0; (i<1000) && !released; i++) {
+        epicsThreadSleep(0.01);
+        epicsMutexLock(holdLock);
+        released = holdReleased;
+        epicsMutexUnlock(holdLock);
+    }
+}
+
+static void holdTask(void *)
+{
+    codecBlockJob job;
+
+    memset(&job, 0, sizeof(job));
+    job.blockFunc = holdBlock;
+    job.nBlocks = NUM_HOLD_BLOCKS;
+    NDCodecBlockPool::getInstance()->run(&job, NUM_HOLD_BLOCKS);
+    epicsEventSignal(holdDone);
+}
+
+static void runMix(const vector<char>& input, vector<char>& output, vector<size_t>& sums, int numThreads)
+{
+    codecBlockJob job;
+
+    memset(&job, 0, sizeof(job));
+    job.blockFunc = mixBlock;
+    job.pIn = &input[0];
+    job.totalBytes = input.size();
+    job.blockSize = BLOCK_SIZE;
+    job.nBlocks = (input.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    output.assign(input.size(), 0);
+    sums.assign(job.nBlocks, 0);
+    job.pOut = &output[0];
+    job.pCompSizes = &sums[0];
+    BOOST_REQUIRE(NDCodecBlockPool::getInstance()->run(&job, numThreads));
+}
+
+BOOST_AUTO_TEST_SUITE(NDCodecBlockPoolTests)
+
+BOOST_AUTO_TEST_CASE(test_ThreadsMatchSingleThread)
+{
+    // The last block is short
+    vector<char> input(257 * BLOCK_SIZE + 1000);
+    vector<char> expected, output;
+    vector<size_t> expectedSums, sums;
+
+    for (size_t i=0; i<input.size(); i++)
+        input[i] = (char)((i * 7919) >> 3);
+    runMix(input, expected, expectedSums, 1);
+
+    int numThreads[] = {2, 4, 8};
+    for (int t=0; t<3; t++) {
+        for (int repeat=0; repeat<20; repeat++) {
+            runMix(input, output, sums, numThreads[t]);
+            BOOST_REQUIRE(output == expected);
+            BOOST_REQUIRE(sums == expectedSums);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_FailedBlock)
+{
+    codecBlockJob job;
+
+    memset(&job, 0, sizeof(job));
+    job.blockFunc = failBlock;
+    job.nBlocks = 64;
+    job.clevel = 50;
+    BOOST_CHECK(!NDCodecBlockPool::getInstance()->run(&job, 4));
+    BOOST_CHECK(job.failed);
+    job.clevel = -1;
+    BOOST_CHECK(NDCodecBlockPool::getInstance()->run(&job, 4));
+    BOOST_CHECK(!job.failed);
+}
+
+// A job whose helpers are queued behind a job that keeps the workers busy is done by the calling thread,
+// and run() returns as soon as its blocks are done rather than waiting for the helpers
+BOOST_AUTO_TEST_CASE(test_ReturnsWhenBlocksDone)
+{
+    vector<char> input(64 * BLOCK_SIZE, 1);
+    vector<char> expected, output;
+    vector<size_t> expectedSums, sums;
+    epicsTimeStamp start, end;
+
+    runMix(input, expected, expectedSums, 1);
+
+    holdLock = epicsMutexMustCreate();
+    holdDone = epicsEventMustCreate(epicsEventEmpty);
+    numHeld = 0;
+    holdReleased = false;
+    epicsThreadCreate("holdTask", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium), holdTask, NULL);
+    for (int i=0; i<500; i++) {
+        epicsMutexLock(holdLock);
+        int held = numHeld;
+        epicsMutexUnlock(holdLock);
+        if (held == NUM_HOLD_BLOCKS) break;
+        epicsThreadSleep(0.01);
+    }
+    BOOST_REQUIRE_EQUAL(numHeld, NUM_HOLD_BLOCKS);
+
+    epicsTimeGetCurrent(&start);
+    runMix(input, output, sums, 4);
+    epicsTimeGetCurrent(&end);
+    BOOST_CHECK(output == expected);
+    BOOST_CHECK(sums == expectedSums);
+    BOOST_CHECK_LT(epicsTimeDiffInSeconds(&end, &start), 5.0);
+
+    // The helpers of the second job get it from the queue after the last block was done
+    epicsMutexLock(holdLock);
+    holdReleased = true;
+    epicsMutexUnlock(holdLock);
+    epicsEventMustWait(holdDone);
+    runMix(input, output, sums, 4);
+    BOOST_CHECK(output == expected);
+
+    epicsEventDestroy(holdDone);
+    epicsMutexDestroy(holdLock);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
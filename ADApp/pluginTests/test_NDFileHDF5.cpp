@@ -292,4 +292,453 @@ BOOST_AUTO_TEST_CASE(test_DatasetLayout1)
 
 }
 
+BOOST_AUTO_TEST_CASE(test_WriteBehind)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  // Create some test arrays
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  // Configure the HDF5 plugin to write from the write-behind thread, with room for 4 queued arrays
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "writebehind");
+  hdf5->write(NDFileWriteBehindString, 1);
+  hdf5->write(NDFileWriteBehindQueueSizeString, 4);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  // NumCaptured counts queued arrays; stopping at 10 closes the file once they are all written
+  epicsInt32 num_captured=0;
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+    num_captured = hdf5->readInt(NDFileNumCapturedString);
+    BOOST_CHECK_EQUAL(num_captured, i+1);
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteBehindQueuedString), 0);
+  BOOST_CHECK_GE(hdf5->readInt(NDFileWriteBehindHighWaterString), 1);
+  BOOST_CHECK_LE(hdf5->readInt(NDFileWriteBehindHighWaterString), 4);
+  BOOST_CHECK_GT(hdf5->readDouble(NDFileMaxWriteTimeString), 0.0);
+
+  // Every queued frame must be in the file
+  HDF5FileReader fr("writebehind_0.5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/data/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+  BOOST_CHECK_EQUAL(odims[1], 6);
+  BOOST_CHECK_EQUAL(odims[2], 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_CaptureArena)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < 10; i++)
+  {
+    epicsUInt32 *pData = (epicsUInt32 *)arrays[i]->pData;
+    for (int j = 0; j < 24; j++) pData[j] = i*100 + j;
+  }
+
+  // Capture 10 frames into a 1 MB arena backed by a scratch file, written when capture completes
+  setup_hdf_stream();
+  hdf5->write(NDFileWriteModeString, NDFileModeCapture);
+  hdf5->write(NDFileNameString, "capturearena");
+  hdf5->write(NDFileNumberString, 0);
+  hdf5->write(NDAutoIncrementString, 0);
+  hdf5->write(NDAutoSaveString, 1);
+  hdf5->write(NDFileCaptureArenaSizeString, 1.0);
+  hdf5->write(NDFileCaptureArenaFileString, "capturearena.tmp");
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to memory
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+    if (i < 9) {
+      BOOST_CHECK_EQUAL(hdf5->readInt(NDFileNumCapturedString), i+1);
+      BOOST_CHECK_GT(hdf5->readDouble(NDFileCaptureArenaUsedString), 0.0);
+    }
+  }
+  // The captured frames are copied, so none of them is held by the plugin
+  for (int i = 0; i < 9; i++)
+  {
+    BOOST_CHECK_EQUAL(arrays[i]->getReferenceCount(), 1);
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  HDF5FileReader fr("capturearena_0.5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/data/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+  BOOST_CHECK_EQUAL(odims[1], 6);
+  BOOST_CHECK_EQUAL(odims[2], 4);
+
+  std::vector<epicsUInt32> data(10*24);
+  hid_t file = H5Fopen("capturearena_0.5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GE(file, 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(dataset, 0);
+  BOOST_CHECK_GE(H5Dread(dataset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]), 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  for (int i = 0; i < 10; i++)
+  {
+    BOOST_CHECK_EQUAL(data[i*24], (epicsUInt32)(i*100));
+    BOOST_CHECK_EQUAL(data[i*24 + 23], (epicsUInt32)(i*100 + 23));
+  }
+
+  // An arena too small for all of the frames stops the capture early and writes what it holds
+  hdf5->write(NDFileNameString, "capturearenafull");
+  hdf5->write(NDFileCaptureArenaSizeString, 0.001);
+  hdf5->write(NDFileCaptureArenaFileString, "");
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readString(NDFileWriteMessageString), "Capture arena full, capture stopped");
+
+  HDF5FileReader frFull("capturearenafull_0.5");
+  odims = frFull.getDatasetDimensions("/entry/data/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_GT(odims[0], 0);
+  BOOST_CHECK_LT(odims[0], 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_ReadFile)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < 10; i++)
+  {
+    epicsUInt32 *pData = (epicsUInt32 *)arrays[i]->pData;
+    for (int j = 0; j < 24; j++) pData[j] = i*100 + j;
+    arrays[i]->uniqueId = 100 + i;
+    epicsInt32 counter = i;
+    arrays[i]->pAttributeList->add("Counter", "Frame counter", NDAttrInt32, &counter);
+  }
+
+  // Write 10 frames, then read them back with their unique IDs and attributes
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "readfile");
+  hdf5->write(NDFileNumberString, 0);
+  hdf5->write(NDAutoIncrementString, 0);
+  hdf5->processCallbacks(arrays[0]);
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+
+  NDArray *pRead = NULL;
+  BOOST_REQUIRE_EQUAL(hdf5->openFile("readfile_0.5", (NDFileOpenMode_t)(NDFileModeRead | NDFileModeMultiple), NULL), asynSuccess);
+  BOOST_REQUIRE_EQUAL(hdf5->getNumArraysInFile(), 10);
+  for (int i = 0; i < 10; i++)
+  {
+    BOOST_REQUIRE_EQUAL(hdf5->readFile(&pRead), asynSuccess);
+    BOOST_REQUIRE_EQUAL(pRead->ndims, 2);
+    BOOST_CHECK_EQUAL(pRead->dims[0].size, 4);
+    BOOST_CHECK_EQUAL(pRead->dims[1].size, 6);
+    BOOST_CHECK_EQUAL(pRead->dataType, NDUInt32);
+    BOOST_CHECK_EQUAL(pRead->uniqueId, 100 + i);
+    BOOST_CHECK(memcmp(pRead->pData, arrays[i]->pData, 24*sizeof(epicsUInt32)) == 0);
+    NDAttribute *pAttribute = pRead->pAttributeList->find("Counter");
+    BOOST_REQUIRE(pAttribute != NULL);
+    epicsInt32 counter = -1;
+    pAttribute->getValue(NDAttrInt32, &counter);
+    BOOST_CHECK_EQUAL(counter, i);
+    pRead->release();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readFile(&pRead), asynError);
+  BOOST_CHECK_EQUAL(hdf5->closeFile(), asynSuccess);
+}
+
+BOOST_AUTO_TEST_CASE(test_MultiFrameChunk)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  // Create some test arrays, each frame holding its own index
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < 10; i++)
+  {
+    epicsUInt32 *pData = (epicsUInt32 *)arrays[i]->pData;
+    for (int j = 0; j < 24; j++) pData[j] = i*100 + j;
+  }
+
+  // Chunks of 4 frames are collected and written whole; the last 2 frames are a partial chunk
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "multiframechunk");
+  hdf5->write(str_NDFileHDF5_nFramesChunks, 4);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  // The cache holds the one chunk being filled, the partial chunk is complete at the end of the dataset
+  BOOST_CHECK_CLOSE(hdf5->readDouble(str_NDFileHDF5_chunkCacheSize), 4*24*4 / (1024.0*1024.0), 0.001);
+  BOOST_CHECK_CLOSE(hdf5->readDouble(str_NDFileHDF5_bytesWritten), 10*24*4 / (1024.0*1024.0), 0.001);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_chunksFlushed), 3);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_chunkEvictions), 0);
+  BOOST_CHECK_GE(hdf5->readDouble(str_NDFileHDF5_avgWriteTime), 0.0);
+
+  HDF5FileReader fr("multiframechunk_0.5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/data/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+  BOOST_CHECK_EQUAL(odims[1], 6);
+  BOOST_CHECK_EQUAL(odims[2], 4);
+
+  // Every frame must be in its place, including those of the partial chunk
+  std::vector<epicsUInt32> data(10*24);
+  hid_t file = H5Fopen("multiframechunk_0.5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GE(file, 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(dataset, 0);
+  BOOST_CHECK_GE(H5Dread(dataset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]), 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  for (int i = 0; i < 10; i++)
+  {
+    BOOST_CHECK_EQUAL(data[i*24], (epicsUInt32)(i*100));
+    BOOST_CHECK_EQUAL(data[i*24 + 23], (epicsUInt32)(i*100 + 23));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_CompressThreads)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(20);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < 20; i++)
+  {
+    epicsUInt32 *pData = (epicsUInt32 *)arrays[i]->pData;
+    for (int j = 0; j < 24; j++) pData[j] = i*100 + j;
+  }
+
+  // zlib chunks of one frame are compressed on 2 threads and must be written in order
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "compressthreads");
+  hdf5->write(str_NDFileHDF5_compressThreads, 2);
+  hdf5->write(str_NDFileHDF5_compressionType, 3); // HDF5CompressZlib
+  hdf5->write(str_NDFileHDF5_zCompressLevel, 6);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 20);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 20; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  std::vector<epicsUInt32> data(20*24);
+  hid_t file = H5Fopen("compressthreads_0.5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GE(file, 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(dataset, 0);
+  BOOST_CHECK_GE(H5Dread(dataset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]), 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  for (int i = 0; i < 20; i++)
+  {
+    BOOST_CHECK_EQUAL(data[i*24], (epicsUInt32)(i*100));
+    BOOST_CHECK_EQUAL(data[i*24 + 23], (epicsUInt32)(i*100 + 23));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Rollover)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < 10; i++)
+  {
+    epicsUInt32 *pData = (epicsUInt32 *)arrays[i]->pData;
+    for (int j = 0; j < 24; j++) pData[j] = i*100 + j;
+  }
+
+  // 10 frames in files of 4 frames, rolled over by the write-behind thread, tied together by a VDS
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "rollover");
+  hdf5->write(NDFileNumberString, 0);
+  hdf5->write(NDAutoIncrementString, 1);
+  hdf5->write(NDFileWriteBehindString, 1);
+  hdf5->write(NDFileRolloverFramesString, 4);
+  hdf5->write(str_NDFileHDF5_rolloverVDS, 1);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileNumCapturedString), 10);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileRolloverCountString), 2);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileNumberString), 3);
+
+  const char *parts[] = {"rollover_0.5", "rollover_1.5", "rollover_2.5"};
+  hsize_t partFrames[] = {4, 4, 2};
+  for (int i = 0; i < 3; i++)
+  {
+    HDF5FileReader fr(parts[i]);
+    std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/data/data");
+    BOOST_REQUIRE_EQUAL(odims.size(), 3);
+    BOOST_CHECK_EQUAL(odims[0], partFrames[i]);
+  }
+
+  // The VDS presents all of the frames in order
+  std::vector<epicsUInt32> data(10*24);
+  hid_t file = H5Fopen("rollover_0_vds.5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GE(file, 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(dataset, 0);
+  hid_t dataspace = H5Dget_space(dataset);
+  BOOST_CHECK_EQUAL(H5Sget_simple_extent_npoints(dataspace), 10*24);
+  H5Sclose(dataspace);
+  BOOST_CHECK_GE(H5Dread(dataset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]), 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  for (int i = 0; i < 10; i++)
+  {
+    BOOST_CHECK_EQUAL(data[i*24], (epicsUInt32)(i*100));
+    BOOST_CHECK_EQUAL(data[i*24 + 23], (epicsUInt32)(i*100 + 23));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Stripe)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < 10; i++)
+  {
+    arrays[i]->uniqueId = 1000 + i;
+    epicsUInt32 *pData = (epicsUInt32 *)arrays[i]->pData;
+    for (int j = 0; j < 24; j++) pData[j] = i*100 + j;
+  }
+
+  // A second writer; the frames are dealt to the two writers in turn as NDPluginScatter does
+  std::string testport("HDF5stripe");
+  uniqueAsynPortName(testport);
+  boost::shared_ptr<HDF5PluginWrapper> hdf5b(new HDF5PluginWrapper(testport.c_str(), 50, 1,
+                                                                   dummy_driver->portName,
+                                                                   0, 0, 2000000));
+  hdf5b->start();
+  hdf5b->write(NDPluginDriverEnableCallbacksString, 1);
+  hdf5b->write(NDPluginDriverBlockingCallbacksString, 1);
+
+  boost::shared_ptr<HDF5PluginWrapper> writers[] = {hdf5, hdf5b};
+  const char *names[] = {"stripe_a", "stripe_b"};
+  for (int w = 0; w < 2; w++)
+  {
+    writers[w]->write(NDFileWriteModeString, NDFileModeStream);
+    writers[w]->write(NDFilePathString, "");
+    writers[w]->write(NDFileNameString, names[w]);
+    writers[w]->write(NDFileTemplateString, "%s%s_%d.5");
+    writers[w]->write(str_NDFileHDF5_stripeCount, 2);
+    writers[w]->write(str_NDFileHDF5_stripeVDSFile, "stripe_vds.5");
+    writers[w]->processCallbacks(arrays[w]);
+    writers[w]->write(NDFileNumCaptureString, 5);
+    writers[w]->write(NDFileCaptureString, 1);
+  }
+
+  for (int i = 0; i < 10; i++)
+  {
+    writers[i%2]->lock();
+    BOOST_CHECK_NO_THROW(writers[i%2]->processCallbacks(arrays[i]));
+    writers[i%2]->unlock();
+  }
+  for (int w = 0; w < 2; w++)
+  {
+    BOOST_CHECK_EQUAL(writers[w]->readInt(NDFileCaptureString), 0);
+    BOOST_CHECK_EQUAL(writers[w]->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  }
+
+  // The VDS presents the frames of both files in uniqueId order
+  std::vector<epicsUInt32> data(10*24);
+  hid_t file = H5Fopen("stripe_vds.5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GE(file, 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE_GE(dataset, 0);
+  hid_t dataspace = H5Dget_space(dataset);
+  BOOST_CHECK_EQUAL(H5Sget_simple_extent_npoints(dataspace), 10*24);
+  H5Sclose(dataspace);
+  BOOST_CHECK_GE(H5Dread(dataset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]), 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  for (int i = 0; i < 10; i++)
+  {
+    BOOST_CHECK_EQUAL(data[i*24], (epicsUInt32)(i*100));
+    BOOST_CHECK_EQUAL(data[i*24 + 23], (epicsUInt32)(i*100 + 23));
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
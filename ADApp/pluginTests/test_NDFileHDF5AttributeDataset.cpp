@@ -717,3 +717,71 @@ BOOST_AUTO_TEST_CASE(test_AttributeDimensionalDataset)
 
 }
 
+
+BOOST_AUTO_TEST_CASE(test_AttributeBufferedDataset)
+{
+  // Open an HDF5 file for testing
+  std::string filename = "test_att_buffered.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  boost::shared_ptr<NDFileHDF5AttributeDataset> adPtr;
+
+  // With chunking of 16 the values are buffered and written 16 at a time. 37 values
+  // leave a partial block that must be written when the dataset is closed.
+  adPtr = boost::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att1", NDAttrInt32));
+  adPtr->setDsetName("dset1");
+  adPtr->createDataset(16);
+  for (epicsInt32 index = 0; index < 37; index++){
+    epicsInt32 val1 = index * 3;
+    NDAttribute ndAttr("att1", "Test attribute 1", NDAttrSourceFunct, "test", NDAttrInt32, &val1);
+    // A SWMR flush part way through a block writes out the values buffered so far
+    adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, (index == 20) ? 1 : 0);
+  }
+  adPtr->closeAttributeDataset();
+
+  // A chunk of strings larger than the buffer limit is written in several blocks
+  adPtr = boost::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att2", NDAttrString));
+  adPtr->setDsetName("dset2");
+  adPtr->createDataset(1000);
+  for (int index = 0; index < 600; index++){
+    char sval2[64];
+    sprintf(sval2, "String %d", index);
+    NDAttribute ndAttr("att2", "Test attribute 2", NDAttrSourceFunct, "test", NDAttrString, sval2);
+    adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, 0);
+  }
+  adPtr->closeAttributeDataset();
+
+  // Read the values back; they must be the same as if each one had been written on its own
+  hid_t dset = H5Dopen2(file, "dset1", H5P_DEFAULT);
+  hid_t space = H5Dget_space(dset);
+  hsize_t dims[1];
+  BOOST_REQUIRE_EQUAL(H5Sget_simple_extent_ndims(space), 1);
+  H5Sget_simple_extent_dims(space, dims, NULL);
+  BOOST_REQUIRE_EQUAL(dims[0], 37);
+  std::vector<epicsInt32> ivals(37);
+  H5Dread(dset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ivals[0]);
+  for (int index = 0; index < 37; index++){
+    BOOST_CHECK_EQUAL(ivals[index], index * 3);
+  }
+  H5Sclose(space);
+  H5Dclose(dset);
+
+  dset = H5Dopen2(file, "dset2", H5P_DEFAULT);
+  space = H5Dget_space(dset);
+  H5Sget_simple_extent_dims(space, dims, NULL);
+  BOOST_REQUIRE_EQUAL(dims[0], 600);
+  hid_t stype = H5Dget_type(dset);
+  std::vector<char> svals(600 * H5Tget_size(stype));
+  H5Dread(dset, stype, H5S_ALL, H5S_ALL, H5P_DEFAULT, &svals[0]);
+  for (int index = 0; index < 600; index++){
+    char sval2[64];
+    sprintf(sval2, "String %d", index);
+    BOOST_CHECK_EQUAL(std::string(&svals[index * H5Tget_size(stype)]), std::string(sval2));
+  }
+  H5Tclose(stype);
+  H5Sclose(space);
+  H5Dclose(dset);
+
+  H5Fclose(file);
+}
@@ -0,0 +1,439 @@
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDFileNetCDF.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+
+#include <netcdf.h>
+
+#include <string.h>
+#include <vector>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define FRAME_X 512
+#define FRAME_Y 512
+#define FRAME_BYTES (FRAME_X * FRAME_Y * sizeof(epicsUInt16))
+
+static const char *testFile = "test_NDFileNetCDF.nc";
+
+// Records the unique ID, first pixel and attributes of the arrays sent by the plugin.
+// The arrays are not kept because they go back to the pool once the callbacks are done.
+class ReplayRecorder : public asynGenericPointerClient {
+public:
+    ReplayRecorder(const char *portName)
+    : asynGenericPointerClient(portName, 0, NDArrayDataString)
+    {
+        this->registerInterruptUser(ReplayRecorder::callback);
+    }
+    static void callback(void *userPvt, asynUser *pasynUser, void *pointer)
+    {
+        ReplayRecorder *self = (ReplayRecorder *)userPvt;
+        NDArray *pArray = (NDArray *)pointer;
+        epicsInt32 counter = -1;
+        char label[32] = "";
+        NDAttribute *pAttribute = pArray->pAttributeList->find("Counter");
+        if (pAttribute) pAttribute->getValue(NDAttrInt32, &counter);
+        pAttribute = pArray->pAttributeList->find("Label");
+        if (pAttribute) pAttribute->getValue(NDAttrString, label, sizeof(label));
+        self->uniqueIds.push_back(pArray->uniqueId);
+        self->firstPixels.push_back(((epicsUInt16 *)pArray->pData)[0]);
+        self->counters.push_back(counter);
+        self->labels.push_back(label);
+    }
+    std::vector<int> uniqueIds;
+    std::vector<int> firstPixels;
+    std::vector<int> counters;
+    std::vector<std::string> labels;
+};
+
+struct NDFileNetCDFFixture
+{
+    NDArrayPool *arrayPool;
+    asynNDArrayDriver *dummy_driver;
+    NDFileNetCDF *netcdf;
+    asynInt32Client *format;
+    asynInt32Client *deflateLevel;
+    asynInt32Client *shuffle;
+    asynInt32Client *framesPerChunk;
+    asynInt32Client *scalarBlock;
+    NDArray *pFrame;
+    std::string testport;
+
+    NDFileNetCDFFixture()
+    {
+        std::string dummy_port("simPort");
+        testport = "NetCDF";
+
+        // Asyn manager doesn't like it if we try to reuse the same port name for multiple drivers (even if only one is ever instantiated at once), so
+        // change it slightly for each test case.
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // We need some upstream driver for our test plugin so that calls to connectToArrayPort don't fail, but we can then ignore it and
+        // call the file methods directly.
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+
+        // This is the plugin under test
+        netcdf = new NDFileNetCDF(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0);
+
+        format = new asynInt32Client(testport.c_str(), 0, NDFileNetCDFFormatString);
+        deflateLevel = new asynInt32Client(testport.c_str(), 0, NDFileNetCDFDeflateLevelString);
+        shuffle = new asynInt32Client(testport.c_str(), 0, NDFileNetCDFShuffleString);
+        framesPerChunk = new asynInt32Client(testport.c_str(), 0, NDFileNetCDFFramesPerChunkString);
+        scalarBlock = new asynInt32Client(testport.c_str(), 0, NDFileNetCDFScalarBlockString);
+
+        // A smooth image with a little noise compresses, but not to nothing
+        size_t dims[2] = {FRAME_X, FRAME_Y};
+        pFrame = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pFrame->pData;
+        for (size_t i=0; i<FRAME_X*FRAME_Y; i++) {
+            pData[i] = (epicsUInt16)((i % FRAME_X) + (i / FRAME_X) + ((i % 7 == 0) ? (i % 5) : 0));
+        }
+        epicsInt32 counter = 0;
+        double exposure = 0.5;
+        pFrame->pAttributeList->add("Counter", "Frame counter", NDAttrInt32, &counter);
+        pFrame->pAttributeList->add("Exposure", "Exposure time", NDAttrFloat64, &exposure);
+        pFrame->pAttributeList->add("Label", "Frame label", NDAttrString, (void *)"frame");
+    }
+    ~NDFileNetCDFFixture()
+    {
+        pFrame->release();
+        delete scalarBlock;
+        delete framesPerChunk;
+        delete shuffle;
+        delete deflateLevel;
+        delete format;
+        delete netcdf;
+        delete dummy_driver;
+        remove(testFile);
+    }
+
+    // Sets the unique ID, first pixel and attributes that identify frame i
+    void setFrame(int i)
+    {
+        char label[32];
+        epicsInt32 counter = i;
+        double exposure = 0.5 + i;
+        pFrame->uniqueId = 100 + i;
+        ((epicsUInt16 *)pFrame->pData)[0] = (epicsUInt16)i;
+        pFrame->pAttributeList->find("Counter")->setValue(&counter);
+        pFrame->pAttributeList->find("Exposure")->setValue(&exposure);
+        sprintf(label, "frame %d", i);
+        pFrame->pAttributeList->find("Label")->setValue(label);
+    }
+
+    void writeFrames(int numFrames)
+    {
+        BOOST_REQUIRE_EQUAL(netcdf->openFile(testFile, (NDFileOpenMode_t)(NDFileModeWrite | NDFileModeMultiple), pFrame), asynSuccess);
+        for (int i = 0; i < numFrames; i++) {
+            setFrame(i);
+            BOOST_REQUIRE_EQUAL(netcdf->writeFile(pFrame), asynSuccess);
+        }
+        BOOST_REQUIRE_EQUAL(netcdf->closeFile(), asynSuccess);
+    }
+
+    // Reads the file back with the netCDF library and checks every frame
+    void checkFrames(int numFrames)
+    {
+        int ncId, varId, dimId;
+        size_t numArrays;
+        std::vector<short> frame(FRAME_X * FRAME_Y);
+
+        BOOST_REQUIRE_EQUAL(nc_open(testFile, NC_NOWRITE, &ncId), 0);
+        BOOST_REQUIRE_EQUAL(nc_inq_dimid(ncId, "numArrays", &dimId), 0);
+        BOOST_REQUIRE_EQUAL(nc_inq_dimlen(ncId, dimId, &numArrays), 0);
+        BOOST_CHECK_EQUAL(numArrays, (size_t)numFrames);
+        for (int i = 0; i < numFrames; i++) {
+            size_t start[3] = {(size_t)i, 0, 0}, count[3] = {1, FRAME_Y, FRAME_X};
+            size_t stringCount[2] = {1, 256};
+            int uniqueId, counter;
+            double exposure;
+            char label[256];
+            BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "array_data", &varId), 0);
+            BOOST_REQUIRE_EQUAL(nc_get_vara_short(ncId, varId, start, count, &frame[0]), 0);
+            BOOST_CHECK_EQUAL(frame[0], i);
+            BOOST_CHECK(memcmp(&frame[1], (epicsUInt16 *)pFrame->pData + 1, FRAME_BYTES - sizeof(epicsUInt16)) == 0);
+            BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "uniqueId", &varId), 0);
+            BOOST_REQUIRE_EQUAL(nc_get_vara_int(ncId, varId, start, count, &uniqueId), 0);
+            BOOST_CHECK_EQUAL(uniqueId, 100 + i);
+            BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Counter", &varId), 0);
+            BOOST_REQUIRE_EQUAL(nc_get_vara_int(ncId, varId, start, count, &counter), 0);
+            BOOST_CHECK_EQUAL(counter, i);
+            BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Exposure", &varId), 0);
+            BOOST_REQUIRE_EQUAL(nc_get_vara_double(ncId, varId, start, count, &exposure), 0);
+            BOOST_CHECK_EQUAL(exposure, 0.5 + i);
+            BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Label", &varId), 0);
+            BOOST_REQUIRE_EQUAL(nc_get_vara_text(ncId, varId, start, stringCount, label), 0);
+            char expected[32];
+            sprintf(expected, "frame %d", i);
+            BOOST_CHECK_EQUAL(string(label), string(expected));
+        }
+        nc_close(ncId);
+    }
+
+    long fileSize()
+    {
+        FILE *fp = fopen(testFile, "rb");
+        if (!fp) return 0;
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fclose(fp);
+        return size;
+    }
+
+    // Writes 100 frames and returns the size of the file
+    long benchmarkWrite(int fmt, int chunkFrames, int level, int block)
+    {
+        const int numFrames = 100;
+        epicsTimeStamp tStart, tEnd;
+
+        format->write(fmt);
+        framesPerChunk->write(chunkFrames);
+        deflateLevel->write(level);
+        shuffle->write(level > 0);
+        scalarBlock->write(block);
+
+        epicsTimeGetCurrent(&tStart);
+        writeFrames(numFrames);
+        epicsTimeGetCurrent(&tEnd);
+
+        double elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+        long size = fileSize();
+        BOOST_TEST_MESSAGE("format=" << fmt << " framesPerChunk=" << chunkFrames << " deflateLevel=" << level
+                           << " scalarBlock=" << block
+                           << " wrote " << numFrames * FRAME_BYTES / elapsed / 1048576. << " MB/s, "
+                           << "file size " << size << " bytes");
+        return size;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileNetCDFTests, NDFileNetCDFFixture)
+
+BOOST_AUTO_TEST_CASE(test_Classic)
+{
+  // One write of the scalar variables per frame, as before they were buffered
+  writeFrames(10);
+  checkFrames(10);
+
+  // Blocks that do not divide the number of frames, the last block is written on close
+  scalarBlock->write(4);
+  writeFrames(10);
+  checkFrames(10);
+}
+
+BOOST_AUTO_TEST_CASE(test_SingleArray)
+{
+  // A file with one array has one record whatever the block size
+  scalarBlock->write(8);
+  setFrame(3);
+  BOOST_REQUIRE_EQUAL(netcdf->openFile(testFile, NDFileModeWrite, pFrame), asynSuccess);
+  BOOST_REQUIRE_EQUAL(netcdf->writeFile(pFrame), asynSuccess);
+  BOOST_REQUIRE_EQUAL(netcdf->closeFile(), asynSuccess);
+  int ncId, varId, uniqueId;
+  size_t start[1] = {0}, count[1] = {1};
+  BOOST_REQUIRE_EQUAL(nc_open(testFile, NC_NOWRITE, &ncId), 0);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "uniqueId", &varId), 0);
+  BOOST_REQUIRE_EQUAL(nc_get_vara_int(ncId, varId, start, count, &uniqueId), 0);
+  BOOST_CHECK_EQUAL(uniqueId, 103);
+  nc_close(ncId);
+}
+
+#ifdef NC_NETCDF4
+BOOST_AUTO_TEST_CASE(test_NetCDF4)
+{
+  int ncId, varId, fileFormat, storage;
+  size_t chunks[3];
+
+  format->write(NDFileNetCDFFormatNetCDF4);
+  framesPerChunk->write(4);
+  scalarBlock->write(16);
+  writeFrames(10);
+  checkFrames(10);
+
+  // Each chunk of the array data is 4 whole frames
+  BOOST_REQUIRE_EQUAL(nc_open(testFile, NC_NOWRITE, &ncId), 0);
+  BOOST_REQUIRE_EQUAL(nc_inq_format(ncId, &fileFormat), 0);
+  BOOST_CHECK_EQUAL(fileFormat, NC_FORMAT_NETCDF4);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "array_data", &varId), 0);
+  BOOST_REQUIRE_EQUAL(nc_inq_var_chunking(ncId, varId, &storage, chunks), 0);
+  BOOST_CHECK_EQUAL(storage, NC_CHUNKED);
+  BOOST_CHECK_EQUAL(chunks[0], 4u);
+  BOOST_CHECK_EQUAL(chunks[1], (size_t)FRAME_Y);
+  BOOST_CHECK_EQUAL(chunks[2], (size_t)FRAME_X);
+  nc_close(ncId);
+}
+
+BOOST_AUTO_TEST_CASE(test_Deflate)
+{
+  int ncId, varId, shuffleOn, deflateOn, level;
+  long uncompressedSize;
+
+  format->write(NDFileNetCDFFormatNetCDF4);
+  writeFrames(10);
+  uncompressedSize = fileSize();
+
+  deflateLevel->write(4);
+  shuffle->write(1);
+  writeFrames(10);
+  checkFrames(10);
+  BOOST_TEST_MESSAGE("deflate file size " << fileSize() << " uncompressed " << uncompressedSize);
+  BOOST_CHECK_LT(fileSize(), uncompressedSize);
+
+  BOOST_REQUIRE_EQUAL(nc_open(testFile, NC_NOWRITE, &ncId), 0);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "array_data", &varId), 0);
+  BOOST_REQUIRE_EQUAL(nc_inq_var_deflate(ncId, varId, &shuffleOn, &deflateOn, &level), 0);
+  BOOST_CHECK_EQUAL(shuffleOn, 1);
+  BOOST_CHECK_EQUAL(deflateOn, 1);
+  BOOST_CHECK_EQUAL(level, 4);
+  nc_close(ncId);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_ReadFile)
+{
+  NDArray *pRead = NULL;
+
+  scalarBlock->write(4);
+  writeFrames(10);
+  BOOST_REQUIRE_EQUAL(netcdf->openFile(testFile, (NDFileOpenMode_t)(NDFileModeRead | NDFileModeMultiple), NULL), asynSuccess);
+  BOOST_REQUIRE_EQUAL(netcdf->getNumArraysInFile(), 10);
+  for (int i = 0; i < 10; i++) {
+    setFrame(i);
+    BOOST_REQUIRE_EQUAL(netcdf->readFile(&pRead), asynSuccess);
+    BOOST_REQUIRE_EQUAL(pRead->ndims, 2);
+    BOOST_CHECK_EQUAL(pRead->dims[0].size, (size_t)FRAME_X);
+    BOOST_CHECK_EQUAL(pRead->dims[1].size, (size_t)FRAME_Y);
+    BOOST_CHECK_EQUAL(pRead->dataType, NDUInt16);
+    BOOST_CHECK_EQUAL(pRead->uniqueId, 100 + i);
+    BOOST_CHECK(memcmp(pRead->pData, pFrame->pData, FRAME_BYTES) == 0);
+    epicsInt32 counter = -1;
+    double exposure = 0;
+    char label[32] = "";
+    BOOST_REQUIRE(pRead->pAttributeList->find("Counter") != NULL);
+    pRead->pAttributeList->find("Counter")->getValue(NDAttrInt32, &counter);
+    BOOST_CHECK_EQUAL(counter, i);
+    BOOST_REQUIRE(pRead->pAttributeList->find("Exposure") != NULL);
+    pRead->pAttributeList->find("Exposure")->getValue(NDAttrFloat64, &exposure);
+    BOOST_CHECK_EQUAL(exposure, 0.5 + i);
+    BOOST_REQUIRE(pRead->pAttributeList->find("Label") != NULL);
+    pRead->pAttributeList->find("Label")->getValue(NDAttrString, label, sizeof(label));
+    char expected[32];
+    sprintf(expected, "frame %d", i);
+    BOOST_CHECK_EQUAL(string(label), string(expected));
+    BOOST_CHECK_EQUAL(string(pRead->pAttributeList->find("Label")->getDescription()), string("Frame label"));
+    pRead->release();
+  }
+  // Reading past the end of the file fails
+  BOOST_CHECK_EQUAL(netcdf->readFile(&pRead), asynError);
+  BOOST_CHECK_EQUAL(netcdf->closeFile(), asynSuccess);
+}
+
+// 64-bit integers are stored as their bits in double variables and must read back unchanged
+BOOST_AUTO_TEST_CASE(test_ReadFileInt64)
+{
+  size_t dims[2] = {4, 2};
+  epicsInt64 values[8] = {0, 1, -2, 1000, (epicsInt64)1 << 40, -((epicsInt64)1 << 53) - 1,
+                          ((epicsInt64)1 << 62) + 3, -1};
+  epicsInt64 total = ((epicsInt64)1 << 60) + 12345;
+  epicsInt64 readTotal = 0;
+  NDArray *pRead = NULL;
+
+  NDArray *pArray = arrayPool->alloc(2, dims, NDInt64, 0, NULL);
+  BOOST_REQUIRE(pArray != NULL);
+  memcpy(pArray->pData, values, sizeof(values));
+  pArray->uniqueId = 7;
+  pArray->pAttributeList->add("Total", "Total counts", NDAttrInt64, &total);
+  BOOST_REQUIRE_EQUAL(netcdf->openFile(testFile, NDFileModeWrite, pArray), asynSuccess);
+  BOOST_REQUIRE_EQUAL(netcdf->writeFile(pArray), asynSuccess);
+  BOOST_REQUIRE_EQUAL(netcdf->closeFile(), asynSuccess);
+  pArray->release();
+
+  BOOST_REQUIRE_EQUAL(netcdf->openFile(testFile, NDFileModeRead, NULL), asynSuccess);
+  BOOST_REQUIRE_EQUAL(netcdf->readFile(&pRead), asynSuccess);
+  BOOST_CHECK_EQUAL(pRead->dataType, NDInt64);
+  BOOST_CHECK_EQUAL(pRead->uniqueId, 7);
+  epicsInt64 *pData = (epicsInt64 *)pRead->pData;
+  for (int i = 0; i < 8; i++) {
+    BOOST_CHECK_EQUAL(pData[i], values[i]);
+  }
+  BOOST_REQUIRE(pRead->pAttributeList->find("Total") != NULL);
+  pRead->pAttributeList->find("Total")->getValue(NDAttrInt64, &readTotal);
+  BOOST_CHECK_EQUAL(readTotal, total);
+  pRead->release();
+  BOOST_CHECK_EQUAL(netcdf->closeFile(), asynSuccess);
+}
+
+BOOST_AUTO_TEST_CASE(test_Replay)
+{
+  asynOctetClient filePath(testport.c_str(), 0, NDFilePathString);
+  asynOctetClient fileName(testport.c_str(), 0, NDFileNameString);
+  asynOctetClient fileTemplate(testport.c_str(), 0, NDFileTemplateString);
+  asynInt32Client arrayCallbacks(testport.c_str(), 0, NDArrayCallbacksString);
+  asynInt32Client replay(testport.c_str(), 0, NDFileReplayString);
+  asynInt32Client replayReadAhead(testport.c_str(), 0, NDFileReplayReadAheadString);
+  asynInt32Client replayNumArrays(testport.c_str(), 0, NDFileReplayNumArraysString);
+  asynInt32Client replayCount(testport.c_str(), 0, NDFileReplayCountString);
+  ReplayRecorder recorder(testport.c_str());
+  size_t nActual;
+  epicsInt32 value;
+
+  writeFrames(10);
+  filePath.write("", 0, &nActual);
+  fileName.write(testFile, strlen(testFile), &nActual);
+  fileTemplate.write("%s%s", 4, &nActual);
+  arrayCallbacks.write(1);
+  replayReadAhead.write(3);
+
+  // Replay the file as fast as possible, the arrays are sent in order with their attributes
+  BOOST_REQUIRE_EQUAL(replay.write(1), asynSuccess);
+  for (int i = 0; i < 500; i++) {
+    replay.read(&value);
+    if (value == 0) break;
+    epicsThreadSleep(0.01);
+  }
+  BOOST_REQUIRE_EQUAL(value, 0);
+  replayNumArrays.read(&value);
+  BOOST_CHECK_EQUAL(value, 10);
+  replayCount.read(&value);
+  BOOST_CHECK_EQUAL(value, 10);
+  BOOST_REQUIRE_EQUAL(recorder.uniqueIds.size(), 10u);
+  for (int i = 0; i < 10; i++) {
+    char expected[32];
+    sprintf(expected, "frame %d", i);
+    BOOST_CHECK_EQUAL(recorder.uniqueIds[i], 100 + i);
+    BOOST_CHECK_EQUAL(recorder.firstPixels[i], i);
+    BOOST_CHECK_EQUAL(recorder.counters[i], i);
+    BOOST_CHECK_EQUAL(recorder.labels[i], string(expected));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_Formats)
+{
+  benchmarkWrite(NDFileNetCDFFormatClassic, 1, 0, 1);
+  benchmarkWrite(NDFileNetCDFFormatClassic, 1, 0, 100);
+#ifdef NC_NETCDF4
+  int chunkFrames[] = {1, 8};
+  for (size_t i = 0; i < sizeof(chunkFrames)/sizeof(chunkFrames[0]); i++) {
+    benchmarkWrite(NDFileNetCDFFormatNetCDF4, chunkFrames[i], 0, 1);
+    long uncompressed = benchmarkWrite(NDFileNetCDFFormatNetCDF4, chunkFrames[i], 0, 100);
+    long deflate1 = benchmarkWrite(NDFileNetCDFFormatNetCDF4, chunkFrames[i], 1, 100);
+    long deflate6 = benchmarkWrite(NDFileNetCDFFormatNetCDF4, chunkFrames[i], 6, 100);
+    // The frames are smooth ramps, which shuffle and deflate compress well
+    BOOST_CHECK_LT(deflate1, uncompressed);
+    BOOST_CHECK_LT(deflate6, uncompressed);
+  }
+#endif
+}
+
+BOOST_AUTO_TEST_SUITE_END()
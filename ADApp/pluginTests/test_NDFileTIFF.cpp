@@ -0,0 +1,362 @@
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDFileTIFF.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+#include <epicsTime.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define FRAME_X 1000
+#define FRAME_Y 600
+#define FRAME_BYTES (FRAME_X * FRAME_Y * sizeof(epicsUInt16))
+
+static const char *testFile = "test_NDFileTIFF.tif";
+
+struct NDFileTIFFFixture
+{
+    NDArrayPool *arrayPool;
+    asynNDArrayDriver *dummy_driver;
+    NDFileTIFF *tiff;
+    asynInt32Client *rowsPerStrip;
+    asynInt32Client *tileWidth;
+    asynInt32Client *tileLength;
+    asynInt32Client *compression;
+    asynInt32Client *compressLevel;
+    asynInt32Client *compressThreads;
+    asynInt32Client *bigTIFF;
+    asynInt32Client *multiPage;
+    asynInt32Client *numPages;
+    NDArray *pFrame;
+
+    NDFileTIFFFixture()
+    {
+        std::string dummy_port("simPort"), testport("TIFF");
+
+        // Asyn manager doesn't like it if we try to reuse the same port name for multiple drivers (even if only one is ever instantiated at once), so
+        // change it slightly for each test case.
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // We need some upstream driver for our test plugin so that calls to connectToArrayPort don't fail, but we can then ignore it and
+        // call the file methods directly.
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+
+        // This is the plugin under test
+        tiff = new NDFileTIFF(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0);
+
+        rowsPerStrip = new asynInt32Client(testport.c_str(), 0, NDFileTIFFRowsPerStripString);
+        tileWidth = new asynInt32Client(testport.c_str(), 0, NDFileTIFFTileWidthString);
+        tileLength = new asynInt32Client(testport.c_str(), 0, NDFileTIFFTileLengthString);
+        compression = new asynInt32Client(testport.c_str(), 0, NDFileTIFFCompressionString);
+        compressLevel = new asynInt32Client(testport.c_str(), 0, NDFileTIFFCompressLevelString);
+        compressThreads = new asynInt32Client(testport.c_str(), 0, NDFileTIFFCompressThreadsString);
+        bigTIFF = new asynInt32Client(testport.c_str(), 0, NDFileTIFFBigTIFFString);
+        multiPage = new asynInt32Client(testport.c_str(), 0, NDFileTIFFMultiPageString);
+        numPages = new asynInt32Client(testport.c_str(), 0, NDFileTIFFNumPagesString);
+
+        // A smooth image with a little noise compresses, but not to nothing
+        size_t dims[2] = {FRAME_X, FRAME_Y};
+        pFrame = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pFrame->pData;
+        for (size_t i=0; i<FRAME_X*FRAME_Y; i++) {
+            pData[i] = (epicsUInt16)((i % FRAME_X) + (i / FRAME_X) + ((i % 7 == 0) ? (i % 5) : 0));
+        }
+        pFrame->uniqueId = 42;
+    }
+    ~NDFileTIFFFixture()
+    {
+        pFrame->release();
+        delete numPages;
+        delete multiPage;
+        delete bigTIFF;
+        delete compressThreads;
+        delete compressLevel;
+        delete compression;
+        delete tileLength;
+        delete tileWidth;
+        delete rowsPerStrip;
+        delete tiff;
+        delete dummy_driver;
+        remove(testFile);
+    }
+
+    void writeFrame(NDArray *pArray)
+    {
+        BOOST_REQUIRE_EQUAL(tiff->openFile(testFile, NDFileModeWrite, pArray), asynSuccess);
+        BOOST_REQUIRE_EQUAL(tiff->writeFile(pArray), asynSuccess);
+        BOOST_REQUIRE_EQUAL(tiff->closeFile(), asynSuccess);
+    }
+
+    // Writes the frame with the current settings, reads it back and checks that it is unchanged
+    void checkRoundTrip(NDArray *pArray)
+    {
+        NDArray *pRead = NULL;
+        NDArrayInfo_t info;
+
+        pArray->getInfo(&info);
+        writeFrame(pArray);
+        BOOST_REQUIRE_EQUAL(tiff->openFile(testFile, NDFileModeRead, NULL), asynSuccess);
+        BOOST_CHECK_EQUAL(tiff->readFile(&pRead), asynSuccess);
+        tiff->closeFile();
+        BOOST_REQUIRE(pRead != NULL);
+        BOOST_CHECK_EQUAL(pRead->ndims, pArray->ndims);
+        BOOST_CHECK_EQUAL(pRead->dataType, pArray->dataType);
+        BOOST_CHECK(memcmp(pRead->pData, pArray->pData, info.totalBytes) == 0);
+        BOOST_CHECK_EQUAL(pRead->uniqueId, pArray->uniqueId);
+        pRead->release();
+    }
+
+    void setLayout(int rows, int width, int length)
+    {
+        rowsPerStrip->write(rows);
+        tileWidth->write(width);
+        tileLength->write(length);
+    }
+
+    long fileSize()
+    {
+        FILE *fp = fopen(testFile, "rb");
+        if (!fp) return 0;
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fclose(fp);
+        return size;
+    }
+
+    void benchmarkWrite(int rows, int comp, int numThreads)
+    {
+        const int numFrames = 20;
+        epicsTimeStamp tStart, tEnd;
+
+        setLayout(rows, 0, 0);
+        compression->write(comp);
+        compressThreads->write(numThreads);
+
+        epicsTimeGetCurrent(&tStart);
+        for (int i = 0; i < numFrames; i++)
+            writeFrame(pFrame);
+        epicsTimeGetCurrent(&tEnd);
+
+        double elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+        BOOST_TEST_MESSAGE("rowsPerStrip=" << rows << " compression=" << comp << " threads=" << numThreads
+                           << " wrote " << numFrames * FRAME_BYTES / elapsed / 1048576. << " MB/s, "
+                           << "file size " << fileSize() << " bytes");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileTIFFTests, NDFileTIFFFixture)
+
+BOOST_AUTO_TEST_CASE(test_Strips)
+{
+  // One strip per image, as before strips could be configured
+  checkRoundTrip(pFrame);
+
+  // Strips that do not divide the image
+  setLayout(64, 0, 0);
+  checkRoundTrip(pFrame);
+}
+
+BOOST_AUTO_TEST_CASE(test_Tiles)
+{
+  // Tile sizes are rounded up to multiples of 16 and the edge tiles are partly outside the image
+  setLayout(0, 100, 100);
+  checkRoundTrip(pFrame);
+  int value;
+  tileWidth->read(&value);
+  BOOST_CHECK_EQUAL(value, 112);
+  tileLength->read(&value);
+  BOOST_CHECK_EQUAL(value, 112);
+}
+
+BOOST_AUTO_TEST_CASE(test_Compression)
+{
+  long uncompressedSize;
+
+  setLayout(32, 0, 0);
+  writeFrame(pFrame);
+  uncompressedSize = fileSize();
+
+  for (int comp = NDFileTIFFCompressDeflate; comp <= NDFileTIFFCompressZstd; comp++) {
+    compression->write(comp);
+    for (int numThreads = 0; numThreads <= 4; numThreads += 4) {
+      compressThreads->write(numThreads);
+      setLayout(32, 0, 0);
+      checkRoundTrip(pFrame);
+      BOOST_TEST_MESSAGE("compression=" << comp << " threads=" << numThreads
+                         << " file size " << fileSize() << " uncompressed " << uncompressedSize);
+      // A TIFF library built without zstd writes the file uncompressed
+      bool compressed = (comp != NDFileTIFFCompressZstd);
+#ifdef COMPRESSION_ZSTD
+      compressed = compressed || TIFFIsCODECConfigured(COMPRESSION_ZSTD);
+#endif
+      if (compressed) BOOST_CHECK_LT(fileSize(), uncompressedSize);
+      setLayout(0, 128, 64);
+      checkRoundTrip(pFrame);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_ColorModes)
+{
+  // Planar and row interleaved color are written a plane at a time, each split into strips or tiles
+  size_t dims[3] = {FRAME_X/4, FRAME_Y/4, 3};
+  for (int colorMode = NDColorModeRGB2; colorMode <= NDColorModeRGB3; colorMode++) {
+    if (colorMode == NDColorModeRGB2) {
+      dims[0] = FRAME_X/4; dims[1] = 3; dims[2] = FRAME_Y/4;
+    } else {
+      dims[0] = FRAME_X/4; dims[1] = FRAME_Y/4; dims[2] = 3;
+    }
+    NDArray *pColor = arrayPool->alloc(3, dims, NDUInt8, 0, NULL);
+    epicsUInt8 *pData = (epicsUInt8 *)pColor->pData;
+    for (size_t i=0; i<dims[0]*dims[1]*dims[2]; i++) pData[i] = (epicsUInt8)(i * 13);
+    pColor->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+    compression->write(NDFileTIFFCompressDeflate);
+    compressThreads->write(2);
+    setLayout(16, 0, 0);
+    if (colorMode == NDColorModeRGB3) {
+      checkRoundTrip(pColor);
+      setLayout(0, 32, 32);
+      checkRoundTrip(pColor);
+    } else {
+      // RGB2 is read back as RGB3, check that it writes
+      writeFrame(pColor);
+    }
+    pColor->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_BigTIFF)
+{
+  bigTIFF->write(1);
+  setLayout(64, 0, 0);
+  checkRoundTrip(pFrame);
+  FILE *fp = fopen(testFile, "rb");
+  BOOST_REQUIRE(fp != NULL);
+  unsigned char header[4];
+  BOOST_REQUIRE_EQUAL(fread(header, 1, 4, fp), 4u);
+  fclose(fp);
+  // Classic TIFF has version 42 in the header, BigTIFF has 43
+  BOOST_CHECK_EQUAL(header[0] == 'I' ? header[2] : header[3], 43);
+}
+
+BOOST_AUTO_TEST_CASE(test_MultiPage)
+{
+  const int numFrames = 5;
+  int value;
+
+  multiPage->write(1);
+  compression->write(NDFileTIFFCompressDeflate);
+  compressThreads->write(2);
+  setLayout(64, 0, 0);
+  BOOST_REQUIRE_EQUAL(tiff->openFile(testFile, (NDFileOpenMode_t)(NDFileModeWrite | NDFileModeMultiple), pFrame), asynSuccess);
+  for (int i = 0; i < numFrames; i++) {
+    pFrame->uniqueId = 100 + i;
+    ((epicsUInt16 *)pFrame->pData)[0] = (epicsUInt16)i;
+    BOOST_REQUIRE_EQUAL(tiff->writeFile(pFrame), asynSuccess);
+  }
+  numPages->read(&value);
+  BOOST_CHECK_EQUAL(value, numFrames);
+
+  // Every page must have the layout of the first
+  size_t dims[2] = {FRAME_X/2, FRAME_Y};
+  NDArray *pOther = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+  BOOST_CHECK_EQUAL(tiff->writeFile(pOther), asynError);
+  pOther->release();
+  BOOST_REQUIRE_EQUAL(tiff->closeFile(), asynSuccess);
+
+  // Each frame is a directory of the file with its own unique ID
+  TIFF *pTiff = TIFFOpen(testFile, "r");
+  BOOST_REQUIRE(pTiff != NULL);
+  BOOST_CHECK_EQUAL(TIFFNumberOfDirectories(pTiff), (unsigned)numFrames);
+  std::vector<epicsUInt16> page(FRAME_X * FRAME_Y);
+  for (int i = 0; i < numFrames; i++) {
+    BOOST_REQUIRE(TIFFSetDirectory(pTiff, i));
+    char *pData = (char *)&page[0];
+    for (uint32_t strip = 0; strip < TIFFNumberOfStrips(pTiff); strip++)
+      pData += TIFFReadEncodedStrip(pTiff, strip, pData, -1);
+    BOOST_CHECK_EQUAL(page[0], i);
+    BOOST_CHECK(memcmp(&page[1], (epicsUInt16 *)pFrame->pData + 1, FRAME_BYTES - sizeof(epicsUInt16)) == 0);
+    uint32_t subfileType = 0;
+    uint16_t pageNumber = 0, numberOfPages = 0;
+    BOOST_CHECK(TIFFGetField(pTiff, TIFFTAG_SUBFILETYPE, &subfileType));
+    BOOST_CHECK_EQUAL(subfileType, (uint32_t)FILETYPE_PAGE);
+    BOOST_CHECK(TIFFGetField(pTiff, TIFFTAG_PAGENUMBER, &pageNumber, &numberOfPages));
+    BOOST_CHECK_EQUAL(pageNumber, i);
+  }
+  TIFFClose(pTiff);
+
+  // A single array written with MultiPage set is not marked as a page of a document
+  writeFrame(pFrame);
+  pTiff = TIFFOpen(testFile, "r");
+  BOOST_REQUIRE(pTiff != NULL);
+  BOOST_CHECK_EQUAL(TIFFNumberOfDirectories(pTiff), 1u);
+  uint32_t subfileType = FILETYPE_PAGE;
+  BOOST_CHECK(TIFFGetFieldDefaulted(pTiff, TIFFTAG_SUBFILETYPE, &subfileType));
+  BOOST_CHECK_EQUAL(subfileType, 0u);
+  uint16_t pageNumber, numberOfPages;
+  BOOST_CHECK(!TIFFGetField(pTiff, TIFFTAG_PAGENUMBER, &pageNumber, &numberOfPages));
+  TIFFClose(pTiff);
+
+  // The first page is read back by the plugin
+  NDArray *pRead = NULL;
+  BOOST_REQUIRE_EQUAL(tiff->openFile(testFile, NDFileModeRead, NULL), asynSuccess);
+  BOOST_CHECK_EQUAL(tiff->readFile(&pRead), asynSuccess);
+  tiff->closeFile();
+  BOOST_REQUIRE(pRead != NULL);
+  BOOST_CHECK_EQUAL(pRead->uniqueId, 100);
+  pRead->release();
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_MultiPage)
+{
+  const int numFrames = 100;
+  epicsTimeStamp tStart, tEnd;
+
+  setLayout(0, 0, 0);
+  epicsTimeGetCurrent(&tStart);
+  for (int i = 0; i < numFrames; i++)
+    writeFrame(pFrame);
+  epicsTimeGetCurrent(&tEnd);
+  double elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+  BOOST_TEST_MESSAGE("one file per frame: " << numFrames / elapsed << " frames/s, "
+                     << numFrames * FRAME_BYTES / elapsed / 1048576. << " MB/s");
+
+  multiPage->write(1);
+  epicsTimeGetCurrent(&tStart);
+  BOOST_REQUIRE_EQUAL(tiff->openFile(testFile, (NDFileOpenMode_t)(NDFileModeWrite | NDFileModeMultiple), pFrame), asynSuccess);
+  for (int i = 0; i < numFrames; i++)
+    BOOST_REQUIRE_EQUAL(tiff->writeFile(pFrame), asynSuccess);
+  BOOST_REQUIRE_EQUAL(tiff->closeFile(), asynSuccess);
+  epicsTimeGetCurrent(&tEnd);
+  elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+  BOOST_TEST_MESSAGE("multi-page file: " << numFrames / elapsed << " frames/s, "
+                     << numFrames * FRAME_BYTES / elapsed / 1048576. << " MB/s");
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_StripSize)
+{
+  int stripRows[] = {0, 256, 64, 16, 4, 1};
+  for (size_t i = 0; i < sizeof(stripRows)/sizeof(stripRows[0]); i++)
+    benchmarkWrite(stripRows[i], NDFileTIFFCompressNone, 0);
+  for (size_t i = 1; i < sizeof(stripRows)/sizeof(stripRows[0]) - 1; i++) {
+    benchmarkWrite(stripRows[i], NDFileTIFFCompressDeflate, 0);
+    benchmarkWrite(stripRows[i], NDFileTIFFCompressDeflate, 4);
+    benchmarkWrite(stripRows[i], NDFileTIFFCompressZstd, 0);
+    benchmarkWrite(stripRows[i], NDFileTIFFCompressZstd, 4);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,14 +10,47 @@
 #include <NDArray.h>
 #include <asynDriver.h>
 #include <asynPortClient.h>
+#include <epicsTime.h>
 
 #include <string.h>
 #include <stdint.h>
+#include <vector>
 
 #include "testingutilities.h"
 
 using namespace std;
 
+#define FRAME_X 512
+#define FRAME_Y 512
+#define FRAME_BYTES (FRAME_X * FRAME_Y * sizeof(epicsUInt16))
+
+// The plugin releases the arrays from the pre-trigger ring as it flushes it, so the pool
+// can reuse them before the test looks at them. This downstream client keeps a copy of the data.
+static void DataCopyPluginCallback(void *drvPvt, asynUser *pasynUser, void *ptr);
+
+class DataCopyPlugin : public asynGenericPointerClient {
+public:
+  DataCopyPlugin(const char *portName, int addr)
+  : asynGenericPointerClient(portName, addr, NDArrayDataString)
+  {
+    this->registerInterruptUser(DataCopyPluginCallback);
+  }
+  void callback(NDArray *pArray)
+  {
+    NDArrayInfo_t info;
+    pArray->getInfo(&info);
+    codecs.push_back(pArray->codec.name);
+    data.push_back(std::vector<char>((char *)pArray->pData, (char *)pArray->pData + info.totalBytes));
+  }
+  std::vector<std::string> codecs;
+  std::vector<std::vector<char> > data;
+};
+
+static void DataCopyPluginCallback(void *drvPvt, asynUser *pasynUser, void *ptr)
+{
+  ((DataCopyPlugin *)drvPvt)->callback((NDArray *)ptr);
+}
+
 
 struct NDPluginCircularBuffFixture
 {
@@ -34,6 +67,13 @@ struct NDPluginCircularBuffFixture
     asynOctetClient *cbTrigA;
     asynOctetClient *cbTrigB;
     asynOctetClient *cbCalc;
+    asynInt32Client *cbCompression;
+    asynInt32Client *cbCompressThreads;
+    asynFloat64Client *cbPreTriggerMaxMem;
+    asynFloat64Client *cbPreTriggerMem;
+    asynInt32Client *cbZeroCopy;
+    asynInt32Client *cbMinUpstreamFree;
+    asynInt32Client *cbNumHeld;
 
     NDPluginCircularBuffFixture()
     {
@@ -66,10 +106,24 @@ struct NDPluginCircularBuffFixture
         cbTrigA = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerAString);
         cbTrigB = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerBString);
         cbCalc = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerCalcString);
+        cbCompression = new asynInt32Client(testport.c_str(), 0, NDCircBuffCompressionString);
+        cbCompressThreads = new asynInt32Client(testport.c_str(), 0, NDCircBuffCompressThreadsString);
+        cbPreTriggerMaxMem = new asynFloat64Client(testport.c_str(), 0, NDCircBuffPreTriggerMaxMemString);
+        cbPreTriggerMem = new asynFloat64Client(testport.c_str(), 0, NDCircBuffPreTriggerMemString);
+        cbZeroCopy = new asynInt32Client(testport.c_str(), 0, NDCircBuffZeroCopyString);
+        cbMinUpstreamFree = new asynInt32Client(testport.c_str(), 0, NDCircBuffMinUpstreamFreeString);
+        cbNumHeld = new asynInt32Client(testport.c_str(), 0, NDCircBuffNumHeldString);
 
     }
     ~NDPluginCircularBuffFixture()
     {
+        delete cbNumHeld;
+        delete cbMinUpstreamFree;
+        delete cbZeroCopy;
+        delete cbPreTriggerMem;
+        delete cbPreTriggerMaxMem;
+        delete cbCompressThreads;
+        delete cbCompression;
         delete cbCalc;
         delete cbTrigB;
         delete cbTrigA;
@@ -89,6 +143,94 @@ struct NDPluginCircularBuffFixture
         cb->processCallbacks(pArray);
         cb->unlock();
     }
+    // A smooth image with a little noise, offset by index so each image is different
+    NDArray *allocFrame(int index)
+    {
+        size_t dims[2] = {FRAME_X, FRAME_Y};
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+        for (size_t i = 0; i < FRAME_X*FRAME_Y; i++) {
+            pData[i] = (epicsUInt16)(index + (i / FRAME_X) + ((i % 7 == 0) ? (i % 3) : 0));
+        }
+        return pArray;
+    }
+    // Fills the pre-trigger ring of numPre with compression, then triggers and checks that
+    // the pre-trigger images come out uncompressed and unchanged
+    void checkCompressedPreBuffer(NDCircBuffCompression_t compression, int numThreads)
+    {
+        size_t gotbytes;
+        const int numPre = 5;
+        NDArray *frames[numPre + 1];
+        DataCopyPlugin copier(cb->portName, 0);
+
+        cbCalc->write("0", 2, &gotbytes);
+        cbCompression->write(compression);
+        cbCompressThreads->write(numThreads);
+        cbPreTrigger->write(numPre);
+        cbPostTrigger->write(1);
+        cbControl->write(1);
+
+        for (int i = 0; i < numPre + 1; i++)
+            frames[i] = allocFrame(i);
+        for (int i = 0; i < numPre; i++)
+            cbProcess(frames[i]);
+
+        double preTriggerMem;
+        cbPreTriggerMem->read(&preTriggerMem);
+        BOOST_TEST_MESSAGE("compression=" << compression << " threads=" << numThreads
+                           << " pre-trigger memory=" << preTriggerMem << " MB for " << numPre << " images");
+
+        cbSoftTrigger->write(1);
+        cbProcess(frames[numPre]);
+
+        BOOST_REQUIRE_EQUAL(copier.data.size(), (size_t)(numPre + 1));
+        for (int i = 0; i < numPre + 1; i++) {
+            BOOST_CHECK(copier.codecs[i].empty());
+            BOOST_REQUIRE_EQUAL(copier.data[i].size(), FRAME_BYTES);
+            BOOST_CHECK(memcmp(&copier.data[i][0], frames[i]->pData, FRAME_BYTES) == 0);
+        }
+        // The ring has been flushed
+        cbPreTriggerMem->read(&preTriggerMem);
+        BOOST_CHECK_EQUAL(preTriggerMem, 0.0);
+
+        for (int i = 0; i < numPre + 1; i++)
+            frames[i]->release();
+    }
+    // Reports the rate at which the pre-trigger ring can store images, and returns the memory in MB
+    // used by the 50 images in the ring
+    double benchmarkPreBuffer(NDCircBuffCompression_t compression, int numThreads)
+    {
+        size_t gotbytes;
+        const int numFrames = 200;
+        NDArray *frames[4];
+        epicsTimeStamp tStart, tEnd;
+        double preTriggerMem;
+
+        cbCalc->write("0", 2, &gotbytes);
+        cbCompression->write(compression);
+        cbCompressThreads->write(numThreads);
+        cbPreTrigger->write(50);
+        cbControl->write(1);
+
+        for (int i = 0; i < 4; i++)
+            frames[i] = allocFrame(i);
+
+        epicsTimeGetCurrent(&tStart);
+        for (int i = 0; i < numFrames; i++)
+            cbProcess(frames[i % 4]);
+        epicsTimeGetCurrent(&tEnd);
+
+        double elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+        cbPreTriggerMem->read(&preTriggerMem);
+        BOOST_TEST_MESSAGE("compression=" << compression << " threads=" << numThreads
+                           << " stored " << numFrames / elapsed << " frames/s, "
+                           << numFrames * FRAME_BYTES / elapsed / 1048576. << " MB/s, "
+                           << "50 images use " << preTriggerMem << " MB");
+
+        for (int i = 0; i < 4; i++)
+            frames[i]->release();
+        return preTriggerMem;
+    }
 };
 
 BOOST_FIXTURE_TEST_SUITE(CircularBuffTests, NDPluginCircularBuffFixture)
@@ -183,4 +325,170 @@ BOOST_AUTO_TEST_CASE(test_PreBufferOrder)
     BOOST_CHECK_EQUAL(3, ((uint8_t *)ds->arrays[3]->pData)[0]);
 }
 
+BOOST_AUTO_TEST_CASE(test_PreBufferMemoryLimit)
+{
+    size_t gotbytes;
+    int eom;
+    int storedImages;
+    double preTriggerMem;
+    char status[50] = {0};
+
+    cbCalc->write("0", 2, &gotbytes);
+
+    // Room for 4 images, although the pre-count allows 10
+    cbPreTrigger->write(10);
+    cbPreTriggerMaxMem->write(4 * FRAME_BYTES / 1048576.);
+    cbControl->write(1);
+
+    NDArray *testArray = allocFrame(0);
+    for (int i = 0; i < 10; i++)
+        cbProcess(testArray);
+
+    cbCount->read(&storedImages);
+    cbPreTriggerMem->read(&preTriggerMem);
+    cbStatus->read(status, 50, &gotbytes, &eom);
+    BOOST_CHECK_EQUAL(storedImages, 4);
+    BOOST_CHECK_CLOSE(preTriggerMem, 4 * FRAME_BYTES / 1048576., 1e-6);
+    BOOST_CHECK_EQUAL(status, "Buffer Wrapping");
+    testArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_PreBufferSizedByMemory)
+{
+    size_t gotbytes;
+    int storedImages;
+    double preTriggerMem;
+    const double maxMem = 4 * FRAME_BYTES / 1048576.;
+
+    cbCalc->write("0", 2, &gotbytes);
+
+    // With a memory limit the ring is sized by memory, so it holds more images than PreCount
+    cbPreTrigger->write(2);
+    cbPreTriggerMaxMem->write(maxMem);
+    cbControl->write(1);
+
+    NDArray *testArray = allocFrame(0);
+    for (int i = 0; i < 10; i++)
+        cbProcess(testArray);
+
+    cbCount->read(&storedImages);
+    BOOST_CHECK_EQUAL(storedImages, 4);
+
+    // Compressed images are smaller, so more of them fit in the same memory
+    cbCompression->write(NDCircBuffCompressLZ4);
+    cbControl->write(1);
+    for (int i = 0; i < 40; i++)
+        cbProcess(testArray);
+
+    cbCount->read(&storedImages);
+    cbPreTriggerMem->read(&preTriggerMem);
+    BOOST_TEST_MESSAGE("LZ4 ring holds " << storedImages << " images in " << preTriggerMem << " MB");
+    BOOST_CHECK_GT(storedImages, 4);
+    BOOST_CHECK_LE(preTriggerMem, maxMem);
+    testArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ZeroCopy)
+{
+    size_t gotbytes;
+    int numHeld;
+    cbCalc->write("0", 2, &gotbytes);
+
+    cbZeroCopy->write(1);
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    // The upstream pool has no memory limit, so references are always held
+    size_t dims = 3;
+    NDArray *testArrays[4];
+    for (int i = 0; i < 4; i++)
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+
+    for (int i = 0; i < 3; i++)
+        cbProcess(testArrays[i]);
+
+    cbNumHeld->read(&numHeld);
+    BOOST_CHECK_EQUAL(numHeld, 3);
+
+    cbSoftTrigger->write(1);
+    cbProcess(testArrays[3]);
+
+    // The downstream plugin receives the upstream arrays themselves
+    BOOST_REQUIRE_EQUAL((size_t)4, ds->arrays.size());
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK_EQUAL(ds->arrays[i], testArrays[i]);
+    cbNumHeld->read(&numHeld);
+    BOOST_CHECK_EQUAL(numHeld, 0);
+
+    for (int i = 0; i < 4; i++)
+        testArrays[i]->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ZeroCopyFallsBackToCopy)
+{
+    size_t gotbytes;
+    int numHeld;
+    cbCalc->write("0", 2, &gotbytes);
+
+    // An upstream pool which is full once the test arrays are allocated
+    size_t dims = 1000;
+    NDArrayPool upstreamPool(dummy_driver, 4 * dims);
+    NDArray *testArrays[4];
+    for (int i = 0; i < 4; i++)
+        testArrays[i] = upstreamPool.alloc(1,&dims,NDUInt8,0,NULL);
+
+    cbZeroCopy->write(1);
+    cbMinUpstreamFree->write(1);
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    for (int i = 0; i < 3; i++)
+        cbProcess(testArrays[i]);
+
+    cbNumHeld->read(&numHeld);
+    BOOST_CHECK_EQUAL(numHeld, 0);
+
+    // The upstream pool has room for more arrays once one is released, so references are held again
+    testArrays[3]->release();
+    cbControl->write(1);
+    for (int i = 0; i < 3; i++)
+        cbProcess(testArrays[i]);
+
+    cbNumHeld->read(&numHeld);
+    BOOST_CHECK_EQUAL(numHeld, 3);
+
+    // Restarting replaces the ring, which releases the references before the upstream pool is destroyed
+    cbControl->write(1);
+    cbControl->write(0);
+    for (int i = 0; i < 3; i++)
+        testArrays[i]->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_PreBufferLZ4)
+{
+    checkCompressedPreBuffer(NDCircBuffCompressLZ4, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_PreBufferBSLZ4)
+{
+    checkCompressedPreBuffer(NDCircBuffCompressBSLZ4, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_PreBufferBSLZ4Threads)
+{
+    checkCompressedPreBuffer(NDCircBuffCompressBSLZ4, 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_PreBufferThroughput)
+{
+    // The same 50 images take less memory in the ring when they are compressed
+    double uncompressedMem = benchmarkPreBuffer(NDCircBuffCompressNone, 1);
+    BOOST_CHECK_CLOSE(uncompressedMem, 50 * FRAME_BYTES / 1048576., 1e-6);
+    BOOST_CHECK_LT(benchmarkPreBuffer(NDCircBuffCompressLZ4, 1), uncompressedMem);
+    BOOST_CHECK_LT(benchmarkPreBuffer(NDCircBuffCompressLZ4, 4), uncompressedMem);
+    // Without bitshuffle support the BSLZ4 images are stored uncompressed
+    BOOST_CHECK_LE(benchmarkPreBuffer(NDCircBuffCompressBSLZ4, 1), uncompressedMem);
+    BOOST_CHECK_LE(benchmarkPreBuffer(NDCircBuffCompressBSLZ4, 4), uncompressedMem);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginCodec.h>
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define FRAME_X 256
+#define FRAME_Y 256
+#define FRAME_BYTES (FRAME_X * FRAME_Y * sizeof(epicsUInt16))
+#define NUM_QUEUED 16
+// Room for the input frame and half of the queued frames at full size
+#define CODEC_MAX_MEMORY (FRAME_BYTES + (NUM_QUEUED/2) * FRAME_BYTES)
+
+struct NDPluginCodecFixture
+{
+    NDArrayPool *pPool;
+    asynNDArrayDriver *dummy_driver;
+    NDArray *pInput;
+
+    NDPluginCodecFixture()
+    {
+        std::string dummy_port("simPort");
+
+        // Asyn manager doesn't like it if we try to reuse the same port name for multiple drivers (even if only one is ever instantiated at once), so
+        // change it slightly for each test case.
+        uniqueAsynPortName(dummy_port);
+
+        // The pool of this driver is shared by the input array and the compressed arrays, as it is for NDPluginCodec
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, CODEC_MAX_MEMORY, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        pPool = dummy_driver->pNDArrayPool;
+
+        size_t dims[2] = {FRAME_X, FRAME_Y};
+        pInput = pPool->alloc(2, dims, NDUInt16, 0, NULL);
+        // A smooth image with a little noise compresses well
+        epicsUInt16 *pData = (epicsUInt16 *)pInput->pData;
+        for (size_t i=0; i<FRAME_X*FRAME_Y; i++) {
+            pData[i] = (epicsUInt16)((i / FRAME_X) + ((i % 7 == 0) ? (i % 3) : 0));
+        }
+    }
+    ~NDPluginCodecFixture()
+    {
+        pInput->release();
+        delete dummy_driver;
+    }
+
+    // Compresses NUM_QUEUED copies of the input frame, holding on to them as a downstream queue
+    // would, and checks that the pool memory they use is the compressed size, not the frame size.
+    void checkQueueMemory(NDCodecCompressor_t compressor, size_t blockSize, int numThreads)
+    {
+        NDArray *pQueue[NUM_QUEUED];
+        NDCodecStatus_t status = NDCODEC_SUCCESS;
+        char errorMessage[256] = "";
+        size_t queueBytes = 0;
+        size_t inputBytes = pPool->getMemorySize();
+
+        for (int i=0; i<NUM_QUEUED; i++) {
+            if (compressor == NDCODEC_LZ4)
+                pQueue[i] = compressLZ4(pInput, blockSize, numThreads, &status, errorMessage);
+            else
+                pQueue[i] = compressBSLZ4(pInput, blockSize, numThreads, &status, errorMessage);
+            if ((i == 0) && !pQueue[0] && strstr(errorMessage, "No ")) {
+                BOOST_TEST_MESSAGE(errorMessage << ", skipping");
+                return;
+            }
+            BOOST_REQUIRE_MESSAGE(pQueue[i] != NULL, errorMessage);
+            BOOST_CHECK_EQUAL(pQueue[i]->dataSize, pQueue[i]->compressedSize);
+            queueBytes += pQueue[i]->compressedSize;
+        }
+
+        double factor = (double)(NUM_QUEUED * FRAME_BYTES) / (double)queueBytes;
+        BOOST_TEST_MESSAGE("compressor=" << codecName[compressor] << " blockSize=" << blockSize
+                           << " factor=" << factor << " queue bytes=" << queueBytes);
+        BOOST_CHECK_GT(factor, 2.0);
+        // The queue holds exactly the compressed data, so its memory drops by the compression factor
+        BOOST_CHECK_EQUAL(pPool->getMemorySize(), inputBytes + queueBytes);
+
+        for (int i=0; i<NUM_QUEUED; i++) {
+            NDArray *pOutput = (compressor == NDCODEC_LZ4) ?
+                decompressLZ4(pQueue[i], numThreads, &status, errorMessage) :
+                decompressBSLZ4(pQueue[i], numThreads, &status, errorMessage);
+            pQueue[i]->release();
+            BOOST_REQUIRE_MESSAGE(pOutput != NULL, errorMessage);
+            BOOST_CHECK(memcmp(pOutput->pData, pInput->pData, FRAME_BYTES) == 0);
+            pOutput->release();
+        }
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginCodecTests, NDPluginCodecFixture)
+
+BOOST_AUTO_TEST_CASE(test_LZ4QueueMemory)
+{
+  checkQueueMemory(NDCODEC_LZ4, 0, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_LZ4BlockedQueueMemory)
+{
+  checkQueueMemory(NDCODEC_LZ4, FRAME_BYTES/8, 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_BSLZ4QueueMemory)
+{
+  checkQueueMemory(NDCODEC_BSLZ4, 0, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_BSLZ4BlockedQueueMemory)
+{
+  checkQueueMemory(NDCODEC_BSLZ4, FRAME_BYTES/8, 4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,177 @@
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginStdArrays.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include <string.h>
+#include <vector>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+struct NDPluginStdArraysFixture
+{
+    NDArrayPool *arrayPool;
+    asynNDArrayDriver *dummy_driver;
+    NDPluginStdArrays *stdArrays;
+    asynInt32Client *maxElements;
+    asynInt32Client *decimateMode;
+    asynInt32Client *decimation;
+    asynInt16ArrayClient *int16Data;
+    asynFloat32ArrayClient *float32Data;
+
+    NDPluginStdArraysFixture()
+    {
+        std::string dummy_port("simPort"), testport("StdArrays");
+
+        // Asyn manager doesn't like it if we try to reuse the same port name for multiple drivers (even if only one is ever instantiated at once), so
+        // change it slightly for each test case.
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // We need some upstream driver for our test plugin so that calls to connectToArrayPort don't fail, but we can then ignore it and
+        // send arrays by calling processCallbacks directly.
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+
+        // This is the plugin under test
+        stdArrays = new NDPluginStdArrays(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 0, 1);
+
+        maxElements = new asynInt32Client(testport.c_str(), 0, NDPluginStdArraysMaxElementsString);
+        decimateMode = new asynInt32Client(testport.c_str(), 0, NDPluginStdArraysDecimateModeString);
+        decimation = new asynInt32Client(testport.c_str(), 0, NDPluginStdArraysDecimationString);
+        int16Data = new asynInt16ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString);
+        float32Data = new asynFloat32ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString);
+    }
+    ~NDPluginStdArraysFixture()
+    {
+        delete float32Data;
+        delete int16Data;
+        delete decimation;
+        delete decimateMode;
+        delete maxElements;
+        delete stdArrays;
+        delete dummy_driver;
+    }
+
+    // Sends a ramp image where each pixel is 100*y + x
+    void sendImage(size_t sizeX, size_t sizeY)
+    {
+        size_t dims[2] = {sizeX, sizeY};
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+        for (size_t y = 0; y < sizeY; y++) {
+            for (size_t x = 0; x < sizeX; x++) {
+                pData[y*sizeX + x] = (epicsUInt16)(100*y + x);
+            }
+        }
+        stdArrays->lock();
+        stdArrays->processCallbacks(pArray);
+        stdArrays->unlock();
+        pArray->release();
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginStdArraysTests, NDPluginStdArraysFixture)
+
+BOOST_AUTO_TEST_CASE(test_NoDecimation)
+{
+  std::vector<epicsInt16> data(64);
+  std::vector<epicsFloat32> floatData(64);
+  size_t nIn;
+  epicsInt32 value;
+
+  // Same element size as the interface, and converted to another type
+  sendImage(8, 6);
+  decimation->read(&value);
+  BOOST_CHECK_EQUAL(value, 1);
+  BOOST_REQUIRE_EQUAL(int16Data->read(&data[0], data.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, 48u);
+  BOOST_REQUIRE_EQUAL(float32Data->read(&floatData[0], floatData.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, 48u);
+  for (size_t y = 0; y < 6; y++) {
+    for (size_t x = 0; x < 8; x++) {
+      BOOST_CHECK_EQUAL(data[y*8 + x], (epicsInt16)(100*y + x));
+      BOOST_CHECK_EQUAL(floatData[y*8 + x], (epicsFloat32)(100*y + x));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Decimation)
+{
+  std::vector<epicsInt16> data(64);
+  std::vector<epicsFloat32> floatData(64);
+  size_t nIn;
+  epicsInt32 value;
+
+  // 8x6 does not fit in 12 elements, 4x3 does with 2x2 bins
+  maxElements->write(12);
+  sendImage(8, 6);
+  decimation->read(&value);
+  BOOST_CHECK_EQUAL(value, 2);
+
+  // Nearest takes the element at the centre of each bin
+  BOOST_REQUIRE_EQUAL(int16Data->read(&data[0], data.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, 12u);
+  for (size_t y = 0; y < 3; y++) {
+    for (size_t x = 0; x < 4; x++) {
+      BOOST_CHECK_EQUAL(data[y*4 + x], (epicsInt16)(100*(2*y + 1) + 2*x + 1));
+    }
+  }
+
+  // Mean averages each bin
+  decimateMode->write(NDPluginStdArraysDecimateMean);
+  BOOST_REQUIRE_EQUAL(float32Data->read(&floatData[0], floatData.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, 12u);
+  for (size_t y = 0; y < 3; y++) {
+    for (size_t x = 0; x < 4; x++) {
+      BOOST_CHECK_CLOSE(floatData[y*4 + x], 100*(2*y + 0.5) + 2*x + 0.5, 1e-4);
+    }
+  }
+
+  // The remainder of a dimension that does not divide by the decimation is dropped
+  maxElements->write(4);
+  sendImage(8, 6);
+  decimation->read(&value);
+  BOOST_CHECK_EQUAL(value, 3);
+  BOOST_REQUIRE_EQUAL(int16Data->read(&data[0], data.size(), &nIn), asynSuccess);
+  BOOST_CHECK_EQUAL(nIn, 4u);
+}
+
+BOOST_AUTO_TEST_CASE(test_ColorDecimation)
+{
+  std::vector<epicsInt16> data(64);
+  size_t nIn;
+  epicsInt32 value;
+  epicsInt32 colorMode = NDColorModeRGB1;
+
+  // The color dimension of an RGB1 image is not binned
+  size_t dims[3] = {3, 4, 4};
+  NDArray *pArray = arrayPool->alloc(3, dims, NDInt16, 0, NULL);
+  pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+  epicsInt16 *pData = (epicsInt16 *)pArray->pData;
+  for (size_t i = 0; i < 48; i++) pData[i] = (epicsInt16)i;
+  maxElements->write(12);
+  stdArrays->lock();
+  stdArrays->processCallbacks(pArray);
+  stdArrays->unlock();
+  pArray->release();
+
+  decimation->read(&value);
+  BOOST_CHECK_EQUAL(value, 2);
+  BOOST_REQUIRE_EQUAL(int16Data->read(&data[0], data.size(), &nIn), asynSuccess);
+  BOOST_REQUIRE_EQUAL(nIn, 12u);
+  // The first output pixel is input pixel (1,1), with all three colors
+  for (int c = 0; c < 3; c++) {
+    BOOST_CHECK_EQUAL(data[c], (epicsInt16)(3*(4*1 + 1) + c));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
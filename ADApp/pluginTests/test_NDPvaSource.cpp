@@ -0,0 +1,271 @@
+/*
+ * test_NDPvaSource.cpp
+ *
+ * Sends arrays from NDPluginPva to NDPvaSource through a pvAccess server in this process.
+ */
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+#include <asynPortClient.h>
+#include <NDPluginPva.h>
+#include <NDPvaSource.h>
+
+// pvAccess dependencies
+#include <pv/serverContext.h>
+#include <pv/configuration.h>
+#include <pv/channelProviderLocal.h>
+
+#include <string.h>
+#include <vector>
+#include <envDefs.h>
+#include <epicsStdio.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+using namespace epics::pvAccess;
+using namespace epics::pvDatabase;
+
+#define SIZE_X 64
+#define SIZE_Y 32
+
+// Records the arrays done by NDPvaSource.  The callbacks come from the monitor thread of the driver.
+// The data is copied because the arrays go back to their pool once the callbacks are done.
+class PvaRecorder : public asynGenericPointerClient {
+public:
+    PvaRecorder(const char *portName)
+    : asynGenericPointerClient(portName, 0, NDArrayDataString)
+    {
+        lock = epicsMutexMustCreate();
+        this->registerInterruptUser(PvaRecorder::callback);
+    }
+    ~PvaRecorder()
+    {
+        epicsMutexDestroy(lock);
+    }
+    static void callback(void *userPvt, asynUser *pasynUser, void *pointer)
+    {
+        PvaRecorder *self = (PvaRecorder *)userPvt;
+        NDArray *pArray = (NDArray *)pointer;
+        NDArrayInfo_t arrayInfo;
+        epicsInt32 counter = -1;
+        NDAttribute *pAttribute = pArray->pAttributeList->find("Counter");
+        if (pAttribute) pAttribute->getValue(NDAttrInt32, &counter);
+        pArray->getInfo(&arrayInfo);
+        epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+        epicsMutexLock(self->lock);
+        self->uniqueIds.push_back(pArray->uniqueId);
+        self->counters.push_back(counter);
+        self->pools.push_back(pArray->pNDArrayPool);
+        self->dataTypes.push_back(pArray->dataType);
+        self->xSizes.push_back(arrayInfo.xSize);
+        self->ySizes.push_back(arrayInfo.ySize);
+        self->data.push_back(vector<epicsUInt16>(pData, pData + arrayInfo.nElements));
+        epicsMutexUnlock(self->lock);
+    }
+    size_t numArrays()
+    {
+        epicsMutexLock(lock);
+        size_t n = uniqueIds.size();
+        epicsMutexUnlock(lock);
+        return n;
+    }
+    epicsMutexId lock;
+    vector<int> uniqueIds;
+    vector<int> counters;
+    vector<NDArrayPool *> pools;
+    vector<NDDataType_t> dataTypes;
+    vector<size_t> xSizes;
+    vector<size_t> ySizes;
+    vector<vector<epicsUInt16> > data;
+};
+
+struct NDPvaSourceFixture
+{
+    ServerContext::shared_pointer server;
+    asynNDArrayDriver *dummy_driver;
+    NDArrayPool *arrayPool;
+    NDPluginPva *pva;
+    NDPvaSource *source;
+    PvaRecorder *recorder;
+    asynInt32Client *acquire;
+    asynInt32Client *imageMode;
+    asynInt32Client *zeroCopy;
+    asynInt32Client *connected;
+    asynOctetClient *sourcePvName;
+    vector<epicsUInt16> frame;
+
+    NDPvaSourceFixture()
+    {
+        std::string dummy_port("simPort"), pvaPort("PvaPlugin"), sourcePort("PvaSource"), pvName("testPva");
+        char port[16];
+
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(pvaPort);
+        uniqueAsynPortName(sourcePort);
+        uniqueAsynPortName(pvName);
+
+        // The server of this process, on the loopback interface only
+        server = ServerContext::create(ServerContext::Config()
+                     .config(ConfigurationBuilder()
+                             .push_env()
+                             .add("EPICS_PVAS_INTF_ADDR_LIST", "127.0.0.1")
+                             .push_map()
+                             .build())
+                     .provider(getChannelProviderLocal()));
+        // The client of NDPvaSource only searches the server of this process
+        epicsSnprintf(port, sizeof(port), "%d", (int)server->getBroadcastPort());
+        epicsEnvSet("EPICS_PVA_ADDR_LIST", "127.0.0.1");
+        epicsEnvSet("EPICS_PVA_AUTO_ADDR_LIST", "NO");
+        epicsEnvSet("EPICS_PVA_BROADCAST_PORT", port);
+
+        // Arrays are sent to NDPluginPva by calling processCallbacks directly
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+        pva = new NDPluginPva(pvaPort.c_str(), 50, 1, dummy_port.c_str(), 0, pvName.c_str(), 0, 0, 0, 0);
+
+        source = new NDPvaSource(sourcePort.c_str(), pvName.c_str(), 0, 0, 0, 0);
+        recorder = new PvaRecorder(sourcePort.c_str());
+        acquire = new asynInt32Client(sourcePort.c_str(), 0, ADAcquireString);
+        imageMode = new asynInt32Client(sourcePort.c_str(), 0, ADImageModeString);
+        zeroCopy = new asynInt32Client(sourcePort.c_str(), 0, NDPvaSourceZeroCopyString);
+        connected = new asynInt32Client(sourcePort.c_str(), 0, NDPvaSourceConnectedString);
+        sourcePvName = new asynOctetClient(sourcePort.c_str(), 0, NDPvaSourcePvNameString);
+
+        frame.resize(SIZE_X * SIZE_Y);
+        for (size_t i = 0; i < frame.size(); i++) {
+            frame[i] = (epicsUInt16)((i % SIZE_X) * 100 + i / SIZE_X);
+        }
+    }
+    ~NDPvaSourceFixture()
+    {
+        size_t nActual;
+
+        // The driver has no way to stop its monitor thread, so it is disconnected but not deleted
+        acquire->write(0);
+        sourcePvName->write("", 0, &nActual);
+        delete sourcePvName;
+        delete connected;
+        delete zeroCopy;
+        delete imageMode;
+        delete acquire;
+        delete recorder;
+        delete pva;
+        delete dummy_driver;
+        epicsThreadSleep(0.2);
+        server->shutdown();
+    }
+
+    // Waits for the monitor of NDPvaSource to get the first value of the PV
+    void waitForConnection()
+    {
+        epicsInt32 value = 0;
+        for (int i = 0; i < 500; i++) {
+            connected->read(&value);
+            if (value) break;
+            epicsThreadSleep(0.01);
+        }
+        BOOST_REQUIRE_EQUAL(value, 1);
+    }
+
+    // Publishes frame i and waits for NDPvaSource to do the callbacks with it
+    void sendFrame(int i)
+    {
+        size_t dims[2] = {SIZE_X, SIZE_Y};
+        size_t numArrays = recorder->numArrays();
+        epicsInt32 counter = i;
+
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        memcpy(pArray->pData, &frame[0], frame.size() * sizeof(epicsUInt16));
+        ((epicsUInt16 *)pArray->pData)[0] = (epicsUInt16)i;
+        pArray->uniqueId = 100 + i;
+        pArray->pAttributeList->add("Counter", "Frame counter", NDAttrInt32, &counter);
+        pva->lock();
+        pva->processCallbacks(pArray);
+        pva->unlock();
+        pArray->release();
+        for (int j = 0; (j < 500) && (recorder->numArrays() == numArrays); j++) {
+            epicsThreadSleep(0.01);
+        }
+        BOOST_REQUIRE_EQUAL(recorder->numArrays(), numArrays + 1);
+    }
+
+    // Checks that the array recorded for frame i has the data, unique ID and attributes that were published,
+    // and that it is from the pool of the driver only if the driver copies the data
+    void checkFrame(size_t n, int i, bool copied)
+    {
+        vector<epicsUInt16> expected(frame);
+        expected[0] = (epicsUInt16)i;
+        epicsMutexLock(recorder->lock);
+        BOOST_CHECK_EQUAL(recorder->uniqueIds[n], 100 + i);
+        BOOST_CHECK_EQUAL(recorder->counters[n], i);
+        BOOST_CHECK_EQUAL(recorder->dataTypes[n], NDUInt16);
+        BOOST_CHECK_EQUAL(recorder->xSizes[n], (size_t)SIZE_X);
+        BOOST_CHECK_EQUAL(recorder->ySizes[n], (size_t)SIZE_Y);
+        BOOST_CHECK(recorder->data[n] == expected);
+        BOOST_CHECK_EQUAL(recorder->pools[n] == source->pNDArrayPool, copied);
+        epicsMutexUnlock(recorder->lock);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPvaSourceTests, NDPvaSourceFixture)
+
+BOOST_AUTO_TEST_CASE(test_RoundTripZeroCopy)
+{
+  imageMode->write(ADImageContinuous);
+  waitForConnection();
+  acquire->write(1);
+  for (int i = 0; i < 5; i++) {
+    sendFrame(i);
+    // The array is built around the data received by pvAccess, in the pool of NTNDArrays,
+    // and nothing is ever allocated from the pool of the driver for a copy
+    checkFrame(i, i, false);
+    BOOST_CHECK_EQUAL(source->pNDArrayPool->getNumBuffers(), 0);
+    BOOST_CHECK_EQUAL(source->pNDArrayPool->getMemorySize(), (size_t)0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_RoundTripCopy)
+{
+  zeroCopy->write(0);
+  imageMode->write(ADImageContinuous);
+  waitForConnection();
+  acquire->write(1);
+  for (int i = 0; i < 5; i++) {
+    sendFrame(i);
+    // The data is copied into an array from the pool of the driver
+    checkFrame(i, i, true);
+    BOOST_CHECK_GE(source->pNDArrayPool->getMemorySize(), frame.size() * sizeof(epicsUInt16));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_SingleImage)
+{
+  epicsInt32 value;
+
+  imageMode->write(ADImageSingle);
+  waitForConnection();
+  acquire->write(1);
+  sendFrame(7);
+  checkFrame(0, 7, false);
+  // Acquisition stops after one array, so the next one is not converted
+  acquire->read(&value);
+  BOOST_CHECK_EQUAL(value, 0);
+  size_t dims[2] = {SIZE_X, SIZE_Y};
+  NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+  pva->lock();
+  pva->processCallbacks(pArray);
+  pva->unlock();
+  pArray->release();
+  epicsThreadSleep(0.5);
+  BOOST_CHECK_EQUAL(recorder->numArrays(), (size_t)1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()